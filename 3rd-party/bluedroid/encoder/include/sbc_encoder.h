@@ -113,6 +113,33 @@
 #define SBC_IS_64_MULT_IN_WINDOW_ACCU  FALSE
 #endif /*SBC_IS_64_MULT_IN_WINDOW_ACCU */
 
+/* BK4BTSTACK_CHANGE START */
+/* Set SBC_SSE2_OPT to TRUE to use SSE2 intrinsics for the windowing of the analysis filter */
+/* -> bit-exact with the C code. Enabled by default if the compiler targets SSE2 */
+#ifndef SBC_SSE2_OPT
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#define SBC_SSE2_OPT TRUE
+#else
+#define SBC_SSE2_OPT FALSE
+#endif
+#endif /* SBC_SSE2_OPT */
+
+/* Set SBC_NEON_OPT to TRUE to use NEON intrinsics for the windowing of the analysis filter */
+/* -> requires a compiler targeting NEON. Not verified on target yet, disabled by default */
+#ifndef SBC_NEON_OPT
+#define SBC_NEON_OPT FALSE
+#endif /* SBC_NEON_OPT */
+
+/* SIMD windowing is only available for the default configuration (16 bit coefficients, 32 bit accumulator) */
+#if (SBC_ARM_ASM_OPT == FALSE) && (SBC_IPAQ_OPT == TRUE) && (SBC_IS_64_MULT_IN_WINDOW_ACCU == FALSE)
+#if (SBC_SSE2_OPT == TRUE)
+#define SBC_SIMD_WINDOW_NAME "SSE2"
+#elif (SBC_NEON_OPT == TRUE)
+#define SBC_SIMD_WINDOW_NAME "NEON"
+#endif
+#endif
+/* BK4BTSTACK_CHANGE END */
+
 /* Set SBC_IS_64_MULT_IN_IDCT to TRUE to use 64 bits multiplication in the DCT of Matrixing */
 /* -> more MIPS required for a better audio quality. comparasion with the SIG utilities shows a division by 10 of the RMS */
 /* CAUTION: It only apply in the if SBC_FAST_DCT is set to TRUE */
@@ -196,6 +223,11 @@ typedef struct SBC_ENC_PARAMS_TAG
     UINT16 u16PacketLength;
     /* BK4BTSTACK_CHANGE START */
     UINT8  mSBCEnabled;
+    /* analysis filter history, kept per encoder instance to make the encoder re-entrant */
+    SINT32 as32X[ENC_VX_BUFFER_SIZE/2];         /* must be 32 bits aligned cf SHIFTUP_X8_2 */
+    SINT16 s16ShiftCounter;
+    SINT16 s16MaxShiftCounter;
+    UINT8  u8NoSimdWindow;                      /* TRUE: use C windowing even if SBC_SIMD_WINDOW_NAME is defined */
     /* BK4BTSTACK_CHANGE END */
 }SBC_ENC_PARAMS;
 
@@ -153,15 +153,9 @@
 #define WIND_8_SUBBANDS_8_2 (SINT16)0x12CF  /* 40 = 0x12CF6C75 */
 #endif
 
-#if (SBC_USE_ARM_PRAGMA==TRUE)
-#pragma arm section zidata = "sbc_s32_analysis_section"
-#endif
-static SINT32   s32DCTY[16]  = {0};
-static SINT32   s32X[ENC_VX_BUFFER_SIZE/2];
-static SINT16   *s16X=(SINT16*) s32X;      /* s16X must be 32 bits aligned cf  SHIFTUP_X8_2*/
-#if (SBC_USE_ARM_PRAGMA==TRUE)
-#pragma arm section zidata
-#endif
+/* BK4BTSTACK_CHANGE START */
+/* s32DCTY, s16X, ShiftCounter and EncMaxShiftCounter are locals of the analysis filters, s16X points into SBC_ENC_PARAMS */
+/* BK4BTSTACK_CHANGE END */
 
 /* This macro is for 4 subbands */
 #define SHIFTUP_X4                                                               \
@@ -897,8 +891,285 @@ static SINT16   *s16X=(SINT16*) s32X;      /* s16X must be 32 bits aligned cf  S
 #endif
 #endif
 
-static SINT16 ShiftCounter=0;
-extern SINT16 EncMaxShiftCounter;
+/* BK4BTSTACK_CHANGE START */
+/****************************************************************************
+* SIMD windowing - computes s32DCTY[n] = sum_j C[n][j] * X[n + j * 2 * SubBands]
+* for all outputs of one block and channel. The coefficients are the ones used
+* by WINDOW_PARTIAL_4/8 above; as all products and sums are done with 32 bit
+* wrap-around arithmetic in both versions, the result is bit-exact.
+*/
+#if defined(SBC_SIMD_WINDOW_NAME)
+#define SBC_SIMD_WINDOW TRUE
+#else
+#define SBC_SIMD_WINDOW FALSE
+#endif
+
+#if (SBC_SIMD_WINDOW == TRUE) && (SBC_SSE2_OPT == TRUE)
+#include <emmintrin.h>
+
+/* coefficients of tap pairs (0,1), (2,3), (4,-) interleaved for _mm_madd_epi16 */
+static const SINT16 gas16SimdCoeffFor4SBs[3][16] = {
+    {
+        0, WIND_4_SUBBANDS_0_1,
+        WIND_4_SUBBANDS_1_0, WIND_4_SUBBANDS_1_1,
+        WIND_4_SUBBANDS_2_0, WIND_4_SUBBANDS_2_1,
+        WIND_4_SUBBANDS_3_0, WIND_4_SUBBANDS_3_1,
+        WIND_4_SUBBANDS_4_0, WIND_4_SUBBANDS_4_1,
+        WIND_4_SUBBANDS_3_4, WIND_4_SUBBANDS_3_3,
+        WIND_4_SUBBANDS_2_4, WIND_4_SUBBANDS_2_3,
+        WIND_4_SUBBANDS_1_4, WIND_4_SUBBANDS_1_3,
+    },
+    {
+        WIND_4_SUBBANDS_0_2, -WIND_4_SUBBANDS_0_2,
+        WIND_4_SUBBANDS_1_2, WIND_4_SUBBANDS_1_3,
+        WIND_4_SUBBANDS_2_2, WIND_4_SUBBANDS_2_3,
+        WIND_4_SUBBANDS_3_2, WIND_4_SUBBANDS_3_3,
+        WIND_4_SUBBANDS_4_2, WIND_4_SUBBANDS_4_1,
+        WIND_4_SUBBANDS_3_2, WIND_4_SUBBANDS_3_1,
+        WIND_4_SUBBANDS_2_2, WIND_4_SUBBANDS_2_1,
+        WIND_4_SUBBANDS_1_2, WIND_4_SUBBANDS_1_1,
+    },
+    {
+        -WIND_4_SUBBANDS_0_1, 0,
+        WIND_4_SUBBANDS_1_4, 0,
+        WIND_4_SUBBANDS_2_4, 0,
+        WIND_4_SUBBANDS_3_4, 0,
+        WIND_4_SUBBANDS_4_0, 0,
+        WIND_4_SUBBANDS_3_0, 0,
+        WIND_4_SUBBANDS_2_0, 0,
+        WIND_4_SUBBANDS_1_0, 0,
+    },
+};
+
+static const SINT16 gas16SimdCoeffFor8SBs[3][32] = {
+    {
+        0, WIND_8_SUBBANDS_0_1,
+        WIND_8_SUBBANDS_1_0, WIND_8_SUBBANDS_1_1,
+        WIND_8_SUBBANDS_2_0, WIND_8_SUBBANDS_2_1,
+        WIND_8_SUBBANDS_3_0, WIND_8_SUBBANDS_3_1,
+        WIND_8_SUBBANDS_4_0, WIND_8_SUBBANDS_4_1,
+        WIND_8_SUBBANDS_5_0, WIND_8_SUBBANDS_5_1,
+        WIND_8_SUBBANDS_6_0, WIND_8_SUBBANDS_6_1,
+        WIND_8_SUBBANDS_7_0, WIND_8_SUBBANDS_7_1,
+        WIND_8_SUBBANDS_8_0, WIND_8_SUBBANDS_8_1,
+        WIND_8_SUBBANDS_7_4, WIND_8_SUBBANDS_7_3,
+        WIND_8_SUBBANDS_6_4, WIND_8_SUBBANDS_6_3,
+        WIND_8_SUBBANDS_5_4, WIND_8_SUBBANDS_5_3,
+        WIND_8_SUBBANDS_4_4, WIND_8_SUBBANDS_4_3,
+        WIND_8_SUBBANDS_3_4, WIND_8_SUBBANDS_3_3,
+        WIND_8_SUBBANDS_2_4, WIND_8_SUBBANDS_2_3,
+        WIND_8_SUBBANDS_1_4, WIND_8_SUBBANDS_1_3,
+    },
+    {
+        WIND_8_SUBBANDS_0_2, -WIND_8_SUBBANDS_0_2,
+        WIND_8_SUBBANDS_1_2, WIND_8_SUBBANDS_1_3,
+        WIND_8_SUBBANDS_2_2, WIND_8_SUBBANDS_2_3,
+        WIND_8_SUBBANDS_3_2, WIND_8_SUBBANDS_3_3,
+        WIND_8_SUBBANDS_4_2, WIND_8_SUBBANDS_4_3,
+        WIND_8_SUBBANDS_5_2, WIND_8_SUBBANDS_5_3,
+        WIND_8_SUBBANDS_6_2, WIND_8_SUBBANDS_6_3,
+        WIND_8_SUBBANDS_7_2, WIND_8_SUBBANDS_7_3,
+        WIND_8_SUBBANDS_8_2, WIND_8_SUBBANDS_8_1,
+        WIND_8_SUBBANDS_7_2, WIND_8_SUBBANDS_7_1,
+        WIND_8_SUBBANDS_6_2, WIND_8_SUBBANDS_6_1,
+        WIND_8_SUBBANDS_5_2, WIND_8_SUBBANDS_5_1,
+        WIND_8_SUBBANDS_4_2, WIND_8_SUBBANDS_4_1,
+        WIND_8_SUBBANDS_3_2, WIND_8_SUBBANDS_3_1,
+        WIND_8_SUBBANDS_2_2, WIND_8_SUBBANDS_2_1,
+        WIND_8_SUBBANDS_1_2, WIND_8_SUBBANDS_1_1,
+    },
+    {
+        -WIND_8_SUBBANDS_0_1, 0,
+        WIND_8_SUBBANDS_1_4, 0,
+        WIND_8_SUBBANDS_2_4, 0,
+        WIND_8_SUBBANDS_3_4, 0,
+        WIND_8_SUBBANDS_4_4, 0,
+        WIND_8_SUBBANDS_5_4, 0,
+        WIND_8_SUBBANDS_6_4, 0,
+        WIND_8_SUBBANDS_7_4, 0,
+        WIND_8_SUBBANDS_8_0, 0,
+        WIND_8_SUBBANDS_7_0, 0,
+        WIND_8_SUBBANDS_6_0, 0,
+        WIND_8_SUBBANDS_5_0, 0,
+        WIND_8_SUBBANDS_4_0, 0,
+        WIND_8_SUBBANDS_3_0, 0,
+        WIND_8_SUBBANDS_2_0, 0,
+        WIND_8_SUBBANDS_1_0, 0,
+    },
+};
+
+static void SbcSimdWindow4(const SINT16 *ps16X, SINT32 *ps32DCTY)
+{
+    __m128i acc0 = _mm_setzero_si128();
+    __m128i acc1 = _mm_setzero_si128();
+    __m128i xa, xb;
+    int p;
+    for (p = 0; p < 3; p++)
+    {
+        xa = _mm_loadu_si128((const __m128i *) &ps16X[p * 16]);
+        xb = (p < 2) ? _mm_loadu_si128((const __m128i *) &ps16X[p * 16 + 8]) : _mm_setzero_si128();
+        acc0 = _mm_add_epi32(acc0, _mm_madd_epi16(_mm_unpacklo_epi16(xa, xb), _mm_loadu_si128((const __m128i *) &gas16SimdCoeffFor4SBs[p][0])));
+        acc1 = _mm_add_epi32(acc1, _mm_madd_epi16(_mm_unpackhi_epi16(xa, xb), _mm_loadu_si128((const __m128i *) &gas16SimdCoeffFor4SBs[p][8])));
+    }
+    _mm_storeu_si128((__m128i *) &ps32DCTY[0], acc0);
+    _mm_storeu_si128((__m128i *) &ps32DCTY[4], acc1);
+}
+
+static void SbcSimdWindow8(const SINT16 *ps16X, SINT32 *ps32DCTY)
+{
+    __m128i acc0 = _mm_setzero_si128();
+    __m128i acc1 = _mm_setzero_si128();
+    __m128i acc2 = _mm_setzero_si128();
+    __m128i acc3 = _mm_setzero_si128();
+    __m128i xa0, xa1, xb0, xb1;
+    int p;
+    for (p = 0; p < 3; p++)
+    {
+        xa0 = _mm_loadu_si128((const __m128i *) &ps16X[p * 32]);
+        xa1 = _mm_loadu_si128((const __m128i *) &ps16X[p * 32 + 8]);
+        if (p < 2)
+        {
+            xb0 = _mm_loadu_si128((const __m128i *) &ps16X[p * 32 + 16]);
+            xb1 = _mm_loadu_si128((const __m128i *) &ps16X[p * 32 + 24]);
+        }
+        else
+        {
+            xb0 = _mm_setzero_si128();
+            xb1 = _mm_setzero_si128();
+        }
+        acc0 = _mm_add_epi32(acc0, _mm_madd_epi16(_mm_unpacklo_epi16(xa0, xb0), _mm_loadu_si128((const __m128i *) &gas16SimdCoeffFor8SBs[p][0])));
+        acc1 = _mm_add_epi32(acc1, _mm_madd_epi16(_mm_unpackhi_epi16(xa0, xb0), _mm_loadu_si128((const __m128i *) &gas16SimdCoeffFor8SBs[p][8])));
+        acc2 = _mm_add_epi32(acc2, _mm_madd_epi16(_mm_unpacklo_epi16(xa1, xb1), _mm_loadu_si128((const __m128i *) &gas16SimdCoeffFor8SBs[p][16])));
+        acc3 = _mm_add_epi32(acc3, _mm_madd_epi16(_mm_unpackhi_epi16(xa1, xb1), _mm_loadu_si128((const __m128i *) &gas16SimdCoeffFor8SBs[p][24])));
+    }
+    _mm_storeu_si128((__m128i *) &ps32DCTY[0],  acc0);
+    _mm_storeu_si128((__m128i *) &ps32DCTY[4],  acc1);
+    _mm_storeu_si128((__m128i *) &ps32DCTY[8],  acc2);
+    _mm_storeu_si128((__m128i *) &ps32DCTY[12], acc3);
+}
+
+#elif (SBC_SIMD_WINDOW == TRUE) && (SBC_NEON_OPT == TRUE)
+#include <arm_neon.h>
+
+/* coefficients per tap */
+static const SINT16 gas16SimdCoeffFor4SBs[5][8] = {
+    {
+        0, WIND_4_SUBBANDS_1_0,
+        WIND_4_SUBBANDS_2_0, WIND_4_SUBBANDS_3_0,
+        WIND_4_SUBBANDS_4_0, WIND_4_SUBBANDS_3_4,
+        WIND_4_SUBBANDS_2_4, WIND_4_SUBBANDS_1_4,
+    },
+    {
+        WIND_4_SUBBANDS_0_1, WIND_4_SUBBANDS_1_1,
+        WIND_4_SUBBANDS_2_1, WIND_4_SUBBANDS_3_1,
+        WIND_4_SUBBANDS_4_1, WIND_4_SUBBANDS_3_3,
+        WIND_4_SUBBANDS_2_3, WIND_4_SUBBANDS_1_3,
+    },
+    {
+        WIND_4_SUBBANDS_0_2, WIND_4_SUBBANDS_1_2,
+        WIND_4_SUBBANDS_2_2, WIND_4_SUBBANDS_3_2,
+        WIND_4_SUBBANDS_4_2, WIND_4_SUBBANDS_3_2,
+        WIND_4_SUBBANDS_2_2, WIND_4_SUBBANDS_1_2,
+    },
+    {
+        -WIND_4_SUBBANDS_0_2, WIND_4_SUBBANDS_1_3,
+        WIND_4_SUBBANDS_2_3, WIND_4_SUBBANDS_3_3,
+        WIND_4_SUBBANDS_4_1, WIND_4_SUBBANDS_3_1,
+        WIND_4_SUBBANDS_2_1, WIND_4_SUBBANDS_1_1,
+    },
+    {
+        -WIND_4_SUBBANDS_0_1, WIND_4_SUBBANDS_1_4,
+        WIND_4_SUBBANDS_2_4, WIND_4_SUBBANDS_3_4,
+        WIND_4_SUBBANDS_4_0, WIND_4_SUBBANDS_3_0,
+        WIND_4_SUBBANDS_2_0, WIND_4_SUBBANDS_1_0,
+    },
+};
+
+static const SINT16 gas16SimdCoeffFor8SBs[5][16] = {
+    {
+        0, WIND_8_SUBBANDS_1_0,
+        WIND_8_SUBBANDS_2_0, WIND_8_SUBBANDS_3_0,
+        WIND_8_SUBBANDS_4_0, WIND_8_SUBBANDS_5_0,
+        WIND_8_SUBBANDS_6_0, WIND_8_SUBBANDS_7_0,
+        WIND_8_SUBBANDS_8_0, WIND_8_SUBBANDS_7_4,
+        WIND_8_SUBBANDS_6_4, WIND_8_SUBBANDS_5_4,
+        WIND_8_SUBBANDS_4_4, WIND_8_SUBBANDS_3_4,
+        WIND_8_SUBBANDS_2_4, WIND_8_SUBBANDS_1_4,
+    },
+    {
+        WIND_8_SUBBANDS_0_1, WIND_8_SUBBANDS_1_1,
+        WIND_8_SUBBANDS_2_1, WIND_8_SUBBANDS_3_1,
+        WIND_8_SUBBANDS_4_1, WIND_8_SUBBANDS_5_1,
+        WIND_8_SUBBANDS_6_1, WIND_8_SUBBANDS_7_1,
+        WIND_8_SUBBANDS_8_1, WIND_8_SUBBANDS_7_3,
+        WIND_8_SUBBANDS_6_3, WIND_8_SUBBANDS_5_3,
+        WIND_8_SUBBANDS_4_3, WIND_8_SUBBANDS_3_3,
+        WIND_8_SUBBANDS_2_3, WIND_8_SUBBANDS_1_3,
+    },
+    {
+        WIND_8_SUBBANDS_0_2, WIND_8_SUBBANDS_1_2,
+        WIND_8_SUBBANDS_2_2, WIND_8_SUBBANDS_3_2,
+        WIND_8_SUBBANDS_4_2, WIND_8_SUBBANDS_5_2,
+        WIND_8_SUBBANDS_6_2, WIND_8_SUBBANDS_7_2,
+        WIND_8_SUBBANDS_8_2, WIND_8_SUBBANDS_7_2,
+        WIND_8_SUBBANDS_6_2, WIND_8_SUBBANDS_5_2,
+        WIND_8_SUBBANDS_4_2, WIND_8_SUBBANDS_3_2,
+        WIND_8_SUBBANDS_2_2, WIND_8_SUBBANDS_1_2,
+    },
+    {
+        -WIND_8_SUBBANDS_0_2, WIND_8_SUBBANDS_1_3,
+        WIND_8_SUBBANDS_2_3, WIND_8_SUBBANDS_3_3,
+        WIND_8_SUBBANDS_4_3, WIND_8_SUBBANDS_5_3,
+        WIND_8_SUBBANDS_6_3, WIND_8_SUBBANDS_7_3,
+        WIND_8_SUBBANDS_8_1, WIND_8_SUBBANDS_7_1,
+        WIND_8_SUBBANDS_6_1, WIND_8_SUBBANDS_5_1,
+        WIND_8_SUBBANDS_4_1, WIND_8_SUBBANDS_3_1,
+        WIND_8_SUBBANDS_2_1, WIND_8_SUBBANDS_1_1,
+    },
+    {
+        -WIND_8_SUBBANDS_0_1, WIND_8_SUBBANDS_1_4,
+        WIND_8_SUBBANDS_2_4, WIND_8_SUBBANDS_3_4,
+        WIND_8_SUBBANDS_4_4, WIND_8_SUBBANDS_5_4,
+        WIND_8_SUBBANDS_6_4, WIND_8_SUBBANDS_7_4,
+        WIND_8_SUBBANDS_8_0, WIND_8_SUBBANDS_7_0,
+        WIND_8_SUBBANDS_6_0, WIND_8_SUBBANDS_5_0,
+        WIND_8_SUBBANDS_4_0, WIND_8_SUBBANDS_3_0,
+        WIND_8_SUBBANDS_2_0, WIND_8_SUBBANDS_1_0,
+    },
+};
+
+static void SbcSimdWindow4(const SINT16 *ps16X, SINT32 *ps32DCTY)
+{
+    int32x4_t acc;
+    int q, j;
+    for (q = 0; q < 8; q += 4)
+    {
+        acc = vmull_s16(vld1_s16(&ps16X[q]), vld1_s16(&gas16SimdCoeffFor4SBs[0][q]));
+        for (j = 1; j < 5; j++)
+        {
+            acc = vmlal_s16(acc, vld1_s16(&ps16X[j * 8 + q]), vld1_s16(&gas16SimdCoeffFor4SBs[j][q]));
+        }
+        vst1q_s32(&ps32DCTY[q], acc);
+    }
+}
+
+static void SbcSimdWindow8(const SINT16 *ps16X, SINT32 *ps32DCTY)
+{
+    int32x4_t acc;
+    int q, j;
+    for (q = 0; q < 16; q += 4)
+    {
+        acc = vmull_s16(vld1_s16(&ps16X[q]), vld1_s16(&gas16SimdCoeffFor8SBs[0][q]));
+        for (j = 1; j < 5; j++)
+        {
+            acc = vmlal_s16(acc, vld1_s16(&ps16X[j * 16 + q]), vld1_s16(&gas16SimdCoeffFor8SBs[j][q]));
+        }
+        vst1q_s32(&ps32DCTY[q], acc);
+    }
+}
+#endif
+/* BK4BTSTACK_CHANGE END */
+
 /****************************************************************************
 * SbcAnalysisFilter - performs Analysis of the input audio stream
 *
@@ -906,6 +1177,12 @@ extern SINT16 EncMaxShiftCounter;
 */
 void SbcAnalysisFilter4(SBC_ENC_PARAMS *pstrEncParams)
 {
+    /* BK4BTSTACK_CHANGE START */
+    SINT32  s32DCTY[16];
+    SINT16 *s16X = (SINT16*) pstrEncParams->as32X;
+    SINT16  ShiftCounter = pstrEncParams->s16ShiftCounter;
+    SINT16  EncMaxShiftCounter = pstrEncParams->s16MaxShiftCounter;
+    /* BK4BTSTACK_CHANGE END */
     SINT16 *ps16PcmBuf;
     SINT32 *ps32SbBuf;
     SINT32  s32Blk,s32Ch;
@@ -965,6 +1242,15 @@ void SbcAnalysisFilter4(SBC_ENC_PARAMS *pstrEncParams)
         {
             ChOffset=s32Ch*Offset2+Offset;
             
+            /* BK4BTSTACK_CHANGE START */
+#if (SBC_SIMD_WINDOW == TRUE)
+            if (!pstrEncParams->u8NoSimdWindow)
+            {
+                SbcSimdWindow4(&s16X[ChOffset], s32DCTY);
+            }
+            else
+#endif
+            /* BK4BTSTACK_CHANGE END */
             WINDOW_PARTIAL_4
 
             SBC_FastIDCT4(s32DCTY, ps32SbBuf);
@@ -994,12 +1280,20 @@ void SbcAnalysisFilter4(SBC_ENC_PARAMS *pstrEncParams)
                 ShiftCounter+=SUB_BANDS_4;
             }
         }
-    }
+    }    /* BK4BTSTACK_CHANGE START */
+    pstrEncParams->s16ShiftCounter = ShiftCounter;
+    /* BK4BTSTACK_CHANGE END */
 }
 
 /* //////////////////////////////////////////////////////////////////////////////////////////////////////////////////// */
 void SbcAnalysisFilter8 (SBC_ENC_PARAMS *pstrEncParams)
 {
+    /* BK4BTSTACK_CHANGE START */
+    SINT32  s32DCTY[16];
+    SINT16 *s16X = (SINT16*) pstrEncParams->as32X;
+    SINT16  ShiftCounter = pstrEncParams->s16ShiftCounter;
+    SINT16  EncMaxShiftCounter = pstrEncParams->s16MaxShiftCounter;
+    /* BK4BTSTACK_CHANGE END */
     SINT16 *ps16PcmBuf;
     SINT32 *ps32SbBuf;
     SINT32  s32Blk,s32Ch;                                     /* counter for block*/
@@ -1068,6 +1362,15 @@ void SbcAnalysisFilter8 (SBC_ENC_PARAMS *pstrEncParams)
         {
             ChOffset=s32Ch*Offset2+Offset;
 
+            /* BK4BTSTACK_CHANGE START */
+#if (SBC_SIMD_WINDOW == TRUE)
+            if (!pstrEncParams->u8NoSimdWindow)
+            {
+                SbcSimdWindow8(&s16X[ChOffset], s32DCTY);
+            }
+            else
+#endif
+            /* BK4BTSTACK_CHANGE END */
             WINDOW_PARTIAL_8
 
             SBC_FastIDCT8 (s32DCTY, ps32SbBuf);
@@ -1098,11 +1401,15 @@ void SbcAnalysisFilter8 (SBC_ENC_PARAMS *pstrEncParams)
                 ShiftCounter+=SUB_BANDS_8;
             }
         }
-    }
+    }    /* BK4BTSTACK_CHANGE START */
+    pstrEncParams->s16ShiftCounter = ShiftCounter;
+    /* BK4BTSTACK_CHANGE END */
 }
 
-void SbcAnalysisInit (void)
+/* BK4BTSTACK_CHANGE START */
+void SbcAnalysisInit (SBC_ENC_PARAMS *pstrEncParams)
 {
-    memset(s16X,0,ENC_VX_BUFFER_SIZE*sizeof(SINT16));
-    ShiftCounter=0;
+    memset(pstrEncParams->as32X,0,ENC_VX_BUFFER_SIZE*sizeof(SINT16));
+    pstrEncParams->s16ShiftCounter=0;
 }
+/* BK4BTSTACK_CHANGE END */
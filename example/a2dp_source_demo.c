@@ -49,7 +49,6 @@
 #define NUM_CHANNELS                2
 #define A2DP_SAMPLE_RATE            44100
 #define BYTES_PER_AUDIO_SAMPLE      (2*NUM_CHANNELS)
-#define AUDIO_TIMEOUT_MS            10 
 #define TABLE_SIZE_441HZ            100
 
 typedef enum {
@@ -60,17 +59,6 @@ typedef enum {
 typedef struct {
     uint16_t a2dp_cid;
     uint8_t  local_seid;
-    
-    uint32_t time_audio_data_sent; // ms
-    uint32_t acc_num_missed_samples;
-    uint32_t samples_ready;
-    btstack_timer_source_t audio_timer;
-    uint8_t  streaming;
-    int      max_media_payload_size;
-    
-    uint8_t  sbc_storage[1030];
-    uint16_t sbc_storage_count;
-    uint8_t  sbc_ready_to_send;
 } a2dp_media_sending_context_t;
 
 static  uint8_t media_sbc_codec_capabilities[] = {
@@ -177,15 +165,6 @@ avrcp_play_status_info_t play_info;
 
 /* AVRCP Target context END */
 
-static void a2dp_demo_send_media_packet(void){
-    int num_bytes_in_frame = btstack_sbc_encoder_sbc_buffer_length();
-    int bytes_in_storage = media_tracker.sbc_storage_count;
-    uint8_t num_frames = bytes_in_storage / num_bytes_in_frame;
-    a2dp_source_stream_send_media_payload(media_tracker.a2dp_cid, media_tracker.local_seid, media_tracker.sbc_storage, bytes_in_storage, num_frames, 0);
-    media_tracker.sbc_storage_count = 0;
-    media_tracker.sbc_ready_to_send = 0;
-}
-
 static void produce_sine_audio(int16_t * pcm_buffer, int num_samples_to_write){
     int count;
     for (count = 0; count < num_samples_to_write ; count++){
@@ -213,88 +192,19 @@ static void produce_audio(int16_t * pcm_buffer, int num_samples){
     }    
 }
 
-static int a2dp_demo_fill_sbc_audio_buffer(a2dp_media_sending_context_t * context){
-    // perform sbc encodin
-    int total_num_bytes_read = 0;
-    unsigned int num_audio_samples_per_sbc_buffer = btstack_sbc_encoder_num_audio_frames();
-    while (context->samples_ready >= num_audio_samples_per_sbc_buffer
-        && (context->max_media_payload_size - context->sbc_storage_count) >= btstack_sbc_encoder_sbc_buffer_length()){
-
-        int16_t pcm_frame[256*NUM_CHANNELS];
-
-        produce_audio(pcm_frame, num_audio_samples_per_sbc_buffer);
-        btstack_sbc_encoder_process_data(pcm_frame);
-        
-        uint16_t sbc_frame_size = btstack_sbc_encoder_sbc_buffer_length(); 
-        uint8_t * sbc_frame = btstack_sbc_encoder_sbc_buffer();
-        
-        total_num_bytes_read += num_audio_samples_per_sbc_buffer;
-        memcpy(&context->sbc_storage[context->sbc_storage_count], sbc_frame, sbc_frame_size);
-        context->sbc_storage_count += sbc_frame_size;
-        context->samples_ready -= num_audio_samples_per_sbc_buffer;
-    }
-    return total_num_bytes_read;
+static int a2dp_demo_fill_pcm(int16_t * pcm_buffer, int num_audio_frames, void * context){
+    UNUSED(context);
+    produce_audio(pcm_buffer, num_audio_frames);
+    return num_audio_frames;
 }
 
-static void a2dp_demo_audio_timeout_handler(btstack_timer_source_t * timer){
-    a2dp_media_sending_context_t * context = (a2dp_media_sending_context_t *) btstack_run_loop_get_timer_context(timer);
-    btstack_run_loop_set_timer(&context->audio_timer, AUDIO_TIMEOUT_MS); 
-    btstack_run_loop_add_timer(&context->audio_timer);
-    uint32_t now = btstack_run_loop_get_time_ms();
-
-    uint32_t update_period_ms = AUDIO_TIMEOUT_MS;
-    if (context->time_audio_data_sent > 0){
-        update_period_ms = now - context->time_audio_data_sent;
-    } 
-
-    uint32_t num_samples = (update_period_ms * A2DP_SAMPLE_RATE) / 1000;
-    context->acc_num_missed_samples += (update_period_ms * A2DP_SAMPLE_RATE) % 1000;
-    
-    while (context->acc_num_missed_samples >= 1000){
-        num_samples++;
-        context->acc_num_missed_samples -= 1000;
-    }
-    context->time_audio_data_sent = now;
-    context->samples_ready += num_samples;
-
-    if (context->sbc_ready_to_send) return;
-
-    a2dp_demo_fill_sbc_audio_buffer(context);
-
-    if ((context->sbc_storage_count + btstack_sbc_encoder_sbc_buffer_length()) > context->max_media_payload_size){
-        // schedule sending
-        context->sbc_ready_to_send = 1;
-        a2dp_source_stream_endpoint_request_can_send_now(context->a2dp_cid, context->local_seid);
-    }
+static void a2dp_demo_print_statistics(void){
+    a2dp_source_media_scheduler_statistics_t statistics;
+    if (a2dp_source_media_scheduler_get_statistics(media_tracker.a2dp_cid, media_tracker.local_seid, &statistics) != ERROR_CODE_SUCCESS) return;
+    printf("A2DP: %u packets with %u frames sent, %u underruns, max %u frames queued.\n",
+        statistics.packets_sent, statistics.frames_sent, statistics.underruns, statistics.max_queued_frames);
 }
 
-static void a2dp_demo_timer_start(a2dp_media_sending_context_t * context){
-    context->max_media_payload_size = a2dp_max_media_payload_size(context->a2dp_cid, context->local_seid);
-    context->sbc_storage_count = 0;
-    context->sbc_ready_to_send = 0;
-    context->streaming = 1;
-    btstack_run_loop_remove_timer(&context->audio_timer);
-    btstack_run_loop_set_timer_handler(&context->audio_timer, a2dp_demo_audio_timeout_handler);
-    btstack_run_loop_set_timer_context(&context->audio_timer, context);
-    btstack_run_loop_set_timer(&context->audio_timer, AUDIO_TIMEOUT_MS); 
-    btstack_run_loop_add_timer(&context->audio_timer);
-}
-
-static void a2dp_demo_timer_stop(a2dp_media_sending_context_t * context){
-    context->time_audio_data_sent = 0;
-    context->acc_num_missed_samples = 0;
-    context->samples_ready = 0;
-    context->streaming = 1;
-    context->sbc_storage_count = 0;
-    context->sbc_ready_to_send = 0;
-    btstack_run_loop_remove_timer(&context->audio_timer);
-} 
-
-static void a2dp_demo_timer_pause(a2dp_media_sending_context_t * context){
-    btstack_run_loop_remove_timer(&context->audio_timer);
-} 
-
-
 static void packet_handler(uint8_t packet_type, uint16_t channel, uint8_t *packet, uint16_t size){
     UNUSED(channel);
     UNUSED(size);
@@ -350,24 +260,31 @@ static void packet_handler(uint8_t packet_type, uint16_t channel, uint8_t *packe
 
         case A2DP_SUBEVENT_STREAM_STARTED:
             play_info.status = AVRCP_PLAY_STATUS_PLAYING;
-            a2dp_demo_timer_start(&media_tracker);
+            status = a2dp_source_media_scheduler_start_pcm(media_tracker.a2dp_cid, media_tracker.local_seid, &a2dp_demo_fill_pcm, NULL);
+            if (status != ERROR_CODE_SUCCESS){
+                printf("Could not start media scheduler, status 0x%2x\n", status);
+            }
             printf("A2DP: Stream started.\n");
             break;
 
-        case A2DP_SUBEVENT_STREAMING_CAN_SEND_MEDIA_PACKET_NOW:
-            a2dp_demo_send_media_packet();
-            break;        
+        case A2DP_SUBEVENT_MEDIA_SCHEDULER_UNDERRUN:
+            printf("A2DP: Underrun %u, %u frames queued.\n", a2dp_subevent_media_scheduler_underrun_get_underruns(packet),
+                a2dp_subevent_media_scheduler_underrun_get_queued_frames(packet));
+            break;
+
+        case A2DP_SUBEVENT_MEDIA_SCHEDULER_BITPOOL_CHANGED:
+            printf("A2DP: Bitpool %u -> %u, backlog %u packets.\n", a2dp_subevent_media_scheduler_bitpool_changed_get_previous_bitpool(packet),
+                a2dp_subevent_media_scheduler_bitpool_changed_get_bitpool(packet), a2dp_subevent_media_scheduler_bitpool_changed_get_backlog(packet));
+            break;
 
         case A2DP_SUBEVENT_STREAM_SUSPENDED:
             play_info.status = AVRCP_PLAY_STATUS_PAUSED;
             printf("A2DP: Stream paused.\n");
-            a2dp_demo_timer_pause(&media_tracker);
             break;
 
         case A2DP_SUBEVENT_STREAM_RELEASED:
             play_info.status = AVRCP_PLAY_STATUS_STOPPED;
             printf("A2DP: Stream released.\n");
-            a2dp_demo_timer_stop(&media_tracker);
             break;
         case A2DP_SUBEVENT_SIGNALING_CONNECTION_RELEASED:
             printf("A2DP: Signaling released.\n");
@@ -546,6 +463,7 @@ static void stdin_process(char cmd){
             break;
         case 'p':
             printf("Pause stream.\n");
+            a2dp_demo_print_statistics();
             status = a2dp_source_pause_stream(media_tracker.a2dp_cid, media_tracker.local_seid);
             break;
         
@@ -573,6 +491,7 @@ int btstack_main(int argc, const char * argv[]){
     // Initialize AVDTP Source
     a2dp_source_init();
     a2dp_source_register_packet_handler(&packet_handler);
+    a2dp_source_media_scheduler_enable_adaptive_bitpool(1);
 
     avdtp_stream_endpoint_t * local_stream_endpoint = a2dp_source_create_stream_endpoint(AVDTP_AUDIO, AVDTP_CODEC_SBC, media_sbc_codec_capabilities, sizeof(media_sbc_codec_capabilities), media_sbc_codec_configuration, sizeof(media_sbc_codec_configuration));
     if (!local_stream_endpoint){
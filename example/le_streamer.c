@@ -44,6 +44,10 @@
  * This example shows how to get a maximal throughput via BLE:
  * - send whenever possible
  * - use the max ATT MTU
+ * - request the max LE Data Length and the LE 2M PHY
+ *
+ * The goodput is reported together with the LL PDU size and PHY in use. To see the gain,
+ * set REQUEST_MAX_DATA_LENGTH and REQUEST_2M_PHY to 0 and compare.
  *
  * In theory, we should also update the connection parameters, but we already get
  * a connection interval of 30 ms and there's no public way to use a shorter 
@@ -62,6 +66,12 @@
 #define REPORT_INTERVAL_MS 3000
 #define MAX_NR_CONNECTIONS 3 
 
+#define REQUEST_MAX_DATA_LENGTH 1
+#define REQUEST_2M_PHY          1
+
+// max LL PDU payload - L2CAP header - ATT Handle Value Notification header
+#define MAX_TEST_DATA_LEN (LE_DATA_LENGTH_MAX_OCTETS - 4 - 3)
+
 static void  packet_handler (uint8_t packet_type, uint16_t channel, uint8_t *packet, uint16_t size);
 static int   att_write_callback(hci_con_handle_t con_handle, uint16_t att_handle, uint16_t transaction_mode, uint16_t offset, uint8_t *buffer, uint16_t buffer_size);
 static void  streamer(void);
@@ -84,7 +94,7 @@ typedef struct {
     int le_notification_enabled;
     hci_con_handle_t connection_handle;
     int  counter;
-    char test_data[200];
+    char test_data[MAX_TEST_DATA_LEN];
     int  test_data_len;
     uint32_t test_data_sent;
     uint32_t test_data_start;
@@ -183,7 +193,14 @@ static void test_track_sent(le_streamer_connection_t * context, int bytes_sent){
     if (time_passed < REPORT_INTERVAL_MS) return;
     // print speed
     int bytes_per_second = context->test_data_sent * 1000 / time_passed;
-    printf("%c: %u bytes sent-> %u.%03u kB/s\n", context->name, context->test_data_sent, bytes_per_second / 1000, bytes_per_second % 1000);
+    uint16_t max_tx_octets = 0;
+    uint16_t max_rx_octets = 0;
+    uint8_t  tx_phy = 0;
+    uint8_t  rx_phy = 0;
+    gap_le_get_data_length(context->connection_handle, &max_tx_octets, &max_rx_octets);
+    gap_le_get_phy(context->connection_handle, &tx_phy, &rx_phy);
+    printf("%c: %u bytes sent-> %u.%03u kB/s (LL PDU %u, PHY %s)\n", context->name, context->test_data_sent, bytes_per_second / 1000, bytes_per_second % 1000,
+        max_tx_octets, tx_phy == LE_PHY_2M ? "2M" : (tx_phy == LE_PHY_CODED ? "Coded" : "1M"));
 
     // restart
     context->test_data_start = now;
@@ -234,11 +251,33 @@ static void packet_handler (uint8_t packet_type, uint16_t channel, uint8_t *pack
                             // min con interval 20 ms 
                             // gap_request_connection_parameter_update(connection_handle, 0x10, 0x18, 0, 0x0048);
                             // printf("Connected, requesting conn param update for handle 0x%04x\n", connection_handle);
+#if defined(ENABLE_LE_DATA_LENGTH_EXTENSION) && REQUEST_MAX_DATA_LENGTH
+                            // max tx time for 251 octets on LE 1M PHY 
+                            gap_le_set_data_length(context->connection_handle, LE_DATA_LENGTH_MAX_OCTETS, 2120);
+#endif
+#if REQUEST_2M_PHY
+                            gap_le_set_phy(context->connection_handle, 0, LE_PHY_MASK_2M, LE_PHY_MASK_2M, 0);
+#endif
+                            break;
+                        case HCI_SUBEVENT_LE_DATA_LENGTH_CHANGE:
+                            context = connection_for_conn_handle(hci_subevent_le_data_length_change_get_connection_handle(packet));
+                            if (!context) break;
+                            printf("%c: LE Data Length: tx %u octets, rx %u octets\n", context->name,
+                                hci_subevent_le_data_length_change_get_max_tx_octets(packet),
+                                hci_subevent_le_data_length_change_get_max_rx_octets(packet));
+                            break;
+                        case HCI_SUBEVENT_LE_PHY_UPDATE_COMPLETE:
+                            context = connection_for_conn_handle(hci_subevent_le_phy_update_complete_get_connection_handle(packet));
+                            if (!context) break;
+                            printf("%c: LE PHY Update: status 0x%02x, tx phy %u, rx phy %u\n", context->name,
+                                hci_subevent_le_phy_update_complete_get_status(packet),
+                                hci_subevent_le_phy_update_complete_get_tx_phy(packet),
+                                hci_subevent_le_phy_update_complete_get_rx_phy(packet));
                             break;
                     }
                     break;  
                 case ATT_EVENT_MTU_EXCHANGE_COMPLETE:
-                    mtu = att_event_mtu_exchange_complete_get_MTU(packet) - 3;
+                    mtu = att_event_mtu_exchange_complete_get_MTU(packet);
                     context = connection_for_conn_handle(att_event_mtu_exchange_complete_get_handle(packet));
                     if (!context) break;
                     context->test_data_len = btstack_min(mtu - 3, sizeof(context->test_data));
@@ -202,6 +202,8 @@ static const btstack_uart_block_t btstack_uart_embedded = {
 	/* int (*get_supported_sleep_modes); */                           &btstack_uart_embedded_get_supported_sleep_modes,
     /* void (*set_sleep)(btstack_uart_sleep_mode_t sleep_mode); */    &btstack_uart_embedded_set_sleep,
     /* void (*set_wakeup_handler)(void (*handler)(void)); */          &btstack_uart_embedded_set_wakeup_handler,
+    /* void (*set_data_received)(void (*handler)(uint16_t size)); */  NULL,
+    /* void (*receive_data)(uint8_t *buffer, uint16_t len); */        NULL,
 };
 
 const btstack_uart_block_t * btstack_uart_block_embedded_instance(void){
@@ -0,0 +1,296 @@
+/*
+ * Copyright (C) 2017 BlueKitchen GmbH
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ * 4. Any redistribution, use, or modification is done solely for
+ *    personal benefit and not for any commercial purpose or for
+ *    monetary gain.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BLUEKITCHEN GMBH AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL MATTHIAS
+ * RINGWALD OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Please inquire about commercial licensing options at 
+ * contact@bluekitchen-gmbh.com
+ *
+ */
+
+#define __BTSTACK_FILE__ "btstack_run_loop_epoll.c"
+
+/*
+ *  btstack_run_loop_epoll.c
+ *
+ *  Linux run loop based on epoll: file descriptors are registered once when a data source is added,
+ *  and only data sources with pending events are visited when the run loop wakes up.
+ */
+
+#include "btstack_run_loop.h"
+#include "btstack_run_loop_epoll.h"
+#include "btstack_linked_list.h"
+#include "btstack_debug.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <time.h>
+#include <unistd.h>
+
+// max number of events collected by a single epoll_wait call
+#ifndef BTSTACK_RUN_LOOP_EPOLL_MAX_EVENTS
+#define BTSTACK_RUN_LOOP_EPOLL_MAX_EVENTS 64
+#endif
+
+static void btstack_run_loop_epoll_dump_timer(void);
+
+// the run loop
+static int epoll_fd = -1;
+static btstack_linked_list_t data_sources;
+static btstack_linked_list_t timers;
+// start time
+static struct timespec init_ts;
+
+// events returned by last epoll_wait, entries are cleared if their data source gets removed
+static struct epoll_event ready_events[BTSTACK_RUN_LOOP_EPOLL_MAX_EVENTS];
+static int ready_events_num;
+static int ready_events_index;
+
+static uint32_t btstack_run_loop_epoll_events_for_flags(uint16_t flags){
+    uint32_t events = 0;
+    if (flags & DATA_SOURCE_CALLBACK_READ){
+        events |= EPOLLIN;
+    }
+    if (flags & DATA_SOURCE_CALLBACK_WRITE){
+        events |= EPOLLOUT;
+    }
+    return events;
+}
+
+static void btstack_run_loop_epoll_update_data_source(btstack_data_source_t * ds, int op){
+    if (ds->fd < 0) return;
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events   = btstack_run_loop_epoll_events_for_flags(ds->flags);
+    event.data.ptr = ds;
+    int res = epoll_ctl(epoll_fd, op, ds->fd, &event);
+    if (res < 0){
+        // data source not added yet or added twice
+        if (op == EPOLL_CTL_MOD && errno == ENOENT) return;
+        if (op == EPOLL_CTL_ADD && errno == EEXIST) return;
+        log_error("btstack_run_loop_epoll: epoll_ctl op %u for fd %u failed, errno %u", op, ds->fd, errno);
+    }
+}
+
+/**
+ * Add data_source to run_loop
+ */
+static void btstack_run_loop_epoll_add_data_source(btstack_data_source_t *ds){
+    btstack_linked_list_add(&data_sources, (btstack_linked_item_t *) ds);
+    btstack_run_loop_epoll_update_data_source(ds, EPOLL_CTL_ADD);
+}
+
+/**
+ * Remove data_source from run loop
+ */
+static int btstack_run_loop_epoll_remove_data_source(btstack_data_source_t *ds){
+    int removed = btstack_linked_list_remove(&data_sources, (btstack_linked_item_t *) ds);
+    if (!removed) return 0;
+    if (ds->fd >= 0){
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, ds->fd, NULL);
+    }
+    // drop pending events for this data source
+    int i;
+    for (i = ready_events_index; i < ready_events_num; i++){
+        if (ready_events[i].data.ptr == ds){
+            ready_events[i].data.ptr = NULL;
+        }
+    }
+    return removed;
+}
+
+/**
+ * Add timer to run_loop (keep list sorted)
+ */
+static void btstack_run_loop_epoll_add_timer(btstack_timer_source_t *ts){
+    btstack_linked_item_t *it;
+    for (it = (btstack_linked_item_t *) &timers; it->next ; it = it->next){
+        btstack_timer_source_t * next = (btstack_timer_source_t *) it->next;
+        if (next == ts){
+            log_error( "btstack_run_loop_timer_add error: timer to add already in list!");
+            return;
+        }
+        // compare as signed to handle 32-bit wrap around
+        if ((int32_t)(next->timeout - ts->timeout) > 0) {
+            break;
+        }
+    }
+    ts->item.next = it->next;
+    it->next = (btstack_linked_item_t *) ts;
+    log_debug("Added timer %p at %u\n", ts, ts->timeout);
+}
+
+/**
+ * Remove timer from run loop
+ */
+static int btstack_run_loop_epoll_remove_timer(btstack_timer_source_t *ts){
+    return btstack_linked_list_remove(&timers, (btstack_linked_item_t *) ts);
+}
+
+static void btstack_run_loop_epoll_dump_timer(void){
+    btstack_linked_item_t *it;
+    int i = 0;
+    for (it = (btstack_linked_item_t *) timers; it ; it = it->next){
+        btstack_timer_source_t *ts = (btstack_timer_source_t*) it;
+        log_info("timer %u, timeout %u\n", i++, ts->timeout);
+    }
+}
+
+static void btstack_run_loop_epoll_enable_data_source_callbacks(btstack_data_source_t * ds, uint16_t callback_types){
+    uint16_t old_flags = ds->flags;
+    ds->flags |= callback_types;
+    if (ds->flags == old_flags) return;
+    btstack_run_loop_epoll_update_data_source(ds, EPOLL_CTL_MOD);
+}
+
+static void btstack_run_loop_epoll_disable_data_source_callbacks(btstack_data_source_t * ds, uint16_t callback_types){
+    uint16_t old_flags = ds->flags;
+    ds->flags &= ~callback_types;
+    if (ds->flags == old_flags) return;
+    btstack_run_loop_epoll_update_data_source(ds, EPOLL_CTL_MOD);
+}
+
+/**
+ * @brief Queries the current time in ms since start, based on monotonic clock
+ */
+static uint32_t btstack_run_loop_epoll_get_time_ms(void){
+    struct timespec now_ts;
+    clock_gettime(CLOCK_MONOTONIC, &now_ts);
+    uint32_t time_ms = (uint32_t)((now_ts.tv_sec - init_ts.tv_sec) * 1000) + (uint32_t)(now_ts.tv_nsec / 1000000);
+    return time_ms;
+}
+
+static void btstack_run_loop_epoll_process_timers(void){
+    uint32_t now_ms = btstack_run_loop_epoll_get_time_ms();
+    while (timers) {
+        btstack_timer_source_t * ts = (btstack_timer_source_t *) timers;
+        if ((int32_t)(ts->timeout - now_ms) > 0) break;
+        log_debug("btstack_run_loop_epoll_execute: process timer %p\n", ts);
+        // remove timer before processing it to allow handler to re-register with run loop
+        btstack_run_loop_epoll_remove_timer(ts);
+        ts->process(ts);
+    }
+}
+
+/**
+ * Execute run_loop
+ */
+static void btstack_run_loop_epoll_execute(void) {
+    while (1) {
+        // get next timeout
+        int timeout_ms = -1;
+        if (timers) {
+            btstack_timer_source_t * ts = (btstack_timer_source_t *) timers;
+            int32_t delta = (int32_t)(ts->timeout - btstack_run_loop_epoll_get_time_ms());
+            timeout_ms = delta < 0 ? 0 : delta;
+            log_debug("btstack_run_loop_epoll_execute next timeout in %u ms", timeout_ms);
+        }
+
+        // wait for ready FDs
+        int num_events = epoll_wait(epoll_fd, ready_events, BTSTACK_RUN_LOOP_EPOLL_MAX_EVENTS, timeout_ms);
+        if (num_events < 0){
+            if (errno != EINTR){
+                log_error("btstack_run_loop_epoll_execute: epoll_wait failed, errno %u", errno);
+            }
+            num_events = 0;
+        }
+
+        // process ready data sources
+        ready_events_num = num_events;
+        for (ready_events_index = 0; ready_events_index < ready_events_num; ready_events_index++){
+            struct epoll_event * event = &ready_events[ready_events_index];
+            btstack_data_source_t * ds = (btstack_data_source_t *) event->data.ptr;
+            if (!ds) continue;
+            // report errors and hang-up as readable, so the read handler can detect it
+            if ((event->events & (EPOLLIN | EPOLLERR | EPOLLHUP)) && (ds->flags & DATA_SOURCE_CALLBACK_READ)){
+                log_debug("btstack_run_loop_epoll_execute: process read ds %p with fd %u\n", ds, ds->fd);
+                ds->process(ds, DATA_SOURCE_CALLBACK_READ);
+                // data source removed by its read handler
+                if (event->data.ptr == NULL) continue;
+            }
+            if ((event->events & EPOLLOUT) && (ds->flags & DATA_SOURCE_CALLBACK_WRITE)){
+                log_debug("btstack_run_loop_epoll_execute: process write ds %p with fd %u\n", ds, ds->fd);
+                ds->process(ds, DATA_SOURCE_CALLBACK_WRITE);
+            }
+        }
+        ready_events_num = 0;
+        ready_events_index = 0;
+
+        // process timers
+        btstack_run_loop_epoll_process_timers();
+    }
+}
+
+// set timer
+static void btstack_run_loop_epoll_set_timer(btstack_timer_source_t *a, uint32_t timeout_in_ms){
+    uint32_t time_ms = btstack_run_loop_epoll_get_time_ms();
+    a->timeout = time_ms + timeout_in_ms;
+    log_debug("btstack_run_loop_epoll_set_timer to %u ms (now %u, timeout %u)", a->timeout, time_ms, timeout_in_ms);
+}
+
+static void btstack_run_loop_epoll_init(void){
+    data_sources = NULL;
+    timers = NULL;
+    ready_events_num = 0;
+    ready_events_index = 0;
+    if (epoll_fd >= 0){
+        close(epoll_fd);
+    }
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0){
+        log_error("btstack_run_loop_epoll_init: epoll_create1 failed, errno %u", errno);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &init_ts);
+    log_debug("btstack_run_loop_epoll_init at %u", (int) init_ts.tv_sec);
+}
+
+static const btstack_run_loop_t btstack_run_loop_epoll = {
+    &btstack_run_loop_epoll_init,
+    &btstack_run_loop_epoll_add_data_source,
+    &btstack_run_loop_epoll_remove_data_source,
+    &btstack_run_loop_epoll_enable_data_source_callbacks,
+    &btstack_run_loop_epoll_disable_data_source_callbacks,
+    &btstack_run_loop_epoll_set_timer,
+    &btstack_run_loop_epoll_add_timer,
+    &btstack_run_loop_epoll_remove_timer,
+    &btstack_run_loop_epoll_execute,
+    &btstack_run_loop_epoll_dump_timer,
+    &btstack_run_loop_epoll_get_time_ms,
+};
+
+/**
+ * Provide btstack_run_loop_epoll instance
+ */
+const btstack_run_loop_t * btstack_run_loop_epoll_get_instance(void){
+    return &btstack_run_loop_epoll;
+}
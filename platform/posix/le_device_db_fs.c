@@ -91,6 +91,16 @@ const  char * csv_header = "# addr_type, addr, irk, ltk, ediv, rand[8], key_size
 static char db_path[sizeof(DB_PATH_TEMPLATE) - 2 + 17 + 1];
 
 static le_device_memory_db_t le_devices[LE_DEVICE_MEMORY_SIZE];
+static void (*le_device_db_changed_callback)(void);
+
+static void le_device_db_emit_changed(void){
+    if (!le_device_db_changed_callback) return;
+    (*le_device_db_changed_callback)();
+}
+
+void le_device_db_set_changed_callback(void (*callback)(void)){
+    le_device_db_changed_callback = callback;
+}
 
 static char bd_addr_to_dash_str_buffer[6*3];  // 12-45-78-01-34-67\0
 static char * bd_addr_to_dash_str(bd_addr_t addr){
@@ -248,6 +258,7 @@ void le_device_db_set_local_bd_addr(bd_addr_t addr){
     log_info("le_device_db_fs: path %s", db_path);
     le_device_db_read();
     le_device_db_dump();
+    le_device_db_emit_changed();
 }
 
 // @returns number of device in db
@@ -264,6 +275,7 @@ int le_device_db_count(void){
 void le_device_db_remove(int index){
     le_devices[index].addr_type = INVALID_ENTRY_ADDR_TYPE;
     le_device_db_store();
+    le_device_db_emit_changed();
 }
 
 int le_device_db_add(int addr_type, bd_addr_t addr, sm_key_t irk){
@@ -288,6 +300,7 @@ int le_device_db_add(int addr_type, bd_addr_t addr, sm_key_t irk){
     le_devices[index].remote_counter = 0; 
 #endif
     le_device_db_store();
+    le_device_db_emit_changed();
 
     return index;
 }
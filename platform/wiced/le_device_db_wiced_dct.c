@@ -83,6 +83,12 @@ typedef struct le_device_nvm {
 } le_device_nvm_t;
 
 static uint32_t start_of_le_device_db;
+static void (*le_device_db_changed_callback)(void);
+
+static void le_device_db_emit_changed(void){
+	if (!le_device_db_changed_callback) return;
+	(*le_device_db_changed_callback)();
+}
 
 // calculate address
 static int le_device_db_address_for_absolute_index(int abolute_index){
@@ -181,6 +187,10 @@ void le_device_db_set_local_bd_addr(bd_addr_t addr){
 	(void) addr;
 }
 
+void le_device_db_set_changed_callback(void (*callback)(void)){
+	le_device_db_changed_callback = callback;
+}
+
 // @returns number of device in db
 int le_device_db_count(void){
     int i;
@@ -207,6 +217,7 @@ void le_device_db_remove(int device_index){
 	le_device_nvm_t entry;
 	memset(&entry, 0, sizeof(le_device_nvm_t));
 	le_device_db_entry_write(absolute_index, &entry);
+	le_device_db_emit_changed();
 }
 
 // custom function
@@ -217,6 +228,7 @@ void le_device_db_wiced_dct_delete_all(void){
 	for (i=0;i<NVM_NUM_LE_DEVICES;i++){
 		le_device_db_entry_write(i, &entry);
 	}
+	le_device_db_emit_changed();
 }
 
 int le_device_db_add(int addr_type, bd_addr_t addr, sm_key_t irk){
@@ -235,6 +247,7 @@ int le_device_db_add(int addr_type, bd_addr_t addr, sm_key_t irk){
     memcpy(entry.irk, irk, 16);
 
     le_device_db_entry_write(absolute_index, &entry);
+    le_device_db_emit_changed();
 
     return absolute_index;
 }
@@ -440,6 +440,8 @@ static const btstack_uart_block_t btstack_uart_windows = {
     /* int (*get_supported_sleep_modes); */                           NULL,
     /* void (*set_sleep)(btstack_uart_sleep_mode_t sleep_mode); */    NULL,
     /* void (*set_wakeup_handler)(void (*handler)(void)); */          NULL,
+    /* void (*set_data_received)(void (*handler)(uint16_t size)); */  NULL,
+    /* void (*receive_data)(uint8_t *buffer, uint16_t len); */        NULL,
 };
 
 const btstack_uart_block_t * btstack_uart_block_windows_instance(void){
@@ -25,6 +25,7 @@
 #define ENABLE_SCO_OVER_HCI
 #define ENABLE_SDP_DES_DUMP
 // #define ENABLE_EHCILL
+// #define ENABLE_H4_STREAMING_RX
 
 // BTstack configuration. buffers, sizes, ...
 #define HCI_INCOMING_PRE_BUFFER_SIZE 14 // sizeof benep heade, avoid memcpy
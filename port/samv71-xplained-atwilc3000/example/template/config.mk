@@ -150,6 +150,8 @@ CSRCS += \
 	${BTSTACK_ROOT_CONFIG}/src/ble/gatt_client.c \
 	${BTSTACK_ROOT_CONFIG}/src/ble/le_device_db_memory.c \
 	${BTSTACK_ROOT_CONFIG}/src/ble/sm.c \
+	${BTSTACK_ROOT_CONFIG}/src/btstack_hash_map.c \
+	${BTSTACK_ROOT_CONFIG}/src/btstack_crc16.c    \
 	${BTSTACK_ROOT_CONFIG}/src/btstack_linked_list.c \
 	${BTSTACK_ROOT_CONFIG}/src/btstack_memory.c \
 	${BTSTACK_ROOT_CONFIG}/src/btstack_memory_pool.c \
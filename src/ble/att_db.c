@@ -68,11 +68,31 @@ static uint16_t uuid16_from_uuid(uint16_t uuid_len, uint8_t * uuid){
 static uint8_t const * att_db = NULL;
 static att_read_callback_t  att_read_callback  = NULL;
 static att_write_callback_t att_write_callback = NULL;
+static void (*att_service_changed_callback)(uint16_t start_handle, uint16_t end_handle) = NULL;
 static uint8_t  att_prepare_write_error_code   = 0;
 static uint16_t att_prepare_write_error_handle = 0x0000;
 
 static btstack_linked_list_t service_handlers;
 
+#ifdef ENABLE_ATT_DB_HANDLE_INDEX
+#ifndef ATT_DB_HANDLE_INDEX_SIZE
+#define ATT_DB_HANDLE_INDEX_SIZE 256
+#endif
+// offsets of all attributes in att_db sorted by handle, followed by offset of end marker
+static uint16_t att_db_handle_index[ATT_DB_HANDLE_INDEX_SIZE + 1];
+static uint16_t att_db_handle_index_count;
+static int      att_db_handle_index_valid;
+#endif
+
+#ifdef ENABLE_ATT_DB_UUID_INDEX
+#ifndef ENABLE_ATT_DB_HANDLE_INDEX
+#error "ENABLE_ATT_DB_UUID_INDEX requires ENABLE_ATT_DB_HANDLE_INDEX"
+#endif
+// positions in handle index sorted by UUID in 128-bit form, then by handle
+static uint16_t att_db_uuid_index[ATT_DB_HANDLE_INDEX_SIZE];
+static uint16_t att_db_uuid_index_count;
+#endif
+
 // new java-style iterator
 typedef struct att_iterator {
     // private
@@ -84,6 +104,11 @@ typedef struct att_iterator {
     uint8_t  const * uuid;
     uint16_t value_len;
     uint8_t  const * value;
+#ifdef ENABLE_ATT_DB_UUID_INDEX
+    // private, used by att_iterator_fetch_next_uuid
+    uint8_t  uuid128[16];
+    uint16_t uuid_index_pos;
+#endif
 } att_iterator_t;
 
 static void att_iterator_init(att_iterator_t *it){
@@ -145,8 +170,243 @@ static int att_iterator_match_uuid(att_iterator_t *it, uint8_t *uuid, uint16_t u
 }
 
 
+#ifdef ENABLE_ATT_DB_HANDLE_INDEX
+
+// index is only used if handles are strictly increasing and all attributes fit into it
+static void att_db_handle_index_build(void){
+    att_db_handle_index_valid = 0;
+    att_db_handle_index_count = 0;
+    if (!att_db) return;
+    uint16_t prev_handle = 0;
+    uint32_t offset = 0;
+    while (1){
+        if (offset > 0xffff){
+            log_info("att_db_handle_index_build: database too large, index not used");
+            return;
+        }
+        uint16_t size = little_endian_read_16(att_db, offset);
+        if (size == 0) break;
+        uint16_t handle = little_endian_read_16(att_db, offset + 4);
+        if (handle <= prev_handle){
+            log_info("att_db_handle_index_build: handle 0x%04x not in order, index not used", handle);
+            return;
+        }
+        if (att_db_handle_index_count == ATT_DB_HANDLE_INDEX_SIZE){
+            log_info("att_db_handle_index_build: more than %u attributes, index not used", ATT_DB_HANDLE_INDEX_SIZE);
+            return;
+        }
+        att_db_handle_index[att_db_handle_index_count++] = (uint16_t) offset;
+        prev_handle = handle;
+        offset += size;
+    }
+    att_db_handle_index[att_db_handle_index_count] = (uint16_t) offset;
+    att_db_handle_index_valid = 1;
+}
+
+static inline uint16_t att_db_handle_index_get_handle(uint16_t pos){
+    return little_endian_read_16(att_db, att_db_handle_index[pos] + 4);
+}
+
+// returns position of first attribute with handle >= given handle, or att_db_handle_index_count if none
+static uint16_t att_db_handle_index_lower_bound(uint16_t handle){
+    if (att_db_handle_index_count == 0) return 0;
+    // direct hit for consecutive handles, as generated by compile_gatt.py and att_db_util
+    uint16_t first_handle = att_db_handle_index_get_handle(0);
+    if (handle <= first_handle) return 0;
+    uint16_t pos = handle - first_handle;
+    if (pos < att_db_handle_index_count && att_db_handle_index_get_handle(pos) == handle) return pos;
+    // binary search
+    uint16_t low  = 0;
+    uint16_t high = att_db_handle_index_count;
+    while (low < high){
+        uint16_t mid = (low + high) >> 1;
+        if (att_db_handle_index_get_handle(mid) < handle){
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+#endif
+
+#ifdef ENABLE_ATT_DB_UUID_INDEX
+
+static void att_uuid128_from_uuid(uint16_t uuid_len, uint8_t const * uuid, uint8_t * uuid128){
+    if (uuid_len == 2){
+        memcpy(uuid128, bluetooth_base_uuid, 16);
+        little_endian_store_16(uuid128, 12, little_endian_read_16(uuid, 0));
+    } else {
+        memcpy(uuid128, uuid, 16);
+    }
+}
+
+static int att_db_uuid_index_compare(uint16_t pos, uint8_t const * uuid128){
+    uint8_t const * att_ptr = &att_db[att_db_handle_index[pos]];
+    uint8_t entry_uuid128[16];
+    uint16_t uuid_len = (little_endian_read_16(att_ptr, 2) & ATT_PROPERTY_UUID128) ? 16 : 2;
+    att_uuid128_from_uuid(uuid_len, &att_ptr[6], entry_uuid128);
+    return memcmp(entry_uuid128, uuid128, 16);
+}
+
+static void att_db_uuid_index_build(void){
+    if (!att_db_handle_index_valid) return;
+    // insertion sort in handle order is stable, so handles are sorted for each UUID
+    uint16_t i;
+    att_db_uuid_index_count = att_db_handle_index_count;
+    for (i=0;i<att_db_handle_index_count;i++){
+        uint8_t const * att_ptr = &att_db[att_db_handle_index[i]];
+        uint8_t uuid128[16];
+        uint16_t uuid_len = (little_endian_read_16(att_ptr, 2) & ATT_PROPERTY_UUID128) ? 16 : 2;
+        att_uuid128_from_uuid(uuid_len, &att_ptr[6], uuid128);
+        uint16_t j = i;
+        while (j > 0 && att_db_uuid_index_compare(att_db_uuid_index[j-1], uuid128) > 0){
+            att_db_uuid_index[j] = att_db_uuid_index[j-1];
+            j--;
+        }
+        att_db_uuid_index[j] = i;
+    }
+}
+
+// returns position in UUID index of first attribute with given UUID and handle >= given handle
+static uint16_t att_db_uuid_index_lower_bound(uint8_t const * uuid128, uint16_t handle){
+    uint16_t low  = 0;
+    uint16_t high = att_db_uuid_index_count;
+    while (low < high){
+        uint16_t mid = (low + high) >> 1;
+        uint16_t pos = att_db_uuid_index[mid];
+        int cmp = att_db_uuid_index_compare(pos, uuid128);
+        if (cmp < 0 || (cmp == 0 && att_db_handle_index_get_handle(pos) < handle)){
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+// returns handle of first attribute with given UUID16 and handle >= given handle, or 0 if none
+static uint16_t att_db_uuid_index_find_uuid16(uint16_t uuid16, uint16_t handle){
+    uint8_t uuid[2];
+    uint8_t uuid128[16];
+    little_endian_store_16(uuid, 0, uuid16);
+    att_uuid128_from_uuid(2, uuid, uuid128);
+    uint16_t index_pos = att_db_uuid_index_lower_bound(uuid128, handle);
+    if (index_pos == att_db_uuid_index_count) return 0;
+    uint16_t pos = att_db_uuid_index[index_pos];
+    if (att_db_uuid_index_compare(pos, uuid128) != 0) return 0;
+    return att_db_handle_index_get_handle(pos);
+}
+
+static void att_db_uuid_index_insert(uint16_t pos){
+    uint8_t const * att_ptr = &att_db[att_db_handle_index[pos]];
+    uint8_t uuid128[16];
+    uint16_t uuid_len = (little_endian_read_16(att_ptr, 2) & ATT_PROPERTY_UUID128) ? 16 : 2;
+    att_uuid128_from_uuid(uuid_len, &att_ptr[6], uuid128);
+    uint16_t index_pos = att_db_uuid_index_lower_bound(uuid128, little_endian_read_16(att_ptr, 4));
+    memmove(&att_db_uuid_index[index_pos + 1], &att_db_uuid_index[index_pos], (att_db_uuid_index_count - index_pos) * sizeof(uint16_t));
+    att_db_uuid_index[index_pos] = pos;
+    att_db_uuid_index_count++;
+}
+#endif
+
+#ifdef ENABLE_ATT_DB_HANDLE_INDEX
+// update indexes after attributes at offset have been replaced, att_db already points to the modified database
+// returns 0 if indexes need to be rebuilt
+static int att_db_handle_index_update(uint16_t offset, uint16_t removed_size, uint16_t inserted_size){
+    if (!att_db_handle_index_valid) return 0;
+
+    // removed attributes [first, last) in index, offset has to be at attribute boundaries
+    uint16_t first = 0;
+    while (first < att_db_handle_index_count && att_db_handle_index[first] < offset) first++;
+    if (att_db_handle_index[first] != offset) return 0;
+    uint16_t last = first;
+    while (last < att_db_handle_index_count && att_db_handle_index[last] < offset + removed_size) last++;
+    if (att_db_handle_index[last] != offset + removed_size) return 0;
+
+    // inserted attributes have to keep handles strictly increasing
+    int32_t delta = (int32_t) inserted_size - (int32_t) removed_size;
+    if ((int32_t) att_db_handle_index[att_db_handle_index_count] + delta > 0xffff) return 0;
+    uint16_t prev_handle = first ? att_db_handle_index_get_handle(first - 1) : 0;
+    uint16_t num_inserted = 0;
+    uint32_t pos = offset;
+    while (pos < (uint32_t) offset + inserted_size){
+        uint16_t size = little_endian_read_16(att_db, pos);
+        if (size == 0) return 0;
+        uint16_t handle = little_endian_read_16(att_db, pos + 4);
+        if (handle <= prev_handle) return 0;
+        prev_handle = handle;
+        num_inserted++;
+        pos += size;
+    }
+    if (pos != (uint32_t) offset + inserted_size) return 0;
+    if (last < att_db_handle_index_count){
+        uint16_t next_handle = little_endian_read_16(att_db, att_db_handle_index[last] + delta + 4);
+        if (next_handle <= prev_handle) return 0;
+    }
+    uint16_t num_removed = last - first;
+    if (att_db_handle_index_count - num_removed + num_inserted > ATT_DB_HANDLE_INDEX_SIZE) return 0;
+
+#ifdef ENABLE_ATT_DB_UUID_INDEX
+    // drop removed attributes and renumber following ones
+    uint16_t i;
+    uint16_t count = 0;
+    for (i=0;i<att_db_uuid_index_count;i++){
+        uint16_t index_pos = att_db_uuid_index[i];
+        if (index_pos >= first && index_pos < last) continue;
+        if (index_pos >= last){
+            index_pos = index_pos - num_removed + num_inserted;
+        }
+        att_db_uuid_index[count++] = index_pos;
+    }
+    att_db_uuid_index_count = count;
+#endif
+
+    // move following attributes incl. end marker and store inserted ones
+    memmove(&att_db_handle_index[first + num_inserted], &att_db_handle_index[last], (att_db_handle_index_count + 1 - last) * sizeof(uint16_t));
+    att_db_handle_index_count = att_db_handle_index_count - num_removed + num_inserted;
+    uint16_t j;
+    for (j = first + num_inserted; j <= att_db_handle_index_count; j++){
+        att_db_handle_index[j] = (uint16_t) (att_db_handle_index[j] + delta);
+    }
+    pos = offset;
+    for (j = first; j < first + num_inserted; j++){
+        att_db_handle_index[j] = (uint16_t) pos;
+        pos += little_endian_read_16(att_db, pos);
+    }
+
+#ifdef ENABLE_ATT_DB_UUID_INDEX
+    for (j = first; j < first + num_inserted; j++){
+        att_db_uuid_index_insert(j);
+    }
+#endif
+    return 1;
+}
+#endif
+
+// start iteration at first attribute with handle >= start_handle. Callers still have to skip lower handles
+static void att_iterator_init_at(att_iterator_t *it, uint16_t start_handle){
+#ifdef ENABLE_ATT_DB_HANDLE_INDEX
+    if (att_db_handle_index_valid){
+        it->att_ptr = &att_db[att_db_handle_index[att_db_handle_index_lower_bound(start_handle)]];
+        return;
+    }
+#endif
+    UNUSED(start_handle);
+    att_iterator_init(it);
+}
+
 static int att_find_handle(att_iterator_t *it, uint16_t handle){
     if (handle == 0) return 0;
+#ifdef ENABLE_ATT_DB_HANDLE_INDEX
+    if (att_db_handle_index_valid){
+        uint16_t pos = att_db_handle_index_lower_bound(handle);
+        if (pos == att_db_handle_index_count) return 0;
+        it->att_ptr = &att_db[att_db_handle_index[pos]];
+        att_iterator_fetch_next(it);
+        return it->handle == handle;
+    }
+#endif
     att_iterator_init(it);
     while (att_iterator_has_next(it)){
         att_iterator_fetch_next(it);
@@ -156,6 +416,81 @@ static int att_find_handle(att_iterator_t *it, uint16_t handle){
     return 0;
 }
 
+// start iteration over attributes with given UUID and handle >= start_handle
+static void att_iterator_init_uuid(att_iterator_t *it, uint16_t start_handle, uint8_t * uuid, uint16_t uuid_len){
+#ifdef ENABLE_ATT_DB_UUID_INDEX
+    if (att_db_handle_index_valid){
+        att_uuid128_from_uuid(uuid_len, uuid, it->uuid128);
+        it->uuid_index_pos = att_db_uuid_index_lower_bound(it->uuid128, start_handle);
+        return;
+    }
+#endif
+    UNUSED(uuid);
+    UNUSED(uuid_len);
+    att_iterator_init_at(it, start_handle);
+    while (att_iterator_has_next(it)){
+        uint8_t const * att_ptr = it->att_ptr;
+        att_iterator_fetch_next(it);
+        if (it->handle == 0 || it->handle >= start_handle){
+            it->att_ptr = att_ptr;
+            return;
+        }
+    }
+}
+
+// returns 1 if next attribute with given UUID and handle <= end_handle was fetched
+static int att_iterator_fetch_next_uuid(att_iterator_t *it, uint16_t end_handle, uint8_t * uuid, uint16_t uuid_len){
+#ifdef ENABLE_ATT_DB_UUID_INDEX
+    if (att_db_handle_index_valid){
+        if (it->uuid_index_pos >= att_db_uuid_index_count) return 0;
+        uint16_t pos = att_db_uuid_index[it->uuid_index_pos];
+        if (att_db_uuid_index_compare(pos, it->uuid128) != 0) return 0;
+        if (att_db_handle_index_get_handle(pos) > end_handle) return 0;
+        it->uuid_index_pos++;
+        it->att_ptr = &att_db[att_db_handle_index[pos]];
+        att_iterator_fetch_next(it);
+        return 1;
+    }
+#endif
+    while (att_iterator_has_next(it)){
+        att_iterator_fetch_next(it);
+        if (it->handle == 0) return 0;
+        if (it->handle > end_handle) return 0;
+        if (att_iterator_match_uuid(it, uuid, uuid_len)) return 1;
+    }
+    return 0;
+}
+
+// returns handle of last attribute before next service declaration or end of att db
+static uint16_t att_iterator_group_end_handle(att_iterator_t *it){
+#ifdef ENABLE_ATT_DB_UUID_INDEX
+    if (att_db_handle_index_valid){
+        uint16_t next_service_handle = 0;
+        if (it->handle < 0xffff){
+            uint16_t primary_handle   = att_db_uuid_index_find_uuid16(GATT_PRIMARY_SERVICE_UUID,   it->handle + 1);
+            uint16_t secondary_handle = att_db_uuid_index_find_uuid16(GATT_SECONDARY_SERVICE_UUID, it->handle + 1);
+            next_service_handle = primary_handle;
+            if (secondary_handle && (next_service_handle == 0 || secondary_handle < next_service_handle)){
+                next_service_handle = secondary_handle;
+            }
+        }
+        if (next_service_handle == 0){
+            return att_db_handle_index_get_handle(att_db_handle_index_count - 1);
+        }
+        return att_db_handle_index_get_handle(att_db_handle_index_lower_bound(next_service_handle) - 1);
+    }
+#endif
+    att_iterator_t group_it = *it;
+    uint16_t end_handle = it->handle;
+    while (att_iterator_has_next(&group_it)){
+        att_iterator_fetch_next(&group_it);
+        if (group_it.handle == 0) break;
+        if (att_iterator_match_uuid16(&group_it, GATT_PRIMARY_SERVICE_UUID) || att_iterator_match_uuid16(&group_it, GATT_SECONDARY_SERVICE_UUID)) break;
+        end_handle = group_it.handle;
+    }
+    return end_handle;
+}
+
 static att_service_handler_t * att_service_handler_for_handle(uint16_t handle){
     btstack_linked_list_iterator_t it;
     btstack_linked_list_iterator_init(&it, &service_handlers);
@@ -219,6 +554,41 @@ static int att_copy_value(att_iterator_t *it, uint16_t offset, uint8_t * buffer,
 
 void att_set_db(uint8_t const * db){
     att_db = db;
+#ifdef ENABLE_ATT_DB_HANDLE_INDEX
+    att_db_handle_index_build();
+#endif
+#ifdef ENABLE_ATT_DB_UUID_INDEX
+    att_db_uuid_index_build();
+#endif
+}
+
+void att_update_db(uint8_t const * old_db, uint8_t const * new_db, uint16_t offset, uint16_t removed_size, uint16_t inserted_size){
+    // ignore changes to other databases
+    if (att_db != old_db) return;
+    att_db = new_db;
+#ifdef ENABLE_ATT_DB_HANDLE_INDEX
+    if (att_db_handle_index_update(offset, removed_size, inserted_size)) return;
+    log_info("att_update_db: rebuild index");
+    att_db_handle_index_build();
+#ifdef ENABLE_ATT_DB_UUID_INDEX
+    att_db_uuid_index_build();
+#endif
+#else
+    UNUSED(offset);
+    UNUSED(removed_size);
+    UNUSED(inserted_size);
+#endif
+}
+
+void att_service_changed(uint8_t const * db, uint16_t start_handle, uint16_t end_handle){
+    // ignore changes to other databases
+    if (att_db != db) return;
+    if (!att_service_changed_callback) return;
+    (*att_service_changed_callback)(start_handle, end_handle);
+}
+
+void att_set_service_changed_callback(void (*callback)(uint16_t start_handle, uint16_t end_handle)){
+    att_service_changed_callback = callback;
 }
 
 void att_set_read_callback(att_read_callback_t callback){
@@ -363,7 +733,7 @@ static uint16_t handle_find_information_request2(att_connection_t * att_connecti
     uint16_t uuid_len = 0;
     
     att_iterator_t it;
-    att_iterator_init(&it);
+    att_iterator_init_at(&it, start_handle);
     while (att_iterator_has_next(&it)){
         att_iterator_fetch_next(&it);
         if (!it.handle) break;
@@ -440,43 +810,26 @@ static uint16_t handle_find_by_type_value_request2(att_connection_t * att_connec
         return setup_error_invalid_handle(response_buffer, request_type, start_handle);
     }
 
-    uint16_t offset      = 1;
-    uint16_t in_group    = 0;
-    uint16_t prev_handle = 0;
-    
+    uint16_t offset = 1;
+    uint8_t  attribute_type_uuid[2];
+    little_endian_store_16(attribute_type_uuid, 0, attribute_type);
+
     att_iterator_t it;
-    att_iterator_init(&it);
-    while (att_iterator_has_next(&it)){
-        att_iterator_fetch_next(&it);
-        
-        if (it.handle && it.handle < start_handle) continue;
-        if (it.handle > end_handle) break;  // (1)
-        
-        // close current tag, if within a group and a new service definition starts or we reach end of att db
-        if (in_group &&
-            (it.handle == 0 || att_iterator_match_uuid16(&it, GATT_PRIMARY_SERVICE_UUID) || att_iterator_match_uuid16(&it, GATT_SECONDARY_SERVICE_UUID))){
-            
-            log_info("End of group, handle 0x%04x", prev_handle);
-            little_endian_store_16(response_buffer, offset, prev_handle);
-            offset += 2;
-            in_group = 0;
-            
-            // check if space for another handle pair available
-            if (offset + 4 > response_buffer_size){
-                break;
-            }
-        }
-        
-        // keep track of previous handle
-        prev_handle = it.handle;
-        
-        // does current attribute match
-        if (it.handle && att_iterator_match_uuid16(&it, attribute_type) && attribute_len == it.value_len && memcmp(attribute_value, it.value, it.value_len) == 0){
-            log_info("Begin of group, handle 0x%04x", it.handle);
-            little_endian_store_16(response_buffer, offset, it.handle);
-            offset += 2;
-            in_group = 1;
-        }
+    att_iterator_init_uuid(&it, start_handle, attribute_type_uuid, 2);
+    while (att_iterator_fetch_next_uuid(&it, end_handle, attribute_type_uuid, 2)){  // (1)
+
+        // does current attribute value match
+        if (attribute_len != it.value_len || memcmp(attribute_value, it.value, it.value_len) != 0) continue;
+
+        // check if space for another handle pair available
+        if (offset + 4 > response_buffer_size) break;
+
+        uint16_t group_end_handle = att_iterator_group_end_handle(&it);
+        log_info("Group 0x%04x - 0x%04x", it.handle, group_end_handle);
+        little_endian_store_16(response_buffer, offset, it.handle);
+        offset += 2;
+        little_endian_store_16(response_buffer, offset, group_end_handle);
+        offset += 2;
     }
     
     if (offset == 1){
@@ -513,19 +866,11 @@ static uint16_t handle_read_by_type_request2(att_connection_t * att_connection,
     uint16_t pair_len = 0;
 
     att_iterator_t it;
-    att_iterator_init(&it);
+    att_iterator_init_uuid(&it, start_handle, attribute_type, attribute_type_len);
     uint8_t error_code = 0;
     uint16_t first_matching_but_unreadable_handle = 0;
 
-    while (att_iterator_has_next(&it)){
-        att_iterator_fetch_next(&it);
-        
-        if (!it.handle) break;
-        if (it.handle < start_handle) continue;
-        if (it.handle > end_handle) break;  // (1)
-
-        // does current attribute match
-        if (!att_iterator_match_uuid(&it, attribute_type, attribute_type_len)) continue;
+    while (att_iterator_fetch_next_uuid(&it, end_handle, attribute_type, attribute_type_len)){  // (1)
         
         // skip handles that cannot be read but rembember that there has been at least one
         if ((it.flags & ATT_PROPERTY_READ) == 0) {
@@ -706,10 +1051,13 @@ static uint16_t handle_read_blob_request(att_connection_t * att_connection, uint
 
 //
 // MARK: ATT_READ_MULTIPLE_REQUEST 0x0e
+// MARK: ATT_READ_MULTIPLE_VARIABLE_REQUEST 0x20
 //
-static uint16_t handle_read_multiple_request2(att_connection_t * att_connection, uint8_t * response_buffer, uint16_t response_buffer_size, uint16_t num_handles, uint8_t * handles){
-    log_info("ATT_READ_MULTIPLE_REQUEST: num handles %u", num_handles);
-    uint8_t request_type = ATT_READ_MULTIPLE_REQUEST;
+// store_length: prefix each value with its 16-bit length (Read Multiple Variable)
+static uint16_t handle_read_multiple_request2(att_connection_t * att_connection, uint8_t * response_buffer, uint16_t response_buffer_size, uint16_t num_handles, uint8_t * handles, int store_length){
+    log_info("ATT_READ_MULTIPLE_%sREQUEST: num handles %u", store_length ? "VARIABLE_" : "", num_handles);
+    uint8_t request_type  = store_length ? ATT_READ_MULTIPLE_VARIABLE_REQUEST  : ATT_READ_MULTIPLE_REQUEST;
+    uint8_t response_type = store_length ? ATT_READ_MULTIPLE_VARIABLE_RESPONSE : ATT_READ_MULTIPLE_RESPONSE;
     
     // TODO: figure out which error to respond with
     // if (num_handles < 2){
@@ -747,10 +1095,23 @@ static uint16_t handle_read_multiple_request2(att_connection_t * att_connection,
             if (error_code) break;
         }
         att_update_value_len(&it, att_connection->con_handle);
+
+        // response full, only validate remaining handles
+        if (offset == response_buffer_size) continue;
+
+        // length of each value, response gets truncated if it exceeds the buffer
+        if (store_length){
+            if (offset + 2 > response_buffer_size){
+                offset = response_buffer_size;
+                continue;
+            }
+            little_endian_store_16(response_buffer, offset, it.value_len);
+            offset += 2;
+        }
         
         // limit data
         if (offset + it.value_len > response_buffer_size) {
-            it.value_len = response_buffer_size - 1;
+            it.value_len = response_buffer_size - offset;
         }
         
         // store
@@ -762,13 +1123,13 @@ static uint16_t handle_read_multiple_request2(att_connection_t * att_connection,
         return setup_error(response_buffer, request_type, handle, error_code);
     }
     
-    response_buffer[0] = ATT_READ_MULTIPLE_RESPONSE;
+    response_buffer[0] = response_type;
     return offset;
 }
 static uint16_t handle_read_multiple_request(att_connection_t * att_connection, uint8_t * request_buffer,  uint16_t request_len,
                                       uint8_t * response_buffer, uint16_t response_buffer_size){
     int num_handles = (request_len - 1) >> 1;
-    return handle_read_multiple_request2(att_connection, response_buffer, response_buffer_size, num_handles, &request_buffer[1]);
+    return handle_read_multiple_request2(att_connection, response_buffer, response_buffer_size, num_handles, &request_buffer[1], request_buffer[0] == ATT_READ_MULTIPLE_VARIABLE_REQUEST);
 }
 
 //
@@ -809,68 +1170,37 @@ static uint16_t handle_read_by_group_type_request2(att_connection_t * att_connec
 
     uint16_t offset   = 1;
     uint16_t pair_len = 0;
-    uint16_t in_group = 0;
-    uint16_t group_start_handle = 0;
-    uint8_t const * group_start_value = NULL;
-    uint16_t prev_handle = 0;
 
     att_iterator_t it;
-    att_iterator_init(&it);
-    while (att_iterator_has_next(&it)){
-        att_iterator_fetch_next(&it);
-        
-        if (it.handle && it.handle < start_handle) continue;
-        if (it.handle > end_handle) break;  // (1)
+    att_iterator_init_uuid(&it, start_handle, attribute_type, attribute_type_len);
+    while (att_iterator_fetch_next_uuid(&it, end_handle, attribute_type, attribute_type_len)){  // (1)
 
-        // log_info("Handle 0x%04x", it.handle);
-        
-        // close current tag, if within a group and a new service definition starts or we reach end of att db
-        if (in_group &&
-            (it.handle == 0 || att_iterator_match_uuid16(&it, GATT_PRIMARY_SERVICE_UUID) || att_iterator_match_uuid16(&it, GATT_SECONDARY_SERVICE_UUID))){
-            // log_info("End of group, handle 0x%04x, val_len: %u", prev_handle, pair_len - 4);
-            
-            little_endian_store_16(response_buffer, offset, group_start_handle);
-            offset += 2;
-            little_endian_store_16(response_buffer, offset, prev_handle);
-            offset += 2;
-            memcpy(response_buffer + offset, group_start_value, pair_len - 4);
-            offset += pair_len - 4;
-            in_group = 0;
-            
-            // check if space for another handle pair available
-            if (offset + pair_len > response_buffer_size){
+        // check if value has same len as last one
+        uint16_t this_pair_len = 4 + it.value_len;
+        if (offset > 1){
+            if (this_pair_len != pair_len) {
                 break;
             }
         }
-        
-        // keep track of previous handle
-        prev_handle = it.handle;
-        
-        // does current attribute match
-        // log_info("compare: %04x == %04x", *(uint16_t*) context->attribute_type, *(uint16_t*) uuid);
-        if (it.handle && att_iterator_match_uuid(&it, attribute_type, attribute_type_len)) {
-            
-            // check if value has same len as last one
-            uint16_t this_pair_len = 4 + it.value_len;
-            if (offset > 1){
-                if (this_pair_len != pair_len) {
-                    break;
-                }
-            }
-            
-            // log_info("Begin of group, handle 0x%04x", it.handle);
-            
-            // first
-            if (offset == 1) {
-                pair_len = this_pair_len;
-                response_buffer[offset] = this_pair_len;
-                offset++;
-            }
-            
-            group_start_handle = it.handle;
-            group_start_value  = it.value;
-            in_group = 1;
+
+        // first
+        if (offset == 1) {
+            pair_len = this_pair_len;
+            response_buffer[offset] = this_pair_len;
+            offset++;
         }
+
+        // space?
+        if (offset + pair_len > response_buffer_size) break;
+
+        uint16_t group_end_handle = att_iterator_group_end_handle(&it);
+        // log_info("Group 0x%04x - 0x%04x, val_len: %u", it.handle, group_end_handle, it.value_len);
+        little_endian_store_16(response_buffer, offset, it.handle);
+        offset += 2;
+        little_endian_store_16(response_buffer, offset, group_end_handle);
+        offset += 2;
+        memcpy(response_buffer + offset, it.value, it.value_len);
+        offset += it.value_len;
     }        
     
     if (offset == 1){
@@ -1066,6 +1396,30 @@ static void handle_write_command(att_connection_t * att_connection, uint8_t * re
     (*callback)(att_connection->con_handle, handle, ATT_TRANSACTION_MODE_NONE, 0, request_buffer + 3, request_len - 3);
 }
 
+#ifdef ENABLE_LE_SIGNED_WRITE
+// MARK: ATT_SIGNED_WRITE_COMMAND 0xD2
+// Core 4.0, vol 3, part F, 3.4.5.4
+// pre: signature { sign counter, MAC } at the end of the command has been validated
+static void handle_signed_write_command(att_connection_t * att_connection, uint8_t * request_buffer,  uint16_t request_len,
+                                           uint8_t * response_buffer, uint16_t response_buffer_size){
+
+    UNUSED(response_buffer);
+    UNUSED(response_buffer_size);
+
+    if (request_len < (3 + 12)) return;
+    uint16_t handle = little_endian_read_16(request_buffer, 1);
+    att_write_callback_t callback = att_write_callback_for_handle(handle);
+    if (!callback) return;
+
+    att_iterator_t it;
+    int ok = att_find_handle(&it, handle);
+    if (!ok) return;
+    if ((it.flags & ATT_PROPERTY_DYNAMIC) == 0) return;
+    if ((it.flags & ATT_PROPERTY_AUTHENTICATED_SIGNED_WRITE) == 0) return;
+    (*callback)(att_connection->con_handle, handle, ATT_TRANSACTION_MODE_NONE, 0, request_buffer + 3, request_len - 3 - 12);
+}
+#endif
+
 // MARK: helper for ATT_HANDLE_VALUE_NOTIFICATION and ATT_HANDLE_VALUE_INDICATION
 static uint16_t prepare_handle_value(att_connection_t * att_connection,
                                      uint16_t handle,
@@ -1091,6 +1445,29 @@ uint16_t att_prepare_handle_value_notification(att_connection_t * att_connection
     return prepare_handle_value(att_connection, handle, value, value_len, response_buffer);
 }
 
+// MARK: ATT_MULTIPLE_HANDLE_VALUE_NOTIFICATION 0x23
+uint16_t att_prepare_multiple_handle_value_notification(att_connection_t * att_connection,
+                                                        uint16_t num_attributes,
+                                                        const uint16_t * attribute_handles,
+                                                        uint8_t ** values,
+                                                        const uint16_t * value_lens,
+                                                        uint8_t * response_buffer){
+
+    if (num_attributes < 2) return 0;
+    response_buffer[0] = ATT_MULTIPLE_HANDLE_VALUE_NOTIFICATION;
+    uint16_t offset = 1;
+    int i;
+    for (i=0;i<num_attributes;i++){
+        // handle, length, value
+        if (offset + 4 + value_lens[i] > att_connection->mtu) return 0;
+        little_endian_store_16(response_buffer, offset, attribute_handles[i]);
+        little_endian_store_16(response_buffer, offset + 2, value_lens[i]);
+        memcpy(&response_buffer[offset + 4], values[i], value_lens[i]);
+        offset += 4 + value_lens[i];
+    }
+    return offset;
+}
+
 // MARK: ATT_HANDLE_VALUE_INDICATION 0x1d
 uint16_t att_prepare_handle_value_indication(att_connection_t * att_connection,
                                              uint16_t handle,
@@ -1130,6 +1507,7 @@ uint16_t att_handle_request(att_connection_t * att_connection,
             response_len = handle_read_blob_request(att_connection, request_buffer, request_len, response_buffer, response_buffer_size);
             break;
         case ATT_READ_MULTIPLE_REQUEST:  
+        case ATT_READ_MULTIPLE_VARIABLE_REQUEST:
             response_len = handle_read_multiple_request(att_connection, request_buffer, request_len, response_buffer, response_buffer_size);
             break;
         case ATT_READ_BY_GROUP_TYPE_REQUEST:  
@@ -1149,7 +1527,8 @@ uint16_t att_handle_request(att_connection_t * att_connection,
             break;
 #ifdef ENABLE_LE_SIGNED_WRITE
         case ATT_SIGNED_WRITE_COMMAND:
-            log_info("handle_signed_write_command preprocessed by att_server.c");
+            // signature validated by att_server.c
+            handle_signed_write_command(att_connection, request_buffer, request_len, response_buffer, response_buffer_size);
             break;
 #endif
         default:
@@ -1210,7 +1589,7 @@ int gatt_server_get_get_handle_range_for_service_with_uuid16(uint16_t uuid16, ui
 // returns 0 if not found
 uint16_t gatt_server_get_value_handle_for_characteristic_with_uuid16(uint16_t start_handle, uint16_t end_handle, uint16_t uuid16){
     att_iterator_t it;
-    att_iterator_init(&it);
+    att_iterator_init_at(&it, start_handle);
     while (att_iterator_has_next(&it)){
         att_iterator_fetch_next(&it);
         if (it.handle && it.handle < start_handle) continue;
@@ -1224,7 +1603,7 @@ uint16_t gatt_server_get_value_handle_for_characteristic_with_uuid16(uint16_t st
 // returns 0 if not found
 uint16_t gatt_server_get_client_configuration_handle_for_characteristic_with_uuid16(uint16_t start_handle, uint16_t end_handle, uint16_t uuid16){
     att_iterator_t it;
-    att_iterator_init(&it);
+    att_iterator_init_at(&it, start_handle);
     int characteristic_found = 0;
     while (att_iterator_has_next(&it)){
         att_iterator_fetch_next(&it);
@@ -108,6 +108,32 @@ typedef struct att_service_handler {
  */
 void att_set_db(uint8_t const * db);
 
+/*
+ * @brief notify ATT DB that attributes of the database set with att_set_db have been replaced
+ * @note lookup indexes are updated incrementally if possible, otherwise they are rebuilt
+ * @param old_db address of database before the change, changes to other databases are ignored
+ * @param new_db address of database after the change, e.g. after realloc
+ * @param offset in database where attributes have been replaced
+ * @param removed_size of attributes removed at offset
+ * @param inserted_size of attributes inserted at offset
+ */
+void att_update_db(uint8_t const * old_db, uint8_t const * new_db, uint16_t offset, uint16_t removed_size, uint16_t inserted_size);
+
+/*
+ * @brief notify ATT DB that services in a handle range of the database set with att_set_db were removed, replaced or renumbered
+ * @note reported to the callback set with att_set_service_changed_callback
+ * @param db address of modified database, changes to other databases are ignored
+ * @param start_handle of affected range
+ * @param end_handle of affected range
+ */
+void att_service_changed(uint8_t const * db, uint16_t start_handle, uint16_t end_handle);
+
+/*
+ * @brief set callback for changes reported with att_service_changed, used by ATT Server to indicate Service Changed
+ * @param callback
+ */
+void att_set_service_changed_callback(void (*callback)(uint16_t start_handle, uint16_t end_handle));
+
 /*
  * @brief set callback for read of dynamic attributes
  * @param callback
@@ -151,6 +177,23 @@ uint16_t att_prepare_handle_value_notification(att_connection_t * att_connection
                                                uint16_t value_len, 
                                                uint8_t * response_buffer);
 
+/*
+ * @brief setup multiple handle value notification in response buffer for a list of handles and values
+ * @param att_connection
+ * @param num_attributes, at least 2
+ * @param attribute_handles
+ * @param values
+ * @param value_lens
+ * @param response_buffer for notification
+ * @returns len of notification, 0 if less than two attributes or if values don't fit into MTU
+ */
+uint16_t att_prepare_multiple_handle_value_notification(att_connection_t * att_connection,
+                                                        uint16_t num_attributes,
+                                                        const uint16_t * attribute_handles,
+                                                        uint8_t ** values,
+                                                        const uint16_t * value_lens,
+                                                        uint8_t * response_buffer);
+
 /*
  * @brief setup value indication in response buffer for a given handle and value
  * @param att_connection
@@ -61,6 +61,15 @@ static uint16_t  att_db_size;
 static uint16_t  att_db_max_size;
 static uint16_t  att_db_next_handle;
 
+// new attributes are inserted at att_db_insert_offset, which is the end of the db unless a service is replaced
+static uint16_t  att_db_insert_offset;
+static uint8_t   att_db_replacing;
+static uint16_t  att_db_replace_max_handle;
+static uint16_t  att_db_replace_next_handle;
+// handle range of replaced service
+static uint16_t  att_db_replace_start_handle;
+static uint16_t  att_db_replace_end_handle;
+
 static void att_db_util_set_end_tag(void){
 	// end tag
 	att_db[att_db_size] = 0;
@@ -77,6 +86,8 @@ void att_db_util_init(void){
 #endif
 	att_db_size = 0;
 	att_db_next_handle = 1;
+	att_db_insert_offset = 0;
+	att_db_replacing = 0;
 	att_db_util_set_end_tag();
 }
 
@@ -89,6 +100,9 @@ static int att_db_util_assert_space(uint16_t size){
 	if (att_db_size + size <= att_db_max_size) return 1;
 #ifdef HAVE_MALLOC
 	int new_size = att_db_size + att_db_size / 2;
+	if (new_size < att_db_size + size){
+		new_size = att_db_size + size;
+	}
 	uint8_t * new_db = (uint8_t*) realloc(att_db, new_size);
 	if (!new_db) {
 		log_error("att_db: realloc failed");
@@ -107,51 +121,76 @@ static int att_db_util_assert_space(uint16_t size){
 
 // db endds with 0x00 0x00
 
+// reserve space for attribute at insert offset, returns NULL if not possible
+static uint8_t * att_db_util_reserve_attribute(uint16_t size){
+	if (att_db_replacing && att_db_next_handle > att_db_replace_max_handle){
+		log_error("att_db: no free handle for replaced service");
+		return NULL;
+	}
+	if (!att_db_util_assert_space(size)) return NULL;
+	// move following attributes and end tag
+	memmove(&att_db[att_db_insert_offset + size], &att_db[att_db_insert_offset], att_db_size + 2 - att_db_insert_offset);
+	return &att_db[att_db_insert_offset];
+}
+
+// checks that handles for a new characteristic are available
+static int att_db_util_assert_handles(uint16_t num_handles){
+	if (!att_db_replacing) return 1;
+	if (att_db_next_handle + num_handles - 1 <= att_db_replace_max_handle) return 1;
+	log_error("att_db: no free handle for replaced service");
+	return 0;
+}
+
+// update state and ATT DB indexes after attribute was stored at insert offset
+static void att_db_util_commit_attribute(uint8_t * old_db, uint16_t size){
+	uint16_t offset = att_db_insert_offset;
+	att_db_size += size;
+	att_db_insert_offset += size;
+	att_db_next_handle++;
+	att_update_db(old_db, att_db, offset, 0, size);
+}
+
 static void att_db_util_add_attribute_uuid16(uint16_t uuid16, uint16_t flags, uint8_t * data, uint16_t data_len){
 	int size = 2 + 2 + 2 + 2 + data_len;
-	if (!att_db_util_assert_space(size)) return;
-	little_endian_store_16(att_db, att_db_size, size);
-	att_db_size += 2;
-	little_endian_store_16(att_db, att_db_size, flags);
-	att_db_size += 2;
-	little_endian_store_16(att_db, att_db_size, att_db_next_handle);
-	att_db_size += 2;
-	att_db_next_handle++;
-	little_endian_store_16(att_db, att_db_size, uuid16);
-	att_db_size += 2;
-	memcpy(&att_db[att_db_size], data, data_len);
-	att_db_size += data_len;
-	att_db_util_set_end_tag();
+	uint8_t * old_db = att_db;
+	uint8_t * attribute = att_db_util_reserve_attribute(size);
+	if (!attribute) return;
+	little_endian_store_16(attribute, 0, size);
+	little_endian_store_16(attribute, 2, flags);
+	little_endian_store_16(attribute, 4, att_db_next_handle);
+	little_endian_store_16(attribute, 6, uuid16);
+	memcpy(&attribute[8], data, data_len);
+	att_db_util_commit_attribute(old_db, size);
 }
 
 static void att_db_util_add_attribute_uuid128(uint8_t * uuid128, uint16_t flags, uint8_t * data, uint16_t data_len){
 	int size = 2 + 2 + 2 + 16 + data_len;
-	if (!att_db_util_assert_space(size)) return;
+	uint8_t * old_db = att_db;
+	uint8_t * attribute = att_db_util_reserve_attribute(size);
+	if (!attribute) return;
 	flags |= ATT_PROPERTY_UUID128;
-	little_endian_store_16(att_db, att_db_size, size);
-	att_db_size += 2;
-	little_endian_store_16(att_db, att_db_size, flags);
-	att_db_size += 2;
-	little_endian_store_16(att_db, att_db_size, att_db_next_handle);
-	att_db_size += 2;
-	att_db_next_handle++;
-	reverse_128(uuid128, &att_db[att_db_size]);
-	att_db_size += 16;
-	memcpy(&att_db[att_db_size], data, data_len);
-	att_db_size += data_len;
-	att_db_util_set_end_tag();
+	little_endian_store_16(attribute, 0, size);
+	little_endian_store_16(attribute, 2, flags);
+	little_endian_store_16(attribute, 4, att_db_next_handle);
+	reverse_128(uuid128, &attribute[6]);
+	memcpy(&attribute[22], data, data_len);
+	att_db_util_commit_attribute(old_db, size);
 }
 
-void att_db_util_add_service_uuid16(uint16_t uuid16){
+uint16_t att_db_util_add_service_uuid16(uint16_t uuid16){
 	uint8_t buffer[2];
+	uint16_t service_handle = att_db_next_handle;
 	little_endian_store_16(buffer, 0, uuid16);
 	att_db_util_add_attribute_uuid16(GATT_PRIMARY_SERVICE_UUID, ATT_PROPERTY_READ, buffer, 2);
+	return service_handle;
 }
 
-void att_db_util_add_service_uuid128(uint8_t * uuid128){
+uint16_t att_db_util_add_service_uuid128(uint8_t * uuid128){
 	uint8_t buffer[16];
+	uint16_t service_handle = att_db_next_handle;
 	reverse_128(uuid128, buffer);
 	att_db_util_add_attribute_uuid16(GATT_PRIMARY_SERVICE_UUID, ATT_PROPERTY_READ, buffer, 16);
+	return service_handle;
 }
 
 static void att_db_util_add_client_characteristic_configuration(uint16_t properties){
@@ -164,6 +203,7 @@ static void att_db_util_add_client_characteristic_configuration(uint16_t propert
 
 uint16_t att_db_util_add_characteristic_uuid16(uint16_t uuid16, uint16_t properties, uint8_t * data, uint16_t data_len){
 	uint8_t buffer[5];
+	if (!att_db_util_assert_handles((properties & (ATT_PROPERTY_NOTIFY | ATT_PROPERTY_INDICATE)) ? 3 : 2)) return 0;
 	buffer[0] = properties;
 	little_endian_store_16(buffer, 1, att_db_next_handle + 1);
 	little_endian_store_16(buffer, 3, uuid16);
@@ -180,6 +220,7 @@ uint16_t att_db_util_add_characteristic_uuid16(uint16_t uuid16, uint16_t propert
 
 uint16_t att_db_util_add_characteristic_uuid128(uint8_t * uuid128, uint16_t properties, uint8_t * data, uint16_t data_len){
 	uint8_t buffer[19];
+	if (!att_db_util_assert_handles((properties & (ATT_PROPERTY_NOTIFY | ATT_PROPERTY_INDICATE)) ? 3 : 2)) return 0;
 	buffer[0] = properties;
 	little_endian_store_16(buffer, 1, att_db_next_handle + 1);
 	reverse_128(uuid128, &buffer[3]);
@@ -194,6 +235,163 @@ uint16_t att_db_util_add_characteristic_uuid128(uint8_t * uuid128, uint16_t prop
 	return value_handle;
 }
 
+static uint16_t att_db_util_attribute_size(uint16_t offset){
+	return little_endian_read_16(att_db, offset);
+}
+
+static uint16_t att_db_util_attribute_handle(uint16_t offset){
+	return little_endian_read_16(att_db, offset + 4);
+}
+
+// returns 16-bit attribute type, or 0 for 128-bit UUIDs
+static uint16_t att_db_util_attribute_uuid16(uint16_t offset){
+	if (little_endian_read_16(att_db, offset + 2) & ATT_PROPERTY_UUID128) return 0;
+	return little_endian_read_16(att_db, offset + 6);
+}
+
+static int att_db_util_is_service_declaration(uint16_t offset){
+	uint16_t uuid16 = att_db_util_attribute_uuid16(offset);
+	return uuid16 == GATT_PRIMARY_SERVICE_UUID || uuid16 == GATT_SECONDARY_SERVICE_UUID;
+}
+
+// returns offset of attribute with given handle, or att_db_size if not found
+static uint16_t att_db_util_offset_for_handle(uint16_t handle){
+	uint16_t offset = 0;
+	while (offset < att_db_size){
+		if (att_db_util_attribute_handle(offset) == handle) break;
+		offset += att_db_util_attribute_size(offset);
+	}
+	return offset;
+}
+
+// remove service starting at offset, returns end handle of service
+static uint16_t att_db_util_remove_service_at_offset(uint16_t offset){
+	uint16_t end_handle = att_db_util_attribute_handle(offset);
+	uint16_t end_offset = offset + att_db_util_attribute_size(offset);
+	while (end_offset < att_db_size && !att_db_util_is_service_declaration(end_offset)){
+		end_handle = att_db_util_attribute_handle(end_offset);
+		end_offset += att_db_util_attribute_size(end_offset);
+	}
+	uint16_t size = end_offset - offset;
+	// move following attributes and end tag
+	memmove(&att_db[offset], &att_db[end_offset], att_db_size + 2 - end_offset);
+	att_db_size -= size;
+	if (att_db_insert_offset > offset){
+		att_db_insert_offset -= size;
+	}
+	att_update_db(att_db, att_db, offset, size, 0);
+	return end_handle;
+}
+
+// returns offset of service declaration with given handle, or att_db_size if not found
+static uint16_t att_db_util_offset_for_service(uint16_t service_handle){
+	uint16_t offset = att_db_util_offset_for_handle(service_handle);
+	if (offset == att_db_size || !att_db_util_is_service_declaration(offset)){
+		log_error("att_db: no service with handle 0x%04x", service_handle);
+		return att_db_size;
+	}
+	return offset;
+}
+
+uint16_t att_db_util_remove_service(uint16_t service_handle){
+	if (att_db_replacing){
+		log_error("att_db: service replacement in progress");
+		return 0;
+	}
+	uint16_t offset = att_db_util_offset_for_service(service_handle);
+	if (offset == att_db_size) return 0;
+	uint16_t end_handle = att_db_util_remove_service_at_offset(offset);
+	att_service_changed(att_db, service_handle, end_handle);
+	return end_handle;
+}
+
+uint16_t att_db_util_replace_service_begin(uint16_t service_handle){
+	if (att_db_replacing){
+		log_error("att_db: service replacement in progress");
+		return 0;
+	}
+	uint16_t offset = att_db_util_offset_for_service(service_handle);
+	if (offset == att_db_size) return 0;
+	uint16_t end_handle = att_db_util_remove_service_at_offset(offset);
+	// new definition may use all free handles up to the next service
+	att_db_replacing = 1;
+	att_db_insert_offset = offset;
+	att_db_replace_next_handle = att_db_next_handle;
+	att_db_replace_max_handle = offset < att_db_size ? att_db_util_attribute_handle(offset) - 1 : 0xffff;
+	att_db_replace_start_handle = service_handle;
+	att_db_replace_end_handle = end_handle;
+	att_db_next_handle = service_handle;
+	return end_handle;
+}
+
+uint16_t att_db_util_replace_service_end(void){
+	if (!att_db_replacing) return 0;
+	uint16_t last_handle = att_db_next_handle - 1;
+	if (att_db_next_handle > att_db_replace_next_handle){
+		att_db_replace_next_handle = att_db_next_handle;
+	}
+	att_db_next_handle = att_db_replace_next_handle;
+	att_db_insert_offset = att_db_size;
+	att_db_replacing = 0;
+	// report old and new definition
+	uint16_t end_handle = last_handle > att_db_replace_end_handle ? last_handle : att_db_replace_end_handle;
+	att_service_changed(att_db, att_db_replace_start_handle, end_handle);
+	return last_handle;
+}
+
+// handles are consecutive after compaction, so the new handle is the position of the old one
+static uint16_t att_db_util_compacted_handle(uint16_t handle){
+	uint16_t new_handle = 1;
+	uint16_t offset = 0;
+	while (offset < att_db_size && att_db_util_attribute_handle(offset) < handle){
+		new_handle++;
+		offset += att_db_util_attribute_size(offset);
+	}
+	return new_handle;
+}
+
+uint16_t att_db_util_compact_handles(void){
+	if (att_db_replacing){
+		log_error("att_db: service replacement in progress");
+		return 0;
+	}
+	// update handle references in characteristic and include declarations first
+	uint16_t offset = 0;
+	while (offset < att_db_size){
+		switch (att_db_util_attribute_uuid16(offset)){
+			case GATT_CHARACTERISTICS_UUID:
+				little_endian_store_16(att_db, offset + 9, att_db_util_compacted_handle(little_endian_read_16(att_db, offset + 9)));
+				break;
+			case GATT_INCLUDE_SERVICE_UUID:
+				little_endian_store_16(att_db, offset + 8,  att_db_util_compacted_handle(little_endian_read_16(att_db, offset + 8)));
+				little_endian_store_16(att_db, offset + 10, att_db_util_compacted_handle(little_endian_read_16(att_db, offset + 10)));
+				break;
+			default:
+				break;
+		}
+		offset += att_db_util_attribute_size(offset);
+	}
+	// renumber attributes. offsets and order are unchanged, so ATT DB indexes stay valid
+	uint16_t first_changed_handle = 0;
+	uint16_t handle = 1;
+	offset = 0;
+	while (offset < att_db_size){
+		if (att_db_util_attribute_handle(offset) != handle){
+			if (first_changed_handle == 0){
+				first_changed_handle = handle;
+			}
+			little_endian_store_16(att_db, offset + 4, handle);
+		}
+		handle++;
+		offset += att_db_util_attribute_size(offset);
+	}
+	att_db_next_handle = handle;
+	if (first_changed_handle){
+		att_service_changed(att_db, first_changed_handle, 0xffff);
+	}
+	return first_changed_handle;
+}
+
 uint8_t * att_db_util_get_address(void){
 	return att_db;
 }
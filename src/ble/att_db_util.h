@@ -64,13 +64,15 @@ void att_db_util_init(void);
 
 /**
  * @brief Add primary service for 16-bit UUID
+ * @returns service handle
  */
-void att_db_util_add_service_uuid16(uint16_t udid16);
+uint16_t att_db_util_add_service_uuid16(uint16_t udid16);
 
 /**
  * @brief Add primary service for 128-bit UUID
+ * @returns service handle
  */
-void att_db_util_add_service_uuid128(uint8_t * udid128);
+uint16_t att_db_util_add_service_uuid128(uint8_t * udid128);
 
 /**
  * @brief Add Characteristic with 16-bit UUID, properties, and data
@@ -86,6 +88,37 @@ uint16_t att_db_util_add_characteristic_uuid16(uint16_t   udid16,  uint16_t prop
  */
 uint16_t att_db_util_add_characteristic_uuid128(uint8_t * udid128, uint16_t properties, uint8_t * data, uint16_t data_len);
 
+/**
+ * @brief Remove service with all its attributes. Its handles stay unused until att_db_util_compact_handles is called
+ * @note If the ATT DB is in use by the ATT Server, it indicates Service Changed to connected clients that enabled it
+ * @param service_handle
+ * @returns end handle of removed service, 0 if not found
+ */
+uint16_t att_db_util_remove_service(uint16_t service_handle);
+
+/**
+ * @brief Start replacing a service: the service is removed and following att_db_util_add_* calls add the new
+ *        definition at the same handles until att_db_util_replace_service_end is called. The new definition can use
+ *        all handles up to the next service
+ * @param service_handle
+ * @returns end handle of the removed service, 0 if not found
+ */
+uint16_t att_db_util_replace_service_begin(uint16_t service_handle);
+
+/**
+ * @brief Complete service replacement. The ATT Server indicates Service Changed for the old and new handle range
+ * @returns last handle used by the new definition
+ */
+uint16_t att_db_util_replace_service_end(void);
+
+/**
+ * @brief Renumber all attributes with consecutive handles starting at 1, e.g. after services have been removed.
+ *        References in characteristic and include declarations are updated. The ATT Server indicates Service Changed
+ *        from the first changed handle on
+ * @returns first handle that changed, 0 if none. All handles from there on might be different
+ */
+uint16_t att_db_util_compact_handles(void);
+
 /** 
  * @brief Get address of constructed ATT DB
  */
@@ -65,14 +65,26 @@
 #include "hci_dump.h"
 #include "l2cap.h"
 
+// max number of ACL packets in the Controller per connection
+// 0 = Controller buffers minus one buffer reserved for each other LE connection
+#ifndef ATT_SERVER_MAX_OUTGOING_PACKETS_PER_CONNECTION
+#define ATT_SERVER_MAX_OUTGOING_PACKETS_PER_CONNECTION 0
+#endif
+
 static void att_run_for_context(att_server_t * att_server);
+#ifdef ENABLE_LE_SIGNED_WRITE
+static void att_server_process_commands(att_server_t * att_server);
+#endif
 
 // global
 static btstack_packet_callback_registration_t hci_event_callback_registration;
 static btstack_packet_callback_registration_t sm_event_callback_registration;
 static btstack_packet_handler_t               att_client_packet_handler = NULL;
-static btstack_linked_list_t                  can_send_now_clients;
 static uint8_t                                att_client_waiting_for_can_send;
+static hci_con_handle_t                       att_client_waiting_for_can_send_con_handle;
+static hci_con_handle_t                       att_server_last_served_con_handle = HCI_CON_HANDLE_INVALID;
+static uint8_t                                att_server_serving_can_send_now;
+static uint8_t                                att_server_waiting_for_completed_packets;
 
 static att_server_t * att_server_for_handle(hci_con_handle_t con_handle){
     hci_connection_t * hci_connection = hci_connection_for_handle(con_handle);
@@ -81,13 +93,13 @@ static att_server_t * att_server_for_handle(hci_con_handle_t con_handle){
 }
 
 #ifdef ENABLE_LE_SIGNED_WRITE
-static att_server_t * att_server_for_state(att_server_state_t state){
+static att_server_t * att_server_for_signed_write_state(att_server_state_t state){
     btstack_linked_list_iterator_t it;
     hci_connections_get_iterator(&it);
     while(btstack_linked_list_iterator_has_next(&it)){
         hci_connection_t * connection = (hci_connection_t *) btstack_linked_list_iterator_next(&it);
         att_server_t * att_server = &connection->att_server;
-        if (att_server->state == state) return att_server;
+        if (att_server->signed_write_state == state) return att_server;
     }
     return NULL;
 }
@@ -170,6 +182,18 @@ static void att_event_packet_handler (uint8_t packet_type, uint16_t channel, uin
                             att_server->connection.authenticated = 0;
 		                	att_server->connection.authorized = 0;
                             att_server->ir_le_device_db_index = -1;
+                            att_server->dropped_pdus = 0;
+                            att_server->service_changed_indications = 0;
+                            att_server->service_changed_pending = 0;
+#ifdef ENABLE_LE_SIGNED_WRITE
+                            att_server->signed_write_state = ATT_SERVER_IDLE;
+                            att_server->command_queue_first = 0;
+                            att_server->command_queue_len = 0;
+#endif
+#ifdef ENABLE_ATT_SERVER_NOTIFICATION_QUEUE
+                            att_server->notification_queue_first = 0;
+                            att_server->notification_queue_len = 0;
+#endif
                             break;
 
                         default:
@@ -193,11 +217,28 @@ static void att_event_packet_handler (uint8_t packet_type, uint16_t channel, uin
                     att_server = att_server_for_handle(con_handle);
                     if (!att_server) break;
                     att_clear_transaction_queue(&att_server->connection);
+                    att_server->can_send_now_clients = NULL;
+#ifdef ENABLE_ATT_SERVER_NOTIFICATION_QUEUE
+                    att_server->notification_queue_len = 0;
+#endif
+#ifdef ENABLE_LE_SIGNED_WRITE
+                    att_server->signed_write_state = ATT_SERVER_IDLE;
+                    att_server->command_queue_len = 0;
+#endif
                     att_server->connection.con_handle = 0;
                     att_server->value_indication_handle = 0; // reset error state
+                    att_server->service_changed_indications = 0;
+                    att_server->service_changed_pending = 0;
                     att_server->state = ATT_SERVER_IDLE;
                     break;
                     
+                case HCI_EVENT_NUMBER_OF_COMPLETED_PACKETS:
+                    // connection that reached its packet limit might be able to send again
+                    if (!att_server_waiting_for_completed_packets) break;
+                    att_server_waiting_for_completed_packets = 0;
+                    att_dispatch_server_request_can_send_now_event(little_endian_read_16(packet, 3));
+                    break;
+
                 case SM_EVENT_IDENTITY_RESOLVING_STARTED:
                     con_handle = sm_event_identity_resolving_started_get_handle(packet);
                     att_server = att_server_for_handle(con_handle);
@@ -213,6 +254,9 @@ static void att_event_packet_handler (uint8_t packet_type, uint16_t channel, uin
                     att_server->ir_le_device_db_index = sm_event_identity_resolving_succeeded_get_index_internal(packet);
                     log_info("SM_EVENT_IDENTITY_RESOLVING_SUCCEEDED id %u", att_server->ir_le_device_db_index);
                     att_run_for_context(att_server);
+#ifdef ENABLE_LE_SIGNED_WRITE
+                    att_server_process_commands(att_server);
+#endif
                     break;
                 case SM_EVENT_IDENTITY_RESOLVING_FAILED:
                     con_handle = sm_event_identity_resolving_failed_get_handle(packet);
@@ -222,6 +266,9 @@ static void att_event_packet_handler (uint8_t packet_type, uint16_t channel, uin
                     att_server->ir_lookup_active = 0;
                     att_server->ir_le_device_db_index = -1;
                     att_run_for_context(att_server);
+#ifdef ENABLE_LE_SIGNED_WRITE
+                    att_server_process_commands(att_server);
+#endif
                     break;
                 case SM_EVENT_AUTHORIZATION_RESULT: {
                     con_handle = sm_event_authorization_result_get_handle(packet);
@@ -241,28 +288,140 @@ static void att_event_packet_handler (uint8_t packet_type, uint16_t channel, uin
 }
 
 #ifdef ENABLE_LE_SIGNED_WRITE
+static void att_server_command_queue_store(att_server_t * att_server, const uint8_t * data, uint16_t len){
+    uint16_t pos = (att_server->command_queue_first + att_server->command_queue_len) % ATT_SERVER_COMMAND_QUEUE_SIZE;
+    uint16_t i;
+    for (i=0;i<len;i++){
+        att_server->command_queue[pos] = data[i];
+        pos = (pos + 1) % ATT_SERVER_COMMAND_QUEUE_SIZE;
+    }
+    att_server->command_queue_len += len;
+}
+
+static void att_server_command_queue_fetch(att_server_t * att_server, uint8_t * data, uint16_t len){
+    uint16_t i;
+    for (i=0;i<len;i++){
+        data[i] = att_server->command_queue[att_server->command_queue_first];
+        att_server->command_queue_first = (att_server->command_queue_first + 1) % ATT_SERVER_COMMAND_QUEUE_SIZE;
+    }
+    att_server->command_queue_len -= len;
+}
+
+// queue command received during Signed Write validation
+static void att_server_command_queue_add(att_server_t * att_server, const uint8_t * packet, uint16_t size){
+    if (ATT_SERVER_COMMAND_QUEUE_SIZE - att_server->command_queue_len < size + 2){
+        log_info("att_server_command_queue_add: dropping att pdu 0x%02x, queue full", packet[0]);
+        att_server->dropped_pdus++;
+        return;
+    }
+    uint8_t size_buffer[2];
+    little_endian_store_16(size_buffer, 0, size);
+    att_server_command_queue_store(att_server, size_buffer, 2);
+    att_server_command_queue_store(att_server, packet, size);
+}
+
 static void att_signed_write_handle_cmac_result(uint8_t hash[8]){
     
-    att_server_t * att_server = att_server_for_state(ATT_SERVER_W4_SIGNED_WRITE_VALIDATION);
+    att_server_t * att_server = att_server_for_signed_write_state(ATT_SERVER_W4_SIGNED_WRITE_VALIDATION);
     if (!att_server) return;
 
+    att_server->signed_write_state = ATT_SERVER_IDLE;
+
     uint8_t hash_flipped[8];
     reverse_64(hash, hash_flipped);
-    if (memcmp(hash_flipped, &att_server->request_buffer[att_server->request_size-8], 8)){
+    if (memcmp(hash_flipped, &att_server->command_buffer[att_server->command_size-8], 8)){
         log_info("ATT Signed Write, invalid signature");
-        att_server->state = ATT_SERVER_IDLE;
+    } else {
+        log_info("ATT Signed Write, valid signature");
+
+        // update sequence number
+        uint32_t counter_packet = little_endian_read_32(att_server->command_buffer, att_server->command_size-12);
+        le_device_db_remote_counter_set(att_server->ir_le_device_db_index, counter_packet+1);
+
+        // no response
+        att_handle_request(&att_server->connection, att_server->command_buffer, att_server->command_size, NULL);
+    }
+
+    att_server_process_commands(att_server);
+}
+
+// validate Signed Write Command in command buffer. sets signed write state to idle if it is invalid
+static void att_server_validate_signed_write(att_server_t * att_server){
+    log_info("ATT Signed Write!");
+    if (!sm_cmac_ready()) {
+        log_info("ATT Signed Write, sm_cmac engine not ready. Abort");
+        att_server->signed_write_state = ATT_SERVER_IDLE;
+        att_server->dropped_pdus++;
+        return;
+    }  
+    if (att_server->command_size < (3 + 12)) {
+        log_info("ATT Signed Write, request to short. Abort.");
+        att_server->signed_write_state = ATT_SERVER_IDLE;
+        return;
+    }
+    if (att_server->ir_lookup_active){
+        return;
+    }
+    if (att_server->ir_le_device_db_index < 0){
+        log_info("ATT Signed Write, CSRK not available");
+        att_server->signed_write_state = ATT_SERVER_IDLE;
+        return;
+    }
+
+    // check counter
+    uint32_t counter_packet = little_endian_read_32(att_server->command_buffer, att_server->command_size-12);
+    uint32_t counter_db     = le_device_db_remote_counter_get(att_server->ir_le_device_db_index);
+    log_info("ATT Signed Write, DB counter %"PRIu32", packet counter %"PRIu32, counter_db, counter_packet);
+    if (counter_packet < counter_db){
+        log_info("ATT Signed Write, db reports higher counter, abort");
+        att_server->signed_write_state = ATT_SERVER_IDLE;
         return;
     }
-    log_info("ATT Signed Write, valid signature");
 
-    // update sequence number
-    uint32_t counter_packet = little_endian_read_32(att_server->request_buffer, att_server->request_size-12);
-    le_device_db_remote_counter_set(att_server->ir_le_device_db_index, counter_packet+1);
-    att_server->state = ATT_SERVER_REQUEST_RECEIVED_AND_VALIDATED;
-    att_dispatch_server_request_can_send_now_event(att_server->connection.con_handle);
+    // signature is { sequence counter, secure hash }
+    sm_key_t csrk;
+    le_device_db_remote_csrk_get(att_server->ir_le_device_db_index, csrk);
+    att_server->signed_write_state = ATT_SERVER_W4_SIGNED_WRITE_VALIDATION;
+    log_info("Orig Signature: ");
+    log_info_hexdump( &att_server->command_buffer[att_server->command_size-8], 8);
+    uint16_t attribute_handle = little_endian_read_16(att_server->command_buffer, 1);
+    sm_cmac_signed_write_start(csrk, att_server->command_buffer[0], attribute_handle, att_server->command_size - 15, &att_server->command_buffer[3], counter_packet, att_signed_write_handle_cmac_result);
+}
+
+// continue Signed Write validation and process queued commands in arrival order
+static void att_server_process_commands(att_server_t * att_server){
+    if (att_server->signed_write_state == ATT_SERVER_REQUEST_RECEIVED){
+        att_server_validate_signed_write(att_server);
+    }
+    while (att_server->signed_write_state == ATT_SERVER_IDLE && att_server->command_queue_len){
+        uint8_t size_buffer[2];
+        att_server_command_queue_fetch(att_server, size_buffer, 2);
+        att_server->command_size = little_endian_read_16(size_buffer, 0);
+        att_server_command_queue_fetch(att_server, att_server->command_buffer, att_server->command_size);
+        if (att_server->command_buffer[0] == ATT_SIGNED_WRITE_COMMAND){
+            att_server->signed_write_state = ATT_SERVER_REQUEST_RECEIVED;
+            att_server_validate_signed_write(att_server);
+        } else {
+            att_handle_request(&att_server->connection, att_server->command_buffer, att_server->command_size, NULL);
+        }
+    }
 }
 #endif
 
+// track Client Characteristic Configuration of Service Changed, written with Write Request
+static void att_server_track_service_changed_configuration(att_server_t * att_server){
+    if (att_server->request_buffer[0] != ATT_WRITE_REQUEST) return;
+    if (att_server->request_size != 5) return;
+    uint16_t configuration_handle = gatt_server_get_client_configuration_handle_for_characteristic_with_uuid16(0x0001, 0xffff, GAP_SERVICE_CHANGED);
+    if (configuration_handle == 0) return;
+    if (little_endian_read_16(att_server->request_buffer, 1) != configuration_handle) return;
+    uint16_t configuration = little_endian_read_16(att_server->request_buffer, 3);
+    att_server->service_changed_indications = (configuration & GATT_CLIENT_CHARACTERISTICS_CONFIGURATION_INDICATION) != 0;
+    if (!att_server->service_changed_indications){
+        att_server->service_changed_pending = 0;
+    }
+}
+
 // pre: att_server->state == ATT_SERVER_REQUEST_RECEIVED_AND_VALIDATED
 // pre: can send now
 // returns: 1 if packet was sent
@@ -297,6 +456,10 @@ static int att_server_process_validated_request(att_server_t * att_server){
         return 0;
     }
 
+    if (att_response_buffer[0] == ATT_WRITE_RESPONSE){
+        att_server_track_service_changed_configuration(att_server);
+    }
+
     l2cap_send_prepared_connectionless(att_server->connection.con_handle, L2CAP_CID_ATTRIBUTE_PROTOCOL, att_response_size);
 
     // notify client about MTU exchange result
@@ -309,49 +472,6 @@ static int att_server_process_validated_request(att_server_t * att_server){
 static void att_run_for_context(att_server_t * att_server){
     switch (att_server->state){
         case ATT_SERVER_REQUEST_RECEIVED:
-#ifdef ENABLE_LE_SIGNED_WRITE
-            if (att_server->request_buffer[0] == ATT_SIGNED_WRITE_COMMAND){
-                log_info("ATT Signed Write!");
-                if (!sm_cmac_ready()) {
-                    log_info("ATT Signed Write, sm_cmac engine not ready. Abort");
-                    att_server->state = ATT_SERVER_IDLE;
-                    return;
-                }  
-                if (att_server->request_size < (3 + 12)) {
-                    log_info("ATT Signed Write, request to short. Abort.");
-                    att_server->state = ATT_SERVER_IDLE;
-                    return;
-                }
-                if (att_server->ir_lookup_active){
-                    return;
-                }
-                if (att_server->ir_le_device_db_index < 0){
-                    log_info("ATT Signed Write, CSRK not available");
-                    att_server->state = ATT_SERVER_IDLE;
-                    return;
-                }
-
-                // check counter
-                uint32_t counter_packet = little_endian_read_32(att_server->request_buffer, att_server->request_size-12);
-                uint32_t counter_db     = le_device_db_remote_counter_get(att_server->ir_le_device_db_index);
-                log_info("ATT Signed Write, DB counter %"PRIu32", packet counter %"PRIu32, counter_db, counter_packet);
-                if (counter_packet < counter_db){
-                    log_info("ATT Signed Write, db reports higher counter, abort");
-                    att_server->state = ATT_SERVER_IDLE;
-                    return;
-                }
-
-                // signature is { sequence counter, secure hash }
-                sm_key_t csrk;
-                le_device_db_remote_csrk_get(att_server->ir_le_device_db_index, csrk);
-                att_server->state = ATT_SERVER_W4_SIGNED_WRITE_VALIDATION;
-                log_info("Orig Signature: ");
-                log_info_hexdump( &att_server->request_buffer[att_server->request_size-8], 8);
-                uint16_t attribute_handle = little_endian_read_16(att_server->request_buffer, 1);
-                sm_cmac_signed_write_start(csrk, att_server->request_buffer[0], attribute_handle, att_server->request_size - 15, &att_server->request_buffer[3], counter_packet, att_signed_write_handle_cmac_result);
-                return;
-            } 
-#endif
             // move on
             att_server->state = ATT_SERVER_REQUEST_RECEIVED_AND_VALIDATED;
             att_dispatch_server_request_can_send_now_event(att_server->connection.con_handle);
@@ -362,41 +482,182 @@ static void att_run_for_context(att_server_t * att_server){
     }   
 }
 
-static void att_server_handle_can_send_now(void){
+#ifdef ENABLE_ATT_SERVER_NOTIFICATION_QUEUE
+static att_server_notification_t * att_server_notification_queue_get(att_server_t * att_server, int pos){
+    return &att_server->notification_queue[(att_server->notification_queue_first + pos) % ATT_SERVER_NOTIFICATION_QUEUE_SIZE];
+}
 
-    // NOTE: we get l2cap fixed channel instead of con_handle 
+static int att_server_notification_queue_add(att_server_t * att_server, uint16_t attribute_handle, const uint8_t * value, uint16_t value_len){
+    if (value_len > ATT_SERVER_NOTIFICATION_QUEUE_VALUE_SIZE){
+        log_error("att_server_notification_queue_add: value len %u > %u", value_len, ATT_SERVER_NOTIFICATION_QUEUE_VALUE_SIZE);
+        return ERROR_CODE_INVALID_HCI_COMMAND_PARAMETERS;
+    }
+    att_server_notification_t * notification = NULL;
+#ifdef ENABLE_ATT_SERVER_NOTIFICATION_COALESCING
+    // replace queued value for same attribute
+    int i;
+    for (i=0;i<att_server->notification_queue_len;i++){
+        att_server_notification_t * queued_notification = att_server_notification_queue_get(att_server, i);
+        if (queued_notification->attribute_handle != attribute_handle) continue;
+        notification = queued_notification;
+        break;
+    }
+#endif
+    if (!notification){
+        if (att_server->notification_queue_len == ATT_SERVER_NOTIFICATION_QUEUE_SIZE) return BTSTACK_ACL_BUFFERS_FULL;
+        notification = att_server_notification_queue_get(att_server, att_server->notification_queue_len);
+        att_server->notification_queue_len++;
+    }
+    notification->attribute_handle = attribute_handle;
+    notification->value_len = value_len;
+    memcpy(notification->value, value, value_len);
+    return 0;
+}
 
+// pre: notification queued and can send now
+static void att_server_notification_queue_send(att_server_t * att_server){
+    att_server_notification_t * notification = att_server_notification_queue_get(att_server, 0);
+    l2cap_reserve_packet_buffer();
+    uint8_t * packet_buffer = l2cap_get_outgoing_buffer();
+    uint16_t size = att_prepare_handle_value_notification(&att_server->connection, notification->attribute_handle, notification->value, notification->value_len, packet_buffer);
+    att_server->notification_queue_first = (att_server->notification_queue_first + 1) % ATT_SERVER_NOTIFICATION_QUEUE_SIZE;
+    att_server->notification_queue_len--;
+    l2cap_send_prepared_connectionless(att_server->connection.con_handle, L2CAP_CID_ATTRIBUTE_PROTOCOL, size);
+}
+#endif
+
+static int att_server_connection_packet_limit(hci_con_handle_t con_handle){
+#if ATT_SERVER_MAX_OUTGOING_PACKETS_PER_CONNECTION > 0
+    UNUSED(con_handle);
+    return ATT_SERVER_MAX_OUTGOING_PACKETS_PER_CONNECTION;
+#else
+    // keep one buffer for each other LE connection, so a stalled connection cannot use all of them
+    int num_outgoing_packets = 0;
+    int num_other_connections = 0;
     btstack_linked_list_iterator_t it;
     hci_connections_get_iterator(&it);
     while(btstack_linked_list_iterator_has_next(&it)){
         hci_connection_t * connection = (hci_connection_t *) btstack_linked_list_iterator_next(&it);
-        att_server_t * att_server = &connection->att_server;
-        if (att_server->state == ATT_SERVER_REQUEST_RECEIVED_AND_VALIDATED){
-            int sent = att_server_process_validated_request(att_server);
-            if (sent && (att_client_waiting_for_can_send || !btstack_linked_list_empty(&can_send_now_clients))){
-                att_dispatch_server_request_can_send_now_event(att_server->connection.con_handle);
-                return;
-            }
+        if (gap_get_connection_type(connection->con_handle) != GAP_CONNECTION_LE) continue;
+        num_outgoing_packets += connection->num_acl_packets_sent;
+        if (connection->con_handle != con_handle){
+            num_other_connections++;
         }
     }
+    int num_buffers = hci_number_free_acl_slots_for_handle(con_handle) + num_outgoing_packets;
+    return btstack_max(1, num_buffers - num_other_connections);
+#endif
+}
 
-    while (!btstack_linked_list_empty(&can_send_now_clients)){
-        // handle first client
-        btstack_context_callback_registration_t * client = (btstack_context_callback_registration_t*) can_send_now_clients;
-        hci_con_handle_t con_handle = (uintptr_t) client->context;
-        btstack_linked_list_remove(&can_send_now_clients, (btstack_linked_item_t *) client);
-        client->callback(client->context);
+// checks controller buffers and packet limit for connection
+static int att_server_connection_can_send_now(hci_con_handle_t con_handle){
+    if (!att_dispatch_server_can_send_now(con_handle)) return 0;
+    if (hci_number_outgoing_acl_packets_for_handle(con_handle) >= att_server_connection_packet_limit(con_handle)) return 0;
+    return 1;
+}
 
-        // request again if needed
-        if (!att_dispatch_server_can_send_now(con_handle)){
-            if (!btstack_linked_list_empty(&can_send_now_clients) || att_client_waiting_for_can_send){
-                att_dispatch_server_request_can_send_now_event(con_handle);
+static int att_server_connection_has_pending_packets(att_server_t * att_server){
+    if (att_server->state == ATT_SERVER_REQUEST_RECEIVED_AND_VALIDATED) return 1;
+    if (att_server->service_changed_pending && !att_server->value_indication_handle) return 1;
+#ifdef ENABLE_ATT_SERVER_NOTIFICATION_QUEUE
+    if (att_server->notification_queue_len) return 1;
+#endif
+    return !btstack_linked_list_empty(&att_server->can_send_now_clients);
+}
+
+// send response or serve one client. returns 1 if done
+static int att_server_serve_connection(att_server_t * att_server){
+    hci_con_handle_t con_handle = att_server->connection.con_handle;
+    if (!att_server_connection_has_pending_packets(att_server)) return 0;
+    if (!att_server_connection_can_send_now(con_handle)) return 0;
+    if (att_server->state == ATT_SERVER_REQUEST_RECEIVED_AND_VALIDATED){
+        if (att_server_process_validated_request(att_server)) return 1;
+        // no response sent, e.g. authorization pending, serve a client instead
+        if (!att_server_connection_can_send_now(con_handle)) return 0;
+    }
+    // only a single indication can be in flight
+    if (att_server->service_changed_pending && !att_server->value_indication_handle){
+        att_server->service_changed_pending = 0;
+        att_server_indicate_service_changed(con_handle, att_server->service_changed_start_handle, att_server->service_changed_end_handle);
+        return 1;
+    }
+#ifdef ENABLE_ATT_SERVER_NOTIFICATION_QUEUE
+    if (att_server->notification_queue_len){
+        att_server_notification_queue_send(att_server);
+        return 1;
+    }
+#endif
+    if (btstack_linked_list_empty(&att_server->can_send_now_clients)) return 0;
+    btstack_context_callback_registration_t * client = (btstack_context_callback_registration_t*) att_server->can_send_now_clients;
+    btstack_linked_list_remove(&att_server->can_send_now_clients, (btstack_linked_item_t *) client);
+    client->callback(client->context);
+    return 1;
+}
+
+// serve each connection once, starting after the last served one. returns 1 if any connection was served
+static int att_server_serve_connections_round_robin(void){
+    hci_con_handle_t last_served_con_handle = att_server_last_served_con_handle;
+    int served = 0;
+    int pass;
+    // first pass: connections after last served one, second pass: connections up to and including it
+    for (pass = 0; pass < 2; pass++){
+        int after_last_served = pass;
+        btstack_linked_list_iterator_t it;
+        hci_connections_get_iterator(&it);
+        while(btstack_linked_list_iterator_has_next(&it)){
+            hci_connection_t * connection = (hci_connection_t *) btstack_linked_list_iterator_next(&it);
+            int is_last_served = connection->con_handle == last_served_con_handle;
+            if (after_last_served){
+                if (att_server_serve_connection(&connection->att_server)){
+                    att_server_last_served_con_handle = connection->con_handle;
+                    served = 1;
+                }
             }
+            if (is_last_served) {
+                if (pass == 1) break;
+                after_last_served = 1;
+            }
+        }
+    }
+    return served;
+}
+
+static void att_server_handle_can_send_now(void){
+
+    // NOTE: we get l2cap fixed channel instead of con_handle 
+
+    // clients registering again are queued and served in the next round
+    att_server_serving_can_send_now = 1;
+    while (att_server_serve_connections_round_robin());
+    att_server_serving_can_send_now = 0;
+
+    // request again if needed
+    btstack_linked_list_iterator_t it;
+    hci_connections_get_iterator(&it);
+    while(btstack_linked_list_iterator_has_next(&it)){
+        hci_connection_t * connection = (hci_connection_t *) btstack_linked_list_iterator_next(&it);
+        att_server_t * att_server = &connection->att_server;
+        if (!att_server_connection_has_pending_packets(att_server)) continue;
+        if (!att_dispatch_server_can_send_now(connection->con_handle)){
+            att_dispatch_server_request_can_send_now_event(connection->con_handle);
             return;
         }
+        if (!att_server_connection_can_send_now(connection->con_handle)){
+            att_server_waiting_for_completed_packets = 1;
+        }
     }
 
     if (att_client_waiting_for_can_send){
+        if (!hci_can_send_acl_le_packet_now()){
+            att_dispatch_server_request_can_send_now_event(HCI_CON_HANDLE_INVALID);
+            return;
+        }
+        // connection reached its packet limit, wait for completed packets
+        hci_con_handle_t con_handle = att_client_waiting_for_can_send_con_handle;
+        if (att_server_for_handle(con_handle) && !att_server_connection_can_send_now(con_handle)){
+            att_server_waiting_for_completed_packets = 1;
+            return;
+        }
         att_client_waiting_for_can_send = 0;
         att_emit_can_send_now_event();
     }
@@ -424,25 +685,49 @@ static void att_packet_handler(uint8_t packet_type, uint16_t handle, uint8_t *pa
                 uint16_t att_handle = att_server->value_indication_handle;
                 att_server->value_indication_handle = 0;    
                 att_handle_value_indication_notify_client(0, att_server->connection.con_handle, att_handle);
-                return;
-            }
-
-            // directly process command
-            // note: signed write cannot be handled directly as authentication needs to be verified
-            if (packet[0] == ATT_WRITE_COMMAND){
-                att_handle_request(&att_server->connection, packet, size, 0);
+                if (att_server->service_changed_pending){
+                    att_dispatch_server_request_can_send_now_event(handle);
+                }
                 return;
             }
 
             // check size
             if (size > sizeof(att_server->request_buffer)) {
                 log_info("att_packet_handler: dropping att pdu 0x%02x as size %u > att_server->request_buffer %u", packet[0], size, (int) sizeof(att_server->request_buffer));
+                att_server->dropped_pdus++;
                 return;
             }
 
+#ifdef ENABLE_LE_SIGNED_WRITE
+            // commands are processed in arrival order independent of pending requests
+            // note: signed write cannot be handled directly as authentication needs to be verified
+            if (packet[0] == ATT_WRITE_COMMAND || packet[0] == ATT_SIGNED_WRITE_COMMAND){
+                if (att_server->signed_write_state != ATT_SERVER_IDLE || att_server->command_queue_len){
+                    att_server_command_queue_add(att_server, packet, size);
+                    return;
+                }
+                if (packet[0] == ATT_WRITE_COMMAND){
+                    att_handle_request(&att_server->connection, packet, size, 0);
+                    return;
+                }
+                att_server->command_size = size;
+                memcpy(att_server->command_buffer, packet, size);
+                att_server->signed_write_state = ATT_SERVER_REQUEST_RECEIVED;
+                att_server_process_commands(att_server);
+                return;
+            }
+#else
+            // directly process command
+            if (packet[0] == ATT_WRITE_COMMAND){
+                att_handle_request(&att_server->connection, packet, size, 0);
+                return;
+            }
+#endif
+
             // last request still in processing?
             if (att_server->state != ATT_SERVER_IDLE){
                 log_info("att_packet_handler: skipping att pdu 0x%02x as server not idle (state %u)", packet[0], att_server->state);
+                att_server->dropped_pdus++;
                 return;
             }
 
@@ -456,6 +741,31 @@ static void att_packet_handler(uint8_t packet_type, uint16_t handle, uint8_t *pa
     }
 }
 
+// ATT DB was modified, e.g. with att_db_util: indicate Service Changed to all clients that enabled it
+static void att_server_handle_service_changed(uint16_t start_handle, uint16_t end_handle){
+    btstack_linked_list_iterator_t it;
+    hci_connections_get_iterator(&it);
+    while(btstack_linked_list_iterator_has_next(&it)){
+        hci_connection_t * connection = (hci_connection_t *) btstack_linked_list_iterator_next(&it);
+        att_server_t * att_server = &connection->att_server;
+        if (!att_server->service_changed_indications) continue;
+        if (att_server->service_changed_pending){
+            // merge with range not indicated yet
+            if (start_handle < att_server->service_changed_start_handle){
+                att_server->service_changed_start_handle = start_handle;
+            }
+            if (end_handle > att_server->service_changed_end_handle){
+                att_server->service_changed_end_handle = end_handle;
+            }
+        } else {
+            att_server->service_changed_pending = 1;
+            att_server->service_changed_start_handle = start_handle;
+            att_server->service_changed_end_handle = end_handle;
+        }
+        att_dispatch_server_request_can_send_now_event(connection->con_handle);
+    }
+}
+
 void att_server_init(uint8_t const * db, att_read_callback_t read_callback, att_write_callback_t write_callback){
 
     // register for HCI Events
@@ -472,6 +782,7 @@ void att_server_init(uint8_t const * db, att_read_callback_t read_callback, att_
     att_set_db(db);
     att_set_read_callback(read_callback);
     att_set_write_callback(write_callback);
+    att_set_service_changed_callback(&att_server_handle_service_changed);
 
 }
 
@@ -480,23 +791,33 @@ void att_server_register_packet_handler(btstack_packet_handler_t handler){
 }
 
 int  att_server_can_send_packet_now(hci_con_handle_t con_handle){
-	return att_dispatch_server_can_send_now(con_handle);
+	return att_server_connection_can_send_now(con_handle);
 }
 
 void att_server_request_can_send_now_event(hci_con_handle_t con_handle){
     log_debug("att_server_request_can_send_now_event 0x%04x", con_handle);
     att_client_waiting_for_can_send = 1;
+    att_client_waiting_for_can_send_con_handle = con_handle;
     att_dispatch_server_request_can_send_now_event(con_handle);
 }
 
 void att_server_register_can_send_now_callback(btstack_context_callback_registration_t * callback_registration, hci_con_handle_t con_handle){
+    att_server_t * att_server = att_server_for_handle(con_handle);
+    if (!att_server) return;
+    // registration can only wait for a single connection
+    btstack_linked_list_iterator_t it;
+    hci_connections_get_iterator(&it);
+    while(btstack_linked_list_iterator_has_next(&it)){
+        hci_connection_t * connection = (hci_connection_t *) btstack_linked_list_iterator_next(&it);
+        btstack_linked_list_remove(&connection->att_server.can_send_now_clients, (btstack_linked_item_t*) callback_registration);
+    }
     // check if can send already
-    if (att_dispatch_server_can_send_now(con_handle)){
+    if (!att_server_serving_can_send_now && btstack_linked_list_empty(&att_server->can_send_now_clients) && att_server_connection_can_send_now(con_handle)){
         callback_registration->callback(callback_registration->context);
         return;
     }
-    callback_registration->context = (void*)(uintptr_t) con_handle;
-    btstack_linked_list_add_tail(&can_send_now_clients, (btstack_linked_item_t*) callback_registration);
+    btstack_linked_list_add_tail(&att_server->can_send_now_clients, (btstack_linked_item_t*) callback_registration);
+    if (att_server_serving_can_send_now) return;
     att_dispatch_server_request_can_send_now_event(con_handle);
 }
 
@@ -505,7 +826,19 @@ int att_server_notify(hci_con_handle_t con_handle, uint16_t attribute_handle, ui
     att_server_t * att_server = att_server_for_handle(con_handle);
     if (!att_server) return ERROR_CODE_UNKNOWN_CONNECTION_IDENTIFIER;
 
-    if (!att_dispatch_server_can_send_now(con_handle)) return BTSTACK_ACL_BUFFERS_FULL;
+#ifdef ENABLE_ATT_SERVER_NOTIFICATION_QUEUE
+    // queue if we cannot send now or to keep order with queued notifications
+    if (att_server->notification_queue_len || !att_server_connection_can_send_now(con_handle)){
+        int status = att_server_notification_queue_add(att_server, attribute_handle, value, value_len);
+        if (status) return status;
+        if (!att_server_serving_can_send_now){
+            att_dispatch_server_request_can_send_now_event(con_handle);
+        }
+        return 0;
+    }
+#else
+    if (!att_server_connection_can_send_now(con_handle)) return BTSTACK_ACL_BUFFERS_FULL;
+#endif
 
     l2cap_reserve_packet_buffer();
     uint8_t * packet_buffer = l2cap_get_outgoing_buffer();
@@ -513,12 +846,50 @@ int att_server_notify(hci_con_handle_t con_handle, uint16_t attribute_handle, ui
 	return l2cap_send_prepared_connectionless(att_server->connection.con_handle, L2CAP_CID_ATTRIBUTE_PROTOCOL, size);
 }
 
+int att_server_multiple_notify(hci_con_handle_t con_handle, uint16_t num_attributes, const uint16_t * attribute_handles, uint8_t ** values, const uint16_t * value_lens){
+    att_server_t * att_server = att_server_for_handle(con_handle);
+    if (!att_server) return ERROR_CODE_UNKNOWN_CONNECTION_IDENTIFIER;
+
+#ifdef ENABLE_ATT_SERVER_NOTIFICATION_QUEUE
+    // keep order with queued notifications
+    if (att_server->notification_queue_len) return BTSTACK_ACL_BUFFERS_FULL;
+#endif
+    if (!att_server_connection_can_send_now(con_handle)) return BTSTACK_ACL_BUFFERS_FULL;
+
+    l2cap_reserve_packet_buffer();
+    uint8_t * packet_buffer = l2cap_get_outgoing_buffer();
+    uint16_t size = att_prepare_multiple_handle_value_notification(&att_server->connection, num_attributes, attribute_handles, values, value_lens, packet_buffer);
+    if (size == 0){
+        l2cap_release_packet_buffer();
+        return ERROR_CODE_INVALID_HCI_COMMAND_PARAMETERS;
+    }
+    return l2cap_send_prepared_connectionless(att_server->connection.con_handle, L2CAP_CID_ATTRIBUTE_PROTOCOL, size);
+}
+
+uint32_t att_server_get_dropped_pdus(hci_con_handle_t con_handle){
+    att_server_t * att_server = att_server_for_handle(con_handle);
+    if (!att_server) return 0;
+    return att_server->dropped_pdus;
+}
+
+int att_server_indicate_service_changed(hci_con_handle_t con_handle, uint16_t start_handle, uint16_t end_handle){
+    uint16_t service_changed_handle = gatt_server_get_value_handle_for_characteristic_with_uuid16(0x0001, 0xffff, GAP_SERVICE_CHANGED);
+    if (service_changed_handle == 0){
+        log_error("att_server_indicate_service_changed: no Service Changed characteristic in ATT DB");
+        return ERROR_CODE_UNSUPPORTED_FEATURE_OR_PARAMETER_VALUE;
+    }
+    uint8_t value[4];
+    little_endian_store_16(value, 0, start_handle);
+    little_endian_store_16(value, 2, end_handle);
+    return att_server_indicate(con_handle, service_changed_handle, value, sizeof(value));
+}
+
 int att_server_indicate(hci_con_handle_t con_handle, uint16_t attribute_handle, uint8_t *value, uint16_t value_len){
     att_server_t * att_server = att_server_for_handle(con_handle);
     if (!att_server) return ERROR_CODE_UNKNOWN_CONNECTION_IDENTIFIER;
 
     if (att_server->value_indication_handle) return ATT_HANDLE_VALUE_INDICATION_IN_PROGRESS;
-    if (!att_dispatch_server_can_send_now(con_handle)) return BTSTACK_ACL_BUFFERS_FULL;
+    if (!att_server_connection_can_send_now(con_handle)) return BTSTACK_ACL_BUFFERS_FULL;
 
     // track indication
     att_server->value_indication_handle = attribute_handle;
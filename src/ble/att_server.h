@@ -74,6 +74,8 @@ int  att_server_can_send_packet_now(hci_con_handle_t con_handle);
  * @brief Request emission of ATT_EVENT_CAN_SEND_NOW as soon as possible
  * @note ATT_EVENT_CAN_SEND_NOW might be emitted during call to this function
  *       so packet handler should be ready to handle it
+ * @note the event is emitted when att_server_can_send_packet_now(con_handle) returns 1, i.e. also the
+ *       packet limit of the connection, see ATT_SERVER_MAX_OUTGOING_PACKETS_PER_CONNECTION, has to be met
  * @param con_handle
  */
 void att_server_request_can_send_now_event(hci_con_handle_t con_handle);
@@ -88,14 +90,30 @@ void att_server_register_can_send_now_callback(btstack_context_callback_registra
 
 /*
  * @brief notify client about attribute value change
+ * @note with ENABLE_ATT_SERVER_NOTIFICATION_QUEUE, the notification is queued if it cannot be sent right now.
+ *       With ENABLE_ATT_SERVER_NOTIFICATION_COALESCING, a queued notification for the same attribute is updated instead
  * @param con_handle
  * @param attribute_handle
  * @param value
  * @param value_len
- * @return 0 if ok, error otherwise
+ * @return 0 if ok (sent or queued), ERROR_CODE_INVALID_HCI_COMMAND_PARAMETERS if value_len > ATT_SERVER_NOTIFICATION_QUEUE_VALUE_SIZE
+ *         and notification needs to be queued, error otherwise
  */
 int att_server_notify(hci_con_handle_t con_handle, uint16_t attribute_handle, uint8_t *value, uint16_t value_len);
 
+/*
+ * @brief notify client about value changes of several attributes in a single Multiple Handle Value Notification
+ * @note client needs to support Multiple Handle Value Notifications, see Client Supported Features characteristic
+ * @note not queued with ENABLE_ATT_SERVER_NOTIFICATION_QUEUE, returns BTSTACK_ACL_BUFFERS_FULL while notifications are queued
+ * @param con_handle
+ * @param num_attributes, at least 2
+ * @param attribute_handles
+ * @param values
+ * @param value_lens
+ * @return 0 if ok, ERROR_CODE_INVALID_HCI_COMMAND_PARAMETERS if less than two attributes or values don't fit into MTU, error otherwise
+ */
+int att_server_multiple_notify(hci_con_handle_t con_handle, uint16_t num_attributes, const uint16_t * attribute_handles, uint8_t ** values, const uint16_t * value_lens);
+
 /*
  * @brief indicate value change to client. client is supposed to reply with an indication_response
  * @param con_handle
@@ -106,6 +124,27 @@ int att_server_notify(hci_con_handle_t con_handle, uint16_t attribute_handle, ui
  */
 int att_server_indicate(hci_con_handle_t con_handle, uint16_t attribute_handle, uint8_t *value, uint16_t value_len);
 
+/*
+ * @brief get number of received PDUs that were dropped on a connection, e.g. requests while the previous one was
+ *        still in processing or commands while the command queue for Signed Write validation was full
+ * @param con_handle
+ * @return number of dropped PDUs since connection was established
+ */
+uint32_t att_server_get_dropped_pdus(hci_con_handle_t con_handle);
+
+/*
+ * @brief indicate Service Changed for given handle range to client
+ * @note After services are removed, replaced or renumbered with att_db_util, Service Changed is indicated automatically
+ *       to all connected clients that enabled it with a Write Request, as soon as no other indication is in flight.
+ *       Completion is reported with ATT_EVENT_HANDLE_VALUE_INDICATION_COMPLETE as for att_server_indicate.
+ * @note application has to check that the client enabled indications for the Service Changed characteristic
+ * @param con_handle
+ * @param start_handle of affected range
+ * @param end_handle of affected range
+ * @return 0 if ok, ERROR_CODE_UNSUPPORTED_FEATURE_OR_PARAMETER_VALUE if ATT DB has no Service Changed characteristic, error otherwise
+ */
+int att_server_indicate_service_changed(hci_con_handle_t con_handle, uint16_t start_handle, uint16_t end_handle);
+
 /* API_END */
 
 #if defined __cplusplus
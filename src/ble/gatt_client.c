@@ -53,6 +53,7 @@
 #include "ble/sm.h"
 #include "btstack_debug.h"
 #include "btstack_event.h"
+#include "btstack_hash_map.h"
 #include "btstack_memory.h"
 #include "btstack_run_loop.h"
 #include "btstack_util.h"
@@ -62,7 +63,16 @@
 #include "hci_dump.h"
 #include "l2cap.h"
 
+// con_handle -> context index
+#ifdef MAX_NR_GATT_CLIENTS
+#define GATT_CLIENT_INDEX_SIZE (2 * MAX_NR_GATT_CLIENTS + 1)
+#else
+#define GATT_CLIENT_INDEX_SIZE 32
+#endif
+
 static btstack_linked_list_t gatt_client_connections;
+static btstack_hash_map_t    gatt_client_index;
+static btstack_hash_map_entry_t gatt_client_index_storage[GATT_CLIENT_INDEX_SIZE];
 static btstack_linked_list_t gatt_client_value_listeners;
 static btstack_packet_callback_registration_t hci_event_callback_registration;
 static uint8_t  pts_suppress_mtu_exchange;
@@ -70,11 +80,20 @@ static uint8_t  pts_suppress_mtu_exchange;
 static void gatt_client_att_packet_handler(uint8_t packet_type, uint16_t handle, uint8_t *packet, uint16_t size);
 static void gatt_client_hci_event_packet_handler(uint8_t packet_type, uint16_t channel, uint8_t *packet, uint16_t size);
 static void gatt_client_report_error_if_pending(gatt_client_t *peripheral, uint8_t error_code);
+static void gatt_client_run(void);
 
 #ifdef ENABLE_LE_SIGNED_WRITE
 static void att_signed_write_handle_cmac_result(uint8_t hash[8]);
 #endif
 
+#ifdef ENABLE_GATT_CLIENT_CACHE
+static void gatt_client_cache_query_complete(gatt_client_t * peripheral, uint8_t status);
+#endif
+
+#ifdef ENABLE_GATT_CLIENT_OPERATION_QUEUE
+static void gatt_client_operation_queue_report_error(gatt_client_t * peripheral, uint8_t error_code);
+#endif
+
 static uint16_t peripheral_mtu(gatt_client_t *peripheral){
     if (peripheral->mtu > l2cap_max_le_mtu()){
         log_error("Peripheral mtu is not initialized");
@@ -85,6 +104,7 @@ static uint16_t peripheral_mtu(gatt_client_t *peripheral){
 
 void gatt_client_init(void){
     gatt_client_connections = NULL;
+    btstack_hash_map_init(&gatt_client_index, gatt_client_index_storage, GATT_CLIENT_INDEX_SIZE);
     pts_suppress_mtu_exchange = 0;
 
     // regsister for HCI Events
@@ -112,6 +132,10 @@ static void gatt_client_timeout_handler(btstack_timer_source_t * timer){
     if (!peripheral) return;
     log_info("GATT client timeout handle, handle 0x%02x", peripheral->con_handle);
     gatt_client_report_error_if_pending(peripheral, ATT_ERROR_TIMEOUT);           
+#ifdef ENABLE_GATT_CLIENT_OPERATION_QUEUE
+    // no further requests can be sent after an ATT timeout, fail queued operations
+    gatt_client_operation_queue_report_error(peripheral, ATT_ERROR_TIMEOUT);
+#endif
 }
 
 static void gatt_client_timeout_start(gatt_client_t * peripheral){
@@ -128,6 +152,10 @@ static void gatt_client_timeout_stop(gatt_client_t * peripheral){
 }
 
 static gatt_client_t * get_gatt_client_context_for_handle(uint16_t handle){
+    gatt_client_t * context = (gatt_client_t *) btstack_hash_map_get(&gatt_client_index, handle);
+    if (context) return context;
+    // not all contexts could be indexed, fall back to linear search
+    if (btstack_hash_map_complete(&gatt_client_index)) return NULL;
     btstack_linked_item_t *it;
     for (it = (btstack_linked_item_t *) gatt_client_connections; it ; it = it->next){
         gatt_client_t * peripheral = (gatt_client_t *) it;
@@ -154,6 +182,7 @@ static gatt_client_t * provide_context_for_conn_handle(hci_con_handle_t con_hand
     context->mtu_state = SEND_MTU_EXCHANGE;
     context->gatt_client_state = P_READY;
     btstack_linked_list_add(&gatt_client_connections, (btstack_linked_item_t*)context);
+    btstack_hash_map_put(&gatt_client_index, con_handle, context);
 
     // skip mtu exchange for testing sm with pts
     if (pts_suppress_mtu_exchange){
@@ -267,10 +296,10 @@ static void att_read_blob_request(uint16_t request_type, uint16_t peripheral_han
     l2cap_send_prepared_connectionless(peripheral_handle, L2CAP_CID_ATTRIBUTE_PROTOCOL, 5);
 }
 
-static void att_read_multiple_request(uint16_t peripheral_handle, uint16_t num_value_handles, uint16_t * value_handles){
+static void att_read_multiple_request(uint16_t request_type, uint16_t peripheral_handle, uint16_t num_value_handles, uint16_t * value_handles){
     l2cap_reserve_packet_buffer();
     uint8_t * request = l2cap_get_outgoing_buffer();
-    request[0] = ATT_READ_MULTIPLE_REQUEST;
+    request[0] = request_type;
     int i;
     int offset = 1;
     for (i=0;i<num_value_handles;i++){
@@ -400,7 +429,11 @@ static void send_gatt_read_blob_request(gatt_client_t *peripheral){
 }
 
 static void send_gatt_read_multiple_request(gatt_client_t * peripheral){
-    att_read_multiple_request(peripheral->con_handle, peripheral->read_multiple_handle_count, peripheral->read_multiple_handles);
+    att_read_multiple_request(ATT_READ_MULTIPLE_REQUEST, peripheral->con_handle, peripheral->read_multiple_handle_count, peripheral->read_multiple_handles);
+}
+
+static void send_gatt_read_multiple_variable_request(gatt_client_t * peripheral){
+    att_read_multiple_request(ATT_READ_MULTIPLE_VARIABLE_REQUEST, peripheral->con_handle, peripheral->read_multiple_handle_count, peripheral->read_multiple_handles);
 }
 
 static void send_gatt_write_attribute_value_request(gatt_client_t * peripheral){
@@ -486,6 +519,9 @@ static void emit_event_to_registered_listeners(hci_con_handle_t con_handle, uint
 }
 
 static void emit_gatt_complete_event(gatt_client_t * peripheral, uint8_t status){
+#ifdef ENABLE_GATT_CLIENT_CACHE
+    gatt_client_cache_query_complete(peripheral, status);
+#endif
     // @format H1
     uint8_t packet[5];
     packet[0] = GATT_EVENT_QUERY_COMPLETE;
@@ -495,6 +531,35 @@ static void emit_gatt_complete_event(gatt_client_t * peripheral, uint8_t status)
     emit_event_new(peripheral->callback, packet, sizeof(packet));
 }
 
+#ifdef ENABLE_GATT_CLIENT_OPERATION_QUEUE
+static gatt_client_operation_t * gatt_client_operation_queue_get(gatt_client_t * peripheral, int index){
+    return &peripheral->operation_queue[(peripheral->operation_queue_first + index) % GATT_CLIENT_OPERATION_QUEUE_SIZE];
+}
+
+// @returns free entry at the end of the queue or NULL if full
+static gatt_client_operation_t * gatt_client_operation_queue_add(gatt_client_t * peripheral){
+    if (peripheral->operation_queue_len >= GATT_CLIENT_OPERATION_QUEUE_SIZE) return NULL;
+    gatt_client_operation_t * operation = gatt_client_operation_queue_get(peripheral, peripheral->operation_queue_len);
+    peripheral->operation_queue_len++;
+    return operation;
+}
+
+static void gatt_client_operation_queue_remove_first(gatt_client_t * peripheral){
+    peripheral->operation_queue_first = (peripheral->operation_queue_first + 1) % GATT_CLIENT_OPERATION_QUEUE_SIZE;
+    peripheral->operation_queue_len--;
+}
+
+static void gatt_client_operation_queue_report_error(gatt_client_t * peripheral, uint8_t error_code){
+    while (peripheral->operation_queue_len){
+        gatt_client_operation_t * operation = gatt_client_operation_queue_get(peripheral, 0);
+        gatt_client_operation_queue_remove_first(peripheral);
+        if (operation->state == P_W2_SEND_WRITE_COMMAND) continue;
+        peripheral->callback = operation->callback;
+        emit_gatt_complete_event(peripheral, error_code);
+    }
+}
+#endif
+
 static void emit_gatt_service_query_result_event(gatt_client_t * peripheral, uint16_t start_group_handle, uint16_t end_group_handle, uint8_t * uuid128){
     // @format HX
     uint8_t packet[24];
@@ -551,6 +616,347 @@ static void emit_gatt_all_characteristic_descriptors_result_event(
     reverse_128(uuid128, &packet[6]);
     emit_event_new(peripheral->callback, packet, sizeof(packet));
 }
+#ifdef ENABLE_GATT_CLIENT_CACHE
+
+#ifndef GATT_CLIENT_CACHE_MAX_SERVICES
+#define GATT_CLIENT_CACHE_MAX_SERVICES 8
+#endif
+
+#ifndef GATT_CLIENT_CACHE_MAX_CHARACTERISTICS
+#define GATT_CLIENT_CACHE_MAX_CHARACTERISTICS 32
+#endif
+
+#ifndef GATT_CLIENT_CACHE_MAX_DESCRIPTORS
+#define GATT_CLIENT_CACHE_MAX_DESCRIPTORS 32
+#endif
+
+#define GATT_CLIENT_CACHE_QUERY_NONE            0
+#define GATT_CLIENT_CACHE_QUERY_SERVICES        1
+#define GATT_CLIENT_CACHE_QUERY_CHARACTERISTICS 2
+#define GATT_CLIENT_CACHE_QUERY_DESCRIPTORS     3
+
+typedef struct {
+    uint16_t start_group_handle;
+    uint16_t end_group_handle;
+    uint8_t  uuid128[16];
+    uint8_t  characteristics_complete;
+} gatt_client_cache_service_t;
+
+typedef struct {
+    uint16_t start_handle;
+    uint16_t value_handle;
+    uint16_t end_handle;
+    uint16_t properties;
+    uint8_t  uuid128[16];
+    uint8_t  descriptors_complete;
+} gatt_client_cache_characteristic_t;
+
+typedef struct {
+    uint16_t handle;
+    uint8_t  uuid128[16];
+} gatt_client_cache_descriptor_t;
+
+// discovered services, characteristics and descriptors of a bonded device
+typedef struct {
+    // identity address to detect re-used le device db entry
+    uint8_t   addr_type;
+    bd_addr_t addr;
+
+    uint8_t   services_complete;
+    uint8_t   num_services;
+    uint8_t   num_characteristics;
+    uint8_t   num_descriptors;
+
+    // characteristics of a service and descriptors of a characteristic are found by their handles
+    gatt_client_cache_service_t        services[GATT_CLIENT_CACHE_MAX_SERVICES];
+    gatt_client_cache_characteristic_t characteristics[GATT_CLIENT_CACHE_MAX_CHARACTERISTICS];
+    gatt_client_cache_descriptor_t     descriptors[GATT_CLIENT_CACHE_MAX_DESCRIPTORS];
+} gatt_client_cache_t;
+
+static const btstack_tlv_t * gatt_client_cache_tlv_impl;
+static       void *          gatt_client_cache_tlv_context;
+
+// cache of a single device is kept in RAM
+static gatt_client_cache_t gatt_client_cache;
+static int                 gatt_client_cache_le_device_index = -1;
+
+static uint32_t gatt_client_cache_tag_for_index(int le_device_index){
+    return ('G' << 24) | ('C' << 16) | ('C' << 8) | (le_device_index & 0xff);
+}
+
+// RAM cache is about to be replaced
+static void gatt_client_cache_abort_queries(void){
+    btstack_linked_item_t *it;
+    for (it = (btstack_linked_item_t *) gatt_client_connections; it ; it = it->next){
+        gatt_client_t * peripheral = (gatt_client_t *) it;
+        peripheral->cache_query = GATT_CLIENT_CACHE_QUERY_NONE;
+    }
+}
+
+// @returns cache for bonded device or NULL
+static gatt_client_cache_t * gatt_client_cache_for_peripheral(gatt_client_t * peripheral){
+    if (!gatt_client_cache_tlv_impl) return NULL;
+    int le_device_index = sm_le_device_index(peripheral->con_handle);
+    if (le_device_index < 0) return NULL;
+    if (le_device_index == gatt_client_cache_le_device_index) return &gatt_client_cache;
+
+    gatt_client_cache_abort_queries();
+
+    int addr_type;
+    bd_addr_t addr;
+    le_device_db_info(le_device_index, &addr_type, addr, NULL);
+    uint32_t tag = gatt_client_cache_tag_for_index(le_device_index);
+    int size = gatt_client_cache_tlv_impl->get_tag(gatt_client_cache_tlv_context, tag, (uint8_t *) &gatt_client_cache, sizeof(gatt_client_cache_t));
+    if (size != sizeof(gatt_client_cache_t) || gatt_client_cache.addr_type != addr_type || memcmp(gatt_client_cache.addr, addr, 6) != 0){
+        log_info("GATT client cache empty for le device index %u", le_device_index);
+        memset(&gatt_client_cache, 0, sizeof(gatt_client_cache_t));
+        gatt_client_cache.addr_type = addr_type;
+        memcpy(gatt_client_cache.addr, addr, 6);
+    }
+    gatt_client_cache_le_device_index = le_device_index;
+    return &gatt_client_cache;
+}
+
+static void gatt_client_cache_store(void){
+    uint32_t tag = gatt_client_cache_tag_for_index(gatt_client_cache_le_device_index);
+    gatt_client_cache_tlv_impl->store_tag(gatt_client_cache_tlv_context, tag, (uint8_t *) &gatt_client_cache, sizeof(gatt_client_cache_t));
+}
+
+static void gatt_client_cache_start_query(gatt_client_t * peripheral, uint8_t query, uint8_t index, uint8_t num_entries){
+    peripheral->cache_query = query;
+    peripheral->cache_query_index = index;
+    peripheral->cache_query_num_entries = num_entries;
+    peripheral->cache_query_overflow = 0;
+}
+
+static void gatt_client_cache_query_complete(gatt_client_t * peripheral, uint8_t status){
+    uint8_t query = peripheral->cache_query;
+    if (query == GATT_CLIENT_CACHE_QUERY_NONE) return;
+    peripheral->cache_query = GATT_CLIENT_CACHE_QUERY_NONE;
+
+    int complete = (status == 0) && !peripheral->cache_query_overflow;
+    switch (query){
+        case GATT_CLIENT_CACHE_QUERY_SERVICES:
+            if (complete){
+                gatt_client_cache.services_complete = 1;
+            } else {
+                gatt_client_cache.num_services = peripheral->cache_query_num_entries;
+            }
+            break;
+        case GATT_CLIENT_CACHE_QUERY_CHARACTERISTICS:
+            if (complete){
+                gatt_client_cache.services[peripheral->cache_query_index].characteristics_complete = 1;
+            } else {
+                gatt_client_cache.num_characteristics = peripheral->cache_query_num_entries;
+            }
+            break;
+        case GATT_CLIENT_CACHE_QUERY_DESCRIPTORS:
+            if (complete){
+                gatt_client_cache.characteristics[peripheral->cache_query_index].descriptors_complete = 1;
+            } else {
+                gatt_client_cache.num_descriptors = peripheral->cache_query_num_entries;
+            }
+            break;
+        default:
+            break;
+    }
+    if (!complete) return;
+    gatt_client_cache_store();
+}
+
+static void gatt_client_cache_add_service(gatt_client_t * peripheral, uint16_t start_group_handle, uint16_t end_group_handle, uint8_t * uuid128){
+    if (peripheral->cache_query != GATT_CLIENT_CACHE_QUERY_SERVICES) return;
+    if (gatt_client_cache.num_services >= GATT_CLIENT_CACHE_MAX_SERVICES){
+        peripheral->cache_query_overflow = 1;
+        return;
+    }
+    gatt_client_cache_service_t * service = &gatt_client_cache.services[gatt_client_cache.num_services++];
+    service->start_group_handle = start_group_handle;
+    service->end_group_handle = end_group_handle;
+    memcpy(service->uuid128, uuid128, 16);
+    service->characteristics_complete = 0;
+}
+
+static void gatt_client_cache_add_characteristic(gatt_client_t * peripheral, uint16_t start_handle, uint16_t value_handle, uint16_t end_handle,
+    uint16_t properties, uint8_t * uuid128){
+    if (peripheral->cache_query != GATT_CLIENT_CACHE_QUERY_CHARACTERISTICS) return;
+    if (gatt_client_cache.num_characteristics >= GATT_CLIENT_CACHE_MAX_CHARACTERISTICS){
+        peripheral->cache_query_overflow = 1;
+        return;
+    }
+    gatt_client_cache_characteristic_t * characteristic = &gatt_client_cache.characteristics[gatt_client_cache.num_characteristics++];
+    characteristic->start_handle = start_handle;
+    characteristic->value_handle = value_handle;
+    characteristic->end_handle = end_handle;
+    characteristic->properties = properties;
+    memcpy(characteristic->uuid128, uuid128, 16);
+    characteristic->descriptors_complete = 0;
+}
+
+static void gatt_client_cache_add_descriptor(gatt_client_t * peripheral, uint16_t handle, uint8_t * uuid128){
+    if (peripheral->cache_query != GATT_CLIENT_CACHE_QUERY_DESCRIPTORS) return;
+    if (gatt_client_cache.num_descriptors >= GATT_CLIENT_CACHE_MAX_DESCRIPTORS){
+        peripheral->cache_query_overflow = 1;
+        return;
+    }
+    gatt_client_cache_descriptor_t * descriptor = &gatt_client_cache.descriptors[gatt_client_cache.num_descriptors++];
+    descriptor->handle = handle;
+    memcpy(descriptor->uuid128, uuid128, 16);
+}
+
+// @returns 1 if answered from cache, otherwise complete discovery is recorded
+static int gatt_client_cache_discover_primary_services(gatt_client_t * peripheral, const uint8_t * uuid128, int report){
+    gatt_client_cache_t * cache = gatt_client_cache_for_peripheral(peripheral);
+    if (!cache) return 0;
+    if (!cache->services_complete){
+        if (uuid128) return 0;
+        cache->num_services = 0;
+        cache->num_characteristics = 0;
+        cache->num_descriptors = 0;
+        gatt_client_cache_start_query(peripheral, GATT_CLIENT_CACHE_QUERY_SERVICES, 0, 0);
+        return 0;
+    }
+    if (!report) return 1;
+    int i;
+    for (i = 0; i < cache->num_services; i++){
+        gatt_client_cache_service_t * service = &cache->services[i];
+        if (uuid128 && memcmp(service->uuid128, uuid128, 16) != 0) continue;
+        emit_gatt_service_query_result_event(peripheral, service->start_group_handle, service->end_group_handle, service->uuid128);
+    }
+    gatt_client_handle_transaction_complete(peripheral);
+    emit_gatt_complete_event(peripheral, 0);
+    return 1;
+}
+
+// @returns 1 if answered from cache, otherwise discovery of all characteristics of a service is recorded
+static int gatt_client_cache_discover_characteristics(gatt_client_t * peripheral, uint16_t start_handle, uint16_t end_handle, const uint8_t * uuid128, int report){
+    gatt_client_cache_t * cache = gatt_client_cache_for_peripheral(peripheral);
+    if (!cache) return 0;
+    int i;
+    for (i = 0; i < cache->num_services; i++){
+        gatt_client_cache_service_t * service = &cache->services[i];
+        if (start_handle < service->start_group_handle || end_handle > service->end_group_handle) continue;
+        if (!service->characteristics_complete){
+            if (uuid128 || start_handle != service->start_group_handle || end_handle != service->end_group_handle) return 0;
+            gatt_client_cache_start_query(peripheral, GATT_CLIENT_CACHE_QUERY_CHARACTERISTICS, i, cache->num_characteristics);
+            return 0;
+        }
+        if (!report) return 1;
+        int j;
+        for (j = 0; j < cache->num_characteristics; j++){
+            gatt_client_cache_characteristic_t * characteristic = &cache->characteristics[j];
+            if (characteristic->start_handle < start_handle || characteristic->start_handle > end_handle) continue;
+            if (uuid128 && memcmp(characteristic->uuid128, uuid128, 16) != 0) continue;
+            emit_gatt_characteristic_query_result_event(peripheral, characteristic->start_handle, characteristic->value_handle,
+                characteristic->end_handle, characteristic->properties, characteristic->uuid128);
+        }
+        gatt_client_handle_transaction_complete(peripheral);
+        emit_gatt_complete_event(peripheral, 0);
+        return 1;
+    }
+    return 0;
+}
+
+// @returns 1 if answered from cache, otherwise discovery is recorded
+static int gatt_client_cache_discover_characteristic_descriptors(gatt_client_t * peripheral, uint16_t value_handle, uint16_t end_handle, int report){
+    gatt_client_cache_t * cache = gatt_client_cache_for_peripheral(peripheral);
+    if (!cache) return 0;
+    int i;
+    for (i = 0; i < cache->num_characteristics; i++){
+        gatt_client_cache_characteristic_t * characteristic = &cache->characteristics[i];
+        if (characteristic->value_handle != value_handle || characteristic->end_handle != end_handle) continue;
+        if (!characteristic->descriptors_complete){
+            gatt_client_cache_start_query(peripheral, GATT_CLIENT_CACHE_QUERY_DESCRIPTORS, i, cache->num_descriptors);
+            return 0;
+        }
+        if (!report) return 1;
+        int j;
+        for (j = 0; j < cache->num_descriptors; j++){
+            gatt_client_cache_descriptor_t * descriptor = &cache->descriptors[j];
+            if (descriptor->handle <= value_handle || descriptor->handle > end_handle) continue;
+            emit_gatt_all_characteristic_descriptors_result_event(peripheral, descriptor->handle, descriptor->uuid128);
+        }
+        gatt_client_handle_transaction_complete(peripheral);
+        emit_gatt_complete_event(peripheral, 0);
+        return 1;
+    }
+    return 0;
+}
+
+// @returns 1 if current discovery query can be answered from cache, results are only emitted if report is set
+static int gatt_client_cache_discover(gatt_client_t * peripheral, int report){
+    switch (peripheral->gatt_client_state){
+        case P_W2_SEND_SERVICE_QUERY:
+            return gatt_client_cache_discover_primary_services(peripheral, NULL, report);
+        case P_W2_SEND_SERVICE_WITH_UUID_QUERY:
+            return gatt_client_cache_discover_primary_services(peripheral, peripheral->uuid128, report);
+        case P_W2_SEND_ALL_CHARACTERISTICS_OF_SERVICE_QUERY:
+        case P_W2_SEND_CHARACTERISTIC_WITH_UUID_QUERY:
+            return gatt_client_cache_discover_characteristics(peripheral, peripheral->start_group_handle, peripheral->end_group_handle,
+                peripheral->filter_with_uuid ? peripheral->uuid128 : NULL, report);
+        case P_W2_SEND_ALL_CHARACTERISTIC_DESCRIPTORS_QUERY:
+            return gatt_client_cache_discover_characteristic_descriptors(peripheral, peripheral->start_group_handle - 1, peripheral->end_group_handle, report);
+        default:
+            return 0;
+    }
+}
+
+static void gatt_client_cache_report_handler(btstack_timer_source_t * timer){
+    gatt_client_t * peripheral = gatt_client_for_timer(timer);
+    if (!peripheral) return;
+    peripheral->cache_report_pending = 0;
+    if (!gatt_client_cache_discover(peripheral, 1)){
+        // cache was deleted or replaced in the meantime, query remote
+        gatt_client_timeout_start(peripheral);
+    }
+    // send query or start queued operations
+    gatt_client_run();
+}
+
+// @returns 1 if answered from cache. Results are emitted from the run loop after the discover call returned
+static int gatt_client_cache_request_report(gatt_client_t * peripheral){
+    if (!gatt_client_cache_discover(peripheral, 0)) return 0;
+    // use transaction timer to report results, it is stopped when the query completes
+    peripheral->cache_report_pending = 1;
+    btstack_run_loop_remove_timer(&peripheral->gc_timeout);
+    btstack_run_loop_set_timer_handler(&peripheral->gc_timeout, gatt_client_cache_report_handler);
+    btstack_run_loop_set_timer(&peripheral->gc_timeout, 0);
+    btstack_run_loop_add_timer(&peripheral->gc_timeout);
+    return 1;
+}
+
+// delete cache if Service Changed characteristic gets indicated
+static void gatt_client_cache_handle_indication(gatt_client_t * peripheral, uint16_t value_handle){
+    gatt_client_cache_t * cache = gatt_client_cache_for_peripheral(peripheral);
+    if (!cache) return;
+    int i;
+    for (i = 0; i < cache->num_characteristics; i++){
+        gatt_client_cache_characteristic_t * characteristic = &cache->characteristics[i];
+        if (characteristic->value_handle != value_handle) continue;
+        if (!uuid_has_bluetooth_prefix(characteristic->uuid128)) return;
+        if (big_endian_read_32(characteristic->uuid128, 0) != GAP_SERVICE_CHANGED) return;
+        log_info("GATT client cache: service changed, delete cache for le device index %u", gatt_client_cache_le_device_index);
+        gatt_client_cache_delete(gatt_client_cache_le_device_index);
+        return;
+    }
+}
+
+void gatt_client_cache_configure(const btstack_tlv_t * btstack_tlv_impl, void * btstack_tlv_context){
+    gatt_client_cache_abort_queries();
+    gatt_client_cache_tlv_impl = btstack_tlv_impl;
+    gatt_client_cache_tlv_context = btstack_tlv_context;
+    gatt_client_cache_le_device_index = -1;
+}
+
+void gatt_client_cache_delete(int le_device_index){
+    if (!gatt_client_cache_tlv_impl) return;
+    gatt_client_cache_tlv_impl->delete_tag(gatt_client_cache_tlv_context, gatt_client_cache_tag_for_index(le_device_index));
+    if (le_device_index != gatt_client_cache_le_device_index) return;
+    // reload on next use
+    gatt_client_cache_abort_queries();
+    gatt_client_cache_le_device_index = -1;
+}
+#endif
 ///
 
 static void report_gatt_services(gatt_client_t * peripheral, uint8_t * packet,  uint16_t size){
@@ -571,6 +977,9 @@ static void report_gatt_services(gatt_client_t * peripheral, uint8_t * packet,
             reverse_128(&packet[i+4], uuid128);
         }
         emit_gatt_service_query_result_event(peripheral, start_group_handle, end_group_handle, uuid128);
+#ifdef ENABLE_GATT_CLIENT_CACHE
+        gatt_client_cache_add_service(peripheral, start_group_handle, end_group_handle, uuid128);
+#endif
     }
     // log_info("report_gatt_services for %02X done", peripheral->con_handle);
 }
@@ -605,6 +1014,10 @@ static void characteristic_end_found(gatt_client_t * peripheral, uint16_t end_ha
 
     emit_gatt_characteristic_query_result_event(peripheral, peripheral->characteristic_start_handle, peripheral->attribute_handle,
         end_handle, peripheral->characteristic_properties, peripheral->uuid128);    
+#ifdef ENABLE_GATT_CLIENT_CACHE
+    gatt_client_cache_add_characteristic(peripheral, peripheral->characteristic_start_handle, peripheral->attribute_handle,
+        end_handle, peripheral->characteristic_properties, peripheral->uuid128);
+#endif
 
     peripheral->characteristic_start_handle = 0;
 }
@@ -687,6 +1100,39 @@ static void report_gatt_characteristic_value(gatt_client_t * peripheral, uint16_
     emit_event_new(peripheral->callback, packet, characteristic_value_event_header_size + length);
 }
 
+// Multiple Handle Value Notification: list of { handle, length, value }, one notification event per value
+// @note assume that packet is part of an l2cap buffer - events overwrite the previous tuple or the HCI/L2CAP/ATT packet headers
+static void report_gatt_multiple_notification(hci_con_handle_t con_handle, uint8_t * packet, uint16_t size){
+    uint16_t offset = 1;
+    while (offset + 4 <= size){
+        uint16_t value_handle = little_endian_read_16(packet, offset);
+        uint16_t value_length = little_endian_read_16(packet, offset + 2);
+        offset += 4;
+        if (offset + value_length > size){
+            log_error("report_gatt_multiple_notification: value for handle 0x%04x exceeds PDU", value_handle);
+            return;
+        }
+        report_gatt_notification(con_handle, value_handle, &packet[offset], value_length);
+        offset += value_length;
+    }
+}
+
+// Read Multiple Variable Response: list of { length, value }, one event per requested handle. Last value might be truncated
+// @note assume that packet is part of an l2cap buffer - events overwrite the previous tuple or the HCI/L2CAP/ATT packet headers
+static void report_gatt_multiple_variable_characteristic_values(gatt_client_t * peripheral, uint8_t * packet, uint16_t size){
+    uint16_t offset = 1;
+    int i;
+    for (i = 0; i < peripheral->read_multiple_handle_count && offset + 2 <= size; i++){
+        uint16_t value_length = little_endian_read_16(packet, offset);
+        offset += 2;
+        if (offset + value_length > size){
+            value_length = size - offset;
+        }
+        report_gatt_characteristic_value(peripheral, peripheral->read_multiple_handles[i], &packet[offset], value_length);
+        offset += value_length;
+    }
+}
+
 // @note assume that value is part of an l2cap buffer - overwrite parts of the HCI/L2CAP/ATT packet (4/4/3) bytes 
 static void report_gatt_long_characteristic_value_blob(gatt_client_t * peripheral, uint16_t attribute_handle, uint8_t * blob, uint16_t blob_length, int value_offset){
     uint8_t * packet = setup_long_characteristic_value_packet(GATT_EVENT_LONG_CHARACTERISTIC_VALUE_QUERY_RESULT, peripheral->con_handle, attribute_handle, value_offset, blob, blob_length);
@@ -719,6 +1165,9 @@ static void report_gatt_all_characteristic_descriptors(gatt_client_t * periphera
             reverse_128(&packet[i+2], uuid128);
         }        
         emit_gatt_all_characteristic_descriptors_result_event(peripheral, descriptor_handle, uuid128);
+#ifdef ENABLE_GATT_CLIENT_CACHE
+        gatt_client_cache_add_descriptor(peripheral, descriptor_handle, uuid128);
+#endif
     }
     
 }
@@ -832,7 +1281,40 @@ static void gatt_client_run(void){
             att_confirmation(peripheral->con_handle);
             return;
         }
-        
+
+#ifdef ENABLE_GATT_CLIENT_OPERATION_QUEUE
+        if (peripheral->operation_queue_len){
+            gatt_client_operation_t * operation = gatt_client_operation_queue_get(peripheral, 0);
+            if (operation->state == P_W2_SEND_WRITE_COMMAND){
+                // Write Commands don't have a response and are sent while waiting for the current one
+                gatt_client_operation_queue_remove_first(peripheral);
+                att_write_request(ATT_WRITE_COMMAND, peripheral->con_handle, operation->attribute_handle, operation->attribute_length, operation->write_command_value);
+                att_dispatch_client_request_can_send_now_event(peripheral->con_handle);
+                return;
+            }
+            if (is_ready(peripheral)){
+                // start next request right away
+                gatt_client_operation_queue_remove_first(peripheral);
+                peripheral->callback = operation->callback;
+                peripheral->attribute_handle = operation->attribute_handle;
+                peripheral->attribute_offset = operation->attribute_offset;
+                peripheral->attribute_length = operation->attribute_length;
+                peripheral->attribute_value  = operation->attribute_value;
+                peripheral->gatt_client_state = operation->state;
+                gatt_client_timeout_start(peripheral);
+                // send following Write Commands after this request
+                if (peripheral->operation_queue_len && gatt_client_operation_queue_get(peripheral, 0)->state == P_W2_SEND_WRITE_COMMAND){
+                    att_dispatch_client_request_can_send_now_event(peripheral->con_handle);
+                }
+            }
+        }
+#endif
+
+#ifdef ENABLE_GATT_CLIENT_CACHE
+        // current query is answered from cache by gatt_client_cache_report_handler
+        if (peripheral->cache_report_pending) continue;
+#endif
+
         // check MTU for writes
         switch (peripheral->gatt_client_state){
             case P_W2_SEND_WRITE_CHARACTERISTIC_VALUE:
@@ -903,6 +1385,11 @@ static void gatt_client_run(void){
                 send_gatt_read_multiple_request(peripheral);
                 break;
 
+            case P_W2_SEND_READ_MULTIPLE_VARIABLE_REQUEST:
+                peripheral->gatt_client_state = P_W4_READ_MULTIPLE_VARIABLE_RESPONSE;
+                send_gatt_read_multiple_variable_request(peripheral);
+                break;
+
             case P_W2_SEND_WRITE_CHARACTERISTIC_VALUE:
                 peripheral->gatt_client_state = P_W4_WRITE_CHARACTERISTIC_VALUE_RESULT;
                 send_gatt_write_attribute_value_request(peripheral);
@@ -1025,8 +1512,12 @@ static void gatt_client_hci_event_packet_handler(uint8_t packet_type, uint16_t c
             gatt_client_t * peripheral = get_gatt_client_context_for_handle(con_handle);
             if (!peripheral) break;
             gatt_client_report_error_if_pending(peripheral, ATT_ERROR_HCI_DISCONNECT_RECEIVED);
+#ifdef ENABLE_GATT_CLIENT_OPERATION_QUEUE
+            gatt_client_operation_queue_report_error(peripheral, ATT_ERROR_HCI_DISCONNECT_RECEIVED);
+#endif
             
             btstack_linked_list_remove(&gatt_client_connections, (btstack_linked_item_t *) peripheral);
+            btstack_hash_map_remove(&gatt_client_index, con_handle);
             btstack_memory_gatt_client_free(peripheral);
             break;
         }
@@ -1051,6 +1542,9 @@ static void gatt_client_att_packet_handler(uint8_t packet_type, uint16_t handle,
         case ATT_HANDLE_VALUE_NOTIFICATION:
             report_gatt_notification(handle, little_endian_read_16(packet,1), &packet[3], size-3);
             return;                
+        case ATT_MULTIPLE_HANDLE_VALUE_NOTIFICATION:
+            report_gatt_multiple_notification(handle, packet, size);
+            return;
         case ATT_HANDLE_VALUE_INDICATION:
             peripheral = provide_context_for_conn_handle(handle);
             break;
@@ -1083,6 +1577,9 @@ static void gatt_client_att_packet_handler(uint8_t packet_type, uint16_t handle,
             }
             break;
         case ATT_HANDLE_VALUE_INDICATION:
+#ifdef ENABLE_GATT_CLIENT_CACHE
+            gatt_client_cache_handle_indication(peripheral, little_endian_read_16(packet,1));
+#endif
             report_gatt_indication(handle, little_endian_read_16(packet,1), &packet[3], size-3);
             peripheral->send_confirmation = 1;
             break;
@@ -1316,6 +1813,18 @@ static void gatt_client_att_packet_handler(uint8_t packet_type, uint16_t handle,
             }
             break;
 
+        case ATT_READ_MULTIPLE_VARIABLE_RESPONSE:
+            switch(peripheral->gatt_client_state){
+                case P_W4_READ_MULTIPLE_VARIABLE_RESPONSE:
+                    report_gatt_multiple_variable_characteristic_values(peripheral, packet, size);
+                    gatt_client_handle_transaction_complete(peripheral);
+                    emit_gatt_complete_event(peripheral, 0);
+                    break;
+                default:
+                    break;
+            }
+            break;
+
         case ATT_ERROR_RESPONSE:
 
             switch (packet[4]){
@@ -1361,6 +1870,38 @@ static void gatt_client_att_packet_handler(uint8_t packet_type, uint16_t handle,
     gatt_client_run();
 }
 
+// start read or write operation, queue it with ENABLE_GATT_CLIENT_OPERATION_QUEUE if another one is active
+static uint8_t gatt_client_start_operation(gatt_client_t * peripheral, btstack_packet_handler_t callback, gatt_client_state_t state,
+    uint16_t attribute_handle, uint16_t attribute_offset, uint16_t attribute_length, uint8_t * attribute_value){
+#ifdef ENABLE_GATT_CLIENT_OPERATION_QUEUE
+    // keep order of requests
+    if (!is_ready(peripheral) || peripheral->operation_queue_len){
+        gatt_client_operation_t * operation = gatt_client_operation_queue_add(peripheral);
+        if (!operation) return GATT_CLIENT_BUSY;
+        operation->state = state;
+        operation->callback = callback;
+        operation->attribute_handle = attribute_handle;
+        operation->attribute_offset = attribute_offset;
+        operation->attribute_length = attribute_length;
+        operation->attribute_value  = attribute_value;
+        gatt_client_run();
+        return 0;
+    }
+#else
+    if (!is_ready(peripheral)) return GATT_CLIENT_IN_WRONG_STATE;
+#endif
+
+    peripheral->callback = callback;
+    peripheral->attribute_handle = attribute_handle;
+    peripheral->attribute_offset = attribute_offset;
+    peripheral->attribute_length = attribute_length;
+    peripheral->attribute_value  = attribute_value;
+    peripheral->gatt_client_state = state;
+    gatt_client_timeout_start(peripheral);
+    gatt_client_run();
+    return 0;
+}
+
 #ifdef ENABLE_LE_SIGNED_WRITE
 static void att_signed_write_handle_cmac_result(uint8_t hash[8]){
     btstack_linked_list_iterator_t it;
@@ -1405,6 +1946,9 @@ uint8_t gatt_client_discover_primary_services(btstack_packet_handler_t callback,
     peripheral->end_group_handle   = 0xffff;
     peripheral->gatt_client_state = P_W2_SEND_SERVICE_QUERY;
     peripheral->uuid16 = 0;
+#ifdef ENABLE_GATT_CLIENT_CACHE
+    if (gatt_client_cache_request_report(peripheral)) return 0;
+#endif
     gatt_client_run();
     return 0;
 }
@@ -1422,6 +1966,9 @@ uint8_t gatt_client_discover_primary_services_by_uuid16(btstack_packet_handler_t
     peripheral->gatt_client_state = P_W2_SEND_SERVICE_WITH_UUID_QUERY;
     peripheral->uuid16 = uuid16;
     uuid_add_bluetooth_prefix((uint8_t*) &(peripheral->uuid128), peripheral->uuid16);
+#ifdef ENABLE_GATT_CLIENT_CACHE
+    if (gatt_client_cache_request_report(peripheral)) return 0;
+#endif
     gatt_client_run();
     return 0;
 }
@@ -1438,6 +1985,9 @@ uint8_t gatt_client_discover_primary_services_by_uuid128(btstack_packet_handler_
     peripheral->uuid16 = 0;
     memcpy(peripheral->uuid128, uuid128, 16);
     peripheral->gatt_client_state = P_W2_SEND_SERVICE_WITH_UUID_QUERY;
+#ifdef ENABLE_GATT_CLIENT_CACHE
+    if (gatt_client_cache_request_report(peripheral)) return 0;
+#endif
     gatt_client_run();
     return 0;
 }
@@ -1454,6 +2004,9 @@ uint8_t gatt_client_discover_characteristics_for_service(btstack_packet_handler_
     peripheral->filter_with_uuid = 0;
     peripheral->characteristic_start_handle = 0;
     peripheral->gatt_client_state = P_W2_SEND_ALL_CHARACTERISTICS_OF_SERVICE_QUERY;
+#ifdef ENABLE_GATT_CLIENT_CACHE
+    if (gatt_client_cache_request_report(peripheral)) return 0;
+#endif
     gatt_client_run();
     return 0;
 }
@@ -1488,6 +2041,9 @@ uint8_t gatt_client_discover_characteristics_for_handle_range_by_uuid16(btstack_
     peripheral->characteristic_start_handle = 0;
     peripheral->gatt_client_state = P_W2_SEND_CHARACTERISTIC_WITH_UUID_QUERY;
     
+#ifdef ENABLE_GATT_CLIENT_CACHE
+    if (gatt_client_cache_request_report(peripheral)) return 0;
+#endif
     gatt_client_run();
     return 0;
 }
@@ -1507,6 +2063,9 @@ uint8_t gatt_client_discover_characteristics_for_handle_range_by_uuid128(btstack
     peripheral->characteristic_start_handle = 0;
     peripheral->gatt_client_state = P_W2_SEND_CHARACTERISTIC_WITH_UUID_QUERY;
     
+#ifdef ENABLE_GATT_CLIENT_CACHE
+    if (gatt_client_cache_request_report(peripheral)) return 0;
+#endif
     gatt_client_run();
     return 0;
 }
@@ -1535,22 +2094,17 @@ uint8_t gatt_client_discover_characteristic_descriptors(btstack_packet_handler_t
     peripheral->end_group_handle   = characteristic->end_handle;
     peripheral->gatt_client_state = P_W2_SEND_ALL_CHARACTERISTIC_DESCRIPTORS_QUERY;
     
+#ifdef ENABLE_GATT_CLIENT_CACHE
+    if (gatt_client_cache_request_report(peripheral)) return 0;
+#endif
     gatt_client_run();
     return 0;
 }
 
 uint8_t gatt_client_read_value_of_characteristic_using_value_handle(btstack_packet_handler_t callback, hci_con_handle_t con_handle, uint16_t value_handle){
-    gatt_client_t * peripheral = provide_context_for_conn_handle_and_start_timer(con_handle);
-    
+    gatt_client_t * peripheral = provide_context_for_conn_handle(con_handle);
     if (!peripheral) return BTSTACK_MEMORY_ALLOC_FAILED; 
-    if (!is_ready(peripheral)) return GATT_CLIENT_IN_WRONG_STATE;
-    
-    peripheral->callback = callback;
-    peripheral->attribute_handle = value_handle;
-    peripheral->attribute_offset = 0;
-    peripheral->gatt_client_state = P_W2_SEND_READ_CHARACTERISTIC_VALUE_QUERY;
-    gatt_client_run();
-    return 0;
+    return gatt_client_start_operation(peripheral, callback, P_W2_SEND_READ_CHARACTERISTIC_VALUE_QUERY, value_handle, 0, 0, NULL);
 }
 
 uint8_t gatt_client_read_value_of_characteristics_by_uuid16(btstack_packet_handler_t callback, hci_con_handle_t con_handle, uint16_t start_handle, uint16_t end_handle, uint16_t uuid16){
@@ -1595,17 +2149,9 @@ uint8_t gatt_client_read_value_of_characteristic(btstack_packet_handler_t callba
 }
 
 uint8_t gatt_client_read_long_value_of_characteristic_using_value_handle_with_offset(btstack_packet_handler_t callback, hci_con_handle_t con_handle, uint16_t characteristic_value_handle, uint16_t offset){
-    gatt_client_t * peripheral = provide_context_for_conn_handle_and_start_timer(con_handle);
-    
+    gatt_client_t * peripheral = provide_context_for_conn_handle(con_handle);
     if (!peripheral) return BTSTACK_MEMORY_ALLOC_FAILED; 
-    if (!is_ready(peripheral)) return GATT_CLIENT_IN_WRONG_STATE;
-    
-    peripheral->callback = callback;
-    peripheral->attribute_handle = characteristic_value_handle;
-    peripheral->attribute_offset = offset;
-    peripheral->gatt_client_state = P_W2_SEND_READ_BLOB_QUERY;
-    gatt_client_run();
-    return 0;
+    return gatt_client_start_operation(peripheral, callback, P_W2_SEND_READ_BLOB_QUERY, characteristic_value_handle, offset, 0, NULL);
 }
 
 uint8_t gatt_client_read_long_value_of_characteristic_using_value_handle(btstack_packet_handler_t callback, hci_con_handle_t con_handle, uint16_t characteristic_value_handle){
@@ -1630,48 +2176,59 @@ uint8_t gatt_client_read_multiple_characteristic_values(btstack_packet_handler_t
     return 0;
 }
 
+uint8_t gatt_client_read_multiple_variable_characteristic_values(btstack_packet_handler_t callback, hci_con_handle_t con_handle, int num_value_handles, uint16_t * value_handles){
+    gatt_client_t * peripheral = provide_context_for_conn_handle_and_start_timer(con_handle);
+    
+    if (!peripheral) return BTSTACK_MEMORY_ALLOC_FAILED; 
+    if (!is_ready(peripheral)) return GATT_CLIENT_IN_WRONG_STATE;
+    
+    peripheral->callback = callback;
+    peripheral->read_multiple_handle_count = num_value_handles;
+    peripheral->read_multiple_handles = value_handles;
+    peripheral->gatt_client_state = P_W2_SEND_READ_MULTIPLE_VARIABLE_REQUEST;
+    gatt_client_run();
+    return 0;
+}
+
 uint8_t gatt_client_write_value_of_characteristic_without_response(hci_con_handle_t con_handle, uint16_t value_handle, uint16_t value_length, uint8_t * value){
     gatt_client_t * peripheral = provide_context_for_conn_handle(con_handle);
     
     if (!peripheral) return BTSTACK_MEMORY_ALLOC_FAILED; 
+#ifdef ENABLE_GATT_CLIENT_OPERATION_QUEUE
+    if (value_length > peripheral_mtu(peripheral) - 3) return GATT_CLIENT_VALUE_TOO_LONG;
+    // Write Commands can be sent while waiting for a response, queue them to keep order with queued requests
+    if (peripheral->operation_queue_len || !att_dispatch_client_can_send_now(peripheral->con_handle)){
+        if (value_length > GATT_CLIENT_WRITE_COMMAND_VALUE_SIZE) return GATT_CLIENT_VALUE_TOO_LONG;
+        gatt_client_operation_t * operation = gatt_client_operation_queue_add(peripheral);
+        if (!operation) return GATT_CLIENT_BUSY;
+        operation->state = P_W2_SEND_WRITE_COMMAND;
+        operation->attribute_handle = value_handle;
+        operation->attribute_length = value_length;
+        memcpy(operation->write_command_value, value, value_length);
+        gatt_client_run();
+        return 0;
+    }
+#else
     if (!is_ready(peripheral)) return GATT_CLIENT_IN_WRONG_STATE;
     
     if (value_length > peripheral_mtu(peripheral) - 3) return GATT_CLIENT_VALUE_TOO_LONG;
     if (!att_dispatch_client_can_send_now(peripheral->con_handle)) return GATT_CLIENT_BUSY;
+#endif
 
     att_write_request(ATT_WRITE_COMMAND, peripheral->con_handle, value_handle, value_length, value);
     return 0;
 }
 
 uint8_t gatt_client_write_value_of_characteristic(btstack_packet_handler_t callback, hci_con_handle_t con_handle, uint16_t value_handle, uint16_t value_length, uint8_t * data){
-    gatt_client_t * peripheral = provide_context_for_conn_handle_and_start_timer(con_handle);
-    
+    gatt_client_t * peripheral = provide_context_for_conn_handle(con_handle);
     if (!peripheral) return BTSTACK_MEMORY_ALLOC_FAILED; 
-    if (!is_ready(peripheral)) return GATT_CLIENT_IN_WRONG_STATE;
-    
-    peripheral->callback = callback;
-    peripheral->attribute_handle = value_handle;
-    peripheral->attribute_length = value_length;
-    peripheral->attribute_value = data;
-    peripheral->gatt_client_state = P_W2_SEND_WRITE_CHARACTERISTIC_VALUE;
-    gatt_client_run();
-    return 0;
+    return gatt_client_start_operation(peripheral, callback, P_W2_SEND_WRITE_CHARACTERISTIC_VALUE, value_handle, 0, value_length, data);
 }
 
 uint8_t gatt_client_write_long_value_of_characteristic_with_offset(btstack_packet_handler_t callback, hci_con_handle_t con_handle, uint16_t value_handle, uint16_t offset, uint16_t value_length, uint8_t  * data){
-    gatt_client_t * peripheral = provide_context_for_conn_handle_and_start_timer(con_handle);
-    
+    gatt_client_t * peripheral = provide_context_for_conn_handle(con_handle);
     if (!peripheral) return BTSTACK_MEMORY_ALLOC_FAILED; 
-    if (!is_ready(peripheral)) return GATT_CLIENT_IN_WRONG_STATE;
-    
-    peripheral->callback = callback;
-    peripheral->attribute_handle = value_handle;
-    peripheral->attribute_length = value_length;
-    peripheral->attribute_offset = offset;
-    peripheral->attribute_value = data;
-    peripheral->gatt_client_state = P_W2_PREPARE_WRITE;
-    gatt_client_run();
-    return 0;
+    return gatt_client_start_operation(peripheral, callback, P_W2_PREPARE_WRITE, value_handle, offset, value_length, data);
 }
 
 uint8_t gatt_client_write_long_value_of_characteristic(btstack_packet_handler_t callback, hci_con_handle_t con_handle, uint16_t value_handle, uint16_t value_length, uint8_t * value){
@@ -1721,17 +2278,9 @@ uint8_t gatt_client_write_client_characteristic_configuration(btstack_packet_han
 }
 
 uint8_t gatt_client_read_characteristic_descriptor_using_descriptor_handle(btstack_packet_handler_t callback, hci_con_handle_t con_handle, uint16_t descriptor_handle){
-    gatt_client_t * peripheral = provide_context_for_conn_handle_and_start_timer(con_handle);
-    
+    gatt_client_t * peripheral = provide_context_for_conn_handle(con_handle);
     if (!peripheral) return BTSTACK_MEMORY_ALLOC_FAILED; 
-    if (!is_ready(peripheral)) return GATT_CLIENT_IN_WRONG_STATE;
-    
-    peripheral->callback = callback;
-    peripheral->attribute_handle = descriptor_handle;
-    
-    peripheral->gatt_client_state = P_W2_SEND_READ_CHARACTERISTIC_DESCRIPTOR_QUERY;
-    gatt_client_run();
-    return 0;
+    return gatt_client_start_operation(peripheral, callback, P_W2_SEND_READ_CHARACTERISTIC_DESCRIPTOR_QUERY, descriptor_handle, 0, 0, NULL);
 }
 
 uint8_t gatt_client_read_characteristic_descriptor(btstack_packet_handler_t callback, hci_con_handle_t con_handle, gatt_client_characteristic_descriptor_t * descriptor){
@@ -1739,17 +2288,9 @@ uint8_t gatt_client_read_characteristic_descriptor(btstack_packet_handler_t call
 }
 
 uint8_t gatt_client_read_long_characteristic_descriptor_using_descriptor_handle_with_offset(btstack_packet_handler_t callback, hci_con_handle_t con_handle, uint16_t descriptor_handle, uint16_t offset){
-    gatt_client_t * peripheral = provide_context_for_conn_handle_and_start_timer(con_handle);
-    
+    gatt_client_t * peripheral = provide_context_for_conn_handle(con_handle);
     if (!peripheral) return BTSTACK_MEMORY_ALLOC_FAILED; 
-    if (!is_ready(peripheral)) return GATT_CLIENT_IN_WRONG_STATE;
-    
-    peripheral->callback = callback;
-    peripheral->attribute_handle = descriptor_handle;
-    peripheral->attribute_offset = offset;
-    peripheral->gatt_client_state = P_W2_SEND_READ_BLOB_CHARACTERISTIC_DESCRIPTOR_QUERY;
-    gatt_client_run();
-    return 0;
+    return gatt_client_start_operation(peripheral, callback, P_W2_SEND_READ_BLOB_CHARACTERISTIC_DESCRIPTOR_QUERY, descriptor_handle, offset, 0, NULL);
 }
 
 uint8_t gatt_client_read_long_characteristic_descriptor_using_descriptor_handle(btstack_packet_handler_t callback, hci_con_handle_t con_handle, uint16_t descriptor_handle){
@@ -1761,19 +2302,9 @@ uint8_t gatt_client_read_long_characteristic_descriptor(btstack_packet_handler_t
 }
 
 uint8_t gatt_client_write_characteristic_descriptor_using_descriptor_handle(btstack_packet_handler_t callback, hci_con_handle_t con_handle, uint16_t descriptor_handle, uint16_t length, uint8_t  * data){
-    gatt_client_t * peripheral = provide_context_for_conn_handle_and_start_timer(con_handle);
-    
+    gatt_client_t * peripheral = provide_context_for_conn_handle(con_handle);
     if (!peripheral) return BTSTACK_MEMORY_ALLOC_FAILED; 
-    if (!is_ready(peripheral)) return GATT_CLIENT_IN_WRONG_STATE;
-    
-    peripheral->callback = callback;
-    peripheral->attribute_handle = descriptor_handle;
-    peripheral->attribute_length = length;
-    peripheral->attribute_offset = 0;
-    peripheral->attribute_value = data;
-    peripheral->gatt_client_state = P_W2_SEND_WRITE_CHARACTERISTIC_DESCRIPTOR;
-    gatt_client_run();
-    return 0;
+    return gatt_client_start_operation(peripheral, callback, P_W2_SEND_WRITE_CHARACTERISTIC_DESCRIPTOR, descriptor_handle, 0, length, data);
 }
 
 uint8_t gatt_client_write_characteristic_descriptor(btstack_packet_handler_t callback, hci_con_handle_t con_handle, gatt_client_characteristic_descriptor_t * descriptor, uint16_t length, uint8_t * value){
@@ -1781,19 +2312,9 @@ uint8_t gatt_client_write_characteristic_descriptor(btstack_packet_handler_t cal
 }
 
 uint8_t gatt_client_write_long_characteristic_descriptor_using_descriptor_handle_with_offset(btstack_packet_handler_t callback, hci_con_handle_t con_handle, uint16_t descriptor_handle, uint16_t offset, uint16_t length, uint8_t  * data){
-    gatt_client_t * peripheral = provide_context_for_conn_handle_and_start_timer(con_handle);
-    
+    gatt_client_t * peripheral = provide_context_for_conn_handle(con_handle);
     if (!peripheral) return BTSTACK_MEMORY_ALLOC_FAILED; 
-    if (!is_ready(peripheral)) return GATT_CLIENT_IN_WRONG_STATE;
-    
-    peripheral->callback = callback;
-    peripheral->attribute_handle = descriptor_handle;
-    peripheral->attribute_length = length;
-    peripheral->attribute_offset = offset;
-    peripheral->attribute_value = data;
-    peripheral->gatt_client_state = P_W2_PREPARE_WRITE_CHARACTERISTIC_DESCRIPTOR;
-    gatt_client_run();
-    return 0;
+    return gatt_client_start_operation(peripheral, callback, P_W2_PREPARE_WRITE_CHARACTERISTIC_DESCRIPTOR, descriptor_handle, offset, length, data);
 }
 
 uint8_t gatt_client_write_long_characteristic_descriptor_using_descriptor_handle(btstack_packet_handler_t callback, hci_con_handle_t con_handle, uint16_t descriptor_handle, uint16_t length, uint8_t * data){
@@ -40,6 +40,7 @@
 #define btstack_gatt_client_h
 
 #include "hci.h"
+#include "btstack_tlv.h"
 
 #if defined __cplusplus
 extern "C" {
@@ -77,6 +78,9 @@ typedef enum {
     P_W2_SEND_READ_MULTIPLE_REQUEST,
     P_W4_READ_MULTIPLE_RESPONSE,
 
+    P_W2_SEND_READ_MULTIPLE_VARIABLE_REQUEST,
+    P_W4_READ_MULTIPLE_VARIABLE_RESPONSE,
+
     P_W2_SEND_WRITE_CHARACTERISTIC_VALUE,
     P_W4_WRITE_CHARACTERISTIC_VALUE_RESULT,
     
@@ -120,6 +124,9 @@ typedef enum {
     P_W4_CMAC_RESULT,
     P_W2_SEND_SIGNED_WRITE,
     P_W4_SEND_SINGED_WRITE_DONE,
+
+    // only used for queued operations
+    P_W2_SEND_WRITE_COMMAND,
 } gatt_client_state_t;
     
     
@@ -129,6 +136,30 @@ typedef enum{
     MTU_EXCHANGED
 } gatt_client_mtu_t;
 
+#ifdef ENABLE_GATT_CLIENT_OPERATION_QUEUE
+
+#ifndef GATT_CLIENT_OPERATION_QUEUE_SIZE
+#define GATT_CLIENT_OPERATION_QUEUE_SIZE 8
+#endif
+
+#ifndef GATT_CLIENT_WRITE_COMMAND_VALUE_SIZE
+#define GATT_CLIENT_WRITE_COMMAND_VALUE_SIZE (ATT_DEFAULT_MTU - 3)
+#endif
+
+// read or write operation queued while another one is active
+typedef struct {
+    gatt_client_state_t      state;
+    btstack_packet_handler_t callback;
+    uint16_t attribute_handle;
+    uint16_t attribute_offset;
+    uint16_t attribute_length;
+    uint8_t* attribute_value;
+    // value of Write Command is copied
+    uint8_t  write_command_value[GATT_CLIENT_WRITE_COMMAND_VALUE_SIZE];
+} gatt_client_operation_t;
+
+#endif
+
 typedef struct gatt_client{
     btstack_linked_item_t    item;
     // TODO: rename gatt_client_state -> state
@@ -174,6 +205,21 @@ typedef struct gatt_client{
     int      le_device_index;
     uint8_t  cmac[8];
 
+#ifdef ENABLE_GATT_CLIENT_CACHE
+    // discovery query recorded in cache
+    uint8_t  cache_query;
+    uint8_t  cache_query_index;
+    uint8_t  cache_query_num_entries;
+    uint8_t  cache_query_overflow;
+    uint8_t  cache_report_pending;
+#endif
+
+#ifdef ENABLE_GATT_CLIENT_OPERATION_QUEUE
+    gatt_client_operation_t operation_queue[GATT_CLIENT_OPERATION_QUEUE_SIZE];
+    uint8_t  operation_queue_first;
+    uint8_t  operation_queue_len;
+#endif
+
     btstack_timer_source_t gc_timeout;
 } gatt_client_t;
 
@@ -220,6 +266,9 @@ uint8_t gatt_client_get_mtu(hci_con_handle_t con_handle, uint16_t * mtu);
 
 /** 
  * @brief Returns if the GATT client is ready to receive a query. It is used with daemon. 
+ * @note With ENABLE_GATT_CLIENT_OPERATION_QUEUE, the read and write functions for a single value or descriptor are
+ *       queued while another query is active and started in order, up to GATT_CLIENT_OPERATION_QUEUE_SIZE per connection.
+ *       GATT_CLIENT_BUSY is returned if the queue is full.
  */
 int gatt_client_is_ready(hci_con_handle_t con_handle);
 
@@ -283,8 +332,20 @@ uint8_t gatt_client_read_long_value_of_characteristic_using_value_handle_with_of
  */
 uint8_t gatt_client_read_multiple_characteristic_values(btstack_packet_handler_t callback, hci_con_handle_t con_handle, int num_value_handles, uint16_t * value_handles);
 
+/*
+ * @brief Read multiple characteristic values with variable length using Read Multiple Variable Request. For each value,
+ *        an le_characteristic_value_event_t with type set to GATT_EVENT_CHARACTERISTIC_VALUE_QUERY_RESULT and the value handle
+ *        will be generated and passed to the registered callback. Values that exceed the MTU are truncated, values that don't fit at all are not reported.
+ *        The gatt_complete_event_t with type set to GATT_EVENT_QUERY_COMPLETE, marks the end of read.
+ * @param number handles
+ * @param list_of_handles list of handles, needs to stay valid until query is complete
+ */
+uint8_t gatt_client_read_multiple_variable_characteristic_values(btstack_packet_handler_t callback, hci_con_handle_t con_handle, int num_value_handles, uint16_t * value_handles);
+
 /** 
  * @brief Writes the characteristic value using the characteristic's value handle without an acknowledgment that the write was successfully performed.
+ * @note With ENABLE_GATT_CLIENT_OPERATION_QUEUE, the value is copied and queued if it cannot be sent now, and sent while waiting for the response to a previous request.
+ *       A value that needs to be queued but is longer than GATT_CLIENT_WRITE_COMMAND_VALUE_SIZE is rejected with GATT_CLIENT_VALUE_TOO_LONG.
  */
 uint8_t gatt_client_write_value_of_characteristic_without_response(hci_con_handle_t con_handle, uint16_t characteristic_value_handle, uint16_t length, uint8_t  * data);
 
@@ -362,6 +423,24 @@ uint8_t gatt_client_execute_write(btstack_packet_handler_t callback, hci_con_han
  */
 uint8_t gatt_client_cancel_write(btstack_packet_handler_t callback, hci_con_handle_t con_handle);
 
+#ifdef ENABLE_GATT_CLIENT_CACHE
+/**
+ * @brief Configure cache for services, characteristics and descriptors of bonded devices stored in btstack_tlv.
+ *        Complete discovery of all primary services, all characteristics of a service, and all descriptors of a characteristic
+ *        is recorded and answered from the cache on the next connection. The cache of a device is deleted when an indication
+ *        for its Service Changed characteristic is received, which therefore needs to be discovered and cached, too.
+ * @param btstack_tlv_impl to use
+ * @param btstack_tlv_context
+ */
+void gatt_client_cache_configure(const btstack_tlv_t * btstack_tlv_impl, void * btstack_tlv_context);
+
+/**
+ * @brief Delete cache for bonded device, e.g. after bonding information has been removed
+ * @param le_device_index
+ */
+void gatt_client_cache_delete(int le_device_index);
+#endif
+
 /* API_END */
 
 // used by generated btstack_event.c
@@ -188,6 +188,12 @@ void le_device_db_local_counter_set(int index, uint32_t counter);
  */
 void le_device_db_remove(int index);
 
+/**
+ * @brief set callback for devices added to or removed from db, used by Security Manager to flush its resolving cache
+ * @param callback
+ */
+void le_device_db_set_changed_callback(void (*callback)(void));
+
 void le_device_db_dump(void);
 
 /* API_END */
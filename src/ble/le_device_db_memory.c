@@ -84,6 +84,16 @@ typedef struct le_device_memory_db {
 #endif
 
 static le_device_memory_db_t le_devices[MAX_NR_LE_DEVICE_DB_ENTRIES];
+static void (*le_device_db_changed_callback)(void);
+
+static void le_device_db_emit_changed(void){
+    if (!le_device_db_changed_callback) return;
+    (*le_device_db_changed_callback)();
+}
+
+void le_device_db_set_changed_callback(void (*callback)(void)){
+    le_device_db_changed_callback = callback;
+}
 
 void le_device_db_init(void){
     int i;
@@ -109,6 +119,7 @@ int le_device_db_count(void){
 // free device
 void le_device_db_remove(int index){
     le_devices[index].addr_type = INVALID_ENTRY_ADDR_TYPE;
+    le_device_db_emit_changed();
 }
 
 int le_device_db_add(int addr_type, bd_addr_t addr, sm_key_t irk){
@@ -132,6 +143,7 @@ int le_device_db_add(int addr_type, bd_addr_t addr, sm_key_t irk){
 #ifdef ENABLE_LE_SIGNED_WRITE
     le_devices[index].remote_counter = 0; 
 #endif
+    le_device_db_emit_changed();
     return index;
 }
 
@@ -91,6 +91,7 @@ typedef struct le_device_db_entry_t {
 #endif
 
 static uint8_t  entry_map[NVM_NUM_DEVICE_DB_ENTRIES];
+static void (*le_device_db_changed_callback)(void);
 static uint32_t num_valid_entries;
 
 static const btstack_tlv_t * le_device_db_tlv_btstack_tlv_impl;
@@ -106,6 +107,11 @@ static uint32_t le_device_db_tlv_tag_for_index(uint8_t index){
 
 // @returns success
 // @param index = entry_pos
+static void le_device_db_emit_changed(void){
+    if (!le_device_db_changed_callback) return;
+    (*le_device_db_changed_callback)();
+}
+
 static int le_device_db_tlv_fetch(int index, le_device_db_entry_t * entry){
     if (index < 0 || index >= NVM_NUM_DEVICE_DB_ENTRIES){
 	    log_error("le_device_db_tlv_fetch called with invalid index %d", index);
@@ -196,6 +202,8 @@ void le_device_db_remove(int index){
 
     // keep track
     num_valid_entries--;
+
+    le_device_db_emit_changed();
 }
 
 int le_device_db_add(int addr_type, bd_addr_t addr, sm_key_t irk){
@@ -250,6 +258,7 @@ int le_device_db_add(int addr_type, bd_addr_t addr, sm_key_t irk){
     // keep track
     num_valid_entries++;
 
+    le_device_db_emit_changed();
     return index;
 }
 
@@ -433,6 +442,10 @@ void le_device_db_dump(void){
     }
 }
 
+void le_device_db_set_changed_callback(void (*callback)(void)){
+    le_device_db_changed_callback = callback;
+}
+
 void le_device_db_tlv_configure(const btstack_tlv_t * btstack_tlv_impl, void * btstack_tlv_context){
 	le_device_db_tlv_btstack_tlv_impl = btstack_tlv_impl;
 	le_device_db_tlv_btstack_tlv_context = btstack_tlv_context;
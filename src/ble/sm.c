@@ -45,6 +45,7 @@
 #include "ble/core.h"
 #include "ble/sm.h"
 #include "bluetooth_company_id.h"
+#include "btstack_aes128.h"
 #include "btstack_debug.h"
 #include "btstack_event.h"
 #include "btstack_linked_list.h"
@@ -70,6 +71,39 @@
 #endif
 #endif
 
+// configure AES128 implementation: HCI LE Encrypt, platform engine or software implementation
+#if defined(ENABLE_SOFTWARE_AES128) && defined(HAVE_AES128)
+#error "Both HAVE_AES128 and ENABLE_SOFTWARE_AES128 defined. Please use only one of them in btstack_config.h"
+#endif
+#if defined(ENABLE_SOFTWARE_AES128) || defined(HAVE_AES128)
+#define USE_HOST_AES128_IMPLEMENTATION
+#endif
+
+// number of connections that can be paired concurrently, each needs its own setup context
+#ifndef SM_SETUP_CONTEXT_NUM
+#ifdef MAX_NR_HCI_CONNECTIONS
+#define SM_SETUP_CONTEXT_NUM MAX_NR_HCI_CONNECTIONS
+#else
+#define SM_SETUP_CONTEXT_NUM 4
+#endif
+#endif
+#if SM_SETUP_CONTEXT_NUM < 1
+#error "SM_SETUP_CONTEXT_NUM must be at least 1"
+#endif
+
+// resolving cache: recently resolved random addresses with their LE Device DB index
+#ifndef SM_RESOLVING_CACHE_SIZE
+#define SM_RESOLVING_CACHE_SIZE 8
+#endif
+#ifndef SM_RESOLVING_CACHE_TIMEOUT_MS
+#define SM_RESOLVING_CACHE_TIMEOUT_MS (15 * 60 * 1000L)
+#endif
+
+// max number of ah() calculations per run loop iteration with AES128 on the host
+#ifndef SM_ADDRESS_RESOLUTION_BATCH_SIZE
+#define SM_ADDRESS_RESOLUTION_BATCH_SIZE 16
+#endif
+
 #ifdef ENABLE_LE_SECURE_CONNECTIONS
 // assert SM Public Key can be sent/received
 #if HCI_ACL_PAYLOAD_SIZE < 69
@@ -174,6 +208,14 @@ typedef enum {
     ADDRESS_RESOLUTION_FAILED,
 } address_resolution_event_t;
 
+typedef struct {
+    bd_addr_t address;
+    int       le_db_index;      // -1 if address could not be resolved
+    sm_key_t  irk;              // IRK of matched device, used to verify LE Device DB entry
+    uint32_t  timestamp_ms;     // time of last use
+    uint8_t   valid;
+} sm_resolving_cache_entry_t;
+
 typedef enum {
     EC_KEY_GENERATION_IDLE,
     EC_KEY_GENERATION_ACTIVE,
@@ -257,20 +299,26 @@ static bd_addr_t sm_address_resolution_address;
 static void *    sm_address_resolution_context;
 static address_resolution_mode_t sm_address_resolution_mode;
 static btstack_linked_list_t sm_address_resolution_general_queue;
+static uint32_t  sm_address_resolution_start_ms;
+static sm_address_resolution_statistics_t sm_address_resolution_statistics;
+static sm_resolving_cache_entry_t sm_resolving_cache[SM_RESOLVING_CACHE_SIZE];
+#ifdef USE_HOST_AES128_IMPLEMENTATION
+static btstack_timer_source_t sm_address_resolution_timer;
+#endif
 
 // aes128 crypto engine. store current sm_connection_t in sm_aes128_context
 static sm_aes128_state_t  sm_aes128_state;
 static void *             sm_aes128_context;
 
-// use aes128 provided by MCU - not needed usually
-#ifdef HAVE_AES128
+// use aes128 provided by MCU or software implementation instead of HCI LE Encrypt
+#ifdef USE_HOST_AES128_IMPLEMENTATION
 static uint8_t                aes128_result_flipped[16];
 static btstack_timer_source_t aes128_timer;
-void btstack_aes128_calc(uint8_t * key, uint8_t * plaintext, uint8_t * result);
 #endif
 
 // random engine. store context (ususally sm_connection_t)
 static void * sm_random_context;
+static int    sm_random_active;
 
 // to receive hci events
 static btstack_packet_callback_registration_t hci_event_callback_registration;
@@ -302,8 +350,8 @@ typedef struct sm_setup_context {
 
     btstack_timer_source_t sm_timeout;
 
-    // used in all phases
-    uint8_t   sm_pairing_failed_reason;
+    // connection that uses this context, HCI_CON_HANDLE_INVALID if free
+    hci_con_handle_t sm_con_handle;
 
     // user response, (Phase 1 and/or 2)
     uint8_t   sm_user_response;
@@ -336,7 +384,7 @@ typedef struct sm_setup_context {
     uint8_t   sm_peer_q[64];    // also stores random for EC key generation during init
     sm_key_t  sm_peer_nonce;    // might be combined with sm_peer_random
     sm_key_t  sm_local_nonce;   // might be combined with sm_local_random
-    sm_key_t  sm_dhkey;
+    uint8_t   sm_dhkey[32];
     sm_key_t  sm_peer_dhkey_check;
     sm_key_t  sm_local_dhkey_check;
     sm_key_t  sm_ra;
@@ -371,12 +419,22 @@ typedef struct sm_setup_context {
 
 } sm_setup_context_t;
 
-//
-static sm_setup_context_t the_setup;
-static sm_setup_context_t * setup = &the_setup;
+// setup contexts - one for each connection that is currently pairing
+static sm_setup_context_t sm_setup_contexts[SM_SETUP_CONTEXT_NUM];
 
-// active connection - the one for which the_setup is used for
-static uint16_t sm_active_connection_handle = HCI_CON_HANDLE_INVALID;
+// current setup context - selected by sm_get_connection_for_handle and when serving a connection in sm_run
+static sm_setup_context_t * setup = &sm_setup_contexts[0];
+
+// round-robin: index of setup context to serve first in next sm_run
+static int sm_setup_context_next;
+
+// set if a setup context was released while serving connections
+static int sm_setup_context_released;
+
+#if defined(ENABLE_LE_SECURE_CONNECTIONS) && !defined(USE_SOFTWARE_ECDH_IMPLEMENTATION)
+// connection that waits for HCI LE Generate DHKey Complete, Controller only handles one at a time
+static hci_con_handle_t sm_generate_dhkey_con_handle = HCI_CON_HANDLE_INVALID;
+#endif
 
 // @returns 1 if oob data is available
 // stores oob data in provided 16 byte buffer if not null
@@ -518,12 +576,18 @@ static void gap_random_address_update_stop(void){
 }
 
 
+static int sm_random_ready(void){
+    return sm_random_active == 0;
+}
+
+// pre: sm_random_ready() == 1, hci_can_send_command == 1
 static void sm_random_start(void * context){
+    sm_random_active = 1;
     sm_random_context = context;
     hci_send_cmd(&hci_le_rand);
 }
 
-#ifdef HAVE_AES128
+#ifdef USE_HOST_AES128_IMPLEMENTATION
 static void aes128_completed(btstack_timer_source_t * ts){
     UNUSED(ts);
     sm_handle_encryption_result(&aes128_result_flipped[0]);
@@ -537,7 +601,7 @@ static void sm_aes128_start(sm_key_t key, sm_key_t plaintext, void * context){
     sm_aes128_state = SM_AES128_ACTIVE;
     sm_aes128_context = context;
 
-#ifdef HAVE_AES128
+#ifdef USE_HOST_AES128_IMPLEMENTATION
     // calc result directly
     sm_key_t result;
     btstack_aes128_calc(key, plaintext, result);
@@ -744,6 +808,9 @@ static void sm_setup_event_base(uint8_t * event, int event_size, uint8_t type, h
 static void sm_dispatch_event(uint8_t packet_type, uint16_t channel, uint8_t * packet, uint16_t size){
     UNUSED(channel);
 
+    // event handlers may call SM functions for other connections, restore current setup context afterwards
+    sm_setup_context_t * current_setup = setup;
+
     // log event
     hci_dump_packet(packet_type, 1, packet, size);
     // dispatch to all event handlers
@@ -753,6 +820,7 @@ static void sm_dispatch_event(uint8_t packet_type, uint16_t channel, uint8_t * p
         btstack_packet_callback_registration_t * entry = (btstack_packet_callback_registration_t*) btstack_linked_list_iterator_next(&it);
         entry->callback(packet_type, 0, packet, size);
     }
+    setup = current_setup;
 }
 
 static void sm_notify_client_base(uint8_t type, hci_con_handle_t con_handle, uint8_t addr_type, bd_addr_t address){
@@ -884,13 +952,118 @@ static int sm_address_resolution_idle(void){
     return sm_address_resolution_mode == ADDRESS_RESOLUTION_IDLE;
 }
 
+static void sm_address_resolution_handle_event(address_resolution_event_t event);
+
+// Resolving cache for random addresses
+// - flushed whenever a device is added to or removed from the LE Device DB
+// - entries for resolved addresses are only used if the LE Device DB entry is valid and has the same IRK
+
+static void sm_resolving_cache_flush(void){
+    memset(sm_resolving_cache, 0, sizeof(sm_resolving_cache));
+}
+
+static int sm_resolving_cache_entry_matches_le_device_db(sm_resolving_cache_entry_t * entry){
+    int addr_type = BD_ADDR_TYPE_UNKNOWN;
+    sm_key_t irk;
+    memset(irk, 0, 16);
+    le_device_db_info(entry->le_db_index, &addr_type, NULL, irk);
+    if (addr_type != BD_ADDR_TYPE_LE_PUBLIC && addr_type != BD_ADDR_TYPE_LE_RANDOM) return 0;
+    return memcmp(irk, entry->irk, 16) == 0;
+}
+
+static sm_resolving_cache_entry_t * sm_resolving_cache_get(bd_addr_t address){
+    uint32_t now = btstack_run_loop_get_time_ms();
+    int i;
+    for (i = 0; i < SM_RESOLVING_CACHE_SIZE; i++){
+        sm_resolving_cache_entry_t * entry = &sm_resolving_cache[i];
+        if (!entry->valid) continue;
+        if ((now - entry->timestamp_ms) > SM_RESOLVING_CACHE_TIMEOUT_MS){
+            entry->valid = 0;
+            continue;
+        }
+        if (memcmp(entry->address, address, 6) != 0) continue;
+        if (entry->le_db_index >= 0 && !sm_resolving_cache_entry_matches_le_device_db(entry)){
+            entry->valid = 0;
+            return NULL;
+        }
+        entry->timestamp_ms = now;
+        return entry;
+    }
+    return NULL;
+}
+
+static void sm_resolving_cache_store(bd_addr_t address, int le_db_index){
+    uint32_t now = btstack_run_loop_get_time_ms();
+    // use entry for same address, free entry, or least recently used one
+    sm_resolving_cache_entry_t * entry = NULL;
+    sm_resolving_cache_entry_t * free_entry = NULL;
+    sm_resolving_cache_entry_t * oldest_entry = &sm_resolving_cache[0];
+    int i;
+    for (i = 0; i < SM_RESOLVING_CACHE_SIZE; i++){
+        sm_resolving_cache_entry_t * it = &sm_resolving_cache[i];
+        if (!it->valid){
+            if (!free_entry) free_entry = it;
+            continue;
+        }
+        if (memcmp(it->address, address, 6) == 0){
+            entry = it;
+            break;
+        }
+        if ((now - it->timestamp_ms) > (now - oldest_entry->timestamp_ms)){
+            oldest_entry = it;
+        }
+    }
+    if (!entry) entry = free_entry;
+    if (!entry) entry = oldest_entry;
+
+    memcpy(entry->address, address, 6);
+    entry->le_db_index = le_db_index;
+    memset(entry->irk, 0, 16);
+    if (le_db_index >= 0){
+        int addr_type;
+        le_device_db_info(le_db_index, &addr_type, NULL, entry->irk);
+    }
+    entry->timestamp_ms = now;
+    entry->valid = 1;
+}
+
 static void sm_address_resolution_start_lookup(uint8_t addr_type, hci_con_handle_t con_handle, bd_addr_t addr, address_resolution_mode_t mode, void * context){
     memcpy(sm_address_resolution_address, addr, 6);
     sm_address_resolution_addr_type = addr_type;
     sm_address_resolution_test = 0;
     sm_address_resolution_mode = mode;
     sm_address_resolution_context = context;
+    sm_address_resolution_start_ms = btstack_run_loop_get_time_ms();
     sm_notify_client_base(SM_EVENT_IDENTITY_RESOLVING_STARTED, con_handle, addr_type, addr);
+
+    // public addresses are matched without ah() calculation
+    if (addr_type == BD_ADDR_TYPE_LE_PUBLIC) return;
+
+    sm_resolving_cache_entry_t * entry = sm_resolving_cache_get(addr);
+    if (!entry) return;
+    log_info("LE Device Lookup: resolving cache hit, index %d", entry->le_db_index);
+    sm_address_resolution_statistics.cache_hits++;
+    if (entry->le_db_index < 0){
+        sm_address_resolution_handle_event(ADDRESS_RESOLUTION_FAILED);
+    } else {
+        sm_address_resolution_test = entry->le_db_index;
+        sm_address_resolution_handle_event(ADDRESS_RESOLUTION_SUCEEDED);
+    }
+}
+
+#ifdef USE_HOST_AES128_IMPLEMENTATION
+static void sm_address_resolution_continue(btstack_timer_source_t * ts){
+    UNUSED(ts);
+    sm_run();
+}
+#endif
+
+void sm_address_resolution_get_statistics(sm_address_resolution_statistics_t * statistics){
+    *statistics = sm_address_resolution_statistics;
+}
+
+void sm_address_resolution_reset_statistics(void){
+    memset(&sm_address_resolution_statistics, 0, sizeof(sm_address_resolution_statistics));
 }
 
 int sm_address_resolution_lookup(uint8_t address_type, bd_addr_t address){
@@ -1164,12 +1337,29 @@ static int sm_key_distribution_all_received(sm_connection_t * sm_conn){
     return recv_flags == setup->sm_key_distribution_received_set;
 }
 
-static void sm_done_for_handle(hci_con_handle_t con_handle){
-    if (sm_active_connection_handle == con_handle){
-        sm_timeout_stop();
-        sm_active_connection_handle = HCI_CON_HANDLE_INVALID;
-        log_info("sm: connection 0x%x released setup context", con_handle);
+static sm_setup_context_t * sm_setup_context_for_handle(hci_con_handle_t con_handle){
+    int i;
+    for (i = 0; i < SM_SETUP_CONTEXT_NUM; i++){
+        if (sm_setup_contexts[i].sm_con_handle == con_handle) return &sm_setup_contexts[i];
     }
+    return NULL;
+}
+
+// make setup context of given connection the current one, if it has one
+static void sm_setup_context_select(hci_con_handle_t con_handle){
+    sm_setup_context_t * context = sm_setup_context_for_handle(con_handle);
+    if (!context) return;
+    setup = context;
+}
+
+static void sm_done_for_handle(hci_con_handle_t con_handle){
+    if (con_handle == HCI_CON_HANDLE_INVALID) return;
+    sm_setup_context_t * context = sm_setup_context_for_handle(con_handle);
+    if (!context) return;
+    btstack_run_loop_remove_timer(&context->sm_timeout);
+    context->sm_con_handle = HCI_CON_HANDLE_INVALID;
+    sm_setup_context_released = 1;
+    log_info("sm: connection 0x%x released setup context", con_handle);
 }
 
 static int sm_key_distribution_flags_for_auth_req(void){
@@ -1273,6 +1463,17 @@ static void sm_address_resolution_handle_event(address_resolution_event_t event)
     sm_address_resolution_test = -1;
     hci_con_handle_t con_handle = 0;
 
+    // update statistics and resolving cache for random addresses
+    if (sm_address_resolution_addr_type != BD_ADDR_TYPE_LE_PUBLIC){
+        uint32_t latency_ms = btstack_run_loop_get_time_ms() - sm_address_resolution_start_ms;
+        sm_address_resolution_statistics.lookups++;
+        sm_address_resolution_statistics.latency_total_ms += latency_ms;
+        if (latency_ms > sm_address_resolution_statistics.latency_max_ms){
+            sm_address_resolution_statistics.latency_max_ms = latency_ms;
+        }
+        sm_resolving_cache_store(sm_address_resolution_address, event == ADDRESS_RESOLUTION_SUCEEDED ? matched_device_id : -1);
+    }
+
     sm_connection_t * sm_connection;
 #ifdef ENABLE_LE_CENTRAL
     sm_key_t ltk;
@@ -1381,10 +1582,10 @@ static void sm_key_distribution_handle_all_received(sm_connection_t * sm_conn){
         le_db_index = le_device_db_add(setup->sm_peer_addr_type, setup->sm_peer_address, setup->sm_peer_irk);
     }
 
-    sm_notify_client_index(SM_EVENT_IDENTITY_CREATED, sm_conn->sm_handle, setup->sm_peer_addr_type, setup->sm_peer_address, le_db_index);
-
     if (le_db_index >= 0){
 
+        sm_notify_client_index(SM_EVENT_IDENTITY_CREATED, sm_conn->sm_handle, setup->sm_peer_addr_type, setup->sm_peer_address, le_db_index);
+
 #ifdef ENABLE_LE_SIGNED_WRITE
         // store local CSRK
         if (setup->sm_key_distribution_send_set & SM_KEYDIST_FLAG_SIGNING_IDENTIFICATION){
@@ -1424,7 +1625,7 @@ static void sm_key_distribution_handle_all_received(sm_connection_t * sm_conn){
 }
 
 static void sm_pairing_error(sm_connection_t * sm_conn, uint8_t reason){
-    setup->sm_pairing_failed_reason = reason;
+    sm_conn->sm_pairing_failed_reason = reason;
     sm_conn->sm_engine_state = SM_GENERAL_SEND_PAIRING_FAILED;
 }
 
@@ -1493,6 +1694,7 @@ static void sm_sc_cmac_done(uint8_t * hash){
 
     sm_connection_t * sm_conn = sm_cmac_connection;
     sm_cmac_connection = NULL;
+    sm_setup_context_select(sm_conn->sm_handle);
 #ifdef ENABLE_CLASSIC
     link_key_type_t link_key_type;
 #endif
@@ -1911,111 +2113,611 @@ static void sm_start_calculating_ltk_from_ediv_and_rand(sm_connection_t * sm_con
 }
 #endif
 
-static void sm_run(void){
+// handle connection that uses the current setup context
+static void sm_run_for_connection(sm_connection_t * connection){
 
-    btstack_linked_list_iterator_t it;
+#if defined(ENABLE_LE_SECURE_CONNECTIONS) && !defined(USE_SOFTWARE_ECDH_IMPLEMENTATION)
+    if ((setup->sm_state_vars & SM_STATE_VAR_DHKEY_NEEDED) && (sm_generate_dhkey_con_handle == HCI_CON_HANDLE_INVALID)){
+        setup->sm_state_vars &= ~SM_STATE_VAR_DHKEY_NEEDED;
+        sm_generate_dhkey_con_handle = connection->sm_handle;
+        hci_send_cmd(&hci_le_generate_dhkey, &setup->sm_peer_q[0], &setup->sm_peer_q[32]);
+        return;
+    }
+#endif
 
-    // assert that stack has already bootet
-    if (hci_get_state() != HCI_STATE_WORKING) return;
+    // assert that we could send a SM PDU - not needed for all of the following
+    if (!l2cap_can_send_fixed_channel_packet_now(connection->sm_handle, L2CAP_CID_SECURITY_MANAGER_PROTOCOL)) {
+        log_info("cannot send now, requesting can send now event");
+        l2cap_request_can_send_fix_channel_now_event(connection->sm_handle, L2CAP_CID_SECURITY_MANAGER_PROTOCOL);
+        return;
+    }
 
-    // assert that we can send at least commands
-    if (!hci_can_send_command_packet_now()) return;
+    // send keypress notifications
+    if (setup->sm_keypress_notification != 0xff){
+        uint8_t buffer[2];
+        buffer[0] = SM_CODE_KEYPRESS_NOTIFICATION;
+        buffer[1] = setup->sm_keypress_notification;
+        setup->sm_keypress_notification = 0xff;
+        l2cap_send_connectionless(connection->sm_handle, L2CAP_CID_SECURITY_MANAGER_PROTOCOL, (uint8_t*) buffer, sizeof(buffer));
+        return;
+    }
 
-    //
-    // non-connection related behaviour
-    //
+    sm_key_t plaintext;
+    int key_distribution_flags;
+    UNUSED(key_distribution_flags);
 
-    // distributed key generation
-    switch (dkg_state){
-        case DKG_CALC_IRK:
-            // already busy?
-            if (sm_aes128_state == SM_AES128_IDLE) {
-                // IRK = d1(IR, 1, 0)
-                sm_key_t d1_prime;
-                sm_d1_d_prime(1, 0, d1_prime);  // plaintext
-                dkg_next_state();
-                sm_aes128_start(sm_persistent_ir, d1_prime, NULL);
-                return;
+    log_info("sm_run: state %u", connection->sm_engine_state);
+
+    switch (connection->sm_engine_state){
+
+        // general
+        case SM_GENERAL_SEND_PAIRING_FAILED: {
+            uint8_t buffer[2];
+            buffer[0] = SM_CODE_PAIRING_FAILED;
+            buffer[1] = connection->sm_pairing_failed_reason;
+            connection->sm_engine_state = connection->sm_role ? SM_RESPONDER_IDLE : SM_INITIATOR_CONNECTED;
+            l2cap_send_connectionless(connection->sm_handle, L2CAP_CID_SECURITY_MANAGER_PROTOCOL, (uint8_t*) buffer, sizeof(buffer));
+            sm_done_for_handle(connection->sm_handle);
+            break;
+        }
+
+        // responding state
+#ifdef ENABLE_LE_SECURE_CONNECTIONS
+        case SM_SC_W2_GET_RANDOM_A:
+            sm_random_start(connection);
+            connection->sm_engine_state = SM_SC_W4_GET_RANDOM_A;
+            break;
+        case SM_SC_W2_GET_RANDOM_B:
+            sm_random_start(connection);
+            connection->sm_engine_state = SM_SC_W4_GET_RANDOM_B;
+            break;
+        case SM_SC_W2_CMAC_FOR_CONFIRMATION:
+            if (!sm_cmac_ready()) break;
+            connection->sm_engine_state = SM_SC_W4_CMAC_FOR_CONFIRMATION;
+            sm_sc_calculate_local_confirm(connection);
+            break;
+        case SM_SC_W2_CMAC_FOR_CHECK_CONFIRMATION:
+            if (!sm_cmac_ready()) break;
+            connection->sm_engine_state = SM_SC_W4_CMAC_FOR_CHECK_CONFIRMATION;
+            sm_sc_calculate_remote_confirm(connection);
+            break;
+        case SM_SC_W2_CALCULATE_F6_FOR_DHKEY_CHECK:
+            if (!sm_cmac_ready()) break;
+            connection->sm_engine_state = SM_SC_W4_CALCULATE_F6_FOR_DHKEY_CHECK;
+            sm_sc_calculate_f6_for_dhkey_check(connection);
+            break;
+        case SM_SC_W2_CALCULATE_F6_TO_VERIFY_DHKEY_CHECK:
+            if (!sm_cmac_ready()) break;
+            connection->sm_engine_state = SM_SC_W4_CALCULATE_F6_TO_VERIFY_DHKEY_CHECK;
+            sm_sc_calculate_f6_to_verify_dhkey_check(connection);
+            break;
+        case SM_SC_W2_CALCULATE_F5_SALT:
+            if (!sm_cmac_ready()) break;
+            connection->sm_engine_state = SM_SC_W4_CALCULATE_F5_SALT;
+            f5_calculate_salt(connection);
+            break;
+        case SM_SC_W2_CALCULATE_F5_MACKEY:
+            if (!sm_cmac_ready()) break;
+            connection->sm_engine_state = SM_SC_W4_CALCULATE_F5_MACKEY;
+            f5_calculate_mackey(connection);
+            break;
+        case SM_SC_W2_CALCULATE_F5_LTK:
+            if (!sm_cmac_ready()) break;
+            connection->sm_engine_state = SM_SC_W4_CALCULATE_F5_LTK;
+            f5_calculate_ltk(connection);
+            break;
+        case SM_SC_W2_CALCULATE_G2:
+            if (!sm_cmac_ready()) break;
+            connection->sm_engine_state = SM_SC_W4_CALCULATE_G2;
+            g2_calculate(connection);
+            break;
+        case SM_SC_W2_CALCULATE_H6_ILK:
+            if (!sm_cmac_ready()) break;
+            connection->sm_engine_state = SM_SC_W4_CALCULATE_H6_ILK;
+            h6_calculate_ilk(connection);
+            break;
+        case SM_SC_W2_CALCULATE_H6_BR_EDR_LINK_KEY:
+            if (!sm_cmac_ready()) break;
+            connection->sm_engine_state = SM_SC_W4_CALCULATE_H6_BR_EDR_LINK_KEY;
+            h6_calculate_br_edr_link_key(connection);
+            break;
+#endif
+
+#ifdef ENABLE_LE_CENTRAL
+        // initiator side
+        case SM_INITIATOR_PH0_SEND_START_ENCRYPTION: {
+            sm_key_t peer_ltk_flipped;
+            reverse_128(setup->sm_peer_ltk, peer_ltk_flipped);
+            connection->sm_engine_state = SM_INITIATOR_PH0_W4_CONNECTION_ENCRYPTED;
+            log_info("sm: hci_le_start_encryption ediv 0x%04x", setup->sm_peer_ediv);
+            uint32_t rand_high = big_endian_read_32(setup->sm_peer_rand, 0);
+            uint32_t rand_low  = big_endian_read_32(setup->sm_peer_rand, 4);
+            hci_send_cmd(&hci_le_start_encryption, connection->sm_handle,rand_low, rand_high, setup->sm_peer_ediv, peer_ltk_flipped);
+            return;
+        }
+
+        case SM_INITIATOR_PH1_SEND_PAIRING_REQUEST:
+            sm_pairing_packet_set_code(setup->sm_m_preq, SM_CODE_PAIRING_REQUEST);
+            connection->sm_engine_state = SM_INITIATOR_PH1_W4_PAIRING_RESPONSE;
+            l2cap_send_connectionless(connection->sm_handle, L2CAP_CID_SECURITY_MANAGER_PROTOCOL, (uint8_t*) &setup->sm_m_preq, sizeof(sm_pairing_packet_t));
+            sm_timeout_reset(connection);
+            break;
+#endif
+
+#ifdef ENABLE_LE_SECURE_CONNECTIONS
+
+        case SM_SC_SEND_PUBLIC_KEY_COMMAND: {
+            uint8_t buffer[65];
+            buffer[0] = SM_CODE_PAIRING_PUBLIC_KEY;
+            //
+            reverse_256(&ec_q[0],  &buffer[1]);
+            reverse_256(&ec_q[32], &buffer[33]);
+
+            // stk generation method
+            // passkey entry: notify app to show passkey or to request passkey
+            switch (setup->sm_stk_generation_method){
+                case JUST_WORKS:
+                case NK_BOTH_INPUT:
+                    if (IS_RESPONDER(connection->sm_role)){
+                        // responder
+                        sm_sc_start_calculating_local_confirm(connection);
+                    } else {
+                        // initiator
+                        connection->sm_engine_state = SM_SC_W4_PUBLIC_KEY_COMMAND;
+                    }
+                    break;
+                case PK_INIT_INPUT:
+                case PK_RESP_INPUT:
+                case OK_BOTH_INPUT:
+                    // use random TK for display
+                    memcpy(setup->sm_ra, setup->sm_tk, 16);
+                    memcpy(setup->sm_rb, setup->sm_tk, 16);
+                    setup->sm_passkey_bit = 0;
+
+                    if (IS_RESPONDER(connection->sm_role)){
+                        // responder
+                        connection->sm_engine_state = SM_SC_W4_CONFIRMATION;
+                    } else {
+                        // initiator
+                        connection->sm_engine_state = SM_SC_W4_PUBLIC_KEY_COMMAND;
+                    }
+                    sm_trigger_user_response(connection);
+                    break;
+                case OOB:
+                    // TODO: implement SC OOB
+                    break;
             }
+
+            l2cap_send_connectionless(connection->sm_handle, L2CAP_CID_SECURITY_MANAGER_PROTOCOL, (uint8_t*) buffer, sizeof(buffer));
+            sm_timeout_reset(connection);
             break;
-        case DKG_CALC_DHK:
-            // already busy?
-            if (sm_aes128_state == SM_AES128_IDLE) {
-                // DHK = d1(IR, 3, 0)
-                sm_key_t d1_prime;
-                sm_d1_d_prime(3, 0, d1_prime);  // plaintext
-                dkg_next_state();
-                sm_aes128_start(sm_persistent_ir, d1_prime, NULL);
-                return;
+        }
+        case SM_SC_SEND_CONFIRMATION: {
+            uint8_t buffer[17];
+            buffer[0] = SM_CODE_PAIRING_CONFIRM;
+            reverse_128(setup->sm_local_confirm, &buffer[1]);
+            if (IS_RESPONDER(connection->sm_role)){
+                connection->sm_engine_state = SM_SC_W4_PAIRING_RANDOM;
+            } else {
+                connection->sm_engine_state = SM_SC_W4_CONFIRMATION;
             }
+            l2cap_send_connectionless(connection->sm_handle, L2CAP_CID_SECURITY_MANAGER_PROTOCOL, (uint8_t*) buffer, sizeof(buffer));
+            sm_timeout_reset(connection);
             break;
-        default:
+        }
+        case SM_SC_SEND_PAIRING_RANDOM: {
+            uint8_t buffer[17];
+            buffer[0] = SM_CODE_PAIRING_RANDOM;
+            reverse_128(setup->sm_local_nonce, &buffer[1]);
+            if (setup->sm_stk_generation_method != JUST_WORKS && setup->sm_stk_generation_method != NK_BOTH_INPUT && setup->sm_passkey_bit < 20){
+                if (IS_RESPONDER(connection->sm_role)){
+                    // responder
+                    connection->sm_engine_state = SM_SC_W4_CONFIRMATION;
+                } else {
+                    // initiator
+                    connection->sm_engine_state = SM_SC_W4_PAIRING_RANDOM;
+                }
+            } else {
+                if (IS_RESPONDER(connection->sm_role)){
+                    // responder
+                    if (setup->sm_stk_generation_method == NK_BOTH_INPUT){
+                        connection->sm_engine_state = SM_SC_W2_CALCULATE_G2;
+                    } else {
+                        sm_sc_prepare_dhkey_check(connection);
+                    }
+                } else {
+                    // initiator
+                    connection->sm_engine_state = SM_SC_W4_PAIRING_RANDOM;
+                }
+            }
+            l2cap_send_connectionless(connection->sm_handle, L2CAP_CID_SECURITY_MANAGER_PROTOCOL, (uint8_t*) buffer, sizeof(buffer));
+            sm_timeout_reset(connection);
             break;
-    }
+        }
+        case SM_SC_SEND_DHKEY_CHECK_COMMAND: {
+            uint8_t buffer[17];
+            buffer[0] = SM_CODE_PAIRING_DHKEY_CHECK;
+            reverse_128(setup->sm_local_dhkey_check, &buffer[1]);
+
+            if (IS_RESPONDER(connection->sm_role)){
+                connection->sm_engine_state = SM_SC_W4_LTK_REQUEST_SC;
+            } else {
+                connection->sm_engine_state = SM_SC_W4_DHKEY_CHECK_COMMAND;
+            }
+
+            l2cap_send_connectionless(connection->sm_handle, L2CAP_CID_SECURITY_MANAGER_PROTOCOL, (uint8_t*) buffer, sizeof(buffer));
+            sm_timeout_reset(connection);
+            break;
+        }
 
-#ifdef ENABLE_LE_SECURE_CONNECTIONS
-    if (ec_key_generation_state == EC_KEY_GENERATION_ACTIVE){
-#ifdef USE_SOFTWARE_ECDH_IMPLEMENTATION
-        sm_random_start(NULL);
-#else
-        ec_key_generation_state = EC_KEY_GENERATION_W4_KEY;
-        hci_send_cmd(&hci_le_read_local_p256_public_key);
-#endif
-        return;
-    }
 #endif
 
-    // random address updates
-    switch (rau_state){
-        case RAU_GET_RANDOM:
-            rau_next_state();
-            sm_random_start(NULL);
+#ifdef ENABLE_LE_PERIPHERAL
+        case SM_RESPONDER_PH1_SEND_PAIRING_RESPONSE:
+            // echo initiator for now
+            sm_pairing_packet_set_code(setup->sm_s_pres,SM_CODE_PAIRING_RESPONSE);
+            key_distribution_flags = sm_key_distribution_flags_for_auth_req();
+
+            if (setup->sm_use_secure_connections){
+                connection->sm_engine_state = SM_SC_W4_PUBLIC_KEY_COMMAND;
+                // skip LTK/EDIV for SC
+                log_info("sm: dropping encryption information flag");
+                key_distribution_flags &= ~SM_KEYDIST_ENC_KEY;
+            } else {
+                connection->sm_engine_state = SM_RESPONDER_PH1_W4_PAIRING_CONFIRM;
+            }
+
+            sm_pairing_packet_set_initiator_key_distribution(setup->sm_s_pres, sm_pairing_packet_get_initiator_key_distribution(setup->sm_m_preq) & key_distribution_flags);
+            sm_pairing_packet_set_responder_key_distribution(setup->sm_s_pres, sm_pairing_packet_get_responder_key_distribution(setup->sm_m_preq) & key_distribution_flags);
+            // update key distribution after ENC was dropped
+            sm_setup_key_distribution(sm_pairing_packet_get_responder_key_distribution(setup->sm_s_pres));
+
+            l2cap_send_connectionless(connection->sm_handle, L2CAP_CID_SECURITY_MANAGER_PROTOCOL, (uint8_t*) &setup->sm_s_pres, sizeof(sm_pairing_packet_t));
+            sm_timeout_reset(connection);
+            // SC Numeric Comparison will trigger user response after public keys & nonces have been exchanged
+            if (!setup->sm_use_secure_connections || setup->sm_stk_generation_method == JUST_WORKS){
+                sm_trigger_user_response(connection);
+            }
             return;
-        case RAU_GET_ENC:
-            // already busy?
-            if (sm_aes128_state == SM_AES128_IDLE) {
-                sm_key_t r_prime;
-                sm_ah_r_prime(sm_random_address, r_prime);
-                rau_next_state();
-                sm_aes128_start(sm_persistent_irk, r_prime, NULL);
-                return;
+#endif
+
+        case SM_PH2_SEND_PAIRING_RANDOM: {
+            uint8_t buffer[17];
+            buffer[0] = SM_CODE_PAIRING_RANDOM;
+            reverse_128(setup->sm_local_random, &buffer[1]);
+            if (IS_RESPONDER(connection->sm_role)){
+                connection->sm_engine_state = SM_RESPONDER_PH2_W4_LTK_REQUEST;
+            } else {
+                connection->sm_engine_state = SM_INITIATOR_PH2_W4_PAIRING_RANDOM;
             }
+            l2cap_send_connectionless(connection->sm_handle, L2CAP_CID_SECURITY_MANAGER_PROTOCOL, (uint8_t*) buffer, sizeof(buffer));
+            sm_timeout_reset(connection);
             break;
-        case RAU_SET_ADDRESS:
-            log_info("New random address: %s", bd_addr_to_str(sm_random_address));
-            rau_state = RAU_IDLE;
-            hci_send_cmd(&hci_le_set_random_address, sm_random_address);
+        }
+
+        case SM_PH2_GET_RANDOM_TK:
+        case SM_PH2_C1_GET_RANDOM_A:
+        case SM_PH2_C1_GET_RANDOM_B:
+        case SM_PH3_GET_RANDOM:
+        case SM_PH3_GET_DIV:
+            sm_next_responding_state(connection);
+            sm_random_start(connection);
             return;
-        default:
-            break;
-    }
 
-#ifdef ENABLE_CMAC_ENGINE
-    // CMAC
-    switch (sm_cmac_state){
-        case CMAC_CALC_SUBKEYS:
-        case CMAC_CALC_MI:
-        case CMAC_CALC_MLAST:
+        case SM_PH2_C1_GET_ENC_B:
+        case SM_PH2_C1_GET_ENC_D:
             // already busy?
             if (sm_aes128_state == SM_AES128_ACTIVE) break;
-            sm_cmac_handle_aes_engine_ready();
+            sm_next_responding_state(connection);
+            sm_aes128_start(setup->sm_tk, setup->sm_c1_t3_value, connection);
             return;
-        default:
-            break;
-    }
-#endif
 
-    // CSRK Lookup
-    // -- if csrk lookup ready, find connection that require csrk lookup
-    if (sm_address_resolution_idle()){
+        case SM_PH3_LTK_GET_ENC:
+        case SM_RESPONDER_PH4_LTK_GET_ENC:
+            // already busy?
+            if (sm_aes128_state == SM_AES128_IDLE) {
+                sm_key_t d_prime;
+                sm_d1_d_prime(setup->sm_local_div, 0, d_prime);
+                sm_next_responding_state(connection);
+                sm_aes128_start(sm_persistent_er, d_prime, connection);
+                return;
+            }
+            break;
+
+        case SM_PH3_CSRK_GET_ENC:
+            // already busy?
+            if (sm_aes128_state == SM_AES128_IDLE) {
+                sm_key_t d_prime;
+                sm_d1_d_prime(setup->sm_local_div, 1, d_prime);
+                sm_next_responding_state(connection);
+                sm_aes128_start(sm_persistent_er, d_prime, connection);
+                return;
+            }
+            break;
+
+        case SM_PH2_C1_GET_ENC_C:
+            // already busy?
+            if (sm_aes128_state == SM_AES128_ACTIVE) break;
+            // calculate m_confirm using aes128 engine - step 1
+            sm_c1_t1(setup->sm_peer_random, (uint8_t*) &setup->sm_m_preq, (uint8_t*) &setup->sm_s_pres, setup->sm_m_addr_type, setup->sm_s_addr_type, plaintext);
+            sm_next_responding_state(connection);
+            sm_aes128_start(setup->sm_tk, plaintext, connection);
+            break;
+        case SM_PH2_C1_GET_ENC_A:
+            // already busy?
+            if (sm_aes128_state == SM_AES128_ACTIVE) break;
+            // calculate confirm using aes128 engine - step 1
+            sm_c1_t1(setup->sm_local_random, (uint8_t*) &setup->sm_m_preq, (uint8_t*) &setup->sm_s_pres, setup->sm_m_addr_type, setup->sm_s_addr_type, plaintext);
+            sm_next_responding_state(connection);
+            sm_aes128_start(setup->sm_tk, plaintext, connection);
+            break;
+        case SM_PH2_CALC_STK:
+            // already busy?
+            if (sm_aes128_state == SM_AES128_ACTIVE) break;
+            // calculate STK
+            if (IS_RESPONDER(connection->sm_role)){
+                sm_s1_r_prime(setup->sm_local_random, setup->sm_peer_random, plaintext);
+            } else {
+                sm_s1_r_prime(setup->sm_peer_random, setup->sm_local_random, plaintext);
+            }
+            sm_next_responding_state(connection);
+            sm_aes128_start(setup->sm_tk, plaintext, connection);
+            break;
+        case SM_PH3_Y_GET_ENC:
+            // already busy?
+            if (sm_aes128_state == SM_AES128_ACTIVE) break;
+            // PH3B2 - calculate Y from      - enc
+            // Y = dm(DHK, Rand)
+            sm_dm_r_prime(setup->sm_local_rand, plaintext);
+            sm_next_responding_state(connection);
+            sm_aes128_start(sm_persistent_dhk, plaintext, connection);
+            return;
+        case SM_PH2_C1_SEND_PAIRING_CONFIRM: {
+            uint8_t buffer[17];
+            buffer[0] = SM_CODE_PAIRING_CONFIRM;
+            reverse_128(setup->sm_local_confirm, &buffer[1]);
+            if (IS_RESPONDER(connection->sm_role)){
+                connection->sm_engine_state = SM_RESPONDER_PH2_W4_PAIRING_RANDOM;
+            } else {
+                connection->sm_engine_state = SM_INITIATOR_PH2_W4_PAIRING_CONFIRM;
+            }
+            l2cap_send_connectionless(connection->sm_handle, L2CAP_CID_SECURITY_MANAGER_PROTOCOL, (uint8_t*) buffer, sizeof(buffer));
+            sm_timeout_reset(connection);
+            return;
+        }
+#ifdef ENABLE_LE_PERIPHERAL
+        case SM_RESPONDER_PH2_SEND_LTK_REPLY: {
+            sm_key_t stk_flipped;
+            reverse_128(setup->sm_ltk, stk_flipped);
+            connection->sm_engine_state = SM_PH2_W4_CONNECTION_ENCRYPTED;
+            hci_send_cmd(&hci_le_long_term_key_request_reply, connection->sm_handle, stk_flipped);
+            return;
+        }
+        case SM_RESPONDER_PH4_SEND_LTK_REPLY: {
+            sm_key_t ltk_flipped;
+            reverse_128(setup->sm_ltk, ltk_flipped);
+            connection->sm_engine_state = SM_RESPONDER_IDLE;
+            hci_send_cmd(&hci_le_long_term_key_request_reply, connection->sm_handle, ltk_flipped);
+            return;
+        }
+        case SM_RESPONDER_PH4_Y_GET_ENC:
+            // already busy?
+            if (sm_aes128_state == SM_AES128_ACTIVE) break;
+            log_info("LTK Request: recalculating with ediv 0x%04x", setup->sm_local_ediv);
+            // Y = dm(DHK, Rand)
+            sm_dm_r_prime(setup->sm_local_rand, plaintext);
+            sm_next_responding_state(connection);
+            sm_aes128_start(sm_persistent_dhk, plaintext, connection);
+            return;
+#endif
+#ifdef ENABLE_LE_CENTRAL
+        case SM_INITIATOR_PH3_SEND_START_ENCRYPTION: {
+            sm_key_t stk_flipped;
+            reverse_128(setup->sm_ltk, stk_flipped);
+            connection->sm_engine_state = SM_PH2_W4_CONNECTION_ENCRYPTED;
+            hci_send_cmd(&hci_le_start_encryption, connection->sm_handle, 0, 0, 0, stk_flipped);
+            return;
+        }
+#endif
+
+        case SM_PH3_DISTRIBUTE_KEYS:
+            if (setup->sm_key_distribution_send_set &   SM_KEYDIST_FLAG_ENCRYPTION_INFORMATION){
+                setup->sm_key_distribution_send_set &= ~SM_KEYDIST_FLAG_ENCRYPTION_INFORMATION;
+                uint8_t buffer[17];
+                buffer[0] = SM_CODE_ENCRYPTION_INFORMATION;
+                reverse_128(setup->sm_ltk, &buffer[1]);
+                l2cap_send_connectionless(connection->sm_handle, L2CAP_CID_SECURITY_MANAGER_PROTOCOL, (uint8_t*) buffer, sizeof(buffer));
+                sm_timeout_reset(connection);
+                return;
+            }
+            if (setup->sm_key_distribution_send_set &   SM_KEYDIST_FLAG_MASTER_IDENTIFICATION){
+                setup->sm_key_distribution_send_set &= ~SM_KEYDIST_FLAG_MASTER_IDENTIFICATION;
+                uint8_t buffer[11];
+                buffer[0] = SM_CODE_MASTER_IDENTIFICATION;
+                little_endian_store_16(buffer, 1, setup->sm_local_ediv);
+                reverse_64(setup->sm_local_rand, &buffer[3]);
+                l2cap_send_connectionless(connection->sm_handle, L2CAP_CID_SECURITY_MANAGER_PROTOCOL, (uint8_t*) buffer, sizeof(buffer));
+                sm_timeout_reset(connection);
+                return;
+            }
+            if (setup->sm_key_distribution_send_set &   SM_KEYDIST_FLAG_IDENTITY_INFORMATION){
+                setup->sm_key_distribution_send_set &= ~SM_KEYDIST_FLAG_IDENTITY_INFORMATION;
+                uint8_t buffer[17];
+                buffer[0] = SM_CODE_IDENTITY_INFORMATION;
+                reverse_128(sm_persistent_irk, &buffer[1]);
+                l2cap_send_connectionless(connection->sm_handle, L2CAP_CID_SECURITY_MANAGER_PROTOCOL, (uint8_t*) buffer, sizeof(buffer));
+                sm_timeout_reset(connection);
+                return;
+            }
+            if (setup->sm_key_distribution_send_set &   SM_KEYDIST_FLAG_IDENTITY_ADDRESS_INFORMATION){
+                setup->sm_key_distribution_send_set &= ~SM_KEYDIST_FLAG_IDENTITY_ADDRESS_INFORMATION;
+                bd_addr_t local_address;
+                uint8_t buffer[8];
+                buffer[0] = SM_CODE_IDENTITY_ADDRESS_INFORMATION;
+                switch (gap_random_address_get_mode()){
+                    case GAP_RANDOM_ADDRESS_TYPE_OFF:
+                    case GAP_RANDOM_ADDRESS_TYPE_STATIC:
+                        // public or static random
+                        gap_le_get_own_address(&buffer[1], local_address);
+                        break;
+                    case GAP_RANDOM_ADDRESS_NON_RESOLVABLE:
+                    case GAP_RANDOM_ADDRESS_RESOLVABLE:
+                        // fallback to public
+                        gap_local_bd_addr(local_address);
+                        buffer[1] = 0;
+                        break;
+                }
+                reverse_bd_addr(local_address, &buffer[2]);
+                l2cap_send_connectionless(connection->sm_handle, L2CAP_CID_SECURITY_MANAGER_PROTOCOL, (uint8_t*) buffer, sizeof(buffer));
+                sm_timeout_reset(connection);
+                return;
+            }
+            if (setup->sm_key_distribution_send_set &   SM_KEYDIST_FLAG_SIGNING_IDENTIFICATION){
+                setup->sm_key_distribution_send_set &= ~SM_KEYDIST_FLAG_SIGNING_IDENTIFICATION;
+
+                // hack to reproduce test runs
+                if (test_use_fixed_local_csrk){
+                    memset(setup->sm_local_csrk, 0xcc, 16);
+                }
+
+                uint8_t buffer[17];
+                buffer[0] = SM_CODE_SIGNING_INFORMATION;
+                reverse_128(setup->sm_local_csrk, &buffer[1]);
+                l2cap_send_connectionless(connection->sm_handle, L2CAP_CID_SECURITY_MANAGER_PROTOCOL, (uint8_t*) buffer, sizeof(buffer));
+                sm_timeout_reset(connection);
+                return;
+            }
+
+            // keys are sent
+            if (IS_RESPONDER(connection->sm_role)){
+                // slave -> receive master keys if any
+                if (sm_key_distribution_all_received(connection)){
+                    sm_key_distribution_handle_all_received(connection);
+                    connection->sm_engine_state = SM_RESPONDER_IDLE;
+                    sm_done_for_handle(connection->sm_handle);
+                } else {
+                    connection->sm_engine_state = SM_PH3_RECEIVE_KEYS;
+                }
+            } else {
+                // master -> all done
+                connection->sm_engine_state = SM_INITIATOR_CONNECTED;
+                sm_done_for_handle(connection->sm_handle);
+            }
+            break;
+
+        default:
+            break;
+    }
+}
+
+static void sm_run(void){
+
+    btstack_linked_list_iterator_t it;
+
+    // assert that stack has already bootet
+    if (hci_get_state() != HCI_STATE_WORKING) return;
+
+    // assert that we can send at least commands
+    if (!hci_can_send_command_packet_now()) return;
+
+    //
+    // non-connection related behaviour
+    //
+
+    // distributed key generation
+    switch (dkg_state){
+        case DKG_CALC_IRK:
+            // already busy?
+            if (sm_aes128_state == SM_AES128_IDLE) {
+                // IRK = d1(IR, 1, 0)
+                sm_key_t d1_prime;
+                sm_d1_d_prime(1, 0, d1_prime);  // plaintext
+                dkg_next_state();
+                sm_aes128_start(sm_persistent_ir, d1_prime, NULL);
+                return;
+            }
+            break;
+        case DKG_CALC_DHK:
+            // already busy?
+            if (sm_aes128_state == SM_AES128_IDLE) {
+                // DHK = d1(IR, 3, 0)
+                sm_key_t d1_prime;
+                sm_d1_d_prime(3, 0, d1_prime);  // plaintext
+                dkg_next_state();
+                sm_aes128_start(sm_persistent_ir, d1_prime, NULL);
+                return;
+            }
+            break;
+        default:
+            break;
+    }
+
+#ifdef ENABLE_LE_SECURE_CONNECTIONS
+    if (ec_key_generation_state == EC_KEY_GENERATION_ACTIVE){
+#ifdef USE_SOFTWARE_ECDH_IMPLEMENTATION
+        if (!sm_random_ready()) return;
+        sm_random_start(NULL);
+#else
+        ec_key_generation_state = EC_KEY_GENERATION_W4_KEY;
+        hci_send_cmd(&hci_le_read_local_p256_public_key);
+#endif
+        return;
+    }
+#endif
+
+    // random address updates
+    switch (rau_state){
+        case RAU_GET_RANDOM:
+            // already busy?
+            if (!sm_random_ready()) break;
+            rau_next_state();
+            sm_random_start(NULL);
+            return;
+        case RAU_GET_ENC:
+            // already busy?
+            if (sm_aes128_state == SM_AES128_IDLE) {
+                sm_key_t r_prime;
+                sm_ah_r_prime(sm_random_address, r_prime);
+                rau_next_state();
+                sm_aes128_start(sm_persistent_irk, r_prime, NULL);
+                return;
+            }
+            break;
+        case RAU_SET_ADDRESS:
+            log_info("New random address: %s", bd_addr_to_str(sm_random_address));
+            rau_state = RAU_IDLE;
+            hci_send_cmd(&hci_le_set_random_address, sm_random_address);
+            return;
+        default:
+            break;
+    }
+
+#ifdef ENABLE_CMAC_ENGINE
+    // CMAC
+    switch (sm_cmac_state){
+        case CMAC_CALC_SUBKEYS:
+        case CMAC_CALC_MI:
+        case CMAC_CALC_MLAST:
+            // already busy?
+            if (sm_aes128_state == SM_AES128_ACTIVE) break;
+            sm_cmac_handle_aes_engine_ready();
+            return;
+        default:
+            break;
+    }
+#endif
+
+    // CSRK Lookup
+    // -- if csrk lookup ready, find connection that require csrk lookup
+    if (sm_address_resolution_idle()){
         hci_connections_get_iterator(&it);
         while(btstack_linked_list_iterator_has_next(&it)){
             hci_connection_t * hci_connection = (hci_connection_t *) btstack_linked_list_iterator_next(&it);
             sm_connection_t  * sm_connection  = &hci_connection->sm_connection;
             if (sm_connection->sm_irk_lookup_state == IRK_LOOKUP_W4_READY){
-                // and start lookup
-                sm_address_resolution_start_lookup(sm_connection->sm_peer_addr_type, sm_connection->sm_handle, sm_connection->sm_peer_address, ADDRESS_RESOLUTION_FOR_CONNECTION, sm_connection);
+                // and start lookup, might complete directly from resolving cache
                 sm_connection->sm_irk_lookup_state = IRK_LOOKUP_STARTED;
+                sm_address_resolution_start_lookup(sm_connection->sm_peer_addr_type, sm_connection->sm_handle, sm_connection->sm_peer_address, ADDRESS_RESOLUTION_FOR_CONNECTION, sm_connection);
                 break;
             }
         }
@@ -2034,6 +2736,9 @@ static void sm_run(void){
     // -- Continue with CSRK device lookup by public or resolvable private address
     if (!sm_address_resolution_idle()){
         log_info("LE Device Lookup: device %u/%u", sm_address_resolution_test, le_device_db_count());
+#ifdef USE_HOST_AES128_IMPLEMENTATION
+        int ah_calculations = 0;
+#endif
         while (sm_address_resolution_test < le_device_db_count()){
             int addr_type;
             bd_addr_t addr;
@@ -2052,19 +2757,44 @@ static void sm_run(void){
                 continue;
             }
 
+#ifdef USE_HOST_AES128_IMPLEMENTATION
+            // calculate batch of ah() directly, then continue on next run loop iteration
+            if (ah_calculations == SM_ADDRESS_RESOLUTION_BATCH_SIZE){
+                btstack_run_loop_remove_timer(&sm_address_resolution_timer);
+                btstack_run_loop_set_timer_handler(&sm_address_resolution_timer, &sm_address_resolution_continue);
+                btstack_run_loop_set_timer(&sm_address_resolution_timer, 0);    // no delay
+                btstack_run_loop_add_timer(&sm_address_resolution_timer);
+                break;
+            }
+#else
             if (sm_aes128_state == SM_AES128_ACTIVE) break;
+#endif
 
             log_info("LE Device Lookup: calculate AH");
             log_info_key("IRK", irk);
 
             sm_key_t r_prime;
             sm_ah_r_prime(sm_address_resolution_address, r_prime);
+            sm_address_resolution_statistics.ah_calculations++;
+
+#ifdef USE_HOST_AES128_IMPLEMENTATION
+            ah_calculations++;
+            sm_key_t hash;
+            btstack_aes128_calc(irk, r_prime, hash);
+            if (memcmp(&sm_address_resolution_address[3], &hash[13], 3) == 0){
+                log_info("LE Device Lookup: matched resolvable private address");
+                sm_address_resolution_handle_event(ADDRESS_RESOLUTION_SUCEEDED);
+                break;
+            }
+            sm_address_resolution_test++;
+#else
             sm_address_resolution_ah_calculation_active = 1;
             sm_aes128_start(irk, r_prime, sm_address_resolution_context);   // keep context
             return;
+#endif
         }
 
-        if (sm_address_resolution_test >= le_device_db_count()){
+        if (!sm_address_resolution_idle() && sm_address_resolution_test >= le_device_db_count()){
             log_info("LE Device Lookup: not found");
             sm_address_resolution_handle_event(ADDRESS_RESOLUTION_FAILED);
         }
@@ -2072,7 +2802,7 @@ static void sm_run(void){
 
     // handle basic actions that don't requires the full context
     hci_connections_get_iterator(&it);
-    while((sm_active_connection_handle == HCI_CON_HANDLE_INVALID) && btstack_linked_list_iterator_has_next(&it)){
+    while(btstack_linked_list_iterator_has_next(&it)){
         hci_connection_t * hci_connection = (hci_connection_t *) btstack_linked_list_iterator_next(&it);
         sm_connection_t  * sm_connection = &hci_connection->sm_connection;
         switch(sm_connection->sm_engine_state){
@@ -2102,15 +2832,21 @@ static void sm_run(void){
 
     //
     // active connection handling
-    // -- use loop to handle next connection if lock on setup context is released
+    // -- use loop to handle next connection if a setup context is released
 
     while (1) {
 
-        // Find connections that requires setup context and make active if no other is locked
+        sm_setup_context_released = 0;
+
+        // Find connections that requires setup context and assign free one
         hci_connections_get_iterator(&it);
-        while((sm_active_connection_handle == HCI_CON_HANDLE_INVALID) && btstack_linked_list_iterator_has_next(&it)){
+        while(btstack_linked_list_iterator_has_next(&it)){
             hci_connection_t * hci_connection = (hci_connection_t *) btstack_linked_list_iterator_next(&it);
             sm_connection_t  * sm_connection = &hci_connection->sm_connection;
+            if (sm_setup_context_for_handle(sm_connection->sm_handle)) continue;
+            sm_setup_context_t * free_context = sm_setup_context_for_handle(HCI_CON_HANDLE_INVALID);
+            if (!free_context) break;
+            setup = free_context;
             // - if no connection locked and we're ready/waiting for setup context, fetch it and start
             int done = 1;
             int err;
@@ -2136,8 +2872,7 @@ static void sm_run(void){
                     memcpy(&setup->sm_m_preq, &sm_connection->sm_m_preq, sizeof(sm_pairing_packet_t));
                     err = sm_stk_generation_init(sm_connection);
                     if (err){
-                        setup->sm_pairing_failed_reason = err;
-                        sm_connection->sm_engine_state = SM_GENERAL_SEND_PAIRING_FAILED;
+                        sm_pairing_error(sm_connection, err);
                         break;
                     }
                     sm_timeout_start(sm_connection);
@@ -2198,520 +2933,35 @@ static void sm_run(void){
                     break;
             }
             if (done){
-                sm_active_connection_handle = sm_connection->sm_handle;
-                log_info("sm: connection 0x%04x locked setup context as %s, state %u", sm_active_connection_handle, sm_connection->sm_role ? "responder" : "initiator", sm_connection->sm_engine_state);
+                setup->sm_con_handle = sm_connection->sm_handle;
+                log_info("sm: connection 0x%04x locked setup context #%u as %s, state %u", sm_connection->sm_handle, (int) (setup - sm_setup_contexts), sm_connection->sm_role ? "responder" : "initiator", sm_connection->sm_engine_state);
             }
         }
 
-        //
-        // active connection handling
-        //
-
-        if (sm_active_connection_handle == HCI_CON_HANDLE_INVALID) return;
-
-        sm_connection_t * connection = sm_get_connection_for_handle(sm_active_connection_handle);
-        if (!connection) {
-            log_info("no connection for handle 0x%04x", sm_active_connection_handle);
-            return;
-        }
-
-#if defined(ENABLE_LE_SECURE_CONNECTIONS) && !defined(USE_SOFTWARE_ECDH_IMPLEMENTATION)
-        if (setup->sm_state_vars & SM_STATE_VAR_DHKEY_NEEDED){
-            setup->sm_state_vars &= ~SM_STATE_VAR_DHKEY_NEEDED;
-            hci_send_cmd(&hci_le_generate_dhkey, &setup->sm_peer_q[0], &setup->sm_peer_q[32]);
-            return;
-        }
-#endif
-
-        // assert that we could send a SM PDU - not needed for all of the following
-        if (!l2cap_can_send_fixed_channel_packet_now(sm_active_connection_handle, L2CAP_CID_SECURITY_MANAGER_PROTOCOL)) {
-            log_info("cannot send now, requesting can send now event");
-            l2cap_request_can_send_fix_channel_now_event(sm_active_connection_handle, L2CAP_CID_SECURITY_MANAGER_PROTOCOL);
-            return;
-        }
-
-        // send keypress notifications
-        if (setup->sm_keypress_notification != 0xff){
-            uint8_t buffer[2];
-            buffer[0] = SM_CODE_KEYPRESS_NOTIFICATION;
-            buffer[1] = setup->sm_keypress_notification;
-            setup->sm_keypress_notification = 0xff;
-            l2cap_send_connectionless(connection->sm_handle, L2CAP_CID_SECURITY_MANAGER_PROTOCOL, (uint8_t*) buffer, sizeof(buffer));
-            return;
-        }
-
-        sm_key_t plaintext;
-        int key_distribution_flags;
-        UNUSED(key_distribution_flags);
-
-        log_info("sm_run: state %u", connection->sm_engine_state);
-
-        switch (connection->sm_engine_state){
-
-            // general
-            case SM_GENERAL_SEND_PAIRING_FAILED: {
-                uint8_t buffer[2];
-                buffer[0] = SM_CODE_PAIRING_FAILED;
-                buffer[1] = setup->sm_pairing_failed_reason;
-                connection->sm_engine_state = connection->sm_role ? SM_RESPONDER_IDLE : SM_INITIATOR_CONNECTED;
-                l2cap_send_connectionless(connection->sm_handle, L2CAP_CID_SECURITY_MANAGER_PROTOCOL, (uint8_t*) buffer, sizeof(buffer));
-                sm_done_for_handle(connection->sm_handle);
-                break;
-            }
-
-            // responding state
-#ifdef ENABLE_LE_SECURE_CONNECTIONS
-            case SM_SC_W2_GET_RANDOM_A:
-                sm_random_start(connection);
-                connection->sm_engine_state = SM_SC_W4_GET_RANDOM_A;
-                break;
-            case SM_SC_W2_GET_RANDOM_B:
-                sm_random_start(connection);
-                connection->sm_engine_state = SM_SC_W4_GET_RANDOM_B;
-                break;
-            case SM_SC_W2_CMAC_FOR_CONFIRMATION:
-                if (!sm_cmac_ready()) break;
-                connection->sm_engine_state = SM_SC_W4_CMAC_FOR_CONFIRMATION;
-                sm_sc_calculate_local_confirm(connection);
-                break;
-            case SM_SC_W2_CMAC_FOR_CHECK_CONFIRMATION:
-                if (!sm_cmac_ready()) break;
-                connection->sm_engine_state = SM_SC_W4_CMAC_FOR_CHECK_CONFIRMATION;
-                sm_sc_calculate_remote_confirm(connection);
-                break;
-            case SM_SC_W2_CALCULATE_F6_FOR_DHKEY_CHECK:
-                if (!sm_cmac_ready()) break;
-                connection->sm_engine_state = SM_SC_W4_CALCULATE_F6_FOR_DHKEY_CHECK;
-                sm_sc_calculate_f6_for_dhkey_check(connection);
-                break;
-            case SM_SC_W2_CALCULATE_F6_TO_VERIFY_DHKEY_CHECK:
-                if (!sm_cmac_ready()) break;
-                connection->sm_engine_state = SM_SC_W4_CALCULATE_F6_TO_VERIFY_DHKEY_CHECK;
-                sm_sc_calculate_f6_to_verify_dhkey_check(connection);
-                break;
-            case SM_SC_W2_CALCULATE_F5_SALT:
-                if (!sm_cmac_ready()) break;
-                connection->sm_engine_state = SM_SC_W4_CALCULATE_F5_SALT;
-                f5_calculate_salt(connection);
-                break;
-            case SM_SC_W2_CALCULATE_F5_MACKEY:
-                if (!sm_cmac_ready()) break;
-                connection->sm_engine_state = SM_SC_W4_CALCULATE_F5_MACKEY;
-                f5_calculate_mackey(connection);
-                break;
-            case SM_SC_W2_CALCULATE_F5_LTK:
-                if (!sm_cmac_ready()) break;
-                connection->sm_engine_state = SM_SC_W4_CALCULATE_F5_LTK;
-                f5_calculate_ltk(connection);
-                break;
-            case SM_SC_W2_CALCULATE_G2:
-                if (!sm_cmac_ready()) break;
-                connection->sm_engine_state = SM_SC_W4_CALCULATE_G2;
-                g2_calculate(connection);
-                break;
-            case SM_SC_W2_CALCULATE_H6_ILK:
-                if (!sm_cmac_ready()) break;
-                connection->sm_engine_state = SM_SC_W4_CALCULATE_H6_ILK;
-                h6_calculate_ilk(connection);
-                break;
-            case SM_SC_W2_CALCULATE_H6_BR_EDR_LINK_KEY:
-                if (!sm_cmac_ready()) break;
-                connection->sm_engine_state = SM_SC_W4_CALCULATE_H6_BR_EDR_LINK_KEY;
-                h6_calculate_br_edr_link_key(connection);
-                break;
-#endif
-
-#ifdef ENABLE_LE_CENTRAL
-            // initiator side
-            case SM_INITIATOR_PH0_SEND_START_ENCRYPTION: {
-                sm_key_t peer_ltk_flipped;
-                reverse_128(setup->sm_peer_ltk, peer_ltk_flipped);
-                connection->sm_engine_state = SM_INITIATOR_PH0_W4_CONNECTION_ENCRYPTED;
-                log_info("sm: hci_le_start_encryption ediv 0x%04x", setup->sm_peer_ediv);
-                uint32_t rand_high = big_endian_read_32(setup->sm_peer_rand, 0);
-                uint32_t rand_low  = big_endian_read_32(setup->sm_peer_rand, 4);
-                hci_send_cmd(&hci_le_start_encryption, connection->sm_handle,rand_low, rand_high, setup->sm_peer_ediv, peer_ltk_flipped);
-                return;
-            }
-
-            case SM_INITIATOR_PH1_SEND_PAIRING_REQUEST:
-                sm_pairing_packet_set_code(setup->sm_m_preq, SM_CODE_PAIRING_REQUEST);
-                connection->sm_engine_state = SM_INITIATOR_PH1_W4_PAIRING_RESPONSE;
-                l2cap_send_connectionless(connection->sm_handle, L2CAP_CID_SECURITY_MANAGER_PROTOCOL, (uint8_t*) &setup->sm_m_preq, sizeof(sm_pairing_packet_t));
-                sm_timeout_reset(connection);
-                break;
-#endif
-
-#ifdef ENABLE_LE_SECURE_CONNECTIONS
-
-            case SM_SC_SEND_PUBLIC_KEY_COMMAND: {
-                uint8_t buffer[65];
-                buffer[0] = SM_CODE_PAIRING_PUBLIC_KEY;
-                //
-                reverse_256(&ec_q[0],  &buffer[1]);
-                reverse_256(&ec_q[32], &buffer[33]);
-
-                // stk generation method
-                // passkey entry: notify app to show passkey or to request passkey
-                switch (setup->sm_stk_generation_method){
-                    case JUST_WORKS:
-                    case NK_BOTH_INPUT:
-                        if (IS_RESPONDER(connection->sm_role)){
-                            // responder
-                            sm_sc_start_calculating_local_confirm(connection);
-                        } else {
-                            // initiator
-                            connection->sm_engine_state = SM_SC_W4_PUBLIC_KEY_COMMAND;
-                        }
-                        break;
-                    case PK_INIT_INPUT:
-                    case PK_RESP_INPUT:
-                    case OK_BOTH_INPUT:
-                        // use random TK for display
-                        memcpy(setup->sm_ra, setup->sm_tk, 16);
-                        memcpy(setup->sm_rb, setup->sm_tk, 16);
-                        setup->sm_passkey_bit = 0;
-
-                        if (IS_RESPONDER(connection->sm_role)){
-                            // responder
-                            connection->sm_engine_state = SM_SC_W4_CONFIRMATION;
-                        } else {
-                            // initiator
-                            connection->sm_engine_state = SM_SC_W4_PUBLIC_KEY_COMMAND;
-                        }
-                        sm_trigger_user_response(connection);
-                        break;
-                    case OOB:
-                        // TODO: implement SC OOB
-                        break;
-                }
-
-                l2cap_send_connectionless(connection->sm_handle, L2CAP_CID_SECURITY_MANAGER_PROTOCOL, (uint8_t*) buffer, sizeof(buffer));
-                sm_timeout_reset(connection);
-                break;
-            }
-            case SM_SC_SEND_CONFIRMATION: {
-                uint8_t buffer[17];
-                buffer[0] = SM_CODE_PAIRING_CONFIRM;
-                reverse_128(setup->sm_local_confirm, &buffer[1]);
-                if (IS_RESPONDER(connection->sm_role)){
-                    connection->sm_engine_state = SM_SC_W4_PAIRING_RANDOM;
-                } else {
-                    connection->sm_engine_state = SM_SC_W4_CONFIRMATION;
-                }
-                l2cap_send_connectionless(connection->sm_handle, L2CAP_CID_SECURITY_MANAGER_PROTOCOL, (uint8_t*) buffer, sizeof(buffer));
-                sm_timeout_reset(connection);
-                break;
-            }
-            case SM_SC_SEND_PAIRING_RANDOM: {
-                uint8_t buffer[17];
-                buffer[0] = SM_CODE_PAIRING_RANDOM;
-                reverse_128(setup->sm_local_nonce, &buffer[1]);
-                if (setup->sm_stk_generation_method != JUST_WORKS && setup->sm_stk_generation_method != NK_BOTH_INPUT && setup->sm_passkey_bit < 20){
-                    if (IS_RESPONDER(connection->sm_role)){
-                        // responder
-                        connection->sm_engine_state = SM_SC_W4_CONFIRMATION;
-                    } else {
-                        // initiator
-                        connection->sm_engine_state = SM_SC_W4_PAIRING_RANDOM;
-                    }
-                } else {
-                    if (IS_RESPONDER(connection->sm_role)){
-                        // responder
-                        if (setup->sm_stk_generation_method == NK_BOTH_INPUT){
-                            connection->sm_engine_state = SM_SC_W2_CALCULATE_G2;
-                        } else {
-                            sm_sc_prepare_dhkey_check(connection);
-                        }
-                    } else {
-                        // initiator
-                        connection->sm_engine_state = SM_SC_W4_PAIRING_RANDOM;
-                    }
-                }
-                l2cap_send_connectionless(connection->sm_handle, L2CAP_CID_SECURITY_MANAGER_PROTOCOL, (uint8_t*) buffer, sizeof(buffer));
-                sm_timeout_reset(connection);
-                break;
-            }
-            case SM_SC_SEND_DHKEY_CHECK_COMMAND: {
-                uint8_t buffer[17];
-                buffer[0] = SM_CODE_PAIRING_DHKEY_CHECK;
-                reverse_128(setup->sm_local_dhkey_check, &buffer[1]);
-
-                if (IS_RESPONDER(connection->sm_role)){
-                    connection->sm_engine_state = SM_SC_W4_LTK_REQUEST_SC;
-                } else {
-                    connection->sm_engine_state = SM_SC_W4_DHKEY_CHECK_COMMAND;
-                }
-
-                l2cap_send_connectionless(connection->sm_handle, L2CAP_CID_SECURITY_MANAGER_PROTOCOL, (uint8_t*) buffer, sizeof(buffer));
-                sm_timeout_reset(connection);
-                break;
-            }
-
-#endif
-
-#ifdef ENABLE_LE_PERIPHERAL
-            case SM_RESPONDER_PH1_SEND_PAIRING_RESPONSE:
-                // echo initiator for now
-                sm_pairing_packet_set_code(setup->sm_s_pres,SM_CODE_PAIRING_RESPONSE);
-                key_distribution_flags = sm_key_distribution_flags_for_auth_req();
-
-                if (setup->sm_use_secure_connections){
-                    connection->sm_engine_state = SM_SC_W4_PUBLIC_KEY_COMMAND;
-                    // skip LTK/EDIV for SC
-                    log_info("sm: dropping encryption information flag");
-                    key_distribution_flags &= ~SM_KEYDIST_ENC_KEY;
-                } else {
-                    connection->sm_engine_state = SM_RESPONDER_PH1_W4_PAIRING_CONFIRM;
-                }
-
-                sm_pairing_packet_set_initiator_key_distribution(setup->sm_s_pres, sm_pairing_packet_get_initiator_key_distribution(setup->sm_m_preq) & key_distribution_flags);
-                sm_pairing_packet_set_responder_key_distribution(setup->sm_s_pres, sm_pairing_packet_get_responder_key_distribution(setup->sm_m_preq) & key_distribution_flags);
-                // update key distribution after ENC was dropped
-                sm_setup_key_distribution(sm_pairing_packet_get_responder_key_distribution(setup->sm_s_pres));
-
-                l2cap_send_connectionless(connection->sm_handle, L2CAP_CID_SECURITY_MANAGER_PROTOCOL, (uint8_t*) &setup->sm_s_pres, sizeof(sm_pairing_packet_t));
-                sm_timeout_reset(connection);
-                // SC Numeric Comparison will trigger user response after public keys & nonces have been exchanged
-                if (!setup->sm_use_secure_connections || setup->sm_stk_generation_method == JUST_WORKS){
-                    sm_trigger_user_response(connection);
-                }
-                return;
-#endif
-
-            case SM_PH2_SEND_PAIRING_RANDOM: {
-                uint8_t buffer[17];
-                buffer[0] = SM_CODE_PAIRING_RANDOM;
-                reverse_128(setup->sm_local_random, &buffer[1]);
-                if (IS_RESPONDER(connection->sm_role)){
-                    connection->sm_engine_state = SM_RESPONDER_PH2_W4_LTK_REQUEST;
-                } else {
-                    connection->sm_engine_state = SM_INITIATOR_PH2_W4_PAIRING_RANDOM;
-                }
-                l2cap_send_connectionless(connection->sm_handle, L2CAP_CID_SECURITY_MANAGER_PROTOCOL, (uint8_t*) buffer, sizeof(buffer));
-                sm_timeout_reset(connection);
-                break;
-            }
-
-            case SM_PH2_GET_RANDOM_TK:
-            case SM_PH2_C1_GET_RANDOM_A:
-            case SM_PH2_C1_GET_RANDOM_B:
-            case SM_PH3_GET_RANDOM:
-            case SM_PH3_GET_DIV:
-                sm_next_responding_state(connection);
-                sm_random_start(connection);
-                return;
-
-            case SM_PH2_C1_GET_ENC_B:
-            case SM_PH2_C1_GET_ENC_D:
-                // already busy?
-                if (sm_aes128_state == SM_AES128_ACTIVE) break;
-                sm_next_responding_state(connection);
-                sm_aes128_start(setup->sm_tk, setup->sm_c1_t3_value, connection);
-                return;
-
-            case SM_PH3_LTK_GET_ENC:
-            case SM_RESPONDER_PH4_LTK_GET_ENC:
-                // already busy?
-                if (sm_aes128_state == SM_AES128_IDLE) {
-                    sm_key_t d_prime;
-                    sm_d1_d_prime(setup->sm_local_div, 0, d_prime);
-                    sm_next_responding_state(connection);
-                    sm_aes128_start(sm_persistent_er, d_prime, connection);
-                    return;
-                }
-                break;
-
-            case SM_PH3_CSRK_GET_ENC:
-                // already busy?
-                if (sm_aes128_state == SM_AES128_IDLE) {
-                    sm_key_t d_prime;
-                    sm_d1_d_prime(setup->sm_local_div, 1, d_prime);
-                    sm_next_responding_state(connection);
-                    sm_aes128_start(sm_persistent_er, d_prime, connection);
-                    return;
-                }
-                break;
-
-            case SM_PH2_C1_GET_ENC_C:
-                // already busy?
-                if (sm_aes128_state == SM_AES128_ACTIVE) break;
-                // calculate m_confirm using aes128 engine - step 1
-                sm_c1_t1(setup->sm_peer_random, (uint8_t*) &setup->sm_m_preq, (uint8_t*) &setup->sm_s_pres, setup->sm_m_addr_type, setup->sm_s_addr_type, plaintext);
-                sm_next_responding_state(connection);
-                sm_aes128_start(setup->sm_tk, plaintext, connection);
-                break;
-            case SM_PH2_C1_GET_ENC_A:
-                // already busy?
-                if (sm_aes128_state == SM_AES128_ACTIVE) break;
-                // calculate confirm using aes128 engine - step 1
-                sm_c1_t1(setup->sm_local_random, (uint8_t*) &setup->sm_m_preq, (uint8_t*) &setup->sm_s_pres, setup->sm_m_addr_type, setup->sm_s_addr_type, plaintext);
-                sm_next_responding_state(connection);
-                sm_aes128_start(setup->sm_tk, plaintext, connection);
-                break;
-            case SM_PH2_CALC_STK:
-                // already busy?
-                if (sm_aes128_state == SM_AES128_ACTIVE) break;
-                // calculate STK
-                if (IS_RESPONDER(connection->sm_role)){
-                    sm_s1_r_prime(setup->sm_local_random, setup->sm_peer_random, plaintext);
-                } else {
-                    sm_s1_r_prime(setup->sm_peer_random, setup->sm_local_random, plaintext);
-                }
-                sm_next_responding_state(connection);
-                sm_aes128_start(setup->sm_tk, plaintext, connection);
-                break;
-            case SM_PH3_Y_GET_ENC:
-                // already busy?
-                if (sm_aes128_state == SM_AES128_ACTIVE) break;
-                // PH3B2 - calculate Y from      - enc
-                // Y = dm(DHK, Rand)
-                sm_dm_r_prime(setup->sm_local_rand, plaintext);
-                sm_next_responding_state(connection);
-                sm_aes128_start(sm_persistent_dhk, plaintext, connection);
-                return;
-            case SM_PH2_C1_SEND_PAIRING_CONFIRM: {
-                uint8_t buffer[17];
-                buffer[0] = SM_CODE_PAIRING_CONFIRM;
-                reverse_128(setup->sm_local_confirm, &buffer[1]);
-                if (IS_RESPONDER(connection->sm_role)){
-                    connection->sm_engine_state = SM_RESPONDER_PH2_W4_PAIRING_RANDOM;
-                } else {
-                    connection->sm_engine_state = SM_INITIATOR_PH2_W4_PAIRING_CONFIRM;
-                }
-                l2cap_send_connectionless(connection->sm_handle, L2CAP_CID_SECURITY_MANAGER_PROTOCOL, (uint8_t*) buffer, sizeof(buffer));
-                sm_timeout_reset(connection);
-                return;
-            }
-#ifdef ENABLE_LE_PERIPHERAL
-            case SM_RESPONDER_PH2_SEND_LTK_REPLY: {
-                sm_key_t stk_flipped;
-                reverse_128(setup->sm_ltk, stk_flipped);
-                connection->sm_engine_state = SM_PH2_W4_CONNECTION_ENCRYPTED;
-                hci_send_cmd(&hci_le_long_term_key_request_reply, connection->sm_handle, stk_flipped);
-                return;
-            }
-            case SM_RESPONDER_PH4_SEND_LTK_REPLY: {
-                sm_key_t ltk_flipped;
-                reverse_128(setup->sm_ltk, ltk_flipped);
-                connection->sm_engine_state = SM_RESPONDER_IDLE;
-                hci_send_cmd(&hci_le_long_term_key_request_reply, connection->sm_handle, ltk_flipped);
-                return;
-            }
-            case SM_RESPONDER_PH4_Y_GET_ENC:
-                // already busy?
-                if (sm_aes128_state == SM_AES128_ACTIVE) break;
-                log_info("LTK Request: recalculating with ediv 0x%04x", setup->sm_local_ediv);
-                // Y = dm(DHK, Rand)
-                sm_dm_r_prime(setup->sm_local_rand, plaintext);
-                sm_next_responding_state(connection);
-                sm_aes128_start(sm_persistent_dhk, plaintext, connection);
-                return;
-#endif
-#ifdef ENABLE_LE_CENTRAL
-            case SM_INITIATOR_PH3_SEND_START_ENCRYPTION: {
-                sm_key_t stk_flipped;
-                reverse_128(setup->sm_ltk, stk_flipped);
-                connection->sm_engine_state = SM_PH2_W4_CONNECTION_ENCRYPTED;
-                hci_send_cmd(&hci_le_start_encryption, connection->sm_handle, 0, 0, 0, stk_flipped);
-                return;
+        // serve connections with setup context in round-robin order to share AES128, CMAC and random engine fairly
+        int start = sm_setup_context_next;
+        sm_setup_context_next = (start + 1) % SM_SETUP_CONTEXT_NUM;
+        int i;
+        for (i = 0; i < SM_SETUP_CONTEXT_NUM; i++){
+            // assert that we can send at least commands
+            if (!hci_can_send_command_packet_now()) return;
+            int index = (start + i) % SM_SETUP_CONTEXT_NUM;
+            hci_con_handle_t con_handle = sm_setup_contexts[index].sm_con_handle;
+            if (con_handle == HCI_CON_HANDLE_INVALID) continue;
+            sm_connection_t * connection = sm_get_connection_for_handle(con_handle);
+            if (!connection) {
+                log_info("no connection for handle 0x%04x", con_handle);
+                continue;
             }
-#endif
-
-            case SM_PH3_DISTRIBUTE_KEYS:
-                if (setup->sm_key_distribution_send_set &   SM_KEYDIST_FLAG_ENCRYPTION_INFORMATION){
-                    setup->sm_key_distribution_send_set &= ~SM_KEYDIST_FLAG_ENCRYPTION_INFORMATION;
-                    uint8_t buffer[17];
-                    buffer[0] = SM_CODE_ENCRYPTION_INFORMATION;
-                    reverse_128(setup->sm_ltk, &buffer[1]);
-                    l2cap_send_connectionless(connection->sm_handle, L2CAP_CID_SECURITY_MANAGER_PROTOCOL, (uint8_t*) buffer, sizeof(buffer));
-                    sm_timeout_reset(connection);
-                    return;
-                }
-                if (setup->sm_key_distribution_send_set &   SM_KEYDIST_FLAG_MASTER_IDENTIFICATION){
-                    setup->sm_key_distribution_send_set &= ~SM_KEYDIST_FLAG_MASTER_IDENTIFICATION;
-                    uint8_t buffer[11];
-                    buffer[0] = SM_CODE_MASTER_IDENTIFICATION;
-                    little_endian_store_16(buffer, 1, setup->sm_local_ediv);
-                    reverse_64(setup->sm_local_rand, &buffer[3]);
-                    l2cap_send_connectionless(connection->sm_handle, L2CAP_CID_SECURITY_MANAGER_PROTOCOL, (uint8_t*) buffer, sizeof(buffer));
-                    sm_timeout_reset(connection);
-                    return;
-                }
-                if (setup->sm_key_distribution_send_set &   SM_KEYDIST_FLAG_IDENTITY_INFORMATION){
-                    setup->sm_key_distribution_send_set &= ~SM_KEYDIST_FLAG_IDENTITY_INFORMATION;
-                    uint8_t buffer[17];
-                    buffer[0] = SM_CODE_IDENTITY_INFORMATION;
-                    reverse_128(sm_persistent_irk, &buffer[1]);
-                    l2cap_send_connectionless(connection->sm_handle, L2CAP_CID_SECURITY_MANAGER_PROTOCOL, (uint8_t*) buffer, sizeof(buffer));
-                    sm_timeout_reset(connection);
-                    return;
-                }
-                if (setup->sm_key_distribution_send_set &   SM_KEYDIST_FLAG_IDENTITY_ADDRESS_INFORMATION){
-                    setup->sm_key_distribution_send_set &= ~SM_KEYDIST_FLAG_IDENTITY_ADDRESS_INFORMATION;
-                    bd_addr_t local_address;
-                    uint8_t buffer[8];
-                    buffer[0] = SM_CODE_IDENTITY_ADDRESS_INFORMATION;
-                    switch (gap_random_address_get_mode()){
-                        case GAP_RANDOM_ADDRESS_TYPE_OFF:
-                        case GAP_RANDOM_ADDRESS_TYPE_STATIC:
-                            // public or static random
-                            gap_le_get_own_address(&buffer[1], local_address);
-                            break;
-                        case GAP_RANDOM_ADDRESS_NON_RESOLVABLE:
-                        case GAP_RANDOM_ADDRESS_RESOLVABLE:
-                            // fallback to public
-                            gap_local_bd_addr(local_address);
-                            buffer[1] = 0;
-                            break;
-                    }
-                    reverse_bd_addr(local_address, &buffer[2]);
-                    l2cap_send_connectionless(connection->sm_handle, L2CAP_CID_SECURITY_MANAGER_PROTOCOL, (uint8_t*) buffer, sizeof(buffer));
-                    sm_timeout_reset(connection);
-                    return;
-                }
-                if (setup->sm_key_distribution_send_set &   SM_KEYDIST_FLAG_SIGNING_IDENTIFICATION){
-                    setup->sm_key_distribution_send_set &= ~SM_KEYDIST_FLAG_SIGNING_IDENTIFICATION;
-
-                    // hack to reproduce test runs
-                    if (test_use_fixed_local_csrk){
-                        memset(setup->sm_local_csrk, 0xcc, 16);
-                    }
-
-                    uint8_t buffer[17];
-                    buffer[0] = SM_CODE_SIGNING_INFORMATION;
-                    reverse_128(setup->sm_local_csrk, &buffer[1]);
-                    l2cap_send_connectionless(connection->sm_handle, L2CAP_CID_SECURITY_MANAGER_PROTOCOL, (uint8_t*) buffer, sizeof(buffer));
-                    sm_timeout_reset(connection);
-                    return;
-                }
-
-                // keys are sent
-                if (IS_RESPONDER(connection->sm_role)){
-                    // slave -> receive master keys if any
-                    if (sm_key_distribution_all_received(connection)){
-                        sm_key_distribution_handle_all_received(connection);
-                        connection->sm_engine_state = SM_RESPONDER_IDLE;
-                        sm_done_for_handle(connection->sm_handle);
-                    } else {
-                        connection->sm_engine_state = SM_PH3_RECEIVE_KEYS;
-                    }
-                } else {
-                    // master -> all done
-                    connection->sm_engine_state = SM_INITIATOR_CONNECTED;
-                    sm_done_for_handle(connection->sm_handle);
-                }
-                break;
-
-            default:
-                break;
+            sm_run_for_connection(connection);
         }
 
-        // check again if active connection was released
-        if (sm_active_connection_handle != HCI_CON_HANDLE_INVALID) break;
+        // check again if setup context was released
+        if (!sm_setup_context_released) break;
     }
 }
 
+
 // note: aes engine is ready as we just got the aes result
 static void sm_handle_encryption_result(uint8_t * data){
 
@@ -2776,6 +3026,7 @@ static void sm_handle_encryption_result(uint8_t * data){
     // retrieve sm_connection provided to sm_aes128_start_encryption
     sm_connection_t * connection = (sm_connection_t*) sm_aes128_context;
     if (!connection) return;
+    sm_setup_context_select(connection->sm_handle);
     switch (connection->sm_engine_state){
         case SM_PH2_C1_W4_ENC_A:
         case SM_PH2_C1_W4_ENC_C:
@@ -2797,8 +3048,7 @@ static void sm_handle_encryption_result(uint8_t * data){
             reverse_128(data, peer_confirm_test);
             log_info_key("c1!", peer_confirm_test);
             if (memcmp(setup->sm_peer_confirm, peer_confirm_test, 16) != 0){
-                setup->sm_pairing_failed_reason = SM_REASON_CONFIRM_VALUE_FAILED;
-                connection->sm_engine_state = SM_GENERAL_SEND_PAIRING_FAILED;
+                sm_pairing_error(connection, SM_REASON_CONFIRM_VALUE_FAILED);
                 return;
             }
             if (IS_RESPONDER(connection->sm_role)){
@@ -2913,6 +3163,8 @@ static int sm_generate_f_rng_mbedtls(void * context, unsigned char * buffer, siz
 // note: random generator is ready. this doesn NOT imply that aes engine is unused!
 static void sm_handle_random_result(uint8_t * data){
 
+    sm_random_active = 0;
+
 #if defined(ENABLE_LE_SECURE_CONNECTIONS) && defined(USE_SOFTWARE_ECDH_IMPLEMENTATION)
 
     if (ec_key_generation_state == EC_KEY_GENERATION_ACTIVE){
@@ -2998,6 +3250,7 @@ static void sm_handle_random_result(uint8_t * data){
     // retrieve sm_connection provided to sm_random_start
     sm_connection_t * connection = (sm_connection_t *) sm_random_context;
     if (!connection) return;
+    sm_setup_context_select(connection->sm_handle);
     switch (connection->sm_engine_state){
 #ifdef ENABLE_LE_SECURE_CONNECTIONS
         case SM_SC_W4_GET_RANDOM_A:
@@ -3230,7 +3483,9 @@ static void sm_event_packet_handler (uint8_t packet_type, uint16_t channel, uint
                             sm_log_ec_keypair();
                             break;
                         case HCI_SUBEVENT_LE_GENERATE_DHKEY_COMPLETE:
-                            sm_conn = sm_get_connection_for_handle(sm_active_connection_handle);
+                            sm_conn = sm_get_connection_for_handle(sm_generate_dhkey_con_handle);
+                            sm_generate_dhkey_con_handle = HCI_CON_HANDLE_INVALID;
+                            if (!sm_conn) break;
                             if (hci_subevent_le_generate_dhkey_complete_get_status(packet)){
                                 log_error("Generate DHKEY failed -> abort");
                                 // abort pairing with 'unspecified reason'
@@ -3464,6 +3719,7 @@ static void sm_pdu_handler(uint8_t packet_type, hci_con_handle_t con_handle, uin
 
     if (sm_pdu_code == SM_CODE_PAIRING_FAILED){
         sm_conn->sm_engine_state = sm_conn->sm_role ? SM_RESPONDER_IDLE : SM_INITIATOR_CONNECTED;
+        sm_done_for_handle(con_handle);
         return;
     }
 
@@ -3524,8 +3780,7 @@ static void sm_pdu_handler(uint8_t packet_type, hci_con_handle_t con_handle, uin
             memcpy(&setup->sm_s_pres, packet, sizeof(sm_pairing_packet_t));
             err = sm_stk_generation_init(sm_conn);
             if (err){
-                setup->sm_pairing_failed_reason = err;
-                sm_conn->sm_engine_state = SM_GENERAL_SEND_PAIRING_FAILED;
+                sm_pairing_error(sm_conn, err);
                 break;
             }
 
@@ -3763,8 +4018,7 @@ static void sm_pdu_handler(uint8_t packet_type, hci_con_handle_t con_handle, uin
 
             // handle user cancel pairing?
             if (setup->sm_user_response == SM_USER_RESPONSE_DECLINE){
-                setup->sm_pairing_failed_reason = SM_REASON_PASSKEYT_ENTRY_FAILED;
-                sm_conn->sm_engine_state = SM_GENERAL_SEND_PAIRING_FAILED;
+                sm_pairing_error(sm_conn, SM_REASON_PASSKEYT_ENTRY_FAILED);
                 break;
             }
 
@@ -3933,13 +4187,25 @@ void sm_init(void){
     dkg_state = DKG_W4_WORKING;
     rau_state = RAU_W4_WORKING;
     sm_aes128_state = SM_AES128_IDLE;
+    sm_random_active = 0;
     sm_address_resolution_test = -1;    // no private address to resolve yet
     sm_address_resolution_ah_calculation_active = 0;
     sm_address_resolution_mode = ADDRESS_RESOLUTION_IDLE;
     sm_address_resolution_general_queue = NULL;
+    sm_resolving_cache_flush();
+    le_device_db_set_changed_callback(&sm_resolving_cache_flush);
+    sm_address_resolution_reset_statistics();
 
     gap_random_adress_update_period = 15 * 60 * 1000L;
-    sm_active_connection_handle = HCI_CON_HANDLE_INVALID;
+
+    for (i = 0; i < SM_SETUP_CONTEXT_NUM; i++){
+        sm_setup_contexts[i].sm_con_handle = HCI_CON_HANDLE_INVALID;
+    }
+    setup = &sm_setup_contexts[0];
+    sm_setup_context_next = 0;
+#if defined(ENABLE_LE_SECURE_CONNECTIONS) && !defined(USE_SOFTWARE_ECDH_IMPLEMENTATION)
+    sm_generate_dhkey_con_handle = HCI_CON_HANDLE_INVALID;
+#endif
 
     test_use_fixed_local_csrk = 0;
 
@@ -4005,12 +4271,25 @@ void sm_allow_ltk_reconstruction_without_le_device_db_entry(int allow){
     sm_reconstruct_ltk_without_le_device_db_entry = allow;
 }
 
+// also selects the setup context of the connection, if it has one
 static sm_connection_t * sm_get_connection_for_handle(hci_con_handle_t con_handle){
     hci_connection_t * hci_con = hci_connection_for_handle(con_handle);
     if (!hci_con) return NULL;
+    sm_setup_context_select(con_handle);
     return &hci_con->sm_connection;
 }
 
+// user actions modify the setup context, ignore them if the connection does not own one
+static sm_connection_t * sm_get_connection_with_setup_context_for_handle(hci_con_handle_t con_handle){
+    sm_connection_t * sm_conn = sm_get_connection_for_handle(con_handle);
+    if (!sm_conn) return NULL;
+    if (!sm_setup_context_for_handle(con_handle)){
+        log_error("sm: no setup context for connection 0x%04x, ignoring user action", con_handle);
+        return NULL;
+    }
+    return sm_conn;
+}
+
 // @returns 0 if not encrypted, 7-16 otherwise
 int sm_encryption_key_size(hci_con_handle_t con_handle){
     sm_connection_t * sm_conn = sm_get_connection_for_handle(con_handle);
@@ -4110,7 +4389,7 @@ void sm_authorization_grant(hci_con_handle_t con_handle){
 // GAP Bonding API
 
 void sm_bonding_decline(hci_con_handle_t con_handle){
-    sm_connection_t * sm_conn = sm_get_connection_for_handle(con_handle);
+    sm_connection_t * sm_conn = sm_get_connection_with_setup_context_for_handle(con_handle);
     if (!sm_conn) return;     // wrong connection
     setup->sm_user_response = SM_USER_RESPONSE_DECLINE;
 
@@ -4134,7 +4413,7 @@ void sm_bonding_decline(hci_con_handle_t con_handle){
 }
 
 void sm_just_works_confirm(hci_con_handle_t con_handle){
-    sm_connection_t * sm_conn = sm_get_connection_for_handle(con_handle);
+    sm_connection_t * sm_conn = sm_get_connection_with_setup_context_for_handle(con_handle);
     if (!sm_conn) return;     // wrong connection
     setup->sm_user_response = SM_USER_RESPONSE_CONFIRM;
     if (sm_conn->sm_engine_state == SM_PH1_W4_USER_RESPONSE){
@@ -4160,7 +4439,7 @@ void sm_numeric_comparison_confirm(hci_con_handle_t con_handle){
 }
 
 void sm_passkey_input(hci_con_handle_t con_handle, uint32_t passkey){
-    sm_connection_t * sm_conn = sm_get_connection_for_handle(con_handle);
+    sm_connection_t * sm_conn = sm_get_connection_with_setup_context_for_handle(con_handle);
     if (!sm_conn) return;     // wrong connection
     sm_reset_tk();
     big_endian_store_32(setup->sm_tk, 12, passkey);
@@ -4179,7 +4458,7 @@ void sm_passkey_input(hci_con_handle_t con_handle, uint32_t passkey){
 }
 
 void sm_keypress_notification(hci_con_handle_t con_handle, uint8_t action){
-    sm_connection_t * sm_conn = sm_get_connection_for_handle(con_handle);
+    sm_connection_t * sm_conn = sm_get_connection_with_setup_context_for_handle(con_handle);
     if (!sm_conn) return;     // wrong connection
     if (action > SM_KEYPRESS_PASSKEY_ENTRY_COMPLETED) return;
     setup->sm_keypress_notification = action;
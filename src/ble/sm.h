@@ -53,6 +53,15 @@ typedef struct {
     bd_addr_type_t address_type;
 } sm_lookup_entry_t;
 
+// statistics for lookups of random addresses, cache hit rate = cache_hits / lookups
+typedef struct {
+    uint32_t lookups;
+    uint32_t cache_hits;
+    uint32_t ah_calculations;
+    uint32_t latency_total_ms;
+    uint32_t latency_max_ms;
+} sm_address_resolution_statistics_t;
+
 static inline uint8_t sm_pairing_packet_get_code(sm_pairing_packet_t packet){
     return packet[0];
 }
@@ -274,6 +283,18 @@ void sm_cmac_signed_write_start(const sm_key_t key, uint8_t opcode, uint16_t att
  */
 int sm_address_resolution_lookup(uint8_t addr_type, bd_addr_t addr);
 
+/*
+ * @brief Get statistics for address resolution of random addresses
+ * @note Lookups are served from a resolving cache of SM_RESOLVING_CACHE_SIZE recently seen addresses
+ * @param statistics
+ */
+void sm_address_resolution_get_statistics(sm_address_resolution_statistics_t * statistics);
+
+/*
+ * @brief Reset address resolution statistics
+ */
+void sm_address_resolution_reset_statistics(void);
+
 /**
  * @brief Identify device in LE Device DB.
  * @param handle
@@ -268,6 +268,25 @@ typedef enum {
 
 #define LE_ADVERTISING_DATA_SIZE    31
 
+// LE Data Length, min/max number of payload octets in a single LL Data PDU
+#define LE_DATA_LENGTH_MIN_OCTETS   27
+#define LE_DATA_LENGTH_MAX_OCTETS  251
+
+/**
+ * LE PHY, used in LE PHY Update Complete and as bit index in LE Set (Default) PHY
+ */
+#define LE_PHY_1M     1
+#define LE_PHY_2M     2
+#define LE_PHY_CODED  3
+
+#define LE_PHY_MASK_1M     (1 << (LE_PHY_1M - 1))
+#define LE_PHY_MASK_2M     (1 << (LE_PHY_2M - 1))
+#define LE_PHY_MASK_CODED  (1 << (LE_PHY_CODED - 1))
+
+// all_phys flags for LE Set (Default) PHY
+#define LE_PHY_ALL_PHYS_NO_TX_PREFERENCE 0x01
+#define LE_PHY_ALL_PHYS_NO_RX_PREFERENCE 0x02
+
 /**
  * Default INQ Mode
  */
@@ -678,6 +697,16 @@ typedef enum {
 // array of advertisements, not handled by event accessor generator
 #define HCI_SUBEVENT_LE_DIRECT_ADVERTISING_REPORT          0x0B
 
+/**
+ * @format 11H11
+ * @param subevent_code
+ * @param status
+ * @param connection_handle
+ * @param tx_phy
+ * @param rx_phy
+ */
+#define HCI_SUBEVENT_LE_PHY_UPDATE_COMPLETE                0x0C
+
 /** 
  * L2CAP Layer
  */
@@ -1037,6 +1066,10 @@ typedef enum {
 #define ATT_HANDLE_VALUE_INDICATION     0x1d
 #define ATT_HANDLE_VALUE_CONFIRMATION   0x1e
 
+#define ATT_READ_MULTIPLE_VARIABLE_REQUEST      0x20
+#define ATT_READ_MULTIPLE_VARIABLE_RESPONSE     0x21
+#define ATT_MULTIPLE_HANDLE_VALUE_NOTIFICATION  0x23
+
 
 #define ATT_WRITE_COMMAND                0x52
 #define ATT_SIGNED_WRITE_COMMAND         0xD2
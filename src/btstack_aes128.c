@@ -0,0 +1,157 @@
+/*
+ * Copyright (C) 2017 BlueKitchen GmbH
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ * 4. Any redistribution, use, or modification is done solely for
+ *    personal benefit and not for any commercial purpose or for
+ *    monetary gain.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BLUEKITCHEN GMBH AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL MATTHIAS
+ * RINGWALD OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Please inquire about commercial licensing options at 
+ * contact@bluekitchen-gmbh.com
+ *
+ */
+
+#define __BTSTACK_FILE__ "btstack_aes128.c"
+
+/*
+ *  btstack_aes128.c
+ *
+ *  Software AES128 with table based Rijndael implementation, AES-NI is used if available on x86 hosts
+ */
+
+#include "btstack_config.h"
+
+#include "btstack_aes128.h"
+
+#ifdef ENABLE_SOFTWARE_AES128
+
+#include <string.h>
+
+#include "rijndael.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define USE_AES128_NI
+#include <wmmintrin.h>
+#define AES128_NI_TARGET __attribute__((target("aes,sse2")))
+#endif
+
+// the Security Manager uses the same key for several blocks in a row (c1, CMAC, IRK lookup),
+// so the key schedule of the last key is kept
+static uint8_t  aes128_key[16];
+static int      aes128_key_valid;
+static uint32_t aes128_rk[RKLENGTH(KEYBITS)];
+static int      aes128_nrounds;
+
+#ifdef USE_AES128_NI
+
+// -1 = not checked yet
+static int      aes128_ni_available = -1;
+static __m128i  aes128_ni_rk[11];
+
+AES128_NI_TARGET
+static __m128i aes128_ni_expand_step(__m128i key, __m128i key_gen){
+    key_gen = _mm_shuffle_epi32(key_gen, _MM_SHUFFLE(3,3,3,3));
+    key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+    key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+    key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+    return _mm_xor_si128(key, key_gen);
+}
+
+// aeskeygenassist requires an immediate round constant
+#define AES128_NI_EXPAND(index, rcon) \
+    aes128_ni_rk[index] = aes128_ni_expand_step(aes128_ni_rk[index-1], _mm_aeskeygenassist_si128(aes128_ni_rk[index-1], rcon))
+
+AES128_NI_TARGET
+static void aes128_ni_setup(const uint8_t * key){
+    aes128_ni_rk[0] = _mm_loadu_si128((const __m128i *) key);
+    AES128_NI_EXPAND( 1, 0x01);
+    AES128_NI_EXPAND( 2, 0x02);
+    AES128_NI_EXPAND( 3, 0x04);
+    AES128_NI_EXPAND( 4, 0x08);
+    AES128_NI_EXPAND( 5, 0x10);
+    AES128_NI_EXPAND( 6, 0x20);
+    AES128_NI_EXPAND( 7, 0x40);
+    AES128_NI_EXPAND( 8, 0x80);
+    AES128_NI_EXPAND( 9, 0x1b);
+    AES128_NI_EXPAND(10, 0x36);
+}
+
+AES128_NI_TARGET
+static void aes128_ni_encrypt(const uint8_t * plaintext, uint8_t * result){
+    __m128i state = _mm_loadu_si128((const __m128i *) plaintext);
+    state = _mm_xor_si128(state, aes128_ni_rk[0]);
+    int i;
+    for (i = 1; i < 10; i++){
+        state = _mm_aesenc_si128(state, aes128_ni_rk[i]);
+    }
+    state = _mm_aesenclast_si128(state, aes128_ni_rk[10]);
+    _mm_storeu_si128((__m128i *) result, state);
+}
+
+static int aes128_ni_check(void){
+    if (aes128_ni_available < 0){
+        __builtin_cpu_init();
+        aes128_ni_available = __builtin_cpu_supports("aes") ? 1 : 0;
+    }
+    return aes128_ni_available;
+}
+#endif
+
+int btstack_aes128_hardware_accelerated(void){
+#ifdef USE_AES128_NI
+    return aes128_ni_check();
+#else
+    return 0;
+#endif
+}
+
+void btstack_aes128_calc(uint8_t * key, uint8_t * plaintext, uint8_t * result){
+#ifdef USE_AES128_NI
+    int use_ni = aes128_ni_check();
+#endif
+    if (!aes128_key_valid || memcmp(key, aes128_key, 16) != 0){
+        memcpy(aes128_key, key, 16);
+        aes128_key_valid = 1;
+#ifdef USE_AES128_NI
+        if (use_ni){
+            aes128_ni_setup(key);
+        } else
+#endif
+        {
+            aes128_nrounds = rijndaelSetupEncrypt(aes128_rk, key, KEYBITS);
+        }
+    }
+#ifdef USE_AES128_NI
+    if (use_ni){
+        aes128_ni_encrypt(plaintext, result);
+        return;
+    }
+#endif
+    rijndaelEncrypt(aes128_rk, aes128_nrounds, plaintext, result);
+}
+
+#endif
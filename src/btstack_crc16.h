@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2017 BlueKitchen GmbH
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ * 4. Any redistribution, use, or modification is done solely for
+ *    personal benefit and not for any commercial purpose or for
+ *    monetary gain.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BLUEKITCHEN GMBH AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL MATTHIAS
+ * RINGWALD OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Please inquire about commercial licensing options at 
+ * contact@bluekitchen-gmbh.com
+ *
+ */
+
+/*
+ *  btstack_crc16.h
+ *
+ *  Reflected CRC-16 calculations used by H5 data integrity check and L2CAP FCS
+ *
+ *  Implementation can be selected at compile time:
+ *  - default: 16 entry table for CRC-16-CCITT, 256 entry table for CRC-16-IBM
+ *  - ENABLE_CRC16_TABLE_256: 256 entry tables for both
+ *  - ENABLE_CRC16_SLICING_BY_8: 8 bytes per iteration, 8 x 256 entry tables per polynomial are generated on first use (8 kB RAM)
+ */
+
+#ifndef __BTSTACK_CRC16_H
+#define __BTSTACK_CRC16_H
+
+#if defined __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+/**
+ * @brief Update CRC-16-CCITT (x^16 + x^12 + x^5 + 1), bit reversed polynomial 0x8408
+ * @param crc current value, e.g. 0xffff for H5 data integrity check
+ * @param data
+ * @param len
+ * @return updated crc
+ */
+uint16_t btstack_crc16_ccitt_update(uint16_t crc, const uint8_t * data, uint16_t len);
+
+/**
+ * @brief Update CRC-16-IBM (x^16 + x^15 + x^2 + 1), bit reversed polynomial 0xa001
+ * @param crc current value, e.g. 0 for L2CAP FCS
+ * @param data
+ * @param len
+ * @return updated crc
+ */
+uint16_t btstack_crc16_ibm_update(uint16_t crc, const uint8_t * data, uint16_t len);
+
+/**
+ * @brief Get name of selected implementation
+ * @return name
+ */
+const char * btstack_crc16_implementation(void);
+
+#if defined __cplusplus
+}
+#endif
+
+#endif // __BTSTACK_CRC16_H
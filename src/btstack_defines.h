@@ -1552,6 +1552,27 @@ typedef uint8_t sm_key_t[16];
  */
 #define A2DP_SUBEVENT_SIGNALING_CONNECTION_RELEASED                  0x0C
 
+/**
+ * @format 12142         Media scheduler did not get audio data in time.
+ * @param subevent_code
+ * @param a2dp_cid
+ * @param local_seid
+ * @param underruns
+ * @param queued_frames
+ */
+#define A2DP_SUBEVENT_MEDIA_SCHEDULER_UNDERRUN                      0x0D
+
+/**
+ * @format 121111        Media scheduler changed SBC bitpool because of link congestion.
+ * @param subevent_code
+ * @param a2dp_cid
+ * @param local_seid
+ * @param previous_bitpool
+ * @param bitpool
+ * @param backlog number of media packets queued in host and controller
+ */
+#define A2DP_SUBEVENT_MEDIA_SCHEDULER_BITPOOL_CHANGED               0x0E
+
 
 /** AVRCP Subevent */
 
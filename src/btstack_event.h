@@ -3467,6 +3467,43 @@ static inline uint8_t hci_subevent_le_enhanced_connection_complete_get_master_cl
     return event[32];
 }
 
+/**
+ * @brief Get field status from event HCI_SUBEVENT_LE_PHY_UPDATE_COMPLETE
+ * @param event packet
+ * @return status
+ * @note: btstack_type 1
+ */
+static inline uint8_t hci_subevent_le_phy_update_complete_get_status(const uint8_t * event){
+    return event[3];
+}
+/**
+ * @brief Get field connection_handle from event HCI_SUBEVENT_LE_PHY_UPDATE_COMPLETE
+ * @param event packet
+ * @return connection_handle
+ * @note: btstack_type H
+ */
+static inline hci_con_handle_t hci_subevent_le_phy_update_complete_get_connection_handle(const uint8_t * event){
+    return little_endian_read_16(event, 4);
+}
+/**
+ * @brief Get field tx_phy from event HCI_SUBEVENT_LE_PHY_UPDATE_COMPLETE
+ * @param event packet
+ * @return tx_phy
+ * @note: btstack_type 1
+ */
+static inline uint8_t hci_subevent_le_phy_update_complete_get_tx_phy(const uint8_t * event){
+    return event[6];
+}
+/**
+ * @brief Get field rx_phy from event HCI_SUBEVENT_LE_PHY_UPDATE_COMPLETE
+ * @param event packet
+ * @return rx_phy
+ * @note: btstack_type 1
+ */
+static inline uint8_t hci_subevent_le_phy_update_complete_get_rx_phy(const uint8_t * event){
+    return event[7];
+}
+
 /**
  * @brief Get field status from event HSP_SUBEVENT_RFCOMM_CONNECTION_COMPLETE
  * @param event packet
@@ -5011,6 +5048,88 @@ static inline uint16_t a2dp_subevent_signaling_connection_released_get_a2dp_cid(
     return little_endian_read_16(event, 3);
 }
 
+/**
+ * @brief Get field a2dp_cid from event A2DP_SUBEVENT_MEDIA_SCHEDULER_UNDERRUN
+ * @param event packet
+ * @return a2dp_cid
+ * @note: btstack_type 2
+ */
+static inline uint16_t a2dp_subevent_media_scheduler_underrun_get_a2dp_cid(const uint8_t * event){
+    return little_endian_read_16(event, 3);
+}
+/**
+ * @brief Get field local_seid from event A2DP_SUBEVENT_MEDIA_SCHEDULER_UNDERRUN
+ * @param event packet
+ * @return local_seid
+ * @note: btstack_type 1
+ */
+static inline uint8_t a2dp_subevent_media_scheduler_underrun_get_local_seid(const uint8_t * event){
+    return event[5];
+}
+/**
+ * @brief Get field underruns from event A2DP_SUBEVENT_MEDIA_SCHEDULER_UNDERRUN
+ * @param event packet
+ * @return underruns
+ * @note: btstack_type 4
+ */
+static inline uint32_t a2dp_subevent_media_scheduler_underrun_get_underruns(const uint8_t * event){
+    return little_endian_read_32(event, 6);
+}
+/**
+ * @brief Get field queued_frames from event A2DP_SUBEVENT_MEDIA_SCHEDULER_UNDERRUN
+ * @param event packet
+ * @return queued_frames
+ * @note: btstack_type 2
+ */
+static inline uint16_t a2dp_subevent_media_scheduler_underrun_get_queued_frames(const uint8_t * event){
+    return little_endian_read_16(event, 10);
+}
+/**
+ * @brief Get field a2dp_cid from event A2DP_SUBEVENT_MEDIA_SCHEDULER_BITPOOL_CHANGED
+ * @param event packet
+ * @return a2dp_cid
+ * @note: btstack_type 2
+ */
+static inline uint16_t a2dp_subevent_media_scheduler_bitpool_changed_get_a2dp_cid(const uint8_t * event){
+    return little_endian_read_16(event, 3);
+}
+/**
+ * @brief Get field local_seid from event A2DP_SUBEVENT_MEDIA_SCHEDULER_BITPOOL_CHANGED
+ * @param event packet
+ * @return local_seid
+ * @note: btstack_type 1
+ */
+static inline uint8_t a2dp_subevent_media_scheduler_bitpool_changed_get_local_seid(const uint8_t * event){
+    return event[5];
+}
+/**
+ * @brief Get field previous_bitpool from event A2DP_SUBEVENT_MEDIA_SCHEDULER_BITPOOL_CHANGED
+ * @param event packet
+ * @return previous_bitpool
+ * @note: btstack_type 1
+ */
+static inline uint8_t a2dp_subevent_media_scheduler_bitpool_changed_get_previous_bitpool(const uint8_t * event){
+    return event[6];
+}
+/**
+ * @brief Get field bitpool from event A2DP_SUBEVENT_MEDIA_SCHEDULER_BITPOOL_CHANGED
+ * @param event packet
+ * @return bitpool
+ * @note: btstack_type 1
+ */
+static inline uint8_t a2dp_subevent_media_scheduler_bitpool_changed_get_bitpool(const uint8_t * event){
+    return event[7];
+}
+/**
+ * @brief Get field backlog from event A2DP_SUBEVENT_MEDIA_SCHEDULER_BITPOOL_CHANGED
+ * @param event packet
+ * @return backlog
+ * @note: btstack_type 1
+ */
+static inline uint8_t a2dp_subevent_media_scheduler_bitpool_changed_get_backlog(const uint8_t * event){
+    return event[8];
+}
+
 /**
  * @brief Get field status from event AVRCP_SUBEVENT_CONNECTION_ESTABLISHED
  * @param event packet
@@ -0,0 +1,176 @@
+/*
+ * Copyright (C) 2017 BlueKitchen GmbH
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ * 4. Any redistribution, use, or modification is done solely for
+ *    personal benefit and not for any commercial purpose or for
+ *    monetary gain.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BLUEKITCHEN GMBH AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL MATTHIAS
+ * RINGWALD OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Please inquire about commercial licensing options at 
+ * contact@bluekitchen-gmbh.com
+ *
+ */
+
+#define __BTSTACK_FILE__ "btstack_hash_map.c"
+
+/*
+ *  btstack_hash_map.c
+ *
+ *  Linear probing with backward shift deletion, no tombstones needed
+ */
+
+#include <string.h>
+
+#include "btstack_hash_map.h"
+
+static inline uint16_t btstack_hash_map_home(btstack_hash_map_t * hash_map, uint16_t key){
+    // con handles and cids are allocated mostly sequentially, modulo spreads them well
+    return key % hash_map->size;
+}
+
+static inline uint16_t btstack_hash_map_next(btstack_hash_map_t * hash_map, uint16_t index){
+    index++;
+    if (index == hash_map->size) return 0;
+    return index;
+}
+
+void btstack_hash_map_init(btstack_hash_map_t * hash_map, btstack_hash_map_entry_t * entries, uint16_t num_entries){
+    hash_map->entries = entries;
+    hash_map->size = num_entries;
+    btstack_hash_map_clear(hash_map);
+}
+
+void btstack_hash_map_clear(btstack_hash_map_t * hash_map){
+    memset(hash_map->entries, 0, hash_map->size * sizeof(btstack_hash_map_entry_t));
+    hash_map->count = 0;
+    hash_map->num_overflows = 0;
+    hash_map->overflow_keys_lost = 0;
+}
+
+// returns index of key in overflow keys or -1
+static int btstack_hash_map_find_overflow(btstack_hash_map_t * hash_map, uint16_t key){
+    int i;
+    for (i = 0; i < hash_map->num_overflows; i++){
+        if (hash_map->overflow_keys[i] == key) return i;
+    }
+    return -1;
+}
+
+static void btstack_hash_map_remove_overflow(btstack_hash_map_t * hash_map, int index){
+    hash_map->num_overflows--;
+    hash_map->overflow_keys[index] = hash_map->overflow_keys[hash_map->num_overflows];
+}
+
+static void btstack_hash_map_add_overflow(btstack_hash_map_t * hash_map, uint16_t key){
+    if (btstack_hash_map_find_overflow(hash_map, key) >= 0) return;
+    if (hash_map->num_overflows == BTSTACK_HASH_MAP_OVERFLOW_SIZE){
+        hash_map->overflow_keys_lost = 1;
+        return;
+    }
+    hash_map->overflow_keys[hash_map->num_overflows++] = key;
+}
+
+// returns index of key or -1
+static int btstack_hash_map_find(btstack_hash_map_t * hash_map, uint16_t key){
+    if (hash_map->size == 0) return -1;
+    uint16_t index = btstack_hash_map_home(hash_map, key);
+    uint16_t probes;
+    for (probes = 0; probes < hash_map->size; probes++){
+        btstack_hash_map_entry_t * entry = &hash_map->entries[index];
+        if (entry->value == NULL) return -1;
+        if (entry->key == key) return index;
+        index = btstack_hash_map_next(hash_map, index);
+    }
+    return -1;
+}
+
+int btstack_hash_map_put(btstack_hash_map_t * hash_map, uint16_t key, void * value){
+    int found = btstack_hash_map_find(hash_map, key);
+    if (found >= 0){
+        hash_map->entries[found].value = value;
+        return 1;
+    }
+    // keep at least one slot empty so that probe sequences terminate
+    if ((hash_map->count + 1) >= hash_map->size){
+        btstack_hash_map_add_overflow(hash_map, key);
+        return 0;
+    }
+    // key that could not be stored before fits now
+    int overflow = btstack_hash_map_find_overflow(hash_map, key);
+    if (overflow >= 0){
+        btstack_hash_map_remove_overflow(hash_map, overflow);
+    }
+    uint16_t index = btstack_hash_map_home(hash_map, key);
+    while (hash_map->entries[index].value != NULL){
+        index = btstack_hash_map_next(hash_map, index);
+    }
+    hash_map->entries[index].key   = key;
+    hash_map->entries[index].value = value;
+    hash_map->count++;
+    return 1;
+}
+
+void * btstack_hash_map_get(btstack_hash_map_t * hash_map, uint16_t key){
+    int found = btstack_hash_map_find(hash_map, key);
+    if (found < 0) return NULL;
+    return hash_map->entries[found].value;
+}
+
+void btstack_hash_map_remove(btstack_hash_map_t * hash_map, uint16_t key){
+    int found = btstack_hash_map_find(hash_map, key);
+    if (found < 0){
+        int overflow = btstack_hash_map_find_overflow(hash_map, key);
+        if (overflow >= 0){
+            btstack_hash_map_remove_overflow(hash_map, overflow);
+        }
+        return;
+    }
+    // shift following entries back into the gap if their home slot is not between gap and their position
+    uint16_t gap   = (uint16_t) found;
+    uint16_t index = gap;
+    while (1){
+        index = btstack_hash_map_next(hash_map, index);
+        btstack_hash_map_entry_t * entry = &hash_map->entries[index];
+        if (entry->value == NULL) break;
+        uint16_t home = btstack_hash_map_home(hash_map, entry->key);
+        int stays;
+        if (gap <= index){
+            stays = (gap < home) && (home <= index);
+        } else {
+            stays = (gap < home) || (home <= index);
+        }
+        if (stays) continue;
+        hash_map->entries[gap] = *entry;
+        gap = index;
+    }
+    hash_map->entries[gap].value = NULL;
+    hash_map->count--;
+}
+
+int btstack_hash_map_complete(btstack_hash_map_t * hash_map){
+    return (hash_map->num_overflows == 0) && (hash_map->overflow_keys_lost == 0);
+}
@@ -0,0 +1,125 @@
+/*
+ * Copyright (C) 2017 BlueKitchen GmbH
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ * 4. Any redistribution, use, or modification is done solely for
+ *    personal benefit and not for any commercial purpose or for
+ *    monetary gain.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BLUEKITCHEN GMBH AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL MATTHIAS
+ * RINGWALD OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Please inquire about commercial licensing options at 
+ * contact@bluekitchen-gmbh.com
+ *
+ */
+
+/*
+ *  btstack_hash_map.h
+ *
+ *  Fixed-size open addressing hash map from 16-bit keys (e.g. con_handle, cid) to pointers
+ */
+
+#ifndef __BTSTACK_HASH_MAP_H
+#define __BTSTACK_HASH_MAP_H
+
+#if defined __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+// max number of keys that could not be stored and are tracked until they are removed
+#ifndef BTSTACK_HASH_MAP_OVERFLOW_SIZE
+#define BTSTACK_HASH_MAP_OVERFLOW_SIZE 4
+#endif
+
+typedef struct btstack_hash_map_entry {
+    void *   value;     // NULL = unused
+    uint16_t key;
+} btstack_hash_map_entry_t;
+
+typedef struct btstack_hash_map {
+    btstack_hash_map_entry_t * entries;
+    uint16_t size;
+    uint16_t count;
+    // keys that could not be stored as the map was full
+    uint16_t overflow_keys[BTSTACK_HASH_MAP_OVERFLOW_SIZE];
+    uint16_t num_overflows;
+    // more keys could not be stored than tracked in overflow_keys, map stays incomplete until cleared
+    uint8_t  overflow_keys_lost;
+} btstack_hash_map_t;
+
+/**
+ * @brief Init hash map with caller provided storage. The map does not allocate memory.
+ * @param hash_map object
+ * @param entries storage
+ * @param num_entries in storage. Up to num_entries - 1 items can be stored, about twice the max number of items keeps probe sequences short
+ */
+void btstack_hash_map_init(btstack_hash_map_t * hash_map, btstack_hash_map_entry_t * entries, uint16_t num_entries);
+
+/**
+ * @brief Remove all items and forget keys that could not be stored
+ * @param hash_map object
+ */
+void btstack_hash_map_clear(btstack_hash_map_t * hash_map);
+
+/**
+ * @brief Add item or replace value of existing key
+ * @note If the map is full, the key is remembered as not stored and btstack_hash_map_complete returns 0 until
+ *       the key is removed. The caller has to keep the item in its own list and search there on a lookup miss.
+ * @param hash_map object
+ * @param key
+ * @param value != NULL
+ * @return 1 if stored, 0 if map is full
+ */
+int btstack_hash_map_put(btstack_hash_map_t * hash_map, uint16_t key, void * value);
+
+/**
+ * @brief Get value for key
+ * @param hash_map object
+ * @param key
+ * @return value or NULL if not stored, see btstack_hash_map_complete
+ */
+void * btstack_hash_map_get(btstack_hash_map_t * hash_map, uint16_t key);
+
+/**
+ * @brief Remove item. Removing a key that is not in the map has no effect.
+ * @param hash_map object
+ * @param key that was stored or that could not be stored as the map was full
+ */
+void btstack_hash_map_remove(btstack_hash_map_t * hash_map, uint16_t key);
+
+/**
+ * @brief Check if all items added and not removed since have been stored, i.e. if a lookup miss is authoritative
+ * @param hash_map object
+ * @return 1 if no item is missing
+ */
+int btstack_hash_map_complete(btstack_hash_map_t * hash_map);
+
+#if defined __cplusplus
+}
+#endif
+
+#endif // __BTSTACK_HASH_MAP_H
@@ -143,6 +143,19 @@ typedef struct {
      */
     void (*set_wakeup_handler)(void (*wakeup_handler)(void));
 
+    // optional support for streaming receive
+
+    /**
+     * set callback for data received via receive_data. NULL disables callback
+     */
+    void (*set_data_received)(void (*data_handler)(uint16_t size));
+
+    /**
+     * receive up to len bytes. data_handler is called with number of bytes received
+     * as soon as some data is available, which allows to receive multiple packets at once
+     */
+    void (*receive_data)(uint8_t *buffer, uint16_t len);
+
 } btstack_uart_block_t;
 
 // common implementations
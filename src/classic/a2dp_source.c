@@ -51,6 +51,66 @@
 
 #define AVDTP_MEDIA_PAYLOAD_HEADER_SIZE 12
 
+// SBC media payload header: fragmentation, start, last, 4-bit number of frames
+#define A2DP_SBC_MEDIA_PAYLOAD_HEADER_SIZE 1
+#define A2DP_SBC_MAX_FRAMES_PER_PACKET    15
+#define A2DP_SBC_MAX_AUDIO_FRAMES_PER_FRAME (16 * 8)
+
+#ifndef A2DP_SOURCE_MEDIA_SCHEDULER_QUEUE_SIZE
+#define A2DP_SOURCE_MEDIA_SCHEDULER_QUEUE_SIZE 4096
+#endif
+
+#ifndef A2DP_SOURCE_MEDIA_SCHEDULER_MAX_FRAMES
+#define A2DP_SOURCE_MEDIA_SCHEDULER_MAX_FRAMES 64
+#endif
+
+#define A2DP_SOURCE_MEDIA_SCHEDULER_PERIOD_MS 5
+
+// adaptive bitpool: backlog in media packets queued in host and controller. Outgoing ACL packets are converted into
+// media packets, ACL packets of other L2CAP channels on the same connection, e.g. AVRCP, are counted as media packets, too
+#define A2DP_SOURCE_BITPOOL_BACKLOG_CONGESTED     3
+#define A2DP_SOURCE_BITPOOL_BACKLOG_CLEAR         1
+#define A2DP_SOURCE_BITPOOL_DECREASE_INTERVAL_MS  100
+#define A2DP_SOURCE_BITPOOL_INCREASE_INTERVAL_MS  1000
+#define A2DP_SOURCE_BITPOOL_INCREASE_STEP         2
+
+typedef struct {
+    int active;
+    uint16_t a2dp_cid;
+    avdtp_stream_endpoint_t * stream_endpoint;
+
+    int (*fill_pcm)(int16_t * pcm_buffer, int num_audio_frames, void * context);
+    int (*fill_sbc_frame)(uint8_t * sbc_frame, int max_len, void * context);
+    void * context;
+
+    btstack_timer_source_t timer;
+    uint32_t sampling_frequency;
+    uint16_t samples_per_frame;
+    uint16_t max_frame_len;
+    uint16_t max_payload_len;
+    uint16_t acl_packets_per_media_packet;
+    int      can_send_now_requested;
+
+    // media clock: samples due = base_samples + (now - base_time_ms) * sampling_frequency / 1000
+    uint32_t base_time_ms;
+    uint32_t base_samples;
+    // samples queued since start, queue head has RTP timestamp num_samples - num_frames * samples_per_frame
+    uint32_t num_samples;
+
+    // queued SBC frames, oldest first
+    uint8_t  queue[A2DP_SOURCE_MEDIA_SCHEDULER_QUEUE_SIZE];
+    uint16_t queue_len;
+    uint16_t frame_len[A2DP_SOURCE_MEDIA_SCHEDULER_MAX_FRAMES];
+    uint16_t num_frames;
+
+    // adaptive bitpool
+    int      bitpool;
+    uint32_t bitpool_adjusted_ms;
+    uint32_t backlog_clear_since_ms;
+
+    a2dp_source_media_scheduler_statistics_t statistics;
+} a2dp_source_media_scheduler_t;
+
 static const char * default_a2dp_source_service_name = "BTstack A2DP Source Service";
 static const char * default_a2dp_source_service_provider_name = "BTstack A2DP Source Service Provider";
 static avdtp_context_t a2dp_source_context;
@@ -58,8 +118,26 @@ static avdtp_context_t a2dp_source_context;
 static a2dp_state_t app_state = A2DP_IDLE;
 static avdtp_stream_endpoint_context_t sc;
 static int next_remote_sep_index_to_query = 0;
+static a2dp_source_media_scheduler_t media_scheduler;
+static int adaptive_bitpool_enabled;
 
 static void packet_handler(uint8_t packet_type, uint16_t channel, uint8_t *packet, uint16_t size);
+static void a2dp_source_media_scheduler_send_packet(void);
+static void a2dp_source_media_scheduler_reset(void);
+
+// SBC encoder channel mode (SBC_MONO, SBC_DUAL, SBC_STEREO, SBC_JOINT_STEREO) for avdtp_sbc_channel_mode_t
+static int a2dp_source_sbc_encoder_channel_mode(uint8_t channel_mode){
+    switch (channel_mode){
+        case AVDTP_SBC_MONO:
+            return 0;
+        case AVDTP_SBC_DUAL_CHANNEL:
+            return 1;
+        case AVDTP_SBC_STEREO:
+            return 2;
+        default:
+            return 3;
+    }
+}
 
 void a2dp_source_create_sdp_record(uint8_t * service, uint32_t service_record_handle, uint16_t supported_features, const char * service_name, const char * service_provider_name){
     uint8_t* attribute;
@@ -239,6 +317,7 @@ static void packet_handler(uint8_t packet_type, uint16_t channel, uint8_t *packe
             sc.block_length = avdtp_subevent_signaling_media_codec_sbc_configuration_get_block_length(packet);
             sc.subbands = avdtp_subevent_signaling_media_codec_sbc_configuration_get_subbands(packet);
             sc.allocation_method = avdtp_subevent_signaling_media_codec_sbc_configuration_get_allocation_method(packet) - 1;
+            sc.min_bitpool_value = avdtp_subevent_signaling_media_codec_sbc_configuration_get_min_bitpool_value(packet);
             sc.max_bitpool_value = avdtp_subevent_signaling_media_codec_sbc_configuration_get_max_bitpool_value(packet);
             sc.channel_mode = avdtp_subevent_signaling_media_codec_sbc_configuration_get_channel_mode(packet);
             // TODO: deal with reconfigure: avdtp_subevent_signaling_media_codec_sbc_configuration_get_reconfigure(packet);
@@ -246,6 +325,11 @@ static void packet_handler(uint8_t packet_type, uint16_t channel, uint8_t *packe
         }  
         case AVDTP_SUBEVENT_STREAMING_CAN_SEND_MEDIA_PACKET_NOW: 
             cid = avdtp_subevent_streaming_can_send_media_packet_now_get_avdtp_cid(packet);
+            local_seid = avdtp_subevent_streaming_can_send_media_packet_now_get_local_seid(packet);
+            if (media_scheduler.active && avdtp_stream_endpoint_seid(media_scheduler.stream_endpoint) == local_seid){
+                a2dp_source_media_scheduler_send_packet();
+                break;
+            }
             a2dp_streaming_emit_can_send_media_packet_now(a2dp_source_context.a2dp_callback, cid, 0);
             break;
         
@@ -313,7 +397,7 @@ static void packet_handler(uint8_t packet_type, uint16_t channel, uint8_t *packe
                         sc.block_length, sc.subbands, 
                         sc.allocation_method, sc.sampling_frequency, 
                         sc.max_bitpool_value,
-                        sc.channel_mode);
+                        a2dp_source_sbc_encoder_channel_mode(sc.channel_mode));
                     avdtp_source_open_stream(cid, avdtp_stream_endpoint_seid(sc.local_stream_endpoint), sc.active_remote_sep->seid);
                     break;
                 }
@@ -333,6 +417,7 @@ static void packet_handler(uint8_t packet_type, uint16_t channel, uint8_t *packe
                             break;
                         }
                         case AVDTP_SI_SUSPEND:{
+                            a2dp_source_media_scheduler_reset();
                             uint8_t event[6];
                             int pos = 0;
                             event[pos++] = HCI_EVENT_A2DP_META;
@@ -346,6 +431,7 @@ static void packet_handler(uint8_t packet_type, uint16_t channel, uint8_t *packe
                         }
                         case AVDTP_SI_ABORT:
                         case AVDTP_SI_CLOSE:{
+                            a2dp_source_media_scheduler_reset();
                             uint8_t event[6];
                             int pos = 0;
                             event[pos++] = HCI_EVENT_A2DP_META;
@@ -380,6 +466,7 @@ static void packet_handler(uint8_t packet_type, uint16_t channel, uint8_t *packe
             break;
         case AVDTP_SUBEVENT_SIGNALING_CONNECTION_RELEASED:{
             app_state = A2DP_IDLE;
+            a2dp_source_media_scheduler_reset();
             uint8_t event[6];
             int pos = 0;
             event[pos++] = HCI_EVENT_A2DP_META;
@@ -393,6 +480,7 @@ static void packet_handler(uint8_t packet_type, uint16_t channel, uint8_t *packe
         }
         case AVDTP_SUBEVENT_STREAMING_CONNECTION_RELEASED:{
             app_state = A2DP_IDLE;
+            a2dp_source_media_scheduler_reset();
             uint8_t event[6];
             int pos = 0;
             event[pos++] = HCI_EVENT_A2DP_META;
@@ -462,7 +550,7 @@ uint8_t a2dp_source_pause_stream(uint16_t a2dp_cid, uint8_t local_seid){
     return avdtp_suspend_stream(a2dp_cid, local_seid, &a2dp_source_context);
 }
 
-static void a2dp_source_setup_media_header(uint8_t * media_packet, int size, int *offset, uint8_t marker, uint16_t sequence_number){
+static void a2dp_source_setup_media_header(uint8_t * media_packet, int size, int *offset, uint8_t marker, uint16_t sequence_number, uint32_t timestamp){
     if (size < AVDTP_MEDIA_PAYLOAD_HEADER_SIZE){
         log_error("small outgoing buffer");
         return;
@@ -474,7 +562,6 @@ static void a2dp_source_setup_media_header(uint8_t * media_packet, int size, int
     uint8_t  csrc_count = 0;
     uint8_t  payload_type = 0x60;
     // uint16_t sequence_number = stream_endpoint->sequence_number;
-    uint32_t timestamp = btstack_run_loop_get_time_ms();
     uint32_t ssrc = 0x11223344;
 
     // rtp header (min size 12B)
@@ -524,6 +611,18 @@ int a2dp_max_media_payload_size(uint16_t a2dp_cid, uint8_t local_seid){
     return l2cap_get_remote_mtu_for_local_cid(stream_endpoint->l2cap_media_cid) - AVDTP_MEDIA_PAYLOAD_HEADER_SIZE;
 }
 
+btstack_sbc_encoder_state_t * a2dp_source_get_sbc_encoder_state(uint16_t a2dp_cid, uint8_t local_seid){
+    if (a2dp_source_context.avdtp_cid != a2dp_cid){
+        log_error("A2DP source: a2dp cid 0x%02x not known, expected 0x%02x", a2dp_cid, a2dp_source_context.avdtp_cid);
+        return NULL;
+    }
+    if (!sc.local_stream_endpoint || avdtp_stream_endpoint_seid(sc.local_stream_endpoint) != local_seid){
+        log_error("A2DP source: no stream established for seid %d", local_seid);
+        return NULL;
+    }
+    return &sc.sbc_encoder_state;
+}
+
 static void a2dp_source_copy_media_payload(uint8_t * media_packet, int size, int * offset, uint8_t * storage, int num_bytes_to_copy, uint8_t num_frames){
     if (size < num_bytes_to_copy + 1){
         log_error("small outgoing buffer: buffer size %u, but need %u", size, num_bytes_to_copy + 1);
@@ -559,9 +658,324 @@ int a2dp_source_stream_send_media_payload(uint16_t a2dp_cid, uint8_t local_seid,
     l2cap_reserve_packet_buffer();
     uint8_t * media_packet = l2cap_get_outgoing_buffer();
     //int size = l2cap_get_remote_mtu_for_local_cid(stream_endpoint->l2cap_media_cid);
-    a2dp_source_setup_media_header(media_packet, size, &offset, marker, stream_endpoint->sequence_number);
+    a2dp_source_setup_media_header(media_packet, size, &offset, marker, stream_endpoint->sequence_number, btstack_run_loop_get_time_ms());
     a2dp_source_copy_media_payload(media_packet, size, &offset, storage, num_bytes_to_copy, num_frames);
     stream_endpoint->sequence_number++;
     l2cap_send_prepared(stream_endpoint->l2cap_media_cid, offset);
     return size;
 }
+
+// A2DP spec, section 12.9 - calculation of SBC frame length, rounded up
+static uint16_t a2dp_source_sbc_frame_length(int bitpool){
+    int num_channels = (sc.channel_mode == AVDTP_SBC_MONO) ? 1 : 2;
+    int num_bits;
+    switch (sc.channel_mode){
+        case AVDTP_SBC_MONO:
+        case AVDTP_SBC_DUAL_CHANNEL:
+            num_bits = sc.block_length * num_channels * bitpool;
+            break;
+        case AVDTP_SBC_JOINT_STEREO:
+            num_bits = sc.subbands + sc.block_length * bitpool;
+            break;
+        default:
+            num_bits = sc.block_length * bitpool;
+            break;
+    }
+    return 4 + (4 * sc.subbands * num_channels) / 8 + (num_bits + 7) / 8;
+}
+
+static void a2dp_source_media_scheduler_emit_underrun(void){
+    if (!a2dp_source_context.a2dp_callback) return;
+    uint8_t event[12];
+    int pos = 0;
+    event[pos++] = HCI_EVENT_A2DP_META;
+    event[pos++] = sizeof(event) - 2;
+    event[pos++] = A2DP_SUBEVENT_MEDIA_SCHEDULER_UNDERRUN;
+    little_endian_store_16(event, pos, media_scheduler.a2dp_cid);
+    pos += 2;
+    event[pos++] = avdtp_stream_endpoint_seid(media_scheduler.stream_endpoint);
+    little_endian_store_32(event, pos, media_scheduler.statistics.underruns);
+    pos += 4;
+    little_endian_store_16(event, pos, media_scheduler.num_frames);
+    pos += 2;
+    (*a2dp_source_context.a2dp_callback)(HCI_EVENT_PACKET, 0, event, sizeof(event));
+}
+
+// number of queued frames and bytes that fit into next media packet
+static int a2dp_source_media_scheduler_frames_for_packet(uint16_t * num_bytes){
+    int num_frames = 0;
+    int len = 0;
+    while (num_frames < media_scheduler.num_frames && num_frames < A2DP_SBC_MAX_FRAMES_PER_PACKET){
+        if (len + media_scheduler.frame_len[num_frames] > media_scheduler.max_payload_len) break;
+        len += media_scheduler.frame_len[num_frames];
+        num_frames++;
+    }
+    *num_bytes = len;
+    return num_frames;
+}
+
+// packet is ready if it cannot take another frame of the same size
+static int a2dp_source_media_scheduler_packet_ready(void){
+    uint16_t num_bytes;
+    int num_frames = a2dp_source_media_scheduler_frames_for_packet(&num_bytes);
+    if (num_frames == 0) return 0;
+    if (num_frames < media_scheduler.num_frames) return 1;
+    if (num_frames == A2DP_SBC_MAX_FRAMES_PER_PACKET) return 1;
+    return num_bytes + media_scheduler.frame_len[num_frames - 1] > media_scheduler.max_payload_len;
+}
+
+static void a2dp_source_media_scheduler_request_can_send_now(void){
+    if (media_scheduler.can_send_now_requested) return;
+    if (!a2dp_source_media_scheduler_packet_ready()) return;
+    media_scheduler.can_send_now_requested = 1;
+    media_scheduler.stream_endpoint->send_stream = 1;
+    avdtp_request_can_send_now_initiator(media_scheduler.stream_endpoint->connection, media_scheduler.stream_endpoint->l2cap_media_cid);
+}
+
+static void a2dp_source_media_scheduler_send_packet(void){
+    media_scheduler.can_send_now_requested = 0;
+    avdtp_stream_endpoint_t * stream_endpoint = media_scheduler.stream_endpoint;
+    if (stream_endpoint->l2cap_media_cid == 0) return;
+
+    uint16_t num_bytes;
+    int num_frames = a2dp_source_media_scheduler_frames_for_packet(&num_bytes);
+    if (num_frames == 0) return;
+
+    // RTP timestamp in sampling frequency units of first frame in packet
+    uint32_t timestamp = media_scheduler.num_samples - media_scheduler.num_frames * media_scheduler.samples_per_frame;
+
+    int size = l2cap_get_remote_mtu_for_local_cid(stream_endpoint->l2cap_media_cid);
+    int offset = 0;
+    l2cap_reserve_packet_buffer();
+    uint8_t * media_packet = l2cap_get_outgoing_buffer();
+    a2dp_source_setup_media_header(media_packet, size, &offset, 0, stream_endpoint->sequence_number, timestamp);
+    a2dp_source_copy_media_payload(media_packet, size - offset, &offset, media_scheduler.queue, num_bytes, num_frames);
+    stream_endpoint->sequence_number++;
+    l2cap_send_prepared(stream_endpoint->l2cap_media_cid, offset);
+
+    // drop sent frames
+    media_scheduler.queue_len  -= num_bytes;
+    media_scheduler.num_frames -= num_frames;
+    memmove(media_scheduler.queue, &media_scheduler.queue[num_bytes], media_scheduler.queue_len);
+    memmove(media_scheduler.frame_len, &media_scheduler.frame_len[num_frames], media_scheduler.num_frames * sizeof(uint16_t));
+
+    media_scheduler.statistics.packets_sent++;
+    media_scheduler.statistics.frames_sent += num_frames;
+
+    a2dp_source_media_scheduler_request_can_send_now();
+}
+
+// get next SBC frame from application and append to queue, returns 0 on underrun
+static int a2dp_source_media_scheduler_queue_frame(void){
+    uint16_t len;
+    if (media_scheduler.fill_pcm){
+        int16_t pcm_buffer[A2DP_SBC_MAX_AUDIO_FRAMES_PER_FRAME * 2];
+        if (!(*media_scheduler.fill_pcm)(pcm_buffer, media_scheduler.samples_per_frame, media_scheduler.context)) return 0;
+        btstack_sbc_encoder_process_data(&sc.sbc_encoder_state, pcm_buffer);
+        len = btstack_sbc_encoder_sbc_buffer_length(&sc.sbc_encoder_state);
+        if (len > sizeof(media_scheduler.queue) - media_scheduler.queue_len || len > media_scheduler.max_payload_len){
+            log_error("A2DP source: SBC frame len %u does not fit into queue", len);
+            return 0;
+        }
+        memcpy(&media_scheduler.queue[media_scheduler.queue_len], btstack_sbc_encoder_sbc_buffer(&sc.sbc_encoder_state), len);
+    } else {
+        int max_len = sizeof(media_scheduler.queue) - media_scheduler.queue_len;
+        int result = (*media_scheduler.fill_sbc_frame)(&media_scheduler.queue[media_scheduler.queue_len], max_len, media_scheduler.context);
+        if (result <= 0) return 0;
+        if (result > max_len || result > media_scheduler.max_payload_len){
+            log_error("A2DP source: invalid SBC frame len %u", result);
+            return 0;
+        }
+        len = result;
+    }
+    media_scheduler.frame_len[media_scheduler.num_frames++] = len;
+    media_scheduler.queue_len  += len;
+    media_scheduler.num_samples += media_scheduler.samples_per_frame;
+    return 1;
+}
+
+static void a2dp_source_media_scheduler_emit_bitpool_changed(int previous_bitpool, int backlog){
+    if (!a2dp_source_context.a2dp_callback) return;
+    uint8_t event[9];
+    int pos = 0;
+    event[pos++] = HCI_EVENT_A2DP_META;
+    event[pos++] = sizeof(event) - 2;
+    event[pos++] = A2DP_SUBEVENT_MEDIA_SCHEDULER_BITPOOL_CHANGED;
+    little_endian_store_16(event, pos, media_scheduler.a2dp_cid);
+    pos += 2;
+    event[pos++] = avdtp_stream_endpoint_seid(media_scheduler.stream_endpoint);
+    event[pos++] = previous_bitpool;
+    event[pos++] = media_scheduler.bitpool;
+    event[pos++] = backlog > 255 ? 255 : backlog;
+    (*a2dp_source_context.a2dp_callback)(HCI_EVENT_PACKET, 0, event, sizeof(event));
+}
+
+static void a2dp_source_media_scheduler_set_bitpool(int bitpool, int backlog){
+    int previous_bitpool = media_scheduler.bitpool;
+    if (bitpool == previous_bitpool) return;
+    media_scheduler.bitpool = bitpool;
+    btstack_sbc_encoder_set_bitpool(&sc.sbc_encoder_state, bitpool);
+    log_info("A2DP source: bitpool %u -> %u, backlog %u packets", previous_bitpool, bitpool, backlog);
+    a2dp_source_media_scheduler_emit_bitpool_changed(previous_bitpool, backlog);
+}
+
+// lower bitpool quickly while media packets pile up in host or controller, raise it slowly after backlog is gone
+static void a2dp_source_media_scheduler_adapt_bitpool(uint32_t now){
+    int min_bitpool = btstack_max(2, sc.min_bitpool_value);
+    int backlog = media_scheduler.queue_len / media_scheduler.max_payload_len;
+    int num_acl_packets = hci_number_outgoing_acl_packets_for_handle(media_scheduler.stream_endpoint->media_con_handle);
+    backlog += (num_acl_packets + media_scheduler.acl_packets_per_media_packet - 1) / media_scheduler.acl_packets_per_media_packet;
+
+    if (backlog > A2DP_SOURCE_BITPOOL_BACKLOG_CLEAR){
+        media_scheduler.backlog_clear_since_ms = now;
+    }
+
+    if (backlog >= A2DP_SOURCE_BITPOOL_BACKLOG_CONGESTED){
+        if ((now - media_scheduler.bitpool_adjusted_ms) < A2DP_SOURCE_BITPOOL_DECREASE_INTERVAL_MS) return;
+        if (media_scheduler.bitpool <= min_bitpool) return;
+        media_scheduler.bitpool_adjusted_ms = now;
+        a2dp_source_media_scheduler_set_bitpool(btstack_max(min_bitpool, media_scheduler.bitpool * 3 / 4), backlog);
+        return;
+    }
+
+    if ((now - media_scheduler.backlog_clear_since_ms) < A2DP_SOURCE_BITPOOL_INCREASE_INTERVAL_MS) return;
+    if ((now - media_scheduler.bitpool_adjusted_ms) < A2DP_SOURCE_BITPOOL_INCREASE_INTERVAL_MS) return;
+    if (media_scheduler.bitpool >= sc.max_bitpool_value) return;
+    media_scheduler.bitpool_adjusted_ms = now;
+    a2dp_source_media_scheduler_set_bitpool(btstack_min(sc.max_bitpool_value, media_scheduler.bitpool + A2DP_SOURCE_BITPOOL_INCREASE_STEP), backlog);
+}
+
+static void a2dp_source_media_scheduler_timeout_handler(btstack_timer_source_t * timer){
+    uint32_t now = btstack_run_loop_get_time_ms();
+    uint32_t samples_due = media_scheduler.base_samples + (uint32_t) (((uint64_t) (now - media_scheduler.base_time_ms) * media_scheduler.sampling_frequency) / 1000);
+
+    while ((int32_t) (samples_due - media_scheduler.num_samples) > 0){
+        // queue full: remote or baseband is slower than media clock, don't catch up later
+        if (media_scheduler.num_frames == A2DP_SOURCE_MEDIA_SCHEDULER_MAX_FRAMES ||
+            media_scheduler.queue_len + media_scheduler.max_frame_len > sizeof(media_scheduler.queue)){
+            media_scheduler.base_time_ms = now;
+            media_scheduler.base_samples = media_scheduler.num_samples;
+            break;
+        }
+        if (!a2dp_source_media_scheduler_queue_frame()){
+            // no media data: restart media clock with next frame, RTP timestamps stay contiguous
+            media_scheduler.statistics.underruns++;
+            media_scheduler.base_time_ms = now;
+            media_scheduler.base_samples = media_scheduler.num_samples;
+            log_info("A2DP source: media underrun, %u frames queued", media_scheduler.num_frames);
+            a2dp_source_media_scheduler_emit_underrun();
+            break;
+        }
+    }
+    if (media_scheduler.num_frames > media_scheduler.statistics.max_queued_frames){
+        media_scheduler.statistics.max_queued_frames = media_scheduler.num_frames;
+    }
+    if (adaptive_bitpool_enabled && media_scheduler.fill_pcm){
+        a2dp_source_media_scheduler_adapt_bitpool(now);
+    }
+    a2dp_source_media_scheduler_request_can_send_now();
+
+    btstack_run_loop_set_timer(timer, A2DP_SOURCE_MEDIA_SCHEDULER_PERIOD_MS);
+    btstack_run_loop_add_timer(timer);
+}
+
+static void a2dp_source_media_scheduler_reset(void){
+    if (!media_scheduler.active) return;
+    btstack_run_loop_remove_timer(&media_scheduler.timer);
+    media_scheduler.active = 0;
+    media_scheduler.num_frames = 0;
+    media_scheduler.queue_len = 0;
+    media_scheduler.can_send_now_requested = 0;
+}
+
+static uint8_t a2dp_source_media_scheduler_start(uint16_t a2dp_cid, uint8_t local_seid, 
+    int (*fill_pcm)(int16_t * pcm_buffer, int num_audio_frames, void * context),
+    int (*fill_sbc_frame)(uint8_t * sbc_frame, int max_len, void * context), void * context){
+
+    if (a2dp_source_context.avdtp_cid != a2dp_cid){
+        log_error("A2DP source: a2dp cid 0x%02x not known, expected 0x%02x", a2dp_cid, a2dp_source_context.avdtp_cid);
+        return AVDTP_CONNECTION_DOES_NOT_EXIST;
+    }
+    if (!sc.local_stream_endpoint || avdtp_stream_endpoint_seid(sc.local_stream_endpoint) != local_seid){
+        log_error("A2DP source: no stream established for seid %d", local_seid);
+        return AVDTP_SEID_DOES_NOT_EXIST;
+    }
+    avdtp_stream_endpoint_t * stream_endpoint = sc.local_stream_endpoint;
+    if (stream_endpoint->l2cap_media_cid == 0){
+        log_error("A2DP source: no media connection for seid %d", local_seid);
+        return AVDTP_MEDIA_CONNECTION_DOES_NOT_EXIST;
+    }
+
+    a2dp_source_media_scheduler_reset();
+    memset(&media_scheduler.statistics, 0, sizeof(media_scheduler.statistics));
+    media_scheduler.a2dp_cid = a2dp_cid;
+    media_scheduler.stream_endpoint = stream_endpoint;
+    media_scheduler.fill_pcm = fill_pcm;
+    media_scheduler.fill_sbc_frame = fill_sbc_frame;
+    media_scheduler.context = context;
+    media_scheduler.sampling_frequency = sc.sampling_frequency;
+    media_scheduler.samples_per_frame = sc.block_length * sc.subbands;
+    media_scheduler.max_frame_len = a2dp_source_sbc_frame_length(sc.max_bitpool_value);
+    media_scheduler.max_payload_len = l2cap_get_remote_mtu_for_local_cid(stream_endpoint->l2cap_media_cid) 
+        - AVDTP_MEDIA_PAYLOAD_HEADER_SIZE - A2DP_SBC_MEDIA_PAYLOAD_HEADER_SIZE;
+    // media packets are fragmented into ACL packets of the Controller's ACL buffer size
+    uint16_t acl_data_packet_length = hci_max_acl_data_packet_length();
+    media_scheduler.acl_packets_per_media_packet = 1;
+    if (acl_data_packet_length){
+        uint16_t l2cap_packet_len = L2CAP_HEADER_SIZE + l2cap_get_remote_mtu_for_local_cid(stream_endpoint->l2cap_media_cid);
+        media_scheduler.acl_packets_per_media_packet = (l2cap_packet_len + acl_data_packet_length - 1) / acl_data_packet_length;
+    }
+    media_scheduler.num_samples = 0;
+    media_scheduler.base_samples = 0;
+    media_scheduler.base_time_ms = btstack_run_loop_get_time_ms();
+    media_scheduler.bitpool_adjusted_ms = media_scheduler.base_time_ms;
+    media_scheduler.backlog_clear_since_ms = media_scheduler.base_time_ms;
+    media_scheduler.active = 1;
+
+    // start with negotiated max bitpool, might have been lowered during previous start
+    media_scheduler.bitpool = sc.max_bitpool_value;
+    if (fill_pcm){
+        btstack_sbc_encoder_set_bitpool(&sc.sbc_encoder_state, media_scheduler.bitpool);
+    }
+
+    btstack_run_loop_set_timer_handler(&media_scheduler.timer, &a2dp_source_media_scheduler_timeout_handler);
+    btstack_run_loop_set_timer(&media_scheduler.timer, A2DP_SOURCE_MEDIA_SCHEDULER_PERIOD_MS);
+    btstack_run_loop_add_timer(&media_scheduler.timer);
+    return ERROR_CODE_SUCCESS;
+}
+
+uint8_t a2dp_source_media_scheduler_start_pcm(uint16_t a2dp_cid, uint8_t local_seid, 
+    int (*fill_pcm)(int16_t * pcm_buffer, int num_audio_frames, void * context), void * context){
+    if (fill_pcm == NULL) return ERROR_CODE_INVALID_HCI_COMMAND_PARAMETERS;
+    return a2dp_source_media_scheduler_start(a2dp_cid, local_seid, fill_pcm, NULL, context);
+}
+
+uint8_t a2dp_source_media_scheduler_start_sbc(uint16_t a2dp_cid, uint8_t local_seid, 
+    int (*fill_sbc_frame)(uint8_t * sbc_frame, int max_len, void * context), void * context){
+    if (fill_sbc_frame == NULL) return ERROR_CODE_INVALID_HCI_COMMAND_PARAMETERS;
+    return a2dp_source_media_scheduler_start(a2dp_cid, local_seid, NULL, fill_sbc_frame, context);
+}
+
+static int a2dp_source_media_scheduler_matches(uint16_t a2dp_cid, uint8_t local_seid){
+    if (!media_scheduler.active) return 0;
+    if (media_scheduler.a2dp_cid != a2dp_cid) return 0;
+    return avdtp_stream_endpoint_seid(media_scheduler.stream_endpoint) == local_seid;
+}
+
+uint8_t a2dp_source_media_scheduler_stop(uint16_t a2dp_cid, uint8_t local_seid){
+    if (!a2dp_source_media_scheduler_matches(a2dp_cid, local_seid)) return ERROR_CODE_COMMAND_DISALLOWED;
+    a2dp_source_media_scheduler_reset();
+    return ERROR_CODE_SUCCESS;
+}
+
+uint8_t a2dp_source_media_scheduler_get_statistics(uint16_t a2dp_cid, uint8_t local_seid, a2dp_source_media_scheduler_statistics_t * statistics){
+    if (!a2dp_source_media_scheduler_matches(a2dp_cid, local_seid)) return ERROR_CODE_COMMAND_DISALLOWED;
+    *statistics = media_scheduler.statistics;
+    statistics->queued_frames = media_scheduler.num_frames;
+    statistics->queued_bytes  = media_scheduler.queue_len;
+    return ERROR_CODE_SUCCESS;
+}
+
+void a2dp_source_media_scheduler_enable_adaptive_bitpool(int enabled){
+    adaptive_bitpool_enabled = enabled;
+}
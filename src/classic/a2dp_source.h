@@ -54,6 +54,15 @@ extern "C" {
 
 /* API_START */
 
+typedef struct {
+    uint32_t packets_sent;
+    uint32_t frames_sent;
+    uint32_t underruns;
+    uint16_t queued_frames;
+    uint16_t queued_bytes;
+    uint16_t max_queued_frames;
+} a2dp_source_media_scheduler_statistics_t;
+
 /**
  * @brief Create A2DP Source service record. 
  * @param service
@@ -94,7 +103,9 @@ avdtp_stream_endpoint_t * a2dp_source_create_stream_endpoint(avdtp_media_type_t
  * - A2DP_SUBEVENT_STREAM_SUSPENDED:							Received when stream is paused.
  * - A2DP_SUBEVENT_STREAM_STOPED:							    received when stream is aborted or stopped.
  * - A2DP_SUBEVENT_STREAM_RELEASED:								Received when stream is released.
- * - A2DP_SUBEVENT_STREAMING_CAN_SEND_MEDIA_PACKET_NOW:			Indicates that the next media packet can be sent.
+ * - A2DP_SUBEVENT_STREAMING_CAN_SEND_MEDIA_PACKET_NOW:			Indicates that the next media packet can be sent. Not emitted while the media scheduler is active.
+ * - A2DP_SUBEVENT_MEDIA_SCHEDULER_UNDERRUN:					Media scheduler did not get audio data in time.
+ * - A2DP_SUBEVENT_MEDIA_SCHEDULER_BITPOOL_CHANGED:			Media scheduler changed SBC bitpool, see a2dp_source_media_scheduler_enable_adaptive_bitpool.
  *
  * @param callback
  */
@@ -143,6 +154,14 @@ void 	a2dp_source_stream_endpoint_request_can_send_now(uint16_t a2dp_cid, uint8_
  */
 int 	a2dp_max_media_payload_size(uint16_t a2dp_cid, uint8_t local_seid);
 
+/**
+ * @brief Get SBC encoder configured for the established stream. Use it with btstack_sbc_encoder_process_data and friends.
+ * @param a2dp_cid 			A2DP channel identifyer.
+ * @param local_seid  		ID of a local stream endpoint.
+ * @return sbc_encoder_state or NULL if no stream is established for local_seid
+ */
+btstack_sbc_encoder_state_t * a2dp_source_get_sbc_encoder_state(uint16_t a2dp_cid, uint8_t local_seid);
+
 /**
  * @brief Send media payload.
  * @param a2dp_cid 			A2DP channel identifyer.
@@ -155,6 +174,56 @@ int 	a2dp_max_media_payload_size(uint16_t a2dp_cid, uint8_t local_seid);
  */
 int  	a2dp_source_stream_send_media_payload(uint16_t a2dp_cid, uint8_t local_seid, uint8_t * storage, int num_bytes_to_copy, uint8_t num_frames, uint8_t marker);
 
+/**
+ * @brief Start media scheduler that encodes PCM audio and sends it paced by the configured sampling frequency.
+ * @note SBC frames are packed into media packets up to the MTU. The RTP timestamp counts samples of the first frame.
+ *       The scheduler is stopped when the stream is suspended, stopped or released.
+ * @param a2dp_cid 			A2DP channel identifyer.
+ * @param local_seid  		ID of a local stream endpoint.
+ * @param fill_pcm			Called to provide num_audio_frames interleaved samples, returns 0 if no audio data is available.
+ * @param context			Provided in fill_pcm callback.
+ * @return status 			ERROR_CODE_SUCCESS if sucessful.
+ */
+uint8_t a2dp_source_media_scheduler_start_pcm(uint16_t a2dp_cid, uint8_t local_seid, 
+	int (*fill_pcm)(int16_t * pcm_buffer, int num_audio_frames, void * context), void * context);
+
+/**
+ * @brief Start media scheduler with SBC frames encoded by the application, see a2dp_source_media_scheduler_start_pcm.
+ * @param a2dp_cid 			A2DP channel identifyer.
+ * @param local_seid  		ID of a local stream endpoint.
+ * @param fill_sbc_frame	Called to store a single SBC frame of up to max_len bytes, returns its length or 0 if no audio data is available.
+ * @param context			Provided in fill_sbc_frame callback.
+ * @return status 			ERROR_CODE_SUCCESS if sucessful.
+ */
+uint8_t a2dp_source_media_scheduler_start_sbc(uint16_t a2dp_cid, uint8_t local_seid, 
+	int (*fill_sbc_frame)(uint8_t * sbc_frame, int max_len, void * context), void * context);
+
+/**
+ * @brief Stop media scheduler and drop queued frames.
+ * @param a2dp_cid 			A2DP channel identifyer.
+ * @param local_seid  		ID of a local stream endpoint.
+ * @return status 			ERROR_CODE_SUCCESS if sucessful.
+ */
+uint8_t a2dp_source_media_scheduler_stop(uint16_t a2dp_cid, uint8_t local_seid);
+
+/**
+ * @brief Get media scheduler statistics since start, including current queue depth.
+ * @param a2dp_cid 			A2DP channel identifyer.
+ * @param local_seid  		ID of a local stream endpoint.
+ * @param statistics
+ * @return status 			ERROR_CODE_SUCCESS if sucessful.
+ */
+uint8_t a2dp_source_media_scheduler_get_statistics(uint16_t a2dp_cid, uint8_t local_seid, a2dp_source_media_scheduler_statistics_t * statistics);
+
+/**
+ * @brief Enable adaptive bitpool for media scheduler started with a2dp_source_media_scheduler_start_pcm.
+ * @note If media packets queue up in the host or in the controller, e.g. because of retransmissions, the bitpool
+ *       is lowered down to the negotiated min bitpool. After the backlog is gone, it is slowly raised up to the
+ *       negotiated max bitpool again. Each change is reported with A2DP_SUBEVENT_MEDIA_SCHEDULER_BITPOOL_CHANGED.
+ * @param enabled
+ */
+void a2dp_source_media_scheduler_enable_adaptive_bitpool(int enabled);
+
 /* API_END */
 
 #if defined __cplusplus
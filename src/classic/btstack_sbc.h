@@ -50,6 +50,10 @@
 extern "C" {
 #endif
 
+// size of codec specific state embedded in decoder/encoder state, checked at compile time by the SBC implementation
+#define BTSTACK_SBC_DECODER_STORAGE_SIZE 3328
+#define BTSTACK_SBC_ENCODER_STORAGE_SIZE 2688
+
 typedef enum{
     SBC_MODE_STANDARD,
     SBC_MODE_mSBC
@@ -59,7 +63,6 @@ typedef struct {
     void * context;
     void (*handle_pcm_data)(int16_t * data, int num_samples, int num_channels, int sample_rate, void * context);
     // private
-    void * decoder_state;
     btstack_sbc_plc_state_t plc_state;
     btstack_sbc_mode_t mode;
 
@@ -67,14 +70,23 @@ typedef struct {
     int good_frames_nr;
     int bad_frames_nr;
     int zero_frames_nr;
+
+    // private - codec state, pointer array for alignment
+    void * decoder_storage[(BTSTACK_SBC_DECODER_STORAGE_SIZE + sizeof(void *) - 1) / sizeof(void *)];
 } btstack_sbc_decoder_state_t;
 
 typedef struct {
     // private
-    void * encoder_state;
     btstack_sbc_mode_t mode;
+    // private - codec state, pointer array for alignment
+    void * encoder_storage[(BTSTACK_SBC_ENCODER_STORAGE_SIZE + sizeof(void *) - 1) / sizeof(void *)];
 } btstack_sbc_encoder_state_t;
 
+/*
+ * Decoder and encoder keep all state in the provided state struct.
+ * Independent instances can be used concurrently, e.g. from different threads.
+ */
+
 /* API_START */
 
 /* BTstack SBC decoder */
@@ -128,33 +140,47 @@ int btstack_sbc_decoder_sample_rate(btstack_sbc_decoder_state_t * state);
 void btstack_sbc_encoder_init(btstack_sbc_encoder_state_t * state, btstack_sbc_mode_t mode, 
                         int blocks, int subbands, int allocation_method, int sample_rate, int bitpool, int channel_mode);
 
+/**
+ * @brief Set bitpool for following SBC frames without resetting the encoder
+ * @param state
+ * @param bitpool
+ */
+void btstack_sbc_encoder_set_bitpool(btstack_sbc_encoder_state_t * state, int bitpool);
+
 /**
  * @brief Encode PCM data
+ * @param state
  * @param buffer with samples in host endianess
  */
-void btstack_sbc_encoder_process_data(int16_t * input_buffer);
+void btstack_sbc_encoder_process_data(btstack_sbc_encoder_state_t * state, int16_t * input_buffer);
 
 /**
  * @brief Return SBC frame
+ * @param state
  */
-uint8_t * btstack_sbc_encoder_sbc_buffer(void);
+uint8_t * btstack_sbc_encoder_sbc_buffer(btstack_sbc_encoder_state_t * state);
 
 /**
  * @brief Return SBC frame length
+ * @param state
  */
-uint16_t  btstack_sbc_encoder_sbc_buffer_length(void);
+uint16_t  btstack_sbc_encoder_sbc_buffer_length(btstack_sbc_encoder_state_t * state);
 
 /**
  * @brief Return number of audio frames required for one SBC packet
+ * @param state
  * @note  each audio frame contains 2 sample values in stereo modes
  */
-int  btstack_sbc_encoder_num_audio_frames(void);
+int  btstack_sbc_encoder_num_audio_frames(btstack_sbc_encoder_state_t * state);
 
 /* API_END */
 
 // testing only
 void btstack_sbc_decoder_test_disable_plc(void);
 void btstack_sbc_decoder_test_simulate_corrupt_frames(int period);
+// select SIMD or C windowing for encoders initialized afterwards, returns name of SIMD kernel or NULL if not available
+void btstack_sbc_encoder_test_use_simd(int enabled);
+const char * btstack_sbc_encoder_test_simd_name(void);
 
 #if defined __cplusplus
 }
@@ -57,89 +57,118 @@ static uint8_t indices0[] = { 0xad, 0x00, 0x00, 0xc5, 0x00, 0x00, 0x00, 0x00, 0x
 0xb6, 0xdd, 0xdb, 0x6d, 0xb7, 0x76, 0xdb, 0x6d, 0xdd, 0xb6, 0xdb, 0x77, 0x6d,
 0xb6, 0xdd, 0xdb, 0x6d, 0xb7, 0x76, 0xdb, 0x6c};
 
-/* Raised COSine table for OLA */
-static float rcos[SBC_OLAL] = {
-    0.99148655f,0.96623611f,0.92510857f,0.86950446f,
-    0.80131732f,0.72286918f,0.63683150f,0.54613418f, 
-    0.45386582f,0.36316850f,0.27713082f,0.19868268f, 
-    0.13049554f,0.07489143f,0.03376389f,0.00851345f};
-
-// taken from http://www.codeproject.com/Articles/69941/Best-Square-Root-Method-Algorithm-Function-Precisi
-// Algorithm: Babylonian Method + some manipulations on IEEE 32 bit floating point representation
-static float sqrt3(const float x){
-    union {
-        int i;
-        float x;
-    } u;
-    u.x = x;
-    u.i = (1<<29) + (u.i >> 1) - (1<<22); 
-
-    // Two Babylonian Steps (simplified from:)
-    // u.x = 0.5f * (u.x + x/u.x);
-    // u.x = 0.5f * (u.x + x/u.x);
-    u.x =       u.x + x/u.x;
-    u.x = 0.25f*u.x + x/u.x;
-
-    return u.x;
-}
+/* Raised COSine table for OLA in Q15, rcos[i] + rcos[SBC_OLAL-1-i] == 1.0 */
+static const int16_t rcos[SBC_OLAL] = {
+    32489, 31662, 30314, 28492,
+    26258, 23687, 20868, 17896,
+    14872, 11900,  9081,  6510,
+     4276,  2454,  1106,   279};
+
+// samples are scaled to this many bits for pattern matching, so that a sum of SBC_M products fits into 32 bit
+#define SBC_PLC_SAMPLE_BITS 12
 
-static float absolute(float x){
-     if (x < 0) x = -x;
-     return x;
+// amplitude scale factor limits in Q15
+#define SBC_PLC_SF_MIN 24576  /* 0.75 */
+#define SBC_PLC_SF_MAX 39322  /* 1.2  */
+
+static int bit_length(uint32_t value){
+    int bits = 0;
+    while (value){
+        bits++;
+        value >>= 1;
+    }
+    return bits;
 }
 
-static float CrossCorrelation(SAMPLE_FORMAT *x, SAMPLE_FORMAT *y){
-    float num = 0;
-    float den = 0;
-    float x2 = 0;
-    float y2 = 0;
-    int   m;
+// kept as a plain loop, compilers map it onto SIMD multiply-accumulate instructions
+static int32_t dot_product(const int16_t *x, const int16_t *y){
+    int32_t sum = 0;
+    int m;
     for (m=0;m<SBC_M;m++){
-        num+=((float)x[m])*y[m];
-        x2+=((float)x[m])*x[m];
-        y2+=((float)y[m])*y[m];
+        sum += (int32_t) x[m] * y[m];
     }
-    den = (float)sqrt3(x2*y2);
-    return num/den;
+    return sum;
 }
 
+// Maximizes the normalized cross-correlation num / sqrt(x2 * y2). As the template x is fixed,
+// candidates are compared by num * |num| / y2 in integer math on the history scaled to
+// SBC_PLC_SAMPLE_BITS. The energy y2 of the candidate window is updated incrementally.
 static int PatternMatch(SAMPLE_FORMAT *y){
-    float maxCn = -999999.0;  // large negative number
-    int   bestmatch = 0;
-    float Cn;
-    int   n;
+    int16_t scaled[SBC_LHIST];
+    int32_t max_abs = 0;
+    int     shift;
+    int     i;
+    for (i=0;i<SBC_LHIST;i++){
+        int32_t value = y[i] < 0 ? -(int32_t)y[i] : y[i];
+        if (value > max_abs){
+            max_abs = value;
+        }
+    }
+    if (max_abs == 0) return 0;
+
+    shift = bit_length((uint32_t) max_abs) - SBC_PLC_SAMPLE_BITS;
+    for (i=0;i<SBC_LHIST;i++){
+        if (shift > 0){
+            scaled[i] = (int16_t) (y[i] >> shift);
+        } else {
+            scaled[i] = (int16_t) (y[i] * (1 << -shift));
+        }
+    }
+
+    const int16_t *x = &scaled[SBC_LHIST-SBC_M];
+    int32_t y2 = 0;
+    for (i=0;i<SBC_M;i++){
+        y2 += (int32_t) scaled[i] * scaled[i];
+    }
+
+    int64_t maxCn = 0;
+    int     bestmatch = -1;
+    int64_t Cn;
+    int32_t num;
+    int     n;
     for (n=0;n<SBC_N;n++){
-        Cn = CrossCorrelation(&y[SBC_LHIST-SBC_M], &y[n]); 
-        if (Cn>maxCn){
-            bestmatch=n;
-            maxCn = Cn; 
+        if (y2 > 0){
+            num = dot_product(x, &scaled[n]);
+            Cn  = ((int64_t) num * (num < 0 ? -num : num)) / y2;
+            if (bestmatch < 0 || Cn > maxCn){
+                bestmatch = n;
+                maxCn = Cn;
+            }
         }
+        y2 += (int32_t) scaled[n+SBC_M] * scaled[n+SBC_M] - (int32_t) scaled[n] * scaled[n];
     }
+    if (bestmatch < 0) return 0;
     return bestmatch;
 }
 
-static float AmplitudeMatch(SAMPLE_FORMAT *y, SAMPLE_FORMAT bestmatch) {
-    int   i;
-    float sumx = 0;
-    float sumy = 0.000001f;
-    float sf;
+// returns scale factor in Q15
+static int32_t AmplitudeMatch(SAMPLE_FORMAT *y, SAMPLE_FORMAT bestmatch) {
+    int     i;
+    int32_t sumx = 0;
+    int32_t sumy = 0;
+    int32_t value;
     
     for (i=0;i<SBC_FS;i++){
-        sumx += absolute(y[SBC_LHIST-SBC_FS+i]);
-        sumy += absolute(y[bestmatch+i]);
+        value = y[SBC_LHIST-SBC_FS+i];
+        sumx += value < 0 ? -value : value;
+        value = y[bestmatch+i];
+        sumy += value < 0 ? -value : value;
     }
-    sf = sumx/sumy;
     // This is not in the paper, but limit the scaling factor to something reasonable to avoid creating artifacts 
-    if (sf<0.75f) sf=0.75f;
-    if (sf>1.2f) sf=1.2f;
-    return sf;
+    if (((int64_t) sumx << 15) <= (int64_t) sumy * SBC_PLC_SF_MIN) return SBC_PLC_SF_MIN;
+    if (((int64_t) sumx << 15) >= (int64_t) sumy * SBC_PLC_SF_MAX) return SBC_PLC_SF_MAX;
+    return (int32_t) (((int64_t) sumx << 15) / sumy);
+}
+
+// multiply sample with Q15 factor, rounded
+static int32_t mul_q15(int32_t factor, int32_t sample){
+    return (factor * sample + (1 << 14)) >> 15;
 }
 
-static SAMPLE_FORMAT crop_sample(float val){
-    float croped_val = val;
-    if (croped_val > 32767.0)  croped_val= 32767.0;
-    if (croped_val < -32768.0) croped_val=-32768.0; 
-    return (SAMPLE_FORMAT) croped_val;
+static SAMPLE_FORMAT crop_sample(int32_t val){
+    if (val > 32767)  return 32767;
+    if (val < -32768) return -32768;
+    return (SAMPLE_FORMAT) val;
 }
 
 uint8_t * btstack_sbc_plc_zero_signal_frame(void){
@@ -153,9 +182,9 @@ void btstack_sbc_plc_init(btstack_sbc_plc_state_t *plc_state){
 }
 
 void btstack_sbc_plc_bad_frame(btstack_sbc_plc_state_t *plc_state, SAMPLE_FORMAT *ZIRbuf, SAMPLE_FORMAT *out){
-    float val;
-    int   i = 0;
-    float sf = 1;
+    int32_t val;
+    int     i = 0;
+    int32_t sf = 1 << 15;
     plc_state->nbf++;
    
     if (plc_state->nbf==1){
@@ -167,21 +196,21 @@ void btstack_sbc_plc_bad_frame(btstack_sbc_plc_state_t *plc_state, SAMPLE_FORMAT
         // Compute Scale Factor to Match Amplitude of Substitution Packet to that of Preceding Packet
         sf = AmplitudeMatch(plc_state->hist, plc_state->bestlag);
         for (i=0;i<SBC_OLAL;i++){
-            float left  = ZIRbuf[i];
-            float right = sf*plc_state->hist[plc_state->bestlag+i];
-            val = left*rcos[i] + right*rcos[SBC_OLAL-1-i];
+            int32_t left  = ZIRbuf[i];
+            int32_t right = mul_q15(sf, plc_state->hist[plc_state->bestlag+i]);
+            val = (left*rcos[i] + right*rcos[SBC_OLAL-1-i] + (1 << 14)) >> 15;
             plc_state->hist[SBC_LHIST+i] = crop_sample(val);
         }
         
         for (;i<SBC_FS;i++){
-            val = sf*plc_state->hist[plc_state->bestlag+i]; 
+            val = mul_q15(sf, plc_state->hist[plc_state->bestlag+i]); 
             plc_state->hist[SBC_LHIST+i] = crop_sample(val);
         }
         
         for (;i<SBC_FS+SBC_OLAL;i++){
-            float left  = sf*plc_state->hist[plc_state->bestlag+i];
-            float right = plc_state->hist[plc_state->bestlag+i];
-            val = left*rcos[i-SBC_FS]+right*rcos[SBC_OLAL-1-i+SBC_FS];
+            int32_t left  = mul_q15(sf, plc_state->hist[plc_state->bestlag+i]);
+            int32_t right = plc_state->hist[plc_state->bestlag+i];
+            val = (left*rcos[i-SBC_FS] + right*rcos[SBC_OLAL-1-i+SBC_FS] + (1 << 14)) >> 15;
             plc_state->hist[SBC_LHIST+i] = crop_sample(val);
         }
 
@@ -204,7 +233,7 @@ void btstack_sbc_plc_bad_frame(btstack_sbc_plc_state_t *plc_state, SAMPLE_FORMAT
 }
 
 void btstack_sbc_plc_good_frame(btstack_sbc_plc_state_t *plc_state, SAMPLE_FORMAT *in, SAMPLE_FORMAT *out){
-    float val;
+    int32_t val;
     int i = 0;
     if (plc_state->nbf>0){
         for (i=0;i<SBC_RT;i++){
@@ -212,9 +241,9 @@ void btstack_sbc_plc_good_frame(btstack_sbc_plc_state_t *plc_state, SAMPLE_FORMA
         }
             
         for (i = SBC_RT;i<SBC_RT+SBC_OLAL;i++){
-            float left  = plc_state->hist[SBC_LHIST+i];
-            float right = in[i];  
-            val = left*rcos[i-SBC_RT] + right*rcos[SBC_OLAL+SBC_RT-1-i];
+            int32_t left  = plc_state->hist[SBC_LHIST+i];
+            int32_t right = in[i];  
+            val = (left*rcos[i-SBC_RT] + right*rcos[SBC_OLAL+SBC_RT-1-i] + (1 << 14)) >> 15;
             out[i] = (SAMPLE_FORMAT)val;
         }
     }
@@ -49,6 +49,7 @@
 #include "bluetooth_sdp.h"
 #include "btstack_debug.h"
 #include "btstack_event.h"
+#include "btstack_hash_map.h"
 #include "btstack_memory.h"
 #include "btstack_util.h"
 #include "classic/core.h"
@@ -132,6 +133,15 @@ static btstack_linked_list_t rfcomm_multiplexers = NULL;
 static btstack_linked_list_t rfcomm_channels = NULL;
 static btstack_linked_list_t rfcomm_services = NULL;
 
+// rfcomm_cid -> channel index
+#ifdef MAX_NR_RFCOMM_CHANNELS
+#define RFCOMM_CHANNEL_INDEX_SIZE (2 * MAX_NR_RFCOMM_CHANNELS + 1)
+#else
+#define RFCOMM_CHANNEL_INDEX_SIZE 32
+#endif
+static btstack_hash_map_t       rfcomm_channel_index;
+static btstack_hash_map_entry_t rfcomm_channel_index_storage[RFCOMM_CHANNEL_INDEX_SIZE];
+
 static gap_security_level_t rfcomm_security_level;
 
 static int  rfcomm_channel_can_send(rfcomm_channel_t * channel);
@@ -416,6 +426,7 @@ static rfcomm_channel_t * rfcomm_channel_create(rfcomm_multiplexer_t * multiplex
     
     // add to services list
     btstack_linked_list_add(&rfcomm_channels, (btstack_linked_item_t *) channel);
+    btstack_hash_map_put(&rfcomm_channel_index, channel->rfcomm_cid, channel);
     
     return channel;
 }
@@ -434,6 +445,10 @@ static void rfcomm_notify_channel_can_send(void){
 }
 
 static rfcomm_channel_t * rfcomm_channel_for_rfcomm_cid(uint16_t rfcomm_cid){
+    rfcomm_channel_t * channel = (rfcomm_channel_t *) btstack_hash_map_get(&rfcomm_channel_index, rfcomm_cid);
+    if (channel) return channel;
+    // not all channels could be indexed, fall back to linear search
+    if (btstack_hash_map_complete(&rfcomm_channel_index)) return NULL;
     btstack_linked_item_t *it;
     for (it = (btstack_linked_item_t *) rfcomm_channels; it ; it = it->next){
         rfcomm_channel_t * channel = ((rfcomm_channel_t *) it);
@@ -786,6 +801,7 @@ static void rfcomm_multiplexer_finalize(rfcomm_multiplexer_t * multiplexer){
             }
             // remove from list
             it->next = it->next->next;
+            btstack_hash_map_remove(&rfcomm_channel_index, channel->rfcomm_cid);
             // free channel struct
             btstack_memory_rfcomm_channel_free(channel);
         } else {
@@ -989,6 +1005,7 @@ static int rfcomm_hci_event_handler(uint8_t *packet, uint16_t size){
                     if (channel->multiplexer == multiplexer){
                         rfcomm_emit_channel_opened(channel, status);
                         it->next = it->next->next;
+                        btstack_hash_map_remove(&rfcomm_channel_index, channel->rfcomm_cid);
                         btstack_memory_rfcomm_channel_free(channel);
                     } else {
                         it = it->next;
@@ -1341,6 +1358,7 @@ static void rfcomm_channel_finalize(rfcomm_channel_t *channel){
 
     // remove from list
     btstack_linked_list_remove( &rfcomm_channels, (btstack_linked_item_t *) channel);
+    btstack_hash_map_remove(&rfcomm_channel_index, channel->rfcomm_cid);
 
     // free channel
     btstack_memory_rfcomm_channel_free(channel);
@@ -2022,6 +2040,7 @@ void rfcomm_init(void){
     rfcomm_multiplexers = NULL;
     rfcomm_services     = NULL;
     rfcomm_channels     = NULL;
+    btstack_hash_map_init(&rfcomm_channel_index, rfcomm_channel_index_storage, RFCOMM_CHANNEL_INDEX_SIZE);
     rfcomm_security_level = LEVEL_2;
 }
 
@@ -2260,7 +2279,11 @@ static uint8_t rfcomm_channel_create_internal(btstack_packet_handler_t packet_ha
 
 fail:
     if (new_multiplexer) btstack_memory_rfcomm_multiplexer_free(multiplexer);
-    if (channel)         btstack_memory_rfcomm_channel_free(channel);
+    if (channel) {
+        btstack_linked_list_remove(&rfcomm_channels, (btstack_linked_item_t *) channel);
+        btstack_hash_map_remove(&rfcomm_channel_index, channel->rfcomm_cid);
+        btstack_memory_rfcomm_channel_free(channel);
+    }
     return status;
 }
 
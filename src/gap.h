@@ -327,6 +327,55 @@ void gap_get_connection_parameter_range(le_connection_parameter_range_t * range)
  */
 void gap_set_connection_parameter_range(le_connection_parameter_range_t * range);
 
+/**
+ * @brief Request LE Data Length for a given LE connection, requires ENABLE_LE_DATA_LENGTH_EXTENSION
+ * @note HCI_SUBEVENT_LE_DATA_LENGTH_CHANGE is emitted when the Controller starts using a new data length
+ * @param con_handle
+ * @param tx_octets max number of payload octets in a single LL Data PDU [27..251]
+ * @param tx_time max time to transmit a single LL Data PDU (unit: us)
+ * @returns 0 if ok
+ */
+int gap_le_set_data_length(hci_con_handle_t con_handle, uint16_t tx_octets, uint16_t tx_time);
+
+/**
+ * @brief Get LE Data Length in use for a given LE connection
+ * @param con_handle
+ * @param max_tx_octets
+ * @param max_rx_octets
+ * @returns 0 if ok
+ */
+int gap_le_get_data_length(hci_con_handle_t con_handle, uint16_t * max_tx_octets, uint16_t * max_rx_octets);
+
+/**
+ * @brief Set preferred PHYs for new LE connections
+ * @param all_phys LE_PHY_ALL_PHYS_NO_TX_PREFERENCE and/or LE_PHY_ALL_PHYS_NO_RX_PREFERENCE
+ * @param tx_phys LE_PHY_MASK_1M, LE_PHY_MASK_2M, LE_PHY_MASK_CODED
+ * @param rx_phys LE_PHY_MASK_1M, LE_PHY_MASK_2M, LE_PHY_MASK_CODED
+ * @returns 0 if ok
+ */
+int gap_le_set_default_phy(uint8_t all_phys, uint8_t tx_phys, uint8_t rx_phys);
+
+/**
+ * @brief Request PHY update for a given LE connection
+ * @note HCI_SUBEVENT_LE_PHY_UPDATE_COMPLETE is emitted on completion
+ * @param con_handle
+ * @param all_phys LE_PHY_ALL_PHYS_NO_TX_PREFERENCE and/or LE_PHY_ALL_PHYS_NO_RX_PREFERENCE
+ * @param tx_phys LE_PHY_MASK_1M, LE_PHY_MASK_2M, LE_PHY_MASK_CODED
+ * @param rx_phys LE_PHY_MASK_1M, LE_PHY_MASK_2M, LE_PHY_MASK_CODED
+ * @param phy_options preferred coding on LE Coded PHY
+ * @returns 0 if ok
+ */
+int gap_le_set_phy(hci_con_handle_t con_handle, uint8_t all_phys, uint8_t tx_phys, uint8_t rx_phys, uint16_t phy_options);
+
+/**
+ * @brief Get PHY in use for a given LE connection
+ * @param con_handle
+ * @param tx_phy LE_PHY_1M, LE_PHY_2M, or LE_PHY_CODED
+ * @param rx_phy LE_PHY_1M, LE_PHY_2M, or LE_PHY_CODED
+ * @returns 0 if ok
+ */
+int gap_le_get_phy(hci_con_handle_t con_handle, uint8_t * tx_phy, uint8_t * rx_phy);
+
 /**
  * @brief Connect to remote LE device
  */
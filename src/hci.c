@@ -68,6 +68,7 @@
 
 #include "btstack_debug.h"
 #include "btstack_event.h"
+#include "btstack_hash_map.h"
 #include "btstack_linked_list.h"
 #include "btstack_memory.h"
 #include "bluetooth_company_id.h"
@@ -201,6 +202,16 @@ static hci_connection_t * create_connection_for_bd_addr_and_type(bd_addr_t addr,
     conn->num_acl_packets_sent = 0;
     conn->num_sco_packets_sent = 0;
     conn->le_con_parameter_update_state = CON_PARAMETER_UPDATE_NONE;
+#ifdef ENABLE_BLE
+    conn->le_max_tx_octets = LE_DATA_LENGTH_MIN_OCTETS;
+    conn->le_max_rx_octets = LE_DATA_LENGTH_MIN_OCTETS;
+#ifdef ENABLE_LE_DATA_LENGTH_EXTENSION
+    conn->le_data_length_tx_octets = 0;
+#endif
+    conn->le_tx_phy = LE_PHY_1M;
+    conn->le_rx_phy = LE_PHY_1M;
+    conn->le_phy_update_pending = 0;
+#endif
     btstack_linked_list_add(&hci_stack->connections, (btstack_linked_item_t *) conn);
     return conn;
 }
@@ -234,12 +245,38 @@ void hci_connections_get_iterator(btstack_linked_list_iterator_t *it){
     btstack_linked_list_iterator_init(it, &hci_stack->connections);
 }
 
+// set con_handle and update index
+static void hci_connection_set_con_handle(hci_connection_t * conn, hci_con_handle_t con_handle){
+    if (conn->con_handle != HCI_CON_HANDLE_INVALID){
+        btstack_hash_map_remove(&hci_stack->connection_index, conn->con_handle);
+    }
+    conn->con_handle = con_handle;
+    if (!btstack_hash_map_put(&hci_stack->connection_index, con_handle, conn)){
+        log_info("connection index full, handle 0x%04x not indexed", con_handle);
+    }
+}
+
+// remove from connection list and index, then free
+static void hci_connection_free(hci_connection_t * conn){
+    if (conn->con_handle != HCI_CON_HANDLE_INVALID){
+        btstack_hash_map_remove(&hci_stack->connection_index, conn->con_handle);
+    }
+    btstack_linked_list_remove(&hci_stack->connections, (btstack_linked_item_t *) conn);
+    btstack_memory_hci_connection_free( conn );
+}
+
 /**
  * get connection for a given handle
  *
  * @return connection OR NULL, if not found
  */
 hci_connection_t * hci_connection_for_handle(hci_con_handle_t con_handle){
+    if (con_handle != HCI_CON_HANDLE_INVALID){
+        hci_connection_t * conn = (hci_connection_t *) btstack_hash_map_get(&hci_stack->connection_index, con_handle);
+        if (conn) return conn;
+        // not all connections could be indexed, fall back to linear search
+        if (btstack_hash_map_complete(&hci_stack->connection_index)) return NULL;
+    }
     btstack_linked_list_iterator_t it;
     btstack_linked_list_iterator_init(&it, &hci_stack->connections);
     while (btstack_linked_list_iterator_has_next(&it)){
@@ -368,20 +405,28 @@ static int nr_hci_connections(void){
     return count;
 }
 
+// keep per connection and per transport counters of packets sent to controller in sync
+static void hci_connection_update_num_acl_packets_sent(hci_connection_t * connection, int delta){
+    connection->num_acl_packets_sent += delta;
+    if (connection->address_type == BD_ADDR_TYPE_CLASSIC){
+        hci_stack->acl_packets_sent_classic += delta;
+    } else {
+        hci_stack->acl_packets_sent_le += delta;
+    }
+}
+
+#ifdef ENABLE_CLASSIC
+static void hci_connection_update_num_sco_packets_sent(hci_connection_t * connection, int delta){
+    connection->num_sco_packets_sent += delta;
+    hci_stack->sco_packets_sent += delta;
+}
+#endif
+
 static int hci_number_free_acl_slots_for_connection_type(bd_addr_type_t address_type){
     
-    unsigned int num_packets_sent_classic = 0;
-    unsigned int num_packets_sent_le = 0;
+    unsigned int num_packets_sent_classic = hci_stack->acl_packets_sent_classic;
+    unsigned int num_packets_sent_le = hci_stack->acl_packets_sent_le;
 
-    btstack_linked_item_t *it;
-    for (it = (btstack_linked_item_t *) hci_stack->connections; it ; it = it->next){
-        hci_connection_t * connection = (hci_connection_t *) it;
-        if (connection->address_type == BD_ADDR_TYPE_CLASSIC){
-            num_packets_sent_classic += connection->num_acl_packets_sent;
-        } else {
-            num_packets_sent_le += connection->num_acl_packets_sent;
-        }
-    }
     log_debug("ACL classic buffers: %u used of %u", num_packets_sent_classic, hci_stack->acl_packets_total_num);
     int free_slots_classic = hci_stack->acl_packets_total_num - num_packets_sent_classic;
     int free_slots_le = 0;
@@ -433,14 +478,15 @@ int hci_number_free_acl_slots_for_handle(hci_con_handle_t con_handle){
     return hci_number_free_acl_slots_for_connection_type(connection->address_type);
 }
 
+int hci_number_outgoing_acl_packets_for_handle(hci_con_handle_t con_handle){
+    hci_connection_t * connection = hci_connection_for_handle(con_handle);
+    if (!connection) return 0;
+    return connection->num_acl_packets_sent;
+}
+
 #ifdef ENABLE_CLASSIC
 static int hci_number_free_sco_slots(void){
-    unsigned int num_sco_packets_sent  = 0;
-    btstack_linked_item_t *it;
-    for (it = (btstack_linked_item_t *) hci_stack->connections; it ; it = it->next){
-        hci_connection_t * connection = (hci_connection_t *) it;
-        num_sco_packets_sent += connection->num_sco_packets_sent;
-    }
+    unsigned int num_sco_packets_sent = hci_stack->sco_packets_sent;
     if (num_sco_packets_sent > hci_stack->sco_packets_total_num){
         log_info("hci_number_free_sco_slots:packets (%u) > total packets (%u)", num_sco_packets_sent, hci_stack->sco_packets_total_num);
         return 0;
@@ -450,9 +496,55 @@ static int hci_number_free_sco_slots(void){
 }
 #endif
 
+// outgoing packet buffer pool
+typedef enum {
+    HCI_PACKET_BUFFER_FREE = 0,
+    HCI_PACKET_BUFFER_RESERVED,
+    HCI_PACKET_BUFFER_QUEUED,
+    HCI_PACKET_BUFFER_IN_TRANSPORT,
+} hci_packet_buffer_state_t;
+
+static uint8_t * hci_packet_buffer_for_index(int index){
+    return &hci_stack->hci_packet_buffer_data[index][HCI_OUTGOING_PRE_BUFFER_SIZE];
+}
+
+// @returns index of outgoing packet buffer or -1 if packet is not stored in one
+static int hci_packet_buffer_index(const uint8_t * packet){
+    int i;
+    for (i=0;i<HCI_OUTGOING_PACKET_BUFFER_NUM;i++){
+        if (packet == hci_packet_buffer_for_index(i)) return i;
+    }
+    return -1;
+}
+
+static int hci_packet_buffer_free_index(void){
+    int i;
+    for (i=0;i<HCI_OUTGOING_PACKET_BUFFER_NUM;i++){
+        if (hci_stack->hci_packet_buffer_state[i] == HCI_PACKET_BUFFER_FREE) return i;
+    }
+    return -1;
+}
+
+// check if an outgoing packet buffer can be reserved
+static int hci_packet_buffer_available(void){
+    if (hci_stack->hci_packet_buffer_reserved) return 0;
+    return hci_packet_buffer_free_index() >= 0;
+}
+
+static void hci_packet_buffers_reset(void){
+    memset(hci_stack->hci_packet_buffer_state, HCI_PACKET_BUFFER_FREE, sizeof(hci_stack->hci_packet_buffer_state));
+    hci_stack->hci_packet_buffer = hci_packet_buffer_for_index(0);
+    hci_stack->hci_packet_buffer_reserved = 0;
+    hci_stack->hci_packet_buffer_in_transport = -1;
+    hci_stack->acl_packet_queue_len = 0;
+    hci_stack->acl_fragmentation_pos = 0;
+    hci_stack->acl_fragmentation_total_size = 0;
+    hci_stack->acl_fragment_in_transport = 0;
+}
+
 // only used to send HCI Host Number Completed Packets
 static int hci_can_send_comand_packet_transport(void){
-    if (hci_stack->hci_packet_buffer_reserved) return 0;
+    if (!hci_packet_buffer_available()) return 0;
 
     // check for async hci transport implementations
     if (hci_stack->hci_transport->can_send_packet_now){
@@ -475,29 +567,28 @@ static int hci_transport_can_send_prepared_packet_now(uint8_t packet_type){
     return hci_stack->hci_transport->can_send_packet_now(packet_type);
 }
 
+// prepared ACL packets are queued if the HCI transport is busy, only controller buffers are checked
 static int hci_can_send_prepared_acl_packet_for_address_type(bd_addr_type_t address_type){
-    if (!hci_transport_can_send_prepared_packet_now(HCI_ACL_DATA_PACKET)) return 0;
     return hci_number_free_acl_slots_for_connection_type(address_type) > 0;
 }
 
 int hci_can_send_acl_le_packet_now(void){
-    if (hci_stack->hci_packet_buffer_reserved) return 0;
+    if (!hci_packet_buffer_available()) return 0;
     return hci_can_send_prepared_acl_packet_for_address_type(BD_ADDR_TYPE_LE_PUBLIC);
 }
 
 int hci_can_send_prepared_acl_packet_now(hci_con_handle_t con_handle) {
-    if (!hci_transport_can_send_prepared_packet_now(HCI_ACL_DATA_PACKET)) return 0;
     return hci_number_free_acl_slots_for_handle(con_handle) > 0;
 }
 
 int hci_can_send_acl_packet_now(hci_con_handle_t con_handle){
-    if (hci_stack->hci_packet_buffer_reserved) return 0;
+    if (!hci_packet_buffer_available()) return 0;
     return hci_can_send_prepared_acl_packet_now(con_handle);
 }
 
 #ifdef ENABLE_CLASSIC
 int hci_can_send_acl_classic_packet_now(void){
-    if (hci_stack->hci_packet_buffer_reserved) return 0;
+    if (!hci_packet_buffer_available()) return 0;
     return hci_can_send_prepared_acl_packet_for_address_type(BD_ADDR_TYPE_CLASSIC);
 }
 
@@ -508,7 +599,7 @@ int hci_can_send_prepared_sco_packet_now(void){
 }
 
 int hci_can_send_sco_packet_now(void){
-    if (hci_stack->hci_packet_buffer_reserved) return 0;
+    if (!hci_packet_buffer_available()) return 0;
     return hci_can_send_prepared_sco_packet_now();
 }
 
@@ -529,11 +620,22 @@ int hci_reserve_packet_buffer(void){
         log_error("hci_reserve_packet_buffer called but buffer already reserved");
         return 0;
     }
+    int index = hci_packet_buffer_free_index();
+    if (index < 0){
+        log_error("hci_reserve_packet_buffer called but no free buffer");
+        return 0;
+    }
+    hci_stack->hci_packet_buffer_state[index] = HCI_PACKET_BUFFER_RESERVED;
+    hci_stack->hci_packet_buffer = hci_packet_buffer_for_index(index);
     hci_stack->hci_packet_buffer_reserved = 1;
     return 1;    
 }
 
 void hci_release_packet_buffer(void){
+    int index = hci_packet_buffer_index(hci_stack->hci_packet_buffer);
+    if (index >= 0 && hci_stack->hci_packet_buffer_state[index] == HCI_PACKET_BUFFER_RESERVED){
+        hci_stack->hci_packet_buffer_state[index] = HCI_PACKET_BUFFER_FREE;
+    }
     hci_stack->hci_packet_buffer_reserved = 0;
 }
 
@@ -542,8 +644,66 @@ static int hci_transport_synchronous(void){
     return hci_stack->hci_transport->can_send_packet_now == NULL;
 }
 
+// free outgoing packet buffer after HCI_EVENT_TRANSPORT_PACKET_SENT
+static void hci_packet_buffer_release_in_transport(void){
+    if (hci_stack->hci_packet_buffer_in_transport < 0) return;
+    hci_stack->hci_packet_buffer_state[hci_stack->hci_packet_buffer_in_transport] = HCI_PACKET_BUFFER_FREE;
+    hci_stack->hci_packet_buffer_in_transport = -1;
+}
+
+// mark outgoing packet buffer as handed to HCI transport, free it right away for synchronous transport
+static void hci_packet_buffer_handed_to_transport(const uint8_t * packet){
+    int index = hci_packet_buffer_index(packet);
+    if (index < 0) return;
+    if (packet == hci_stack->hci_packet_buffer){
+        hci_stack->hci_packet_buffer_reserved = 0;
+    }
+    hci_stack->acl_fragment_in_transport = 0;
+    if (hci_transport_synchronous()){
+        hci_stack->hci_packet_buffer_state[index] = HCI_PACKET_BUFFER_FREE;
+    } else {
+        // transport accepts a single packet, so a previous packet must be done
+        hci_packet_buffer_release_in_transport();
+        hci_stack->hci_packet_buffer_state[index] = HCI_PACKET_BUFFER_IN_TRANSPORT;
+        hci_stack->hci_packet_buffer_in_transport = index;
+    }
+}
+
+static void hci_acl_packet_queue_remove(int queue_pos){
+    int index = hci_stack->acl_packet_queue[queue_pos];
+    if (queue_pos == 0 && hci_stack->acl_fragment_in_transport){
+        // HCI transport still reads from buffer, release it on HCI_EVENT_TRANSPORT_PACKET_SENT
+        hci_packet_buffer_handed_to_transport(hci_packet_buffer_for_index(index));
+    } else {
+        hci_stack->hci_packet_buffer_state[index] = HCI_PACKET_BUFFER_FREE;
+    }
+    hci_stack->acl_packet_queue_len--;
+    memmove(&hci_stack->acl_packet_queue[queue_pos], &hci_stack->acl_packet_queue[queue_pos+1], hci_stack->acl_packet_queue_len - queue_pos);
+}
+
+// drop queued ACL packets incl. pending fragments for a closed connection
+static void hci_acl_packet_queue_drop_for_handle(hci_con_handle_t con_handle){
+    int queue_pos = 0;
+    while (queue_pos < hci_stack->acl_packet_queue_len){
+        uint8_t * packet = hci_packet_buffer_for_index(hci_stack->acl_packet_queue[queue_pos]);
+        if (READ_ACL_CONNECTION_HANDLE(packet) != con_handle){
+            queue_pos++;
+            continue;
+        }
+        if (queue_pos == 0 && hci_stack->acl_fragmentation_total_size > 0){
+            log_info("hci: drop fragmented ACL data for closed connection");
+            hci_stack->acl_fragmentation_total_size = 0;
+            hci_stack->acl_fragmentation_pos = 0;
+        }
+        hci_acl_packet_queue_remove(queue_pos);
+    }
+}
+
+// send fragments of first queued ACL packet
 static int hci_send_acl_packet_fragments(hci_connection_t *connection){
 
+    uint8_t * buffer = hci_packet_buffer_for_index(hci_stack->acl_packet_queue[0]);
+
     // log_info("hci_send_acl_packet_fragments  %u/%u (con 0x%04x)", hci_stack->acl_fragmentation_pos, hci_stack->acl_fragmentation_total_size, connection->con_handle);
 
     // max ACL data packet length depends on connection type (LE vs. Classic) and available buffers
@@ -576,30 +736,34 @@ static int hci_send_acl_packet_fragments(hci_connection_t *connection){
 
         // copy handle_and_flags if not first fragment and update packet boundary flags to be 01 (continuing fragmnent)
         if (acl_header_pos > 0){
-            uint16_t handle_and_flags = little_endian_read_16(hci_stack->hci_packet_buffer, 0);
+            uint16_t handle_and_flags = little_endian_read_16(buffer, 0);
             handle_and_flags = (handle_and_flags & 0xcfff) | (1 << 12);
-            little_endian_store_16(hci_stack->hci_packet_buffer, acl_header_pos, handle_and_flags);
+            little_endian_store_16(buffer, acl_header_pos, handle_and_flags);
+            // count packet, first fragment has been counted when packet was queued
+            hci_connection_update_num_acl_packets_sent(connection, 1);
         }
 
         // update header len
-        little_endian_store_16(hci_stack->hci_packet_buffer, acl_header_pos + 2, current_acl_data_packet_length);
+        little_endian_store_16(buffer, acl_header_pos + 2, current_acl_data_packet_length);
 
-        // count packet
-        connection->num_acl_packets_sent++;
         log_debug("hci_send_acl_packet_fragments loop before send (more fragments %d)", more_fragments);
 
         // update state for next fragment (if any) as "transport done" might be sent during send_packet already
         if (more_fragments){
             // update start of next fragment to send
             hci_stack->acl_fragmentation_pos += current_acl_data_packet_length;
+            hci_stack->acl_fragment_in_transport = !hci_transport_synchronous();
         } else {
-            // done
+            // done, remove from queue and keep buffer until transport is done
             hci_stack->acl_fragmentation_pos = 0;
             hci_stack->acl_fragmentation_total_size = 0;
+            hci_stack->acl_packet_queue_len--;
+            memmove(&hci_stack->acl_packet_queue[0], &hci_stack->acl_packet_queue[1], hci_stack->acl_packet_queue_len);
+            hci_packet_buffer_handed_to_transport(buffer);
         }
 
         // send packet
-        uint8_t * packet = &hci_stack->hci_packet_buffer[acl_header_pos];
+        uint8_t * packet = &buffer[acl_header_pos];
         const int size = current_acl_data_packet_length + 4;
         hci_dump_packet(HCI_ACL_DATA_PACKET, 0, packet, size);
         err = hci_stack->hci_transport->send_packet(HCI_ACL_DATA_PACKET, packet, size);
@@ -610,14 +774,14 @@ static int hci_send_acl_packet_fragments(hci_connection_t *connection){
         if (!more_fragments) break;
 
         // can send more?
+        if (!hci_transport_can_send_prepared_packet_now(HCI_ACL_DATA_PACKET)) return err;
         if (!hci_can_send_prepared_acl_packet_now(connection->con_handle)) return err;
     }
 
     log_debug("hci_send_acl_packet_fragments loop over");
 
-    // release buffer now for synchronous transport
+    // buffer already released for synchronous transport
     if (hci_transport_synchronous()){
-        hci_release_packet_buffer();
         // notify upper stack that it might be possible to send again
         uint8_t event[] = { HCI_EVENT_TRANSPORT_PACKET_SENT, 0};
         hci_emit_event(&event[0], sizeof(event), 0);  // don't dump
@@ -626,6 +790,37 @@ static int hci_send_acl_packet_fragments(hci_connection_t *connection){
     return err;
 }
 
+// send queued ACL packets as long as HCI transport and controller buffers allow
+static int hci_send_queued_acl_packets(void){
+    int err = 0;
+    while (hci_stack->acl_packet_queue_len > 0){
+        int index = hci_stack->acl_packet_queue[0];
+        hci_con_handle_t con_handle = READ_ACL_CONNECTION_HANDLE(hci_packet_buffer_for_index(index));
+        hci_connection_t *connection = hci_connection_for_handle(con_handle);
+        if (!connection) {
+            // connection gone -> discard packet and further fragments
+            log_info("hci_send_queued_acl_packets: no connection -> discard ACL packet");
+            hci_stack->acl_fragmentation_total_size = 0;
+            hci_stack->acl_fragmentation_pos = 0;
+            hci_acl_packet_queue_remove(0);
+            continue;
+        }
+        if (!hci_transport_can_send_prepared_packet_now(HCI_ACL_DATA_PACKET)) break;
+        if (hci_stack->acl_fragmentation_total_size == 0){
+            // setup data, controller buffer for first fragment already counted
+            hci_stack->acl_fragmentation_total_size = hci_stack->hci_packet_buffer_size[index];
+            hci_stack->acl_fragmentation_pos = 4;   // start of L2CAP packet
+        } else {
+            // continuation fragment needs another controller buffer
+            if (!hci_can_send_prepared_acl_packet_now(con_handle)) break;
+        }
+        err = hci_send_acl_packet_fragments(connection);
+        // stop if packet wasn't sent completely
+        if (hci_stack->acl_fragmentation_total_size > 0) break;
+    }
+    return err;
+}
+
 // pre: caller has reserved the packet buffer
 int hci_send_acl_packet_buffer(int size){
 
@@ -659,11 +854,17 @@ int hci_send_acl_packet_buffer(int size){
 
     // hci_dump_packet( HCI_ACL_DATA_PACKET, 0, packet, size);
 
-    // setup data
-    hci_stack->acl_fragmentation_total_size = size;
-    hci_stack->acl_fragmentation_pos = 4;   // start of L2CAP packet
+    // count first fragment now, so that controller buffers are not over-committed by queued packets
+    hci_connection_update_num_acl_packets_sent(connection, 1);
 
-    return hci_send_acl_packet_fragments(connection);
+    // queue packet
+    int index = hci_packet_buffer_index(packet);
+    hci_stack->hci_packet_buffer_state[index] = HCI_PACKET_BUFFER_QUEUED;
+    hci_stack->hci_packet_buffer_size[index]  = size;
+    hci_stack->hci_packet_buffer_reserved = 0;
+    hci_stack->acl_packet_queue[hci_stack->acl_packet_queue_len++] = index;
+
+    return hci_send_queued_acl_packets();
 }
 
 #ifdef ENABLE_CLASSIC
@@ -697,14 +898,14 @@ int hci_send_sco_packet_buffer(int size){
             hci_release_packet_buffer();
             return 0;
         }
-        connection->num_sco_packets_sent++;
+        hci_connection_update_num_sco_packets_sent(connection, 1);
     }
 
+    hci_packet_buffer_handed_to_transport(packet);
     hci_dump_packet( HCI_SCO_DATA_PACKET, 0, packet, size);
     int err = hci_stack->hci_transport->send_packet(HCI_SCO_DATA_PACKET, packet, size);
 
     if (hci_transport_synchronous()){
-        hci_release_packet_buffer();
         // notify upper stack that it might be possible to send again
         uint8_t event[] = { HCI_EVENT_TRANSPORT_PACKET_SENT, 0};
         hci_emit_event(&event[0], sizeof(event), 0);    // don't dump
@@ -832,9 +1033,14 @@ static void hci_shutdown_connection(hci_connection_t *conn){
 #endif
 
     btstack_run_loop_remove_timer(&conn->timeout);
+
+    // packets outstanding for this connection have been flushed by the controller
+    hci_connection_update_num_acl_packets_sent(conn, -conn->num_acl_packets_sent);
+#ifdef ENABLE_CLASSIC
+    hci_connection_update_num_sco_packets_sent(conn, -conn->num_sco_packets_sent);
+#endif
     
-    btstack_linked_list_remove(&hci_stack->connections, (btstack_linked_item_t *) conn);
-    btstack_memory_hci_connection_free( conn );
+    hci_connection_free(conn);
     
     // now it's gone
     hci_emit_nr_connections_changed();
@@ -1335,7 +1541,12 @@ static void hci_initializing_run(void){
             break;
         case HCI_INIT_LE_SET_EVENT_MASK:
             hci_stack->substate = HCI_INIT_W4_LE_SET_EVENT_MASK;
-            hci_send_cmd(&hci_le_set_event_mask, 0x1FF, 0x0);
+            if (hci_stack->local_supported_commands[0] & 0x40){
+                // also LE PHY Update Complete
+                hci_send_cmd(&hci_le_set_event_mask, 0x9FF, 0x0);
+            } else {
+                hci_send_cmd(&hci_le_set_event_mask, 0x1FF, 0x0);
+            }
             break;
         case HCI_INIT_WRITE_LE_HOST_SUPPORTED:
             // LE Supported Host = 1, Simultaneous Host = 0
@@ -1375,6 +1586,10 @@ static void hci_init_done(void){
     // done. tell the app
     log_info("hci_init_done -> HCI_STATE_WORKING");
     hci_stack->state = HCI_STATE_WORKING;
+#ifdef ENABLE_BLE
+    // restore default PHY after Controller reset
+    hci_stack->le_default_phy_pending = hci_stack->le_default_phy_configured;
+#endif
     hci_emit_state();
     hci_run();
 }
@@ -1807,7 +2022,9 @@ static void event_handler(uint8_t *packet, int size){
                     (packet[OFFSET_OF_DATA_IN_COMMAND_COMPLETE+1+10] & 0x10) >> 2 |  // bit 2 = Octet 10, bit 4
                     (packet[OFFSET_OF_DATA_IN_COMMAND_COMPLETE+1+18] & 0x08)      |  // bit 3 = Octet 18, bit 3
                     (packet[OFFSET_OF_DATA_IN_COMMAND_COMPLETE+1+34] & 0x01) << 4 |  // bit 4 = Octet 34, bit 0
-                    (packet[OFFSET_OF_DATA_IN_COMMAND_COMPLETE+1+35] & 0x08) << 2;   // bit 5 = Octet 35, bit 3
+                    (packet[OFFSET_OF_DATA_IN_COMMAND_COMPLETE+1+35] & 0x08) << 2 |  // bit 5 = Octet 35, bit 3
+                    (packet[OFFSET_OF_DATA_IN_COMMAND_COMPLETE+1+35] & 0x40)      |  // bit 6 = Octet 35, bit 6
+                    (packet[OFFSET_OF_DATA_IN_COMMAND_COMPLETE+1+33] & 0x40) << 1;   // bit 7 = Octet 33, bit 6
                     log_info("Local supported commands summary 0x%02x", hci_stack->local_supported_commands[0]); 
             }
 #ifdef ENABLE_CLASSIC
@@ -1841,19 +2058,19 @@ static void event_handler(uint8_t *packet, int size){
                 if (conn->address_type == BD_ADDR_TYPE_SCO){
 #ifdef ENABLE_CLASSIC
                     if (conn->num_sco_packets_sent >= num_packets){
-                        conn->num_sco_packets_sent -= num_packets;
+                        hci_connection_update_num_sco_packets_sent(conn, -num_packets);
                     } else {
                         log_error("hci_number_completed_packets, more sco slots freed then sent.");
-                        conn->num_sco_packets_sent = 0;
+                        hci_connection_update_num_sco_packets_sent(conn, -conn->num_sco_packets_sent);
                     }
                     hci_notify_if_sco_can_send_now();
 #endif
                 } else {
                     if (conn->num_acl_packets_sent >= num_packets){
-                        conn->num_acl_packets_sent -= num_packets;
+                        hci_connection_update_num_acl_packets_sent(conn, -num_packets);
                     } else {
                         log_error("hci_number_completed_packets, more acl slots freed then sent.");
-                        conn->num_acl_packets_sent = 0;
+                        hci_connection_update_num_acl_packets_sent(conn, -conn->num_acl_packets_sent);
                     }
                 }
                 // log_info("hci_number_completed_packet %u processed for handle %u, outstanding %u", num_packets, handle, conn->num_acl_packets_sent);
@@ -1908,7 +2125,7 @@ static void event_handler(uint8_t *packet, int size){
             if (conn) {
                 if (!packet[2]){
                     conn->state = OPEN;
-                    conn->con_handle = little_endian_read_16(packet, 3);
+                    hci_connection_set_con_handle(conn, little_endian_read_16(packet, 3));
                     conn->bonding_flags |= BONDING_REQUEST_REMOTE_FEATURES;
 
                     // restart timer
@@ -1925,8 +2142,7 @@ static void event_handler(uint8_t *packet, int size){
                     memcpy(&bd_address, conn->address, 6);
 
                     // connection failed, remove entry
-                    btstack_linked_list_remove(&hci_stack->connections, (btstack_linked_item_t *) conn);
-                    btstack_memory_hci_connection_free( conn );
+                    hci_connection_free(conn);
                     
                     // notify client if dedicated bonding
                     if (notify_dedicated_bonding_failed){
@@ -1957,7 +2173,7 @@ static void event_handler(uint8_t *packet, int size){
                 break;
             }
             conn->state = OPEN;
-            conn->con_handle = little_endian_read_16(packet, 3);            
+            hci_connection_set_con_handle(conn, little_endian_read_16(packet, 3));
 
 #ifdef ENABLE_SCO_OVER_HCI
             // update SCO
@@ -2090,14 +2306,8 @@ static void event_handler(uint8_t *packet, int size){
         case HCI_EVENT_DISCONNECTION_COMPLETE:
             if (packet[2]) break;   // status != 0
             handle = little_endian_read_16(packet, 3);
-            // drop outgoing ACL fragments if it is for closed connection
-            if (hci_stack->acl_fragmentation_total_size > 0) {
-                if (handle == READ_ACL_CONNECTION_HANDLE(hci_stack->hci_packet_buffer)){
-                    log_info("hci: drop fragmented ACL data for closed connection");
-                     hci_stack->acl_fragmentation_total_size = 0;
-                     hci_stack->acl_fragmentation_pos = 0;
-                }
-            }
+            // drop queued outgoing ACL packets and fragments for closed connection
+            hci_acl_packet_queue_drop_for_handle(handle);
 
             // re-enable advertisements for le connections if active
             conn = hci_connection_for_handle(handle);
@@ -2139,8 +2349,9 @@ static void event_handler(uint8_t *packet, int size){
                 log_error("Synchronous HCI Transport shouldn't send HCI_EVENT_TRANSPORT_PACKET_SENT");
                 return; // instead of break: to avoid re-entering hci_run()
             }
+            hci_stack->acl_fragment_in_transport = 0;
+            hci_packet_buffer_release_in_transport();
             if (hci_stack->acl_fragmentation_total_size) break;
-            hci_release_packet_buffer();
             
             // L2CAP receives this event via the hci_emit_event below
 
@@ -2191,8 +2402,7 @@ static void event_handler(uint8_t *packet, int size){
                         hci_stack->le_connecting_state = LE_CONNECTING_IDLE;
                         // remove entry
                         if (conn){
-                            btstack_linked_list_remove(&hci_stack->connections, (btstack_linked_item_t *) conn);
-                            btstack_memory_hci_connection_free( conn );
+                            hci_connection_free(conn);
                         }
                         break;
                     }
@@ -2222,7 +2432,7 @@ static void event_handler(uint8_t *packet, int size){
                     
                     conn->state = OPEN;
                     conn->role  = packet[6];
-                    conn->con_handle = little_endian_read_16(packet, 4);
+                    hci_connection_set_con_handle(conn, little_endian_read_16(packet, 4));
                     
                     // TODO: store - role, peer address type, conn_interval, conn_latency, supervision timeout, master clock
 
@@ -2235,6 +2445,25 @@ static void event_handler(uint8_t *packet, int size){
                     hci_emit_nr_connections_changed();
                     break;
 
+                case HCI_SUBEVENT_LE_DATA_LENGTH_CHANGE:
+                    handle = hci_subevent_le_data_length_change_get_connection_handle(packet);
+                    conn = hci_connection_for_handle(handle);
+                    if (!conn) break;
+                    conn->le_max_tx_octets = hci_subevent_le_data_length_change_get_max_tx_octets(packet);
+                    conn->le_max_rx_octets = hci_subevent_le_data_length_change_get_max_rx_octets(packet);
+                    log_info("LE Data Length Change: handle 0x%04x, tx octets %u, rx octets %u", handle, conn->le_max_tx_octets, conn->le_max_rx_octets);
+                    break;
+
+                case HCI_SUBEVENT_LE_PHY_UPDATE_COMPLETE:
+                    handle = hci_subevent_le_phy_update_complete_get_connection_handle(packet);
+                    conn = hci_connection_for_handle(handle);
+                    if (!conn) break;
+                    if (hci_subevent_le_phy_update_complete_get_status(packet)) break;
+                    conn->le_tx_phy = hci_subevent_le_phy_update_complete_get_tx_phy(packet);
+                    conn->le_rx_phy = hci_subevent_le_phy_update_complete_get_rx_phy(packet);
+                    log_info("LE PHY Update Complete: handle 0x%04x, tx phy %u, rx phy %u", handle, conn->le_tx_phy, conn->le_rx_phy);
+                    break;
+
             // log_info("LE buffer size: %u, count %u", little_endian_read_16(packet,6), packet[8]);
                     
                 default:
@@ -2344,6 +2573,10 @@ void hci_register_sco_packet_handler(btstack_packet_handler_t handler){
 static void hci_state_reset(void){
     // no connections yet
     hci_stack->connections = NULL;
+    btstack_hash_map_init(&hci_stack->connection_index, hci_stack->connection_index_storage, HCI_CONNECTION_INDEX_SIZE);
+    hci_stack->acl_packets_sent_classic = 0;
+    hci_stack->acl_packets_sent_le = 0;
+    hci_stack->sco_packets_sent = 0;
 
     // keep discoverable/connectable as this has been requested by the client(s)
     // hci_stack->discoverable = 0;
@@ -2351,8 +2584,8 @@ static void hci_state_reset(void){
     // hci_stack->bondable = 1;
     // hci_stack->own_addr_type = 0;
 
-    // buffer is free
-    hci_stack->hci_packet_buffer_reserved = 0;
+    // buffers are free
+    hci_packet_buffers_reset();
 
     // no pending cmds
     hci_stack->decline_reason = 0;
@@ -2403,7 +2636,7 @@ void hci_init(const hci_transport_t *transport, const void *config){
     hci_stack->config = config;
     
     // setup pointer for outgoing packet buffer
-    hci_stack->hci_packet_buffer = &hci_stack->hci_packet_buffer_data[HCI_OUTGOING_PRE_BUFFER_SIZE];
+    hci_packet_buffers_reset();
 
     // max acl payload size defined in config.h
     hci_stack->acl_data_packet_length = HCI_ACL_PAYLOAD_SIZE;
@@ -2628,7 +2861,7 @@ static int hci_power_control_wake(void){
 static void hci_power_transition_to_initializing(void){
     // set up state machine
     hci_stack->num_cmd_packets = 1; // assume that one cmd can be sent
-    hci_stack->hci_packet_buffer_reserved = 0;
+    hci_packet_buffers_reset();
     hci_stack->state = HCI_STATE_INITIALIZING;
     hci_stack->substate = HCI_INIT_SEND_RESET;
 }
@@ -2838,13 +3071,9 @@ static void hci_host_num_completed_packets(void){
 
     hci_stack->host_completed_packets = 0;
 
+    hci_packet_buffer_handed_to_transport(packet);
     hci_dump_packet(HCI_COMMAND_DATA_PACKET, 0, packet, size);
     hci_stack->hci_transport->send_packet(HCI_COMMAND_DATA_PACKET, packet, size);
-
-    // release packet buffer for synchronous transport implementations    
-    if (hci_transport_synchronous()){
-        hci_stack->hci_packet_buffer_reserved = 0;
-    }
 }
 #endif
 
@@ -2853,21 +3082,13 @@ static void hci_run(void){
     // log_info("hci_run: entered");
     btstack_linked_item_t * it;
 
-    // send continuation fragments first, as they block the prepared packet buffer
-    if (hci_stack->acl_fragmentation_total_size > 0) {
-        hci_con_handle_t con_handle = READ_ACL_CONNECTION_HANDLE(hci_stack->hci_packet_buffer);
-        hci_connection_t *connection = hci_connection_for_handle(con_handle);
-        if (connection) {
-            if (hci_can_send_prepared_acl_packet_now(con_handle)){
-                hci_send_acl_packet_fragments(connection);
-                return;
-            }
-        } else {
-            // connection gone -> discard further fragments
-            log_info("hci_run: fragmented ACL packet no connection -> discard fragment");
-            hci_stack->acl_fragmentation_total_size = 0;
-            hci_stack->acl_fragmentation_pos = 0;
-        }
+    // send queued ACL packets and continuation fragments first, as they block outgoing packet buffers
+    if (hci_stack->acl_packet_queue_len > 0) {
+        uint8_t queue_len = hci_stack->acl_packet_queue_len;
+        uint16_t fragmentation_pos = hci_stack->acl_fragmentation_pos;
+        hci_send_queued_acl_packets();
+        // return if something was sent
+        if (queue_len != hci_stack->acl_packet_queue_len || fragmentation_pos != hci_stack->acl_fragmentation_pos) return;
     }
 
 #ifdef ENABLE_HCI_CONTROLLER_TO_HOST_FLOW_CONTROL
@@ -2947,6 +3168,15 @@ static void hci_run(void){
 #endif
 
 #ifdef ENABLE_BLE
+    // preferred PHY for new connections
+    if (hci_stack->state == HCI_STATE_WORKING && hci_stack->le_default_phy_pending){
+        hci_stack->le_default_phy_pending = 0;
+        if (hci_stack->local_supported_commands[0] & 0x40){
+            hci_send_cmd(&hci_le_set_default_phy, hci_stack->le_default_phy_all_phys, hci_stack->le_default_phy_tx_phys, hci_stack->le_default_phy_rx_phys);
+            return;
+        }
+    }
+
     // advertisements, active scanning, and creating connections requires randaom address to be set if using private address
     if ((hci_stack->state == HCI_STATE_WORKING)
     && (hci_stack->le_own_addr_type == BD_ADDR_TYPE_LE_PUBLIC || hci_stack->le_random_address_set)){
@@ -3256,6 +3486,22 @@ static void hci_run(void){
                 connection->le_conn_interval_max, connection->le_conn_latency, connection->le_supervision_timeout,
                 0x0000, 0xffff);
         }
+
+#ifdef ENABLE_LE_DATA_LENGTH_EXTENSION
+        if (connection->le_data_length_tx_octets){
+            uint16_t tx_octets = connection->le_data_length_tx_octets;
+            connection->le_data_length_tx_octets = 0;
+            hci_send_cmd(&hci_le_set_data_length, connection->con_handle, tx_octets, connection->le_data_length_tx_time);
+            return;
+        }
+#endif
+
+        if (connection->le_phy_update_pending){
+            connection->le_phy_update_pending = 0;
+            hci_send_cmd(&hci_le_set_phy, connection->con_handle, connection->le_phy_update_all_phys,
+                connection->le_phy_update_tx_phys, connection->le_phy_update_rx_phys, connection->le_phy_update_phy_options);
+            return;
+        }
 #endif
     }
     
@@ -3502,14 +3748,12 @@ int hci_send_cmd_packet(uint8_t *packet, int size){
 
     hci_stack->num_cmd_packets--;
 
+    // keep packet buffer until transport is done, release right away for synchronous transport implementations
+    hci_packet_buffer_handed_to_transport(packet);
+
     hci_dump_packet(HCI_COMMAND_DATA_PACKET, 0, packet, size);
     int err = hci_stack->hci_transport->send_packet(HCI_COMMAND_DATA_PACKET, packet, size);
 
-    // release packet buffer for synchronous transport implementations    
-    if (hci_transport_synchronous() && (packet == hci_stack->hci_packet_buffer)){
-        hci_stack->hci_packet_buffer_reserved = 0;
-    }
-
     return err;
 }
 
@@ -4030,8 +4274,7 @@ uint8_t gap_connect_cancel(void){
         case SEND_CREATE_CONNECTION:
             // skip sending create connection and emit event instead
             hci_emit_le_connection_complete(conn->address_type, conn->address, 0, ERROR_CODE_UNKNOWN_CONNECTION_IDENTIFIER);
-            btstack_linked_list_remove(&hci_stack->connections, (btstack_linked_item_t *) conn);
-            btstack_memory_hci_connection_free( conn );
+            hci_connection_free(conn);
             break;            
         case SENT_CREATE_CONNECTION:
             // request to send cancel connection
@@ -4111,6 +4354,101 @@ int gap_request_connection_parameter_update(hci_con_handle_t con_handle, uint16_
     return 0;
 }
 
+#ifdef ENABLE_LE_DATA_LENGTH_EXTENSION
+/**
+ * @brief Request LE Data Length for a given LE connection
+ * @param con_handle
+ * @param tx_octets max number of payload octets in a single LL Data PDU
+ * @param tx_time max time to transmit a single LL Data PDU (unit: us)
+ * @returns 0 if ok
+ */
+int gap_le_set_data_length(hci_con_handle_t con_handle, uint16_t tx_octets, uint16_t tx_time){
+    hci_connection_t * connection = hci_connection_for_handle(con_handle);
+    if (!connection) return ERROR_CODE_UNKNOWN_CONNECTION_IDENTIFIER;
+    if ((hci_stack->local_supported_commands[0] & 0x80) == 0) return ERROR_CODE_UNSUPPORTED_FEATURE_OR_PARAMETER_VALUE;
+    if (tx_octets < LE_DATA_LENGTH_MIN_OCTETS || tx_octets > LE_DATA_LENGTH_MAX_OCTETS) return ERROR_CODE_INVALID_HCI_COMMAND_PARAMETERS;
+    // limit to Controller capabilities, if known
+    if (hci_stack->le_supported_max_tx_octets){
+        tx_octets = btstack_min(tx_octets, hci_stack->le_supported_max_tx_octets);
+        tx_time   = btstack_min(tx_time,   hci_stack->le_supported_max_tx_time);
+    }
+    connection->le_data_length_tx_octets = tx_octets;
+    connection->le_data_length_tx_time   = tx_time;
+    hci_run();
+    return 0;
+}
+#endif
+
+/**
+ * @brief Get LE Data Length in use for a given LE connection
+ * @param con_handle
+ * @param max_tx_octets
+ * @param max_rx_octets
+ * @returns 0 if ok
+ */
+int gap_le_get_data_length(hci_con_handle_t con_handle, uint16_t * max_tx_octets, uint16_t * max_rx_octets){
+    hci_connection_t * connection = hci_connection_for_handle(con_handle);
+    if (!connection) return ERROR_CODE_UNKNOWN_CONNECTION_IDENTIFIER;
+    *max_tx_octets = connection->le_max_tx_octets;
+    *max_rx_octets = connection->le_max_rx_octets;
+    return 0;
+}
+
+/**
+ * @brief Set preferred PHYs for new LE connections
+ * @param all_phys LE_PHY_ALL_PHYS_NO_TX_PREFERENCE and/or LE_PHY_ALL_PHYS_NO_RX_PREFERENCE
+ * @param tx_phys LE_PHY_MASK_1M, LE_PHY_MASK_2M, LE_PHY_MASK_CODED
+ * @param rx_phys LE_PHY_MASK_1M, LE_PHY_MASK_2M, LE_PHY_MASK_CODED
+ * @returns 0 if ok
+ */
+int gap_le_set_default_phy(uint8_t all_phys, uint8_t tx_phys, uint8_t rx_phys){
+    if ((hci_stack->local_supported_commands[0] & 0x40) == 0 && hci_stack->state == HCI_STATE_WORKING) return ERROR_CODE_UNSUPPORTED_FEATURE_OR_PARAMETER_VALUE;
+    hci_stack->le_default_phy_all_phys = all_phys;
+    hci_stack->le_default_phy_tx_phys  = tx_phys;
+    hci_stack->le_default_phy_rx_phys  = rx_phys;
+    hci_stack->le_default_phy_configured = 1;
+    hci_stack->le_default_phy_pending  = 1;
+    hci_run();
+    return 0;
+}
+
+/**
+ * @brief Request PHY update for a given LE connection
+ * @param con_handle
+ * @param all_phys LE_PHY_ALL_PHYS_NO_TX_PREFERENCE and/or LE_PHY_ALL_PHYS_NO_RX_PREFERENCE
+ * @param tx_phys LE_PHY_MASK_1M, LE_PHY_MASK_2M, LE_PHY_MASK_CODED
+ * @param rx_phys LE_PHY_MASK_1M, LE_PHY_MASK_2M, LE_PHY_MASK_CODED
+ * @param phy_options preferred coding on LE Coded PHY
+ * @returns 0 if ok
+ */
+int gap_le_set_phy(hci_con_handle_t con_handle, uint8_t all_phys, uint8_t tx_phys, uint8_t rx_phys, uint16_t phy_options){
+    hci_connection_t * connection = hci_connection_for_handle(con_handle);
+    if (!connection) return ERROR_CODE_UNKNOWN_CONNECTION_IDENTIFIER;
+    if ((hci_stack->local_supported_commands[0] & 0x40) == 0) return ERROR_CODE_UNSUPPORTED_FEATURE_OR_PARAMETER_VALUE;
+    connection->le_phy_update_all_phys    = all_phys;
+    connection->le_phy_update_tx_phys     = tx_phys;
+    connection->le_phy_update_rx_phys     = rx_phys;
+    connection->le_phy_update_phy_options = phy_options;
+    connection->le_phy_update_pending     = 1;
+    hci_run();
+    return 0;
+}
+
+/**
+ * @brief Get PHY in use for a given LE connection
+ * @param con_handle
+ * @param tx_phy LE_PHY_1M, LE_PHY_2M, or LE_PHY_CODED
+ * @param rx_phy LE_PHY_1M, LE_PHY_2M, or LE_PHY_CODED
+ * @returns 0 if ok
+ */
+int gap_le_get_phy(hci_con_handle_t con_handle, uint8_t * tx_phy, uint8_t * rx_phy){
+    hci_connection_t * connection = hci_connection_for_handle(con_handle);
+    if (!connection) return ERROR_CODE_UNKNOWN_CONNECTION_IDENTIFIER;
+    *tx_phy = connection->le_tx_phy;
+    *rx_phy = connection->le_rx_phy;
+    return 0;
+}
+
 #ifdef ENABLE_LE_PERIPHERAL
 
 static void gap_advertisments_changed(void){
@@ -49,6 +49,7 @@
 
 #include "btstack_chipset.h"
 #include "btstack_control.h"
+#include "btstack_hash_map.h"
 #include "btstack_linked_list.h"
 #include "btstack_util.h"
 #include "classic/btstack_link_key_db.h"
@@ -115,6 +116,21 @@ extern "C" {
 #define HCI_OUTGOING_PRE_BUFFER_SIZE 1
 #endif
 
+// number of outgoing packet buffers. With more than one buffer, the next packet can be prepared while the
+// HCI transport is still busy with the previous one, prepared ACL packets are queued for the transport
+#ifndef HCI_OUTGOING_PACKET_BUFFER_NUM
+#define HCI_OUTGOING_PACKET_BUFFER_NUM 1
+#endif
+
+// size of con_handle -> connection index, about twice the max number of connections keeps lookups in O(1)
+#ifndef HCI_CONNECTION_INDEX_SIZE
+#ifdef MAX_NR_HCI_CONNECTIONS
+#define HCI_CONNECTION_INDEX_SIZE (2 * MAX_NR_HCI_CONNECTIONS + 1)
+#else
+#define HCI_CONNECTION_INDEX_SIZE 64
+#endif
+#endif
+
 // BNEP may uncompress the IP Header by 16 bytes
 #ifndef HCI_INCOMING_PRE_BUFFER_SIZE
 #ifdef ENABLE_CLASSIC
@@ -397,6 +413,7 @@ typedef struct sm_connection {
     uint8_t                  sm_role;   // 0 - IamMaster, 1 = IamSlave
     uint8_t                  sm_security_request_received;
     uint8_t                  sm_bonding_requested;
+    uint8_t                  sm_pairing_failed_reason;
     uint8_t                  sm_peer_addr_type;
     bd_addr_t                sm_peer_address;
     security_manager_state_t sm_engine_state;
@@ -420,6 +437,30 @@ typedef struct sm_connection {
 #define ATT_REQUEST_BUFFER_SIZE HCI_ACL_PAYLOAD_SIZE
 #endif
 
+#ifdef ENABLE_LE_SIGNED_WRITE
+// size of ring for Write Commands and Signed Write Commands received during Signed Write validation, in bytes
+#ifndef ATT_SERVER_COMMAND_QUEUE_SIZE
+#define ATT_SERVER_COMMAND_QUEUE_SIZE (2 * ATT_REQUEST_BUFFER_SIZE)
+#endif
+#endif
+
+#ifdef ENABLE_ATT_SERVER_NOTIFICATION_QUEUE
+// number of queued notifications per connection
+#ifndef ATT_SERVER_NOTIFICATION_QUEUE_SIZE
+#define ATT_SERVER_NOTIFICATION_QUEUE_SIZE 4
+#endif
+// max value size of queued notification, longer values are truncated
+#ifndef ATT_SERVER_NOTIFICATION_QUEUE_VALUE_SIZE
+#define ATT_SERVER_NOTIFICATION_QUEUE_VALUE_SIZE (ATT_REQUEST_BUFFER_SIZE - 3)
+#endif
+
+typedef struct {
+    uint16_t attribute_handle;
+    uint16_t value_len;
+    uint8_t  value[ATT_SERVER_NOTIFICATION_QUEUE_VALUE_SIZE];
+} att_server_notification_t;
+#endif
+
 typedef enum {
     ATT_SERVER_IDLE,
     ATT_SERVER_REQUEST_RECEIVED,
@@ -439,11 +480,41 @@ typedef struct {
     int                     value_indication_handle;    
     btstack_timer_source_t  value_indication_timer;
 
+    // Service Changed indications enabled by client, handle range waiting to be indicated
+    uint8_t                 service_changed_indications;
+    uint8_t                 service_changed_pending;
+    uint16_t                service_changed_start_handle;
+    uint16_t                service_changed_end_handle;
+
     att_connection_t        connection;
 
     uint16_t                request_size;
     uint8_t                 request_buffer[ATT_REQUEST_BUFFER_SIZE];
 
+#ifdef ENABLE_LE_SIGNED_WRITE
+    // Signed Write Command in validation: ATT_SERVER_IDLE, ATT_SERVER_REQUEST_RECEIVED or ATT_SERVER_W4_SIGNED_WRITE_VALIDATION
+    att_server_state_t      signed_write_state;
+    uint16_t                command_size;
+    uint8_t                 command_buffer[ATT_REQUEST_BUFFER_SIZE];
+    // commands received during validation, ring buffer of { size (16), pdu }
+    uint8_t                 command_queue[ATT_SERVER_COMMAND_QUEUE_SIZE];
+    uint16_t                command_queue_first;
+    uint16_t                command_queue_len;
+#endif
+
+    // number of received PDUs dropped as server was busy or buffers were full
+    uint32_t                dropped_pdus;
+
+    // clients waiting for can send now on this connection
+    btstack_linked_list_t   can_send_now_clients;
+
+#ifdef ENABLE_ATT_SERVER_NOTIFICATION_QUEUE
+    // notifications waiting for can send now, ring buffer
+    att_server_notification_t notification_queue[ATT_SERVER_NOTIFICATION_QUEUE_SIZE];
+    uint8_t                 notification_queue_first;
+    uint8_t                 notification_queue_len;
+#endif
+
 } att_server_t;
 
 #endif
@@ -524,6 +595,25 @@ typedef struct {
     uint16_t le_supervision_timeout;
 
 #ifdef ENABLE_BLE
+    // LE Data Length in use
+    uint16_t le_max_tx_octets;
+    uint16_t le_max_rx_octets;
+#ifdef ENABLE_LE_DATA_LENGTH_EXTENSION
+    // LE Data Length requested by app, 0 = none
+    uint16_t le_data_length_tx_octets;
+    uint16_t le_data_length_tx_time;
+#endif
+
+    // LE PHY in use
+    uint8_t  le_tx_phy;
+    uint8_t  le_rx_phy;
+    // LE PHY requested by app
+    uint8_t  le_phy_update_pending;
+    uint8_t  le_phy_update_all_phys;
+    uint8_t  le_phy_update_tx_phys;
+    uint8_t  le_phy_update_rx_phys;
+    uint16_t le_phy_update_phy_options;
+
     // LE Security Manager
     sm_connection_t sm_connection;
 
@@ -688,6 +778,10 @@ typedef struct {
     // list of existing baseband connections
     btstack_linked_list_t     connections;
 
+    // index of connections with valid con_handle
+    btstack_hash_map_t        connection_index;
+    btstack_hash_map_entry_t  connection_index_storage[HCI_CONNECTION_INDEX_SIZE];
+
     /* callback to L2CAP layer */
     btstack_packet_handler_t acl_packet_handler;
 
@@ -711,12 +805,22 @@ typedef struct {
     uint8_t            ssp_auto_accept;
     inquiry_mode_t     inquiry_mode;
 
-    // single buffer for HCI packet assembly + additional prebuffer for H4 drivers
+    // buffers for HCI packet assembly + additional prebuffer for H4 drivers
+    // hci_packet_buffer points to the buffer returned by hci_get_outgoing_packet_buffer
     uint8_t   * hci_packet_buffer;
-    uint8_t   hci_packet_buffer_data[HCI_OUTGOING_PRE_BUFFER_SIZE + HCI_PACKET_BUFFER_SIZE];
+    uint8_t   hci_packet_buffer_data[HCI_OUTGOING_PACKET_BUFFER_NUM][HCI_OUTGOING_PRE_BUFFER_SIZE + HCI_PACKET_BUFFER_SIZE];
+    uint8_t   hci_packet_buffer_state[HCI_OUTGOING_PACKET_BUFFER_NUM];
+    uint16_t  hci_packet_buffer_size[HCI_OUTGOING_PACKET_BUFFER_NUM];
     uint8_t   hci_packet_buffer_reserved;
+    int8_t    hci_packet_buffer_in_transport;
+
+    // prepared ACL packets waiting for HCI transport, fragmentation applies to first entry
+    uint8_t   acl_packet_queue[HCI_OUTGOING_PACKET_BUFFER_NUM];
+    uint8_t   acl_packet_queue_len;
     uint16_t  acl_fragmentation_pos;
     uint16_t  acl_fragmentation_total_size;
+    // fragment of first entry handed to asynchronous HCI transport, buffer is in use until HCI_EVENT_TRANSPORT_PACKET_SENT
+    uint8_t   acl_fragment_in_transport;
      
     /* host to controller flow control */
     uint8_t  num_cmd_packets;
@@ -726,6 +830,11 @@ typedef struct {
     uint8_t  sco_data_packet_length;
     uint8_t  synchronous_flow_control_enabled;
     uint8_t  le_acl_packets_total_num;
+
+    // number of packets sent to controller, sum of num_acl_packets_sent/num_sco_packets_sent over all connections
+    uint16_t acl_packets_sent_classic;
+    uint16_t acl_packets_sent_le;
+    uint16_t sco_packets_sent;
     uint16_t le_data_packets_length;
     uint8_t  sco_waiting_for_can_send_now;
 
@@ -739,6 +848,8 @@ typedef struct {
     /* 3 - Write Default Erroneous Data Reporting (Octet 18/bit 3) */
     /* 4 - LE Write Suggested Default Data Length (Octet 34/bit 0) */
     /* 5 - LE Read Maximum Data Length (Octet 35/bit 3) */
+    /* 6 - LE Set PHY (Octet 35/bit 6) */
+    /* 7 - LE Set Data Length (Octet 33/bit 6) */
     uint8_t local_supported_commands[1];
 
     /* bluetooth device information from hci read local version information */
@@ -851,6 +962,15 @@ typedef struct {
     uint16_t le_supported_max_tx_time;
 #endif
 
+#ifdef ENABLE_BLE
+    // LE Default PHY
+    uint8_t  le_default_phy_configured;
+    uint8_t  le_default_phy_pending;
+    uint8_t  le_default_phy_all_phys;
+    uint8_t  le_default_phy_tx_phys;
+    uint8_t  le_default_phy_rx_phys;
+#endif
+
     // custom BD ADDR
     bd_addr_t custom_bd_addr; 
     uint8_t   custom_bd_addr_set;
@@ -1120,6 +1240,11 @@ void hci_disconnect_all(void);
  */
 int hci_number_free_acl_slots_for_handle(hci_con_handle_t con_handle);
 
+/**
+ * Get number of acl packets for given handle that have been sent to controller but not completed yet
+ */
+int hci_number_outgoing_acl_packets_for_handle(hci_con_handle_t con_handle);
+
 /**
  * @brief Set Advertisement Parameters
  * @param adv_int_min
@@ -46,6 +46,7 @@
  */
 
 #include <inttypes.h>
+#include <string.h>
 
 #include "btstack_config.h"
 
@@ -103,6 +104,21 @@ static btstack_timer_source_t ehcill_sleep_ack_timer;
 #error HCI_OUTGOING_PRE_BUFFER_SIZE not defined. Please update hci.h
 #endif
 
+// streaming receive requires that the whole packet is read in one block after a baud rate change on CC256x
+#if defined(ENABLE_H4_STREAMING_RX) && !defined(ENABLE_CC256X_BAUDRATE_CHANGE_FLOWCONTROL_BUG_WORKAROUND)
+#define USE_H4_STREAMING_RX
+#endif
+
+#ifdef USE_H4_STREAMING_RX
+// rx buffer needs to hold at least one full packet, two allow to receive the next packet without moving the current one
+#ifndef HCI_H4_RX_BUFFER_SIZE
+#define HCI_H4_RX_BUFFER_SIZE (2 * (1 + HCI_PACKET_BUFFER_SIZE))
+#endif
+#if HCI_H4_RX_BUFFER_SIZE < (1 + HCI_PACKET_BUFFER_SIZE)
+#error HCI_H4_RX_BUFFER_SIZE too small, needs to hold packet type + HCI_PACKET_BUFFER_SIZE
+#endif
+#endif
+
 static void dummy_handler(uint8_t packet_type, uint8_t *packet, uint16_t size); 
 
 typedef enum {
@@ -147,6 +163,16 @@ static int read_pos;
 static uint8_t hci_packet_with_pre_buffer[HCI_INCOMING_PRE_BUFFER_SIZE + 1 + HCI_PACKET_BUFFER_SIZE]; // packet type + max(acl header + acl payload, event header + event data)
 static uint8_t * hci_packet = &hci_packet_with_pre_buffer[HCI_INCOMING_PRE_BUFFER_SIZE];
 
+#ifdef USE_H4_STREAMING_RX
+// streaming receive: UART driver reads as much as available into rx buffer, packets are framed in place
+// a partial packet at the end of the buffer is moved to the front if the remaining space cannot hold a full packet
+static int      h4_stream_active;
+static uint16_t h4_rx_read_pos;
+static uint16_t h4_rx_write_pos;
+static uint8_t  h4_rx_buffer_with_pre_buffer[HCI_INCOMING_PRE_BUFFER_SIZE + HCI_H4_RX_BUFFER_SIZE];
+static uint8_t * h4_rx_buffer = &h4_rx_buffer_with_pre_buffer[HCI_INCOMING_PRE_BUFFER_SIZE];
+#endif
+
 #ifdef ENABLE_CC256X_BAUDRATE_CHANGE_FLOWCONTROL_BUG_WORKAROUND
 static const uint8_t local_version_event_prefix[] = { 0x04, 0x0e, 0x0c, 0x01, 0x01, 0x10};
 static const uint8_t baud_rate_command_prefix[]   = { 0x01, 0x36, 0xff, 0x04};
@@ -264,6 +290,82 @@ static void hci_transport_h4_block_read(void){
     hci_transport_h4_trigger_next_read();
 }
 
+#ifdef USE_H4_STREAMING_RX
+
+static void hci_transport_h4_stream_trigger_next_read(void){
+    // move partial packet to front if a full packet would not fit into the remaining buffer
+    if (h4_rx_read_pos == h4_rx_write_pos){
+        h4_rx_read_pos  = 0;
+        h4_rx_write_pos = 0;
+    } else if (h4_rx_read_pos + 1 + HCI_PACKET_BUFFER_SIZE > HCI_H4_RX_BUFFER_SIZE){
+        uint16_t partial_len = h4_rx_write_pos - h4_rx_read_pos;
+        memmove(&h4_rx_buffer[0], &h4_rx_buffer[h4_rx_read_pos], partial_len);
+        h4_rx_read_pos  = 0;
+        h4_rx_write_pos = partial_len;
+    }
+    btstack_uart->receive_data(&h4_rx_buffer[h4_rx_write_pos], HCI_H4_RX_BUFFER_SIZE - h4_rx_write_pos);
+}
+
+// @returns size of packet incl. packet type, 0 if header is incomplete
+static uint16_t hci_transport_h4_stream_packet_size(const uint8_t * packet, uint16_t available){
+    switch (packet[0]){
+        case HCI_EVENT_PACKET:
+            if (available < 1 + HCI_EVENT_HEADER_SIZE) return 0;
+            return 1 + HCI_EVENT_HEADER_SIZE + packet[2];
+        case HCI_ACL_DATA_PACKET:
+            if (available < 1 + HCI_ACL_HEADER_SIZE) return 0;
+            return 1 + HCI_ACL_HEADER_SIZE + little_endian_read_16(packet, 3);
+        case HCI_SCO_DATA_PACKET:
+            if (available < 1 + HCI_SCO_HEADER_SIZE) return 0;
+            return 1 + HCI_SCO_HEADER_SIZE + packet[3];
+        default:
+            return 1;
+    }
+}
+
+static void hci_transport_h4_data_received(uint16_t size){
+
+    h4_rx_write_pos += size;
+
+    // deliver all complete packets directly from rx buffer
+    while (h4_rx_read_pos < h4_rx_write_pos){
+        uint8_t * packet   = &h4_rx_buffer[h4_rx_read_pos];
+        uint16_t available = h4_rx_write_pos - h4_rx_read_pos;
+        switch (packet[0]){
+            case HCI_EVENT_PACKET:
+            case HCI_ACL_DATA_PACKET:
+            case HCI_SCO_DATA_PACKET:
+                break;
+#ifdef ENABLE_EHCILL
+            case EHCILL_GO_TO_SLEEP_IND:
+            case EHCILL_GO_TO_SLEEP_ACK:
+            case EHCILL_WAKE_UP_IND:
+            case EHCILL_WAKE_UP_ACK:
+                h4_rx_read_pos++;
+                hci_transport_h4_ehcill_handle_command(packet[0]);
+                continue;
+#endif
+            default:
+                log_error("hci_transport_h4: invalid packet type 0x%02x", packet[0]);
+                h4_rx_read_pos++;
+                continue;
+        }
+        uint16_t packet_size = hci_transport_h4_stream_packet_size(packet, available);
+        if (packet_size == 0) break;
+        if (packet_size > 1 + HCI_PACKET_BUFFER_SIZE){
+            log_error("hci_transport_h4: invalid ACL payload len %d - only space for %u", packet_size - 1 - HCI_ACL_HEADER_SIZE, HCI_PACKET_BUFFER_SIZE - HCI_ACL_HEADER_SIZE);
+            h4_rx_read_pos++;
+            continue;
+        }
+        if (available < packet_size) break;
+        h4_rx_read_pos += packet_size;
+        packet_handler(packet[0], &packet[1], packet_size - 1);
+    }
+
+    hci_transport_h4_stream_trigger_next_read();
+}
+#endif
+
 static void hci_transport_h4_block_sent(void){
     switch (tx_state){
         case TX_W4_PACKET_SENT:
@@ -355,6 +457,15 @@ static void hci_transport_h4_init(const void * transport_config){
     btstack_uart->init(&uart_config);
     btstack_uart->set_block_received(&hci_transport_h4_block_read);
     btstack_uart->set_block_sent(&hci_transport_h4_block_sent);
+
+#ifdef USE_H4_STREAMING_RX
+    // use streaming receive if supported by UART driver, fallback to block reads otherwise
+    h4_stream_active = btstack_uart->receive_data && btstack_uart->set_data_received;
+    if (h4_stream_active){
+        btstack_uart->set_data_received(&hci_transport_h4_data_received);
+    }
+    log_info("hci_transport_h4: streaming receive %u", h4_stream_active);
+#endif
 }
 
 static int hci_transport_h4_open(void){
@@ -362,8 +473,17 @@ static int hci_transport_h4_open(void){
     if (res){
         return res;
     }
-    hci_transport_h4_reset_statemachine();
-    hci_transport_h4_trigger_next_read();
+#ifdef USE_H4_STREAMING_RX
+    if (h4_stream_active){
+        h4_rx_read_pos  = 0;
+        h4_rx_write_pos = 0;
+        hci_transport_h4_stream_trigger_next_read();
+    } else
+#endif
+    {
+        hci_transport_h4_reset_statemachine();
+        hci_transport_h4_trigger_next_read();
+    }
 
     tx_state = TX_IDLE;
 
@@ -46,8 +46,10 @@
  */
 
 #include <inttypes.h>
+#include <string.h>
 
 #include "hci.h"
+#include "btstack_crc16.h"
 #include "btstack_slip.h"
 #include "btstack_debug.h"
 #include "hci_transport.h"
@@ -74,8 +76,17 @@ typedef enum {
 
 } hci_transport_link_actions_t;
 
-// Configuration Field. No packet buffers -> sliding window = 1, no OOF flow control, support data integrity check
-#define LINK_CONFIG_SLIDING_WINDOW_SIZE 1
+// Sliding window size, number of reliable packets that can be sent before an acknowledgement is required.
+// For a window size > 1, outgoing packets are copied into a retransmit queue.
+#ifndef HCI_H5_SLIDING_WINDOW_SIZE
+#define HCI_H5_SLIDING_WINDOW_SIZE 1
+#endif
+#if (HCI_H5_SLIDING_WINDOW_SIZE < 1) || (HCI_H5_SLIDING_WINDOW_SIZE > 7)
+#error "HCI_H5_SLIDING_WINDOW_SIZE must be in range 1..7"
+#endif
+
+// Configuration Field. Sliding window, no OOF flow control, support data integrity check
+#define LINK_CONFIG_SLIDING_WINDOW_SIZE HCI_H5_SLIDING_WINDOW_SIZE
 #define LINK_CONFIG_OOF_FLOW_CONTROL 0
 #define LINK_CONFIG_DATA_INTEGRITY_CHECK 1
 #define LINK_CONFIG_VERSION_NR 0
@@ -94,6 +105,9 @@ typedef enum {
 // max size of write requests
 #define LINK_SLIP_TX_CHUNK_LEN 64
 
+// max size of read requests if UART driver supports streaming receive
+#define LINK_SLIP_RX_CHUNK_LEN 256
+
 // ---
 static const uint8_t link_control_sync[] =   { 0x01, 0x7e};
 static const uint8_t link_control_sync_response[] = { 0x02, 0x7d};
@@ -121,8 +135,9 @@ static int       slip_write_active;
 // H5 Link State
 static hci_transport_link_state_t link_state;
 static btstack_timer_source_t link_timer;
-static uint8_t  link_seq_nr;
+static uint8_t  link_seq_nr;     // seq nr of oldest unacknowledged packet
 static uint8_t  link_ack_nr;
+static uint8_t  link_window_size;
 static uint16_t link_resend_timeout_ms;
 static uint8_t  link_peer_asleep;
 static uint8_t  link_peer_supports_data_integrity_check;
@@ -131,10 +146,23 @@ static uint8_t  link_peer_supports_data_integrity_check;
 static btstack_timer_source_t inactivity_timer;
 static uint16_t link_inactivity_timeout_ms; // auto-sleep if set
 
-// Outgoing packet
-static uint8_t   hci_packet_type;
-static uint16_t  hci_packet_size;
-static uint8_t * hci_packet;
+// Outgoing packets: retransmit queue with up to window size unacknowledged packets
+typedef struct {
+    uint8_t * packet;
+    uint16_t  size;
+    uint8_t   type;
+} hci_transport_link_queue_entry_t;
+
+static hci_transport_link_queue_entry_t link_tx_queue[LINK_CONFIG_SLIDING_WINDOW_SIZE];
+static uint8_t link_tx_queue_first;     // index of oldest unacknowledged packet
+static uint8_t link_tx_queue_len;       // number of unacknowledged packets
+static uint8_t link_tx_queue_sent;      // number of packets in queue sent since last (re-)transmission started
+static uint8_t link_tx_packet_sent_pending; // HCI_EVENT_TRANSPORT_PACKET_SENT not emitted for last packet
+
+#if LINK_CONFIG_SLIDING_WINDOW_SIZE > 1
+// packets are copied to allow upper stack to prepare next packet
+static uint8_t link_tx_buffer[LINK_CONFIG_SLIDING_WINDOW_SIZE][HCI_PACKET_BUFFER_SIZE];
+#endif
 
 // hci packet handler
 static  void (*packet_handler)(uint8_t packet_type, uint8_t *packet, uint16_t size);
@@ -147,6 +175,10 @@ static btstack_uart_config_t uart_config;
 static btstack_uart_sleep_mode_t btstack_uart_sleep_mode;
 static int hci_transport_bcsp_mode;
 
+// streaming receive
+static int     hci_transport_link_stream_active;
+static uint8_t hci_transport_link_read_buffer[LINK_SLIP_RX_CHUNK_LEN];
+
 // Prototypes
 static void hci_transport_h5_process_frame(uint16_t frame_size);
 static int  hci_transport_link_have_outgoing_packet(void);
@@ -157,41 +189,18 @@ static void hci_transport_link_run(void);
 static void hci_transport_slip_init(void);
 
 // -----------------------------
-// CRC16-CCITT Calculation - compromise: use 32 byte table - 512 byte table would be faster, but that's too large
-
-static const uint16_t crc16_ccitt_table[] ={
-    0x0000, 0x1081, 0x2102, 0x3183,
-    0x4204, 0x5285, 0x6306, 0x7387,
-    0x8408, 0x9489, 0xa50a, 0xb58b,
-    0xc60c, 0xd68d, 0xe70e, 0xf78f
-};
-
-static uint16_t crc16_ccitt_update (uint16_t crc, uint8_t ch){
-    crc = (crc >> 4) ^ crc16_ccitt_table[(crc ^ ch) & 0x000f];
-    crc = (crc >> 4) ^ crc16_ccitt_table[(crc ^ (ch >> 4)) & 0x000f];
-    return crc;
-}
+// CRC16-CCITT Calculation, see btstack_crc16.c
 
 static uint16_t btstack_reverse_bits_16(uint16_t value){
-    int reverse = 0;
-    int i;
-    for (i = 0; i < 16; i++) { 
-        reverse = reverse << 1;
-        reverse |= value & 1;
-        value = value >> 1;
-    }
-    return reverse;
+    value = ((value >> 1) & 0x5555) | ((value & 0x5555) << 1);
+    value = ((value >> 2) & 0x3333) | ((value & 0x3333) << 2);
+    value = ((value >> 4) & 0x0f0f) | ((value & 0x0f0f) << 4);
+    return (value >> 8) | (value << 8);
 }
 
 static uint16_t crc16_calc_for_slip_frame(const uint8_t * header, const uint8_t * payload, uint16_t len){
-    int i;
-    uint16_t crc = 0xffff;
-    for (i=0 ; i < 4 ; i++){
-        crc = crc16_ccitt_update(crc, header[i]);
-    }
-    for (i=0 ; i < len ; i++){
-        crc = crc16_ccitt_update(crc, payload[i]);
-    }
+    uint16_t crc = btstack_crc16_ccitt_update(0xffff, header, 4);
+    crc = btstack_crc16_ccitt_update(crc, payload, len);
     return btstack_reverse_bits_16(crc);
 }
 
@@ -347,19 +356,32 @@ static void hci_transport_link_send_sleep(void){
     hci_transport_link_send_control(link_control_sleep, sizeof(link_control_sleep));
 }
 
+static int hci_transport_link_inc_seq_nr(int seq_nr){
+    return (seq_nr + 1) & 0x07;    
+}
+
+static int hci_transport_link_have_unsent_packet(void){
+    return link_tx_queue_sent < link_tx_queue_len;
+}
+
+// send next packet from retransmit queue
 static void hci_transport_link_send_queued_packet(void){
 
+    hci_transport_link_queue_entry_t * entry = &link_tx_queue[(link_tx_queue_first + link_tx_queue_sent) % LINK_CONFIG_SLIDING_WINDOW_SIZE];
+    uint8_t seq_nr = (link_seq_nr + link_tx_queue_sent) & 0x07;
+    link_tx_queue_sent++;
+
     uint8_t header[4];
-    hci_transport_link_calc_header(header, link_seq_nr, link_ack_nr, link_peer_supports_data_integrity_check, 1, hci_packet_type, hci_packet_size);
+    hci_transport_link_calc_header(header, seq_nr, link_ack_nr, link_peer_supports_data_integrity_check, 1, entry->type, entry->size);
 
     uint16_t data_integrity_check = 0;
     if (link_peer_supports_data_integrity_check){
-        data_integrity_check = crc16_calc_for_slip_frame(header, hci_packet, hci_packet_size);
+        data_integrity_check = crc16_calc_for_slip_frame(header, entry->packet, entry->size);
     }
-    log_debug("hci_transport_link_send_queued_packet: seq %u, ack %u, size %u. Append dic %u, dic = 0x%04x", link_seq_nr, link_ack_nr, hci_packet_size, link_peer_supports_data_integrity_check, data_integrity_check);
-    log_debug_hexdump(hci_packet, hci_packet_size);
+    log_debug("hci_transport_link_send_queued_packet: seq %u, ack %u, size %u. Append dic %u, dic = 0x%04x", seq_nr, link_ack_nr, entry->size, link_peer_supports_data_integrity_check, data_integrity_check);
+    log_debug_hexdump(entry->packet, entry->size);
 
-    hci_transport_slip_send_frame(header, hci_packet, hci_packet_size, data_integrity_check);
+    hci_transport_slip_send_frame(header, entry->packet, entry->size, data_integrity_check);
 
     // reset inactvitiy timer
     hci_transport_inactivity_timer_set();
@@ -414,7 +436,15 @@ static void hci_transport_link_run(void){
         return;
     }
     if (hci_transport_link_actions & HCI_TRANSPORT_LINK_SEND_QUEUED_PACKET){
-        hci_transport_link_actions &= ~HCI_TRANSPORT_LINK_SEND_QUEUED_PACKET;
+        if (!hci_transport_link_have_unsent_packet()){
+            hci_transport_link_actions &= ~HCI_TRANSPORT_LINK_SEND_QUEUED_PACKET;
+        }
+    }
+    if (hci_transport_link_actions & HCI_TRANSPORT_LINK_SEND_QUEUED_PACKET){
+        // keep sending until all packets in window have been sent
+        if (link_tx_queue_sent + 1 >= link_tx_queue_len){
+            hci_transport_link_actions &= ~HCI_TRANSPORT_LINK_SEND_QUEUED_PACKET;
+        }
         // packet already contains ack, no need to send addtitional one
         hci_transport_link_actions &= ~HCI_TRANSPORT_LINK_SEND_ACK_PACKET;
         hci_transport_link_send_queued_packet();
@@ -437,6 +467,7 @@ static void hci_transport_link_run(void){
 static void hci_transport_link_set_timer(uint16_t timeout_ms){
     btstack_run_loop_set_timer_handler(&link_timer, &hci_transport_link_timeout_handler);
     btstack_run_loop_set_timer(&link_timer, timeout_ms);
+    btstack_run_loop_remove_timer(&link_timer);
     btstack_run_loop_add_timer(&link_timer);
 }
 
@@ -460,7 +491,9 @@ static void hci_transport_link_timeout_handler(btstack_timer_source_t * timer){
                 hci_transport_link_set_timer(LINK_WAKEUP_MS);
                 return;
             }
-            // resend packet
+            // resend all unacknowledged packets
+            log_info("h5 resend %u packet(s) starting with seq %u", link_tx_queue_len, link_seq_nr);
+            link_tx_queue_sent = 0;
             hci_transport_link_actions |= HCI_TRANSPORT_LINK_SEND_QUEUED_PACKET;
             hci_transport_link_set_timer(link_resend_timeout_ms);
             break;
@@ -475,6 +508,7 @@ static void hci_transport_link_init(void){
     link_state = LINK_UNINITIALIZED;
     link_peer_asleep = 0;
     link_peer_supports_data_integrity_check = 0;
+    link_window_size = 1;
  
     // get started
     hci_transport_link_actions |= HCI_TRANSPORT_LINK_SEND_SYNC;
@@ -482,23 +516,47 @@ static void hci_transport_link_init(void){
     hci_transport_link_run();
 }
 
-static int hci_transport_link_inc_seq_nr(int seq_nr){
-    return (seq_nr + 1) & 0x07;    
-}
-
 static int hci_transport_link_have_outgoing_packet(void){
-    return hci_packet != 0;
+    return link_tx_queue_len > 0;
 }
 
 static void hci_transport_link_clear_queue(void){
     btstack_run_loop_remove_timer(&link_timer);
-    hci_packet = NULL;
+    link_tx_queue_first = 0;
+    link_tx_queue_len   = 0;
+    link_tx_queue_sent  = 0;
+    link_tx_packet_sent_pending = 0;
 }
 
 static void hci_transport_h5_queue_packet(uint8_t packet_type, uint8_t *packet, int size){
-    hci_packet = packet;
-    hci_packet_type = packet_type;
-    hci_packet_size = size;
+    hci_transport_link_queue_entry_t * entry = &link_tx_queue[(link_tx_queue_first + link_tx_queue_len) % LINK_CONFIG_SLIDING_WINDOW_SIZE];
+#if LINK_CONFIG_SLIDING_WINDOW_SIZE > 1
+    uint8_t * buffer = link_tx_buffer[(link_tx_queue_first + link_tx_queue_len) % LINK_CONFIG_SLIDING_WINDOW_SIZE];
+    memcpy(buffer, packet, size);
+    entry->packet = buffer;
+#else
+    entry->packet = packet;
+#endif
+    entry->type = packet_type;
+    entry->size = size;
+    link_tx_queue_len++;
+    link_tx_packet_sent_pending = 1;
+}
+
+// remove packets acknowledged by peer from queue. @returns number of acknowledged packets
+static int hci_transport_link_process_ack(uint8_t ack_nr){
+    int num_acked = (ack_nr - link_seq_nr) & 0x07;
+    if (num_acked == 0 || num_acked > link_tx_queue_len) return 0;
+    log_debug("%u outgoing packet(s) starting with seq %u ack'ed", num_acked, link_seq_nr);
+    link_seq_nr = ack_nr;
+    link_tx_queue_first = (link_tx_queue_first + num_acked) % LINK_CONFIG_SLIDING_WINDOW_SIZE;
+    link_tx_queue_len  -= num_acked;
+    if (link_tx_queue_sent > num_acked){
+        link_tx_queue_sent -= num_acked;
+    } else {
+        link_tx_queue_sent = 0;
+    }
+    return num_acked;
 }
 
 static void hci_transport_h5_emit_sleep_state(int sleep_active){
@@ -514,6 +572,17 @@ static void hci_transport_h5_emit_sleep_state(int sleep_active){
     packet_handler(HCI_EVENT_PACKET, &event[0], sizeof(event));        
 }
 
+// notify upper stack that it can send again, packet buffer can be reused if it was copied or acknowledged
+static void hci_transport_h5_emit_packet_sent_if_ready(void){
+    if (!link_tx_packet_sent_pending) return;
+    if (slip_write_active) return;
+    if (link_tx_queue_len >= link_window_size) return;
+    if (hci_transport_link_have_unsent_packet()) return;
+    link_tx_packet_sent_pending = 0;
+    uint8_t event[] = { HCI_EVENT_TRANSPORT_PACKET_SENT, 0};
+    packet_handler(HCI_EVENT_PACKET, &event[0], sizeof(event));
+}
+
 static void hci_transport_h5_process_frame(uint16_t frame_size){
 
     if (frame_size < 4) return;
@@ -606,13 +675,22 @@ static void hci_transport_h5_process_frame(uint16_t frame_size){
             if (memcmp(slip_payload, link_control_config_response, link_control_config_response_prefix_len) == 0){
                 uint8_t config = slip_payload[2];
                 link_peer_supports_data_integrity_check = (config & 0x10) != 0;
-                log_info("link received config response 0x%02x, data integrity check supported %u", config, link_peer_supports_data_integrity_check);
+                // use smaller sliding window, config field missing -> window size 1
+                link_window_size = 1;
+                if (link_payload_len > link_control_config_response_prefix_len){
+                    link_window_size = btstack_min(config & 0x07, LINK_CONFIG_SLIDING_WINDOW_SIZE);
+                    if (link_window_size == 0){
+                        link_window_size = 1;
+                    }
+                }
+                log_info("link received config response 0x%02x, data integrity check supported %u, sliding window %u", config, link_peer_supports_data_integrity_check, link_window_size);
                 link_state = LINK_ACTIVE;
                 btstack_run_loop_remove_timer(&link_timer);
                 log_info("link activated");
                 // 
                 link_seq_nr = 0;
                 link_ack_nr = 0;
+                hci_transport_link_clear_queue();
                 // notify upper stack that it can start
                 uint8_t event[] = { HCI_EVENT_TRANSPORT_PACKET_SENT, 0};
                 packet_handler(HCI_EVENT_PACKET, &event[0], sizeof(event));
@@ -635,16 +713,13 @@ static void hci_transport_h5_process_frame(uint16_t frame_size){
 
             // Process ACKs in reliable packet and explicit ack packets
             if (reliable_packet || link_packet_type == LINK_ACKNOWLEDGEMENT_TYPE){
-                // our packet is good if the remote expects our seq nr + 1
-                int next_seq_nr = hci_transport_link_inc_seq_nr(link_seq_nr);
-                if (hci_transport_link_have_outgoing_packet() && next_seq_nr == ack_nr){
-                    log_debug("outoing packet with seq %u ack'ed", link_seq_nr);
-                    link_seq_nr = next_seq_nr;
-                    hci_transport_link_clear_queue();
-
-                    // notify upper stack that it can send again
-                    uint8_t event[] = { HCI_EVENT_TRANSPORT_PACKET_SENT, 0};
-                    packet_handler(HCI_EVENT_PACKET, &event[0], sizeof(event));
+                // our packets are good up to the seq nr the remote expects next
+                if (hci_transport_link_process_ack(ack_nr)){
+                    btstack_run_loop_remove_timer(&link_timer);
+                    if (hci_transport_link_have_outgoing_packet()){
+                        hci_transport_link_set_timer(link_resend_timeout_ms);
+                    }
+                    hci_transport_h5_emit_packet_sent_if_ready();
                 }
             } 
 
@@ -730,16 +805,32 @@ static void hci_transport_link_update_resend_timeout(uint32_t baudrate){
 static uint8_t hci_transport_link_read_byte;
 
 static void hci_transport_h5_read_next_byte(void){
+    if (hci_transport_link_stream_active){
+        btstack_uart->receive_data(hci_transport_link_read_buffer, sizeof(hci_transport_link_read_buffer));
+        return;
+    }
     btstack_uart->receive_block(&hci_transport_link_read_byte, 1);    
 }
 
-static void hci_transport_h5_block_received(){
-    btstack_slip_decoder_process(hci_transport_link_read_byte);
+static void hci_transport_h5_process_byte(uint8_t input){
+    btstack_slip_decoder_process(input);
     uint16_t frame_size = btstack_slip_decoder_frame_size();
     if (frame_size) {
         hci_transport_h5_process_frame(frame_size);
         hci_transport_slip_init();
     }
+}
+
+static void hci_transport_h5_block_received(){
+    hci_transport_h5_process_byte(hci_transport_link_read_byte);
+    hci_transport_h5_read_next_byte();
+}
+
+static void hci_transport_h5_data_received(uint16_t size){
+    uint16_t i;
+    for (i=0;i<size;i++){
+        hci_transport_h5_process_byte(hci_transport_link_read_buffer[i]);
+    }
     hci_transport_h5_read_next_byte();
 }
 
@@ -754,6 +845,9 @@ static void hci_transport_h5_block_sent(void){
     // done
     slip_write_active = 0;
 
+    // packet copied into retransmit queue and sent, upper stack can prepare next one if window not full
+    hci_transport_h5_emit_packet_sent_if_ready();
+
     // enter sleep mode after sending sleep message
     if (hci_transport_link_actions & HCI_TRANSPORT_LINK_ENTER_SLEEP){
         hci_transport_link_actions &= ~HCI_TRANSPORT_LINK_ENTER_SLEEP;
@@ -790,6 +884,12 @@ static void hci_transport_h5_init(const void * transport_config){
     btstack_uart->init(&uart_config);
     btstack_uart->set_block_received(&hci_transport_h5_block_received);
     btstack_uart->set_block_sent(&hci_transport_h5_block_sent);
+
+    // use streaming receive if supported by UART driver
+    hci_transport_link_stream_active = btstack_uart->receive_data && btstack_uart->set_data_received;
+    if (hci_transport_link_stream_active){
+        btstack_uart->set_data_received(&hci_transport_h5_data_received);
+    }
 }
 
 static int hci_transport_h5_open(void){
@@ -841,7 +941,7 @@ static void hci_transport_h5_register_packet_handler(void (*handler)(uint8_t pac
 }
 
 static int hci_transport_h5_can_send_packet_now(uint8_t packet_type){
-    int res = !hci_transport_link_have_outgoing_packet() && link_state == LINK_ACTIVE;
+    int res = link_state == LINK_ACTIVE && !link_tx_packet_sent_pending && link_tx_queue_len < link_window_size;
     // log_info("can_send_packet_now: %u", res);
     return res;
 }
@@ -866,7 +966,10 @@ static int hci_transport_h5_send_packet(uint8_t packet_type, uint8_t *packet, in
         hci_transport_link_set_timer(LINK_WAKEUP_MS);
     } else {
         hci_transport_link_actions |= HCI_TRANSPORT_LINK_SEND_QUEUED_PACKET;
-        hci_transport_link_set_timer(link_resend_timeout_ms);
+        // resend timer runs for oldest unacknowledged packet
+        if (link_tx_queue_len == 1){
+            hci_transport_link_set_timer(link_resend_timeout_ms);
+        }
     }
     hci_transport_link_run();
     return 0;
@@ -49,8 +49,10 @@
 #include "hci.h"
 #include "hci_dump.h"
 #include "bluetooth_sdp.h"
+#include "btstack_crc16.h"
 #include "btstack_debug.h"
 #include "btstack_event.h"
+#include "btstack_hash_map.h"
 #include "btstack_memory.h"
 
 #ifdef ENABLE_LE_DATA_CHANNELS
@@ -68,6 +70,13 @@
 // used to cache l2cap rejects, echo, and informational requests
 #define NR_PENDING_SIGNALING_RESPONSES 3
 
+// size of local cid -> channel index
+#ifdef MAX_NR_L2CAP_CHANNELS
+#define L2CAP_CHANNEL_INDEX_SIZE (2 * MAX_NR_L2CAP_CHANNELS + 1)
+#else
+#define L2CAP_CHANNEL_INDEX_SIZE 32
+#endif
+
 // nr of credits provided to remote if credits fall below watermark
 #define L2CAP_LE_DATA_CHANNELS_AUTOMATIC_CREDITS_WATERMARK 5
 #define L2CAP_LE_DATA_CHANNELS_AUTOMATIC_CREDITS_INCREMENT 5
@@ -103,12 +112,15 @@ static void l2cap_emit_channel_opened(l2cap_channel_t *channel, uint8_t status);
 static void l2cap_emit_channel_closed(l2cap_channel_t *channel);
 static void l2cap_emit_incoming_connection(l2cap_channel_t *channel);
 static int  l2cap_channel_ready_for_open(l2cap_channel_t *channel);
+static void l2cap_channel_list_add(l2cap_channel_t * channel);
+static void l2cap_channel_list_remove(l2cap_channel_t * channel);
 #endif
 #ifdef ENABLE_LE_DATA_CHANNELS
 static void l2cap_emit_le_channel_opened(l2cap_channel_t *channel, uint8_t status);
 static void l2cap_emit_le_incoming_connection(l2cap_channel_t *channel);
 static l2cap_channel_t * l2cap_le_get_channel_for_local_cid(uint16_t local_cid);
 static void l2cap_le_notify_channel_can_send(l2cap_channel_t *channel);
+static uint16_t l2cap_le_local_mps(l2cap_channel_t *channel);
 static void l2cap_le_finialize_channel_close(l2cap_channel_t *channel);
 static inline l2cap_service_t * l2cap_le_get_service(uint16_t psm);
 #endif
@@ -131,6 +143,8 @@ typedef struct l2cap_fixed_channel {
 
 #ifdef ENABLE_CLASSIC
 static btstack_linked_list_t l2cap_channels;
+static btstack_hash_map_t    l2cap_channel_index;
+static btstack_hash_map_entry_t l2cap_channel_index_storage[L2CAP_CHANNEL_INDEX_SIZE];
 static btstack_linked_list_t l2cap_services;
 static uint8_t require_security_level2_for_outgoing_sdp;
 #endif
@@ -154,34 +168,8 @@ static btstack_packet_handler_t l2cap_event_packet_handler;
 
 #ifdef ENABLE_L2CAP_ENHANCED_RETRANSMISSION_MODE
 
-/*
- * CRC lookup table for generator polynom D^16 + D^15 + D^2 + 1
- */
-static const uint16_t crc16_table[256] = {
-    0x0000, 0xc0c1, 0xc181, 0x0140, 0xc301, 0x03c0, 0x0280, 0xc241, 0xc601, 0x06c0, 0x0780, 0xc741, 0x0500, 0xc5c1, 0xc481, 0x0440,
-    0xcc01, 0x0cc0, 0x0d80, 0xcd41, 0x0f00, 0xcfc1, 0xce81, 0x0e40, 0x0a00, 0xcac1, 0xcb81, 0x0b40, 0xc901, 0x09c0, 0x0880, 0xc841,
-    0xd801, 0x18c0, 0x1980, 0xd941, 0x1b00, 0xdbc1, 0xda81, 0x1a40, 0x1e00, 0xdec1, 0xdf81, 0x1f40, 0xdd01, 0x1dc0, 0x1c80, 0xdc41,
-    0x1400, 0xd4c1, 0xd581, 0x1540, 0xd701, 0x17c0, 0x1680, 0xd641, 0xd201, 0x12c0, 0x1380, 0xd341, 0x1100, 0xd1c1, 0xd081, 0x1040,
-    0xf001, 0x30c0, 0x3180, 0xf141, 0x3300, 0xf3c1, 0xf281, 0x3240, 0x3600, 0xf6c1, 0xf781, 0x3740, 0xf501, 0x35c0, 0x3480, 0xf441,
-    0x3c00, 0xfcc1, 0xfd81, 0x3d40, 0xff01, 0x3fc0, 0x3e80, 0xfe41, 0xfa01, 0x3ac0, 0x3b80, 0xfb41, 0x3900, 0xf9c1, 0xf881, 0x3840,
-    0x2800, 0xe8c1, 0xe981, 0x2940, 0xeb01, 0x2bc0, 0x2a80, 0xea41, 0xee01, 0x2ec0, 0x2f80, 0xef41, 0x2d00, 0xedc1, 0xec81, 0x2c40,
-    0xe401, 0x24c0, 0x2580, 0xe541, 0x2700, 0xe7c1, 0xe681, 0x2640, 0x2200, 0xe2c1, 0xe381, 0x2340, 0xe101, 0x21c0, 0x2080, 0xe041,
-    0xa001, 0x60c0, 0x6180, 0xa141, 0x6300, 0xa3c1, 0xa281, 0x6240, 0x6600, 0xa6c1, 0xa781, 0x6740, 0xa501, 0x65c0, 0x6480, 0xa441,
-    0x6c00, 0xacc1, 0xad81, 0x6d40, 0xaf01, 0x6fc0, 0x6e80, 0xae41, 0xaa01, 0x6ac0, 0x6b80, 0xab41, 0x6900, 0xa9c1, 0xa881, 0x6840,
-    0x7800, 0xb8c1, 0xb981, 0x7940, 0xbb01, 0x7bc0, 0x7a80, 0xba41, 0xbe01, 0x7ec0, 0x7f80, 0xbf41, 0x7d00, 0xbdc1, 0xbc81, 0x7c40,
-    0xb401, 0x74c0, 0x7580, 0xb541, 0x7700, 0xb7c1, 0xb681, 0x7640, 0x7200, 0xb2c1, 0xb381, 0x7340, 0xb101, 0x71c0, 0x7080, 0xb041,
-    0x5000, 0x90c1, 0x9181, 0x5140, 0x9301, 0x53c0, 0x5280, 0x9241, 0x9601, 0x56c0, 0x5780, 0x9741, 0x5500, 0x95c1, 0x9481, 0x5440,
-    0x9c01, 0x5cc0, 0x5d80, 0x9d41, 0x5f00, 0x9fc1, 0x9e81, 0x5e40, 0x5a00, 0x9ac1, 0x9b81, 0x5b40, 0x9901, 0x59c0, 0x5880, 0x9841,
-    0x8801, 0x48c0, 0x4980, 0x8941, 0x4b00, 0x8bc1, 0x8a81, 0x4a40, 0x4e00, 0x8ec1, 0x8f81, 0x4f40, 0x8d01, 0x4dc0, 0x4c80, 0x8c41,
-    0x4400, 0x84c1, 0x8581, 0x4540, 0x8701, 0x47c0, 0x4680, 0x8641, 0x8201, 0x42c0, 0x4380, 0x8341, 0x4100, 0x81c1, 0x8081, 0x4040, 
-};
-
 static uint16_t crc16_calc(uint8_t * data, uint16_t len){
-    uint16_t crc = 0;   // initial value = 0 
-    while (len--){
-        crc = (crc >> 8) ^ crc16_table[ (crc ^ ((uint16_t) *data++)) & 0x00FF ];
-    }
-    return crc;
+    return btstack_crc16_ibm_update(0, data, len);   // initial value = 0
 }
 
 static inline uint16_t l2cap_encanced_control_field_for_information_frame(uint8_t tx_seq, int final, uint8_t req_seq, l2cap_segmentation_and_reassembly_t sar){
@@ -477,7 +465,7 @@ uint8_t l2cap_create_ertm_channel(btstack_packet_handler_t packet_handler, bd_ad
     l2cap_ertm_configure_channel(channel, ertm_config, buffer, size);
 
     // add to connections list
-    btstack_linked_list_add(&l2cap_channels, (btstack_linked_item_t *) channel);
+    l2cap_channel_list_add(channel);
 
     // store local_cid
     if (out_local_cid){
@@ -693,6 +681,7 @@ void l2cap_init(void){
     
 #ifdef ENABLE_CLASSIC
     l2cap_channels = NULL;
+    btstack_hash_map_init(&l2cap_channel_index, l2cap_channel_index_storage, L2CAP_CHANNEL_INDEX_SIZE);
     l2cap_services = NULL;
     require_security_level2_for_outgoing_sdp = 0;
 #endif
@@ -870,7 +859,27 @@ static void l2cap_emit_incoming_connection(l2cap_channel_t *channel) {
     l2cap_dispatch_to_channel(channel, HCI_EVENT_PACKET, event, sizeof(event));
 }
 
+// add to channel list and local cid index
+static void l2cap_channel_list_add(l2cap_channel_t * channel){
+    btstack_linked_list_add(&l2cap_channels, (btstack_linked_item_t *) channel);
+    btstack_hash_map_put(&l2cap_channel_index, channel->local_cid, channel);
+}
+
+static void l2cap_channel_index_remove(l2cap_channel_t * channel){
+    btstack_hash_map_remove(&l2cap_channel_index, channel->local_cid);
+}
+
+// remove from channel list and local cid index
+static void l2cap_channel_list_remove(l2cap_channel_t * channel){
+    l2cap_channel_index_remove(channel);
+    btstack_linked_list_remove(&l2cap_channels, (btstack_linked_item_t *) channel);
+}
+
 static l2cap_channel_t * l2cap_get_channel_for_local_cid(uint16_t local_cid){
+    l2cap_channel_t * channel = (l2cap_channel_t *) btstack_hash_map_get(&l2cap_channel_index, local_cid);
+    if (channel) return channel;
+    // not all channels could be indexed, fall back to linear search
+    if (btstack_hash_map_complete(&l2cap_channel_index)) return NULL;
     btstack_linked_list_iterator_t it;    
     btstack_linked_list_iterator_init(&it, &l2cap_channels);
     while (btstack_linked_list_iterator_has_next(&it)){
@@ -952,7 +961,7 @@ static void l2cap_rtx_timeout(btstack_timer_source_t * ts){
 
     // discard channel
     // no need to stop timer here, it is removed from list during timer callback
-    btstack_linked_list_remove(&l2cap_channels, (btstack_linked_item_t *) channel);
+    l2cap_channel_list_remove(channel);
     btstack_memory_l2cap_channel_free(channel);
 }
 
@@ -1288,6 +1297,7 @@ static void l2cap_run(void){
                 l2cap_send_signaling_packet(channel->con_handle, CONNECTION_RESPONSE, channel->remote_sig_id, channel->local_cid, channel->remote_cid, channel->reason, 0);
                 // discard channel - l2cap_finialize_channel_close without sending l2cap close event
                 l2cap_stop_rtx(channel);
+                l2cap_channel_index_remove(channel);
                 btstack_linked_list_iterator_remove(&it);
                 btstack_memory_l2cap_channel_free(channel); 
                 break;
@@ -1468,15 +1478,14 @@ static void l2cap_run(void){
                 channel->local_sig_id = l2cap_next_sig_id();
                 channel->credits_incoming =  channel->new_credits_incoming;
                 channel->new_credits_incoming = 0;
-                l2cap_send_le_signaling_packet( channel->con_handle, LE_CREDIT_BASED_CONNECTION_REQUEST, channel->local_sig_id, channel->psm, channel->local_cid, channel->local_mtu, 23, channel->credits_incoming);
+                l2cap_send_le_signaling_packet( channel->con_handle, LE_CREDIT_BASED_CONNECTION_REQUEST, channel->local_sig_id, channel->psm, channel->local_cid, channel->local_mtu, l2cap_le_local_mps(channel), channel->credits_incoming);
                 break;
             case L2CAP_STATE_WILL_SEND_LE_CONNECTION_RESPONSE_ACCEPT:
                 if (!hci_can_send_acl_packet_now(channel->con_handle)) break;
-                // TODO: support larger MPS
                 channel->state = L2CAP_STATE_OPEN;
                 channel->credits_incoming =  channel->new_credits_incoming;
                 channel->new_credits_incoming = 0;
-                l2cap_send_le_signaling_packet(channel->con_handle, LE_CREDIT_BASED_CONNECTION_RESPONSE, channel->remote_sig_id, channel->local_cid, channel->local_mtu, 23, channel->credits_incoming, 0);
+                l2cap_send_le_signaling_packet(channel->con_handle, LE_CREDIT_BASED_CONNECTION_RESPONSE, channel->remote_sig_id, channel->local_cid, channel->local_mtu, l2cap_le_local_mps(channel), channel->credits_incoming, 0);
                 // notify client
                 l2cap_emit_le_channel_opened(channel, 0);
                 break;                       
@@ -1518,7 +1527,8 @@ static void l2cap_run(void){
                     little_endian_store_16(l2cap_payload, pos, channel->send_sdu_len);
                     pos += 2;
                 }
-                payload_size = btstack_min(channel->send_sdu_len + 2 - channel->send_sdu_pos, channel->remote_mps - pos);
+                // K-frame limited by remote MPS and outgoing buffer, Controller fragments it into LL PDUs of negotiated data length
+                payload_size = btstack_min(channel->send_sdu_len + 2 - channel->send_sdu_pos, btstack_min(channel->remote_mps, l2cap_max_le_mtu()) - pos);
                 log_info("len %u, pos %u => payload %u, credits %u", channel->send_sdu_len, channel->send_sdu_pos, payload_size, channel->credits_outgoing);
                 memcpy(&l2cap_payload[pos], &channel->send_sdu_buffer[channel->send_sdu_pos-2], payload_size); // -2 for virtual SDU len
                 pos += payload_size;
@@ -1691,7 +1701,7 @@ uint8_t l2cap_create_channel(btstack_packet_handler_t channel_packet_handler, bd
 #endif    
 
     // add to connections list
-    btstack_linked_list_add(&l2cap_channels, (btstack_linked_item_t *) channel);
+    l2cap_channel_list_add(channel);
 
     // store local_cid
     if (out_local_cid){
@@ -1740,6 +1750,7 @@ static void l2cap_handle_connection_failed_for_addr(bd_addr_t address, uint8_t s
                 l2cap_emit_channel_opened(channel, status);
                 // discard channel
                 l2cap_stop_rtx(channel);
+                l2cap_channel_index_remove(channel);
                 btstack_linked_list_iterator_remove(&it);
                 btstack_memory_l2cap_channel_free(channel);
                 break;
@@ -1913,6 +1924,7 @@ static void l2cap_hci_event_handler(uint8_t packet_type, uint16_t cid, uint8_t *
             while (btstack_linked_list_iterator_has_next(&it)){
                 l2cap_channel_t * channel = (l2cap_channel_t *) btstack_linked_list_iterator_next(&it);
                 if (channel->con_handle != handle) continue;
+                l2cap_channel_index_remove(channel);
                 btstack_linked_list_iterator_remove(&it);
                 l2cap_stop_rtx(channel);
                 l2cap_handle_hci_disconnect_event(channel);
@@ -2075,7 +2087,7 @@ static void l2cap_handle_connection_request(hci_con_handle_t handle, uint8_t sig
     channel->state_var  = (L2CAP_CHANNEL_STATE_VAR) (L2CAP_CHANNEL_STATE_VAR_SEND_CONN_RESP_PEND | L2CAP_CHANNEL_STATE_VAR_INCOMING);
     
     // add to connections list
-    btstack_linked_list_add(&l2cap_channels, (btstack_linked_item_t *) channel);
+    l2cap_channel_list_add(channel);
 
     // assert security requirements
     gap_request_security_level(handle, channel->required_security_level);
@@ -2327,7 +2339,7 @@ static void l2cap_signaling_handler_channel(l2cap_channel_t *channel, uint8_t *c
                             }
                             
                             // discard channel
-                            btstack_linked_list_remove(&l2cap_channels, (btstack_linked_item_t *) channel);
+                            l2cap_channel_list_remove(channel);
                             btstack_memory_l2cap_channel_free(channel);
                             break;
                     }
@@ -2486,7 +2498,7 @@ static void l2cap_signaling_handler_dispatch(hci_con_handle_t handle, uint8_t *
                                 // map l2cap connection response result to BTstack status enumeration
                                 l2cap_emit_channel_opened(channel, L2CAP_CONNECTION_RESPONSE_RESULT_ERTM_NOT_SUPPORTED);
                                 // discard channel
-                                btstack_linked_list_remove(&l2cap_channels, (btstack_linked_item_t *) channel);
+                                l2cap_channel_list_remove(channel);
                                 btstack_memory_l2cap_channel_free(channel);
                                 continue;
                             } else {
@@ -3162,7 +3174,7 @@ void l2cap_finialize_channel_close(l2cap_channel_t * channel){
     l2cap_emit_channel_closed(channel);
     // discard channel
     l2cap_stop_rtx(channel);
-    btstack_linked_list_remove(&l2cap_channels, (btstack_linked_item_t *) channel);
+    l2cap_channel_list_remove(channel);
     btstack_memory_l2cap_channel_free(channel);
 }
 
@@ -3236,6 +3248,12 @@ uint8_t l2cap_unregister_service(uint16_t psm){
 
 #ifdef ENABLE_LE_DATA_CHANNELS
 
+// MPS = largest K-frame that fits into incoming ACL buffer, so that peer can fill LL PDUs of the negotiated data length
+static uint16_t l2cap_le_local_mps(l2cap_channel_t *channel){
+    uint16_t mps = btstack_min(l2cap_max_le_mtu(), channel->local_mtu + 2);
+    return btstack_max(mps, L2CAP_LE_DEFAULT_MTU);
+}
+
 static void l2cap_le_notify_channel_can_send(l2cap_channel_t *channel){
     if (!channel->waiting_for_can_send_now) return;
     if (channel->send_sdu_buffer) return;
@@ -0,0 +1,382 @@
+/*
+ * Copyright (C) 2017 BlueKitchen GmbH
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ * 4. Any redistribution, use, or modification is done solely for
+ *    personal benefit and not for any commercial purpose or for
+ *    monetary gain.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BLUEKITCHEN GMBH AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL MATTHIAS
+ * RINGWALD OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Please inquire about commercial licensing options at 
+ * contact@bluekitchen-gmbh.com
+ *
+ */
+
+// *****************************************************************************
+//
+// ATT DB tests: attribute lookup by handle and handle ranges
+//
+// *****************************************************************************
+
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "CppUTest/TestHarness.h"
+#include "CppUTest/CommandLineTestRunner.h"
+
+#include "ble/att_db.h"
+#include "ble/att_db_util.h"
+#include "btstack_util.h"
+#include "bluetooth.h"
+
+#define NUM_CHARACTERISTICS 100
+
+static att_connection_t att_connection;
+static uint8_t att_request[ATT_DEFAULT_MTU];
+static uint8_t att_response[ATT_DEFAULT_MTU];
+static uint16_t att_response_len;
+
+// hand-crafted database
+static uint8_t  att_db_raw[200];
+static uint16_t att_db_raw_len;
+
+static void att_db_raw_add(uint16_t handle, uint16_t uuid16, uint8_t value){
+    little_endian_store_16(att_db_raw, att_db_raw_len + 0, 9);
+    little_endian_store_16(att_db_raw, att_db_raw_len + 2, ATT_PROPERTY_READ);
+    little_endian_store_16(att_db_raw, att_db_raw_len + 4, handle);
+    little_endian_store_16(att_db_raw, att_db_raw_len + 6, uuid16);
+    att_db_raw[att_db_raw_len + 8] = value;
+    att_db_raw_len += 9;
+    little_endian_store_16(att_db_raw, att_db_raw_len, 0);
+}
+
+static void read_request(uint16_t handle){
+    att_request[0] = ATT_READ_REQUEST;
+    little_endian_store_16(att_request, 1, handle);
+    att_response_len = att_handle_request(&att_connection, att_request, 3, att_response);
+}
+
+static void find_information_request(uint16_t start_handle, uint16_t end_handle){
+    att_request[0] = ATT_FIND_INFORMATION_REQUEST;
+    little_endian_store_16(att_request, 1, start_handle);
+    little_endian_store_16(att_request, 3, end_handle);
+    att_response_len = att_handle_request(&att_connection, att_request, 5, att_response);
+}
+
+static void read_by_type_request(uint16_t start_handle, uint16_t end_handle, uint16_t uuid16){
+    att_request[0] = ATT_READ_BY_TYPE_REQUEST;
+    little_endian_store_16(att_request, 1, start_handle);
+    little_endian_store_16(att_request, 3, end_handle);
+    little_endian_store_16(att_request, 5, uuid16);
+    att_response_len = att_handle_request(&att_connection, att_request, 7, att_response);
+}
+
+static void read_by_group_type_request(uint16_t start_handle, uint16_t end_handle, uint16_t uuid16){
+    att_request[0] = ATT_READ_BY_GROUP_TYPE_REQUEST;
+    little_endian_store_16(att_request, 1, start_handle);
+    little_endian_store_16(att_request, 3, end_handle);
+    little_endian_store_16(att_request, 5, uuid16);
+    att_response_len = att_handle_request(&att_connection, att_request, 7, att_response);
+}
+
+static void find_by_type_value_request(uint16_t start_handle, uint16_t end_handle, uint16_t uuid16, uint16_t value){
+    att_request[0] = ATT_FIND_BY_TYPE_VALUE_REQUEST;
+    little_endian_store_16(att_request, 1, start_handle);
+    little_endian_store_16(att_request, 3, end_handle);
+    little_endian_store_16(att_request, 5, uuid16);
+    little_endian_store_16(att_request, 7, value);
+    att_response_len = att_handle_request(&att_connection, att_request, 9, att_response);
+}
+
+// Bluetooth Base UUID with given UUID16 in little endian
+static void uuid128_from_uuid16(uint16_t uuid16, uint8_t * uuid128){
+    const uint8_t base_uuid[] = { 0xfb, 0x34, 0x9b, 0x5f, 0x80, 0x00, 0x00, 0x80, 0x00, 0x10, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 };
+    memcpy(uuid128, base_uuid, 16);
+    little_endian_store_16(uuid128, 12, uuid16);
+}
+
+// services 0x1800, 0x1801 and 0x180f with two characteristics each
+static uint16_t setup_services(void){
+    att_db_util_init();
+    uint8_t value = 0;
+    uint16_t service;
+    for (service=0x1800;service<0x1803;service++){
+        att_db_util_add_service_uuid16(service == 0x1802 ? 0x180f : service);
+        att_db_util_add_characteristic_uuid16(0x2a00, ATT_PROPERTY_READ, &value, 1);
+        att_db_util_add_characteristic_uuid16(0x2a19, ATT_PROPERTY_READ, &value, 1);
+    }
+    att_set_db(att_db_util_get_address());
+    // each service: service declaration, 2 x (characteristic declaration + value)
+    return 5;
+}
+
+TEST_GROUP(AttDb){
+    void setup(void){
+        memset(&att_connection, 0, sizeof(att_connection));
+        att_connection.mtu = ATT_DEFAULT_MTU;
+        att_connection.max_mtu = ATT_DEFAULT_MTU;
+        att_db_raw_len = 0;
+        little_endian_store_16(att_db_raw, 0, 0);
+    }
+};
+
+TEST(AttDb, ReadConsecutiveHandles){
+    att_db_util_init();
+    att_db_util_add_service_uuid16(0x1800);
+    uint16_t value_handles[NUM_CHARACTERISTICS];
+    int i;
+    for (i=0;i<NUM_CHARACTERISTICS;i++){
+        uint8_t value = i;
+        value_handles[i] = att_db_util_add_characteristic_uuid16(0x2a00 + i, ATT_PROPERTY_READ, &value, 1);
+    }
+    att_set_db(att_db_util_get_address());
+
+    for (i=0;i<NUM_CHARACTERISTICS;i++){
+        read_request(value_handles[i]);
+        CHECK_EQUAL(2, att_response_len);
+        CHECK_EQUAL(ATT_READ_RESPONSE, att_response[0]);
+        CHECK_EQUAL(i, att_response[1]);
+        CHECK_EQUAL(0x2a00 + i, att_uuid_for_handle(value_handles[i]));
+    }
+
+    // beyond last handle
+    read_request(value_handles[NUM_CHARACTERISTICS-1] + 1);
+    CHECK_EQUAL(ATT_ERROR_RESPONSE, att_response[0]);
+    CHECK_EQUAL(ATT_ERROR_INVALID_HANDLE, att_response[4]);
+    CHECK_EQUAL(0, att_uuid_for_handle(0));
+
+    // range query starting in the middle
+    read_by_type_request(value_handles[50], 0xffff, 0x2a00 + 50);
+    CHECK_EQUAL(ATT_READ_BY_TYPE_RESPONSE, att_response[0]);
+    CHECK_EQUAL(value_handles[50], little_endian_read_16(att_response, 2));
+    read_by_type_request(value_handles[50] + 1, 0xffff, 0x2a00 + 50);
+    CHECK_EQUAL(ATT_ERROR_RESPONSE, att_response[0]);
+    CHECK_EQUAL(ATT_ERROR_ATTRIBUTE_NOT_FOUND, att_response[4]);
+}
+
+TEST(AttDb, HandlesWithGaps){
+    att_db_raw_add(0x0001, 0x2800, 1);
+    att_db_raw_add(0x0002, 0x2a00, 2);
+    att_db_raw_add(0x0005, 0x2a01, 5);
+    att_db_raw_add(0x0009, 0x2a02, 9);
+    att_set_db(att_db_raw);
+
+    read_request(0x0005);
+    CHECK_EQUAL(ATT_READ_RESPONSE, att_response[0]);
+    CHECK_EQUAL(5, att_response[1]);
+    read_request(0x0009);
+    CHECK_EQUAL(9, att_response[1]);
+    read_request(0x0004);
+    CHECK_EQUAL(ATT_ERROR_RESPONSE, att_response[0]);
+    read_request(0x000a);
+    CHECK_EQUAL(ATT_ERROR_RESPONSE, att_response[0]);
+
+    // starts at first handle >= start handle
+    find_information_request(0x0003, 0xffff);
+    CHECK_EQUAL(ATT_FIND_INFORMATION_REPLY, att_response[0]);
+    CHECK_EQUAL(2 + 2 * 4, att_response_len);
+    CHECK_EQUAL(0x0005, little_endian_read_16(att_response, 2));
+    CHECK_EQUAL(0x0009, little_endian_read_16(att_response, 6));
+
+    find_information_request(0x000a, 0xffff);
+    CHECK_EQUAL(ATT_ERROR_RESPONSE, att_response[0]);
+    CHECK_EQUAL(ATT_ERROR_ATTRIBUTE_NOT_FOUND, att_response[4]);
+}
+
+TEST(AttDb, HandlesNotInOrder){
+    att_db_raw_add(0x0001, 0x2800, 1);
+    att_db_raw_add(0x0003, 0x2a00, 3);
+    att_db_raw_add(0x0002, 0x2a01, 2);
+    att_set_db(att_db_raw);
+
+    read_request(0x0002);
+    CHECK_EQUAL(ATT_READ_RESPONSE, att_response[0]);
+    CHECK_EQUAL(2, att_response[1]);
+    read_request(0x0003);
+    CHECK_EQUAL(3, att_response[1]);
+
+    // group ends before next service declaration
+    att_db_raw_add(0x0004, GATT_PRIMARY_SERVICE_UUID, 4);
+    att_set_db(att_db_raw);
+    att_request[0] = ATT_FIND_BY_TYPE_VALUE_REQUEST;
+    little_endian_store_16(att_request, 1, 0x0001);
+    little_endian_store_16(att_request, 3, 0xffff);
+    little_endian_store_16(att_request, 5, GATT_PRIMARY_SERVICE_UUID);
+    att_request[7] = 1;
+    att_response_len = att_handle_request(&att_connection, att_request, 8, att_response);
+    CHECK_EQUAL(ATT_FIND_BY_TYPE_VALUE_RESPONSE, att_response[0]);
+    CHECK_EQUAL(5, att_response_len);
+    CHECK_EQUAL(0x0001, little_endian_read_16(att_response, 1));
+    CHECK_EQUAL(0x0002, little_endian_read_16(att_response, 3));
+}
+
+TEST(AttDb, ReadByGroupType){
+    uint16_t service_size = setup_services();
+
+    read_by_group_type_request(0x0001, 0xffff, GATT_PRIMARY_SERVICE_UUID);
+    CHECK_EQUAL(ATT_READ_BY_GROUP_TYPE_RESPONSE, att_response[0]);
+    CHECK_EQUAL(6, att_response[1]);
+    CHECK_EQUAL(2 + 3 * 6, att_response_len);
+    int i;
+    for (i=0;i<3;i++){
+        CHECK_EQUAL(1 + i * service_size, little_endian_read_16(att_response, 2 + i * 6));
+        CHECK_EQUAL((i + 1) * service_size, little_endian_read_16(att_response, 4 + i * 6));
+    }
+    CHECK_EQUAL(0x180f, little_endian_read_16(att_response, 6 + 2 * 6));
+
+    // continue after second service
+    read_by_group_type_request(2 * service_size, 0xffff, GATT_PRIMARY_SERVICE_UUID);
+    CHECK_EQUAL(2 + 6, att_response_len);
+    CHECK_EQUAL(1 + 2 * service_size, little_endian_read_16(att_response, 2));
+
+    read_by_group_type_request(3 * service_size, 0xffff, GATT_PRIMARY_SERVICE_UUID);
+    CHECK_EQUAL(ATT_ERROR_RESPONSE, att_response[0]);
+    CHECK_EQUAL(ATT_ERROR_ATTRIBUTE_NOT_FOUND, att_response[4]);
+}
+
+TEST(AttDb, FindByTypeValue){
+    uint16_t service_size = setup_services();
+
+    find_by_type_value_request(0x0001, 0xffff, GATT_PRIMARY_SERVICE_UUID, 0x1801);
+    CHECK_EQUAL(ATT_FIND_BY_TYPE_VALUE_RESPONSE, att_response[0]);
+    CHECK_EQUAL(5, att_response_len);
+    CHECK_EQUAL(1 + service_size, little_endian_read_16(att_response, 1));
+    CHECK_EQUAL(2 * service_size, little_endian_read_16(att_response, 3));
+
+    find_by_type_value_request(0x0001, 0xffff, GATT_PRIMARY_SERVICE_UUID, 0x180f);
+    CHECK_EQUAL(1 + 2 * service_size, little_endian_read_16(att_response, 1));
+    CHECK_EQUAL(3 * service_size, little_endian_read_16(att_response, 3));
+
+    find_by_type_value_request(0x0001, 0xffff, GATT_PRIMARY_SERVICE_UUID, 0x1802);
+    CHECK_EQUAL(ATT_ERROR_RESPONSE, att_response[0]);
+}
+
+TEST(AttDb, ReadByTypeWithUUID128){
+    uint16_t service_size = setup_services();
+
+    // Battery Level as 128-bit Bluetooth Base UUID matches 16-bit attribute type
+    att_request[0] = ATT_READ_BY_TYPE_REQUEST;
+    little_endian_store_16(att_request, 1, 0x0001);
+    little_endian_store_16(att_request, 3, 0xffff);
+    uuid128_from_uuid16(0x2a19, &att_request[5]);
+    att_response_len = att_handle_request(&att_connection, att_request, 21, att_response);
+    CHECK_EQUAL(ATT_READ_BY_TYPE_RESPONSE, att_response[0]);
+    CHECK_EQUAL(3, att_response[1]);
+    CHECK_EQUAL(2 + 3 * 3, att_response_len);
+    int i;
+    for (i=0;i<3;i++){
+        CHECK_EQUAL(i * service_size + 5, little_endian_read_16(att_response, 2 + i * 3));
+    }
+
+    // limited to second service
+    read_by_type_request(1 + service_size, 2 * service_size, 0x2a19);
+    CHECK_EQUAL(2 + 3, att_response_len);
+    CHECK_EQUAL(service_size + 5, little_endian_read_16(att_response, 2));
+}
+
+TEST(AttDb, ReadMultipleVariable){
+    // values with length 1, 3 and 30 at handles 3, 5, 7
+    uint8_t value[30];
+    int i;
+    for (i=0;i<(int)sizeof(value);i++){
+        value[i] = i;
+    }
+    att_db_util_init();
+    att_db_util_add_service_uuid16(0x180f);
+    att_db_util_add_characteristic_uuid16(0x2a19, ATT_PROPERTY_READ, value, 1);
+    att_db_util_add_characteristic_uuid16(0x2a1a, ATT_PROPERTY_READ, value, 3);
+    att_db_util_add_characteristic_uuid16(0x2a1b, ATT_PROPERTY_READ, value, sizeof(value));
+    att_set_db(att_db_util_get_address());
+
+    att_request[0] = ATT_READ_MULTIPLE_VARIABLE_REQUEST;
+    little_endian_store_16(att_request, 1, 0x0005);
+    little_endian_store_16(att_request, 3, 0x0003);
+    att_response_len = att_handle_request(&att_connection, att_request, 5, att_response);
+    CHECK_EQUAL(ATT_READ_MULTIPLE_VARIABLE_RESPONSE, att_response[0]);
+    CHECK_EQUAL(1 + 2 + 3 + 2 + 1, att_response_len);
+    CHECK_EQUAL(3, little_endian_read_16(att_response, 1));
+    CHECK_EQUAL(0, memcmp(value, &att_response[3], 3));
+    CHECK_EQUAL(1, little_endian_read_16(att_response, 6));
+    CHECK_EQUAL(value[0], att_response[8]);
+
+    // last value truncated to MTU, length field keeps full length
+    little_endian_store_16(att_request, 5, 0x0007);
+    att_response_len = att_handle_request(&att_connection, att_request, 7, att_response);
+    CHECK_EQUAL(ATT_DEFAULT_MTU, att_response_len);
+    CHECK_EQUAL(sizeof(value), little_endian_read_16(att_response, 9));
+    CHECK_EQUAL(0, memcmp(value, &att_response[11], ATT_DEFAULT_MTU - 11));
+
+    // fixed length Read Multiple unchanged
+    att_request[0] = ATT_READ_MULTIPLE_REQUEST;
+    att_response_len = att_handle_request(&att_connection, att_request, 5, att_response);
+    CHECK_EQUAL(ATT_READ_MULTIPLE_RESPONSE, att_response[0]);
+    CHECK_EQUAL(1 + 3 + 1, att_response_len);
+
+    // invalid handle
+    att_request[0] = ATT_READ_MULTIPLE_VARIABLE_REQUEST;
+    little_endian_store_16(att_request, 3, 0x0020);
+    att_response_len = att_handle_request(&att_connection, att_request, 5, att_response);
+    CHECK_EQUAL(ATT_ERROR_RESPONSE, att_response[0]);
+    CHECK_EQUAL(ATT_READ_MULTIPLE_VARIABLE_REQUEST, att_response[1]);
+    CHECK_EQUAL(ATT_ERROR_INVALID_HANDLE, att_response[4]);
+}
+
+TEST(AttDb, MultipleHandleValueNotification){
+    uint8_t value_a[] = { 1, 2, 3 };
+    uint8_t value_b[] = { 4 };
+    uint16_t handles[] = { 0x0003, 0x0010 };
+    uint8_t * values[] = { value_a, value_b };
+    uint16_t value_lens[] = { sizeof(value_a), sizeof(value_b) };
+
+    att_response_len = att_prepare_multiple_handle_value_notification(&att_connection, 2, handles, values, value_lens, att_response);
+    CHECK_EQUAL(1 + 4 + 3 + 4 + 1, att_response_len);
+    CHECK_EQUAL(ATT_MULTIPLE_HANDLE_VALUE_NOTIFICATION, att_response[0]);
+    CHECK_EQUAL(0x0003, little_endian_read_16(att_response, 1));
+    CHECK_EQUAL(3, little_endian_read_16(att_response, 3));
+    CHECK_EQUAL(0, memcmp(value_a, &att_response[5], 3));
+    CHECK_EQUAL(0x0010, little_endian_read_16(att_response, 8));
+    CHECK_EQUAL(1, little_endian_read_16(att_response, 10));
+    CHECK_EQUAL(4, att_response[12]);
+
+    // at least two values
+    CHECK_EQUAL(0, att_prepare_multiple_handle_value_notification(&att_connection, 1, handles, values, value_lens, att_response));
+
+    // values must fit into MTU
+    uint8_t value_long[ATT_DEFAULT_MTU];
+    memset(value_long, 0, sizeof(value_long));
+    values[1] = value_long;
+    value_lens[1] = ATT_DEFAULT_MTU - 1 - 4 - 3 - 4 + 1;
+    CHECK_EQUAL(0, att_prepare_multiple_handle_value_notification(&att_connection, 2, handles, values, value_lens, att_response));
+    value_lens[1]--;
+    CHECK_EQUAL(ATT_DEFAULT_MTU, att_prepare_multiple_handle_value_notification(&att_connection, 2, handles, values, value_lens, att_response));
+}
+
+int main (int argc, const char * argv[]){
+    return CommandLineTestRunner::RunAllTests(argc, argv);
+}
@@ -106,6 +106,192 @@ TEST(AttDbUtil, LeCounterDb){
     CHECK_EQUAL_ARRAY(profile_data, addr, size);
 }
 
+static att_connection_t att_connection;
+static uint8_t att_request[ATT_DEFAULT_MTU];
+static uint8_t att_response[ATT_DEFAULT_MTU];
+
+static uint16_t read_by_group_type_request(uint16_t start_handle, uint8_t * response){
+    att_request[0] = ATT_READ_BY_GROUP_TYPE_REQUEST;
+    little_endian_store_16(att_request, 1, start_handle);
+    little_endian_store_16(att_request, 3, 0xffff);
+    little_endian_store_16(att_request, 5, GATT_PRIMARY_SERVICE_UUID);
+    return att_handle_request(&att_connection, att_request, 7, response);
+}
+
+static uint16_t read_by_type_request(uint16_t start_handle, uint16_t uuid16, uint8_t * response){
+    att_request[0] = ATT_READ_BY_TYPE_REQUEST;
+    little_endian_store_16(att_request, 1, start_handle);
+    little_endian_store_16(att_request, 3, 0xffff);
+    little_endian_store_16(att_request, 5, uuid16);
+    return att_handle_request(&att_connection, att_request, 7, response);
+}
+
+static uint16_t read_request(uint16_t handle, uint8_t * response){
+    att_request[0] = ATT_READ_REQUEST;
+    little_endian_store_16(att_request, 1, handle);
+    return att_handle_request(&att_connection, att_request, 3, response);
+}
+
+// compare responses of incrementally updated ATT DB with responses after rebuilding its indexes
+static void check_att_db_consistent(void){
+    uint8_t response[ATT_DEFAULT_MTU];
+    uint16_t handles[] = { 0x0001, 0x0003, 0x0004, 0x0006, 0x0009, 0x000c, 0x0010 };
+    uint16_t lens[3 * sizeof(handles) / sizeof(uint16_t)];
+    uint8_t  responses[3 * sizeof(handles) / sizeof(uint16_t)][ATT_DEFAULT_MTU];
+    int pass;
+    for (pass = 0; pass < 2; pass++){
+        unsigned int i;
+        for (i = 0; i < sizeof(handles) / sizeof(uint16_t); i++){
+            uint16_t len[3];
+            len[0] = read_by_group_type_request(handles[i], response);
+            if (pass == 0) {
+                memcpy(responses[3*i], response, len[0]);
+            } else {
+                CHECK_EQUAL(lens[3*i], len[0]);
+                CHECK_EQUAL(0, memcmp(responses[3*i], response, len[0]));
+            }
+            len[1] = read_by_type_request(handles[i], GATT_CHARACTERISTICS_UUID, response);
+            if (pass == 0) {
+                memcpy(responses[3*i+1], response, len[1]);
+            } else {
+                CHECK_EQUAL(lens[3*i+1], len[1]);
+                CHECK_EQUAL(0, memcmp(responses[3*i+1], response, len[1]));
+            }
+            len[2] = read_request(handles[i], response);
+            if (pass == 0) {
+                memcpy(responses[3*i+2], response, len[2]);
+                memcpy(&lens[3*i], len, sizeof(len));
+            } else {
+                CHECK_EQUAL(lens[3*i+2], len[2]);
+                CHECK_EQUAL(0, memcmp(responses[3*i+2], response, len[2]));
+            }
+        }
+        att_set_db(att_db_util_get_address());
+    }
+}
+
+// services 0x1800 (handles 1-3), 0x180f (4-9, with CCC), 0x180a (10-12)
+static uint16_t setup_mutable_db(void){
+    uint8_t value = 0x42;
+    att_db_util_add_service_uuid16(0x1800);
+    att_db_util_add_characteristic_uuid16(0x2a00, ATT_PROPERTY_READ, (uint8_t*) "BTstack", 7);
+    uint16_t service_handle = att_db_util_add_service_uuid16(0x180f);
+    att_db_util_add_characteristic_uuid16(0x2a19, ATT_PROPERTY_READ | ATT_PROPERTY_NOTIFY, &value, 1);
+    att_db_util_add_characteristic_uuid16(0x2a1a, ATT_PROPERTY_READ, &value, 1);
+    att_db_util_add_service_uuid16(0x180a);
+    att_db_util_add_characteristic_uuid16(0x2a29, ATT_PROPERTY_READ, (uint8_t*) "BlueKitchen", 11);
+    return service_handle;
+}
+
+TEST_GROUP(AttDbUtilMutable){
+    void setup(void){
+        memset(&att_connection, 0, sizeof(att_connection));
+        att_connection.mtu = ATT_DEFAULT_MTU;
+        att_connection.max_mtu = ATT_DEFAULT_MTU;
+        att_db_util_init();
+        att_set_db(att_db_util_get_address());
+    }
+};
+
+TEST(AttDbUtilMutable, AddServiceAtRuntime){
+    setup_mutable_db();
+    check_att_db_consistent();
+    uint16_t service_handle = att_db_util_add_service_uuid16(0x181c);
+    CHECK_EQUAL(13, service_handle);
+    uint8_t value = 0x17;
+    uint16_t value_handle = att_db_util_add_characteristic_uuid16(0x2a8a, ATT_PROPERTY_READ, &value, 1);
+    CHECK_EQUAL(15, value_handle);
+    read_request(value_handle, att_response);
+    CHECK_EQUAL(ATT_READ_RESPONSE, att_response[0]);
+    CHECK_EQUAL(0x17, att_response[1]);
+    check_att_db_consistent();
+}
+
+TEST(AttDbUtilMutable, RemoveService){
+    uint16_t service_handle = setup_mutable_db();
+    uint16_t end_handle = att_db_util_remove_service(service_handle);
+    CHECK_EQUAL(9, end_handle);
+    end_handle = att_db_util_remove_service(service_handle);
+    CHECK_EQUAL(0, end_handle);
+    end_handle = att_db_util_remove_service(0x0002);
+    CHECK_EQUAL(0, end_handle);
+
+    // two services left, handles of third service unchanged
+    uint16_t len = read_by_group_type_request(0x0001, att_response);
+    CHECK_EQUAL(2 + 2 * 6, len);
+    CHECK_EQUAL(0x0001, little_endian_read_16(att_response, 2));
+    CHECK_EQUAL(0x0003, little_endian_read_16(att_response, 4));
+    CHECK_EQUAL(0x000a, little_endian_read_16(att_response, 8));
+    CHECK_EQUAL(0x000c, little_endian_read_16(att_response, 10));
+    read_request(0x0005, att_response);
+    CHECK_EQUAL(ATT_ERROR_RESPONSE, att_response[0]);
+    check_att_db_consistent();
+}
+
+TEST(AttDbUtilMutable, ReplaceService){
+    uint16_t service_handle = setup_mutable_db();
+    uint8_t value = 0x55;
+    uint16_t handle = att_db_util_replace_service_begin(service_handle);
+    CHECK_EQUAL(9, handle);
+    handle = att_db_util_add_service_uuid16(0x1810);
+    CHECK_EQUAL(service_handle, handle);
+    handle = att_db_util_add_characteristic_uuid16(0x2a35, ATT_PROPERTY_READ, &value, 1);
+    CHECK_EQUAL(6, handle);
+    handle = att_db_util_replace_service_end();
+    CHECK_EQUAL(6, handle);
+
+    uint16_t len = read_by_group_type_request(service_handle, att_response);
+    CHECK_EQUAL(2 + 2 * 6, len);
+    CHECK_EQUAL(0x0004, little_endian_read_16(att_response, 2));
+    CHECK_EQUAL(0x0006, little_endian_read_16(att_response, 4));
+    CHECK_EQUAL(0x1810, little_endian_read_16(att_response, 6));
+    CHECK_EQUAL(0x000a, little_endian_read_16(att_response, 8));
+    read_request(0x0006, att_response);
+    CHECK_EQUAL(0x55, att_response[1]);
+    check_att_db_consistent();
+
+    // new definition cannot use handles of the next service
+    att_db_util_replace_service_begin(service_handle);
+    att_db_util_add_service_uuid16(0x1810);
+    handle = att_db_util_add_characteristic_uuid16(0x2a35, ATT_PROPERTY_READ, &value, 1);
+    CHECK_EQUAL(6, handle);
+    handle = att_db_util_add_characteristic_uuid16(0x2a36, ATT_PROPERTY_READ, &value, 1);
+    CHECK_EQUAL(8, handle);
+    handle = att_db_util_add_characteristic_uuid16(0x2a37, ATT_PROPERTY_READ, &value, 1);
+    CHECK_EQUAL(0, handle);
+    handle = att_db_util_replace_service_end();
+    CHECK_EQUAL(8, handle);
+    check_att_db_consistent();
+
+    // next handle after replacement continues after last service
+    handle = att_db_util_add_service_uuid16(0x181c);
+    CHECK_EQUAL(13, handle);
+}
+
+TEST(AttDbUtilMutable, CompactHandles){
+    uint16_t service_handle = setup_mutable_db();
+    uint16_t handle = att_db_util_compact_handles();
+    CHECK_EQUAL(0, handle);
+    att_db_util_remove_service(service_handle);
+    handle = att_db_util_compact_handles();
+    CHECK_EQUAL(4, handle);
+
+    // third service moved to handles 4-6, characteristic declaration points to new value handle
+    uint16_t len = read_by_group_type_request(0x0004, att_response);
+    CHECK_EQUAL(2 + 6, len);
+    CHECK_EQUAL(0x0004, little_endian_read_16(att_response, 2));
+    CHECK_EQUAL(0x0006, little_endian_read_16(att_response, 4));
+    read_request(0x0005, att_response);
+    CHECK_EQUAL(0x0006, little_endian_read_16(att_response, 2));
+    read_request(0x0006, att_response);
+    CHECK_EQUAL(0, memcmp("BlueKitchen", &att_response[1], 11));
+    check_att_db_consistent();
+
+    handle = att_db_util_add_service_uuid16(0x181c);
+    CHECK_EQUAL(7, handle);
+    check_att_db_consistent();
+}
+
 int main (int argc, const char * argv[]){
     return CommandLineTestRunner::RunAllTests(argc, argv);
 }
\ No newline at end of file
@@ -0,0 +1,146 @@
+/*
+ * Copyright (C) 2017 BlueKitchen GmbH
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ * 4. Any redistribution, use, or modification is done solely for
+ *    personal benefit and not for any commercial purpose or for
+ *    monetary gain.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BLUEKITCHEN GMBH AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL MATTHIAS
+ * RINGWALD OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Please inquire about commercial licensing options at 
+ * contact@bluekitchen-gmbh.com
+ *
+ */
+
+/*
+ *  att_server_can_send_now_test.c
+ *
+ *  Checks that ATT_EVENT_CAN_SEND_NOW respects the packet limit of the requesting connection for an
+ *  application that notifies and requests the next event from its handler, as example/le_streamer.c does.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "btstack_config.h"
+#include "btstack_event.h"
+#include "btstack_memory.h"
+#include "btstack_run_loop.h"
+#include "btstack_run_loop_posix.h"
+#include "ble/att_server.h"
+#include "bluetooth.h"
+#include "hci.h"
+#include "l2cap.h"
+#include "mock_controller.h"
+
+#define NUM_ACL_BUFFERS 2
+#define CON_HANDLE_A    0x0040
+#define CON_HANDLE_B    0x0041
+#define VALUE_HANDLE    0x0003
+#define MAX_NESTING     10
+
+#define CHECK_EQUAL(expected, actual) check_equal(expected, actual, __LINE__)
+
+static const uint8_t profile_data[] = { 0x00, 0x00 };
+
+static int can_send_now_events;
+static int notifications_sent;
+static int notifications_failed;
+static int nesting;
+static int max_nesting;
+static int failures;
+
+static void check_equal(int expected, int actual, int line){
+    if (expected == actual) return;
+    printf("line %u: expected %d, got %d\n", line, expected, actual);
+    failures++;
+}
+
+// notify and request next can send now, like le_streamer
+static void packet_handler(uint8_t packet_type, uint16_t channel, uint8_t *packet, uint16_t size){
+    (void) channel;
+    (void) size;
+    if (packet_type != HCI_EVENT_PACKET) return;
+    if (hci_event_packet_get_type(packet) != ATT_EVENT_CAN_SEND_NOW) return;
+    can_send_now_events++;
+    nesting++;
+    if (nesting > max_nesting){
+        max_nesting = nesting;
+    }
+    if (nesting <= MAX_NESTING){
+        uint8_t value[4];
+        memset(value, 0, sizeof(value));
+        if (att_server_notify(CON_HANDLE_A, VALUE_HANDLE, value, sizeof(value)) == 0){
+            notifications_sent++;
+        } else {
+            notifications_failed++;
+        }
+        att_server_request_can_send_now_event(CON_HANDLE_A);
+    }
+    nesting--;
+}
+
+int main(void){
+    btstack_memory_init();
+    btstack_run_loop_init(btstack_run_loop_posix_get_instance());
+    mock_controller_init(NUM_ACL_BUFFERS);
+    l2cap_init();
+    att_server_init(profile_data, NULL, NULL);
+    att_server_register_packet_handler(&packet_handler);
+    if (mock_controller_power_on()){
+        printf("HCI init failed\n");
+        return 1;
+    }
+    mock_controller_create_le_connection(CON_HANDLE_A);
+    mock_controller_create_le_connection(CON_HANDLE_B);
+
+    // one buffer is reserved for B, A waits after its first notification
+    att_server_request_can_send_now_event(CON_HANDLE_A);
+    CHECK_EQUAL(1, can_send_now_events);
+    CHECK_EQUAL(1, notifications_sent);
+    CHECK_EQUAL(0, notifications_failed);
+    CHECK_EQUAL(1, max_nesting);
+
+    // each completed packet allows for the next notification
+    int i;
+    for (i = 0; i < 3; i++){
+        CHECK_EQUAL(CON_HANDLE_A, mock_controller_complete_packet(HCI_CON_HANDLE_INVALID));
+        CHECK_EQUAL(2 + i, can_send_now_events);
+        CHECK_EQUAL(2 + i, notifications_sent);
+    }
+    CHECK_EQUAL(0, notifications_failed);
+    CHECK_EQUAL(1, max_nesting);
+    CHECK_EQUAL(1, att_server_can_send_packet_now(CON_HANDLE_B));
+
+    if (failures){
+        printf("%u checks failed\n", failures);
+        return 1;
+    }
+    printf("can send now: OK\n");
+    return 0;
+}
@@ -0,0 +1,248 @@
+/*
+ * Copyright (C) 2017 BlueKitchen GmbH
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ * 4. Any redistribution, use, or modification is done solely for
+ *    personal benefit and not for any commercial purpose or for
+ *    monetary gain.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BLUEKITCHEN GMBH AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL MATTHIAS
+ * RINGWALD OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Please inquire about commercial licensing options at 
+ * contact@bluekitchen-gmbh.com
+ *
+ */
+
+/*
+ *  att_server_command_queue_test.c
+ *
+ *  Checks that Write Commands received during Signed Write validation are queued and processed in order
+ *  with ENABLE_LE_SIGNED_WRITE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "btstack_config.h"
+#include "btstack_memory.h"
+#include "btstack_run_loop.h"
+#include "btstack_run_loop_posix.h"
+#include "ble/att_server.h"
+#include "ble/le_device_db.h"
+#include "ble/sm.h"
+#include "bluetooth.h"
+#include "hci.h"
+#include "l2cap.h"
+#include "mock_controller.h"
+
+#define NUM_ACL_BUFFERS 2
+#define CON_HANDLE      0x0040
+#define VALUE_HANDLE    0x0003
+
+#define CHECK_EQUAL(expected, actual) check_equal(expected, actual, __LINE__)
+
+// single dynamic attribute with Write Without Response and Authenticated Signed Write
+static const uint8_t profile_data[] = {
+    0x08, 0x00, 0x44, 0x01, 0x03, 0x00, 0x00, 0x2a,
+    0x00, 0x00
+};
+
+// written values in order of att_write_callback
+static uint8_t written_values[32];
+static int     written_num;
+static int     failures;
+
+// pending sm_cmac_signed_write_start
+static void (*cmac_done_callback)(uint8_t hash[8]);
+static uint32_t remote_counter;
+
+static void check_equal(int expected, int actual, int line){
+    if (expected == actual) return;
+    printf("line %u: expected %d, got %d\n", line, expected, actual);
+    failures++;
+}
+
+// SM and LE Device DB stubs for Signed Write validation
+int sm_cmac_ready(void){
+    return 1;
+}
+void sm_cmac_signed_write_start(const sm_key_t key, uint8_t opcode, uint16_t attribute_handle, uint16_t message_len, const uint8_t * message, uint32_t sign_counter, void (*done_callback)(uint8_t * hash)){
+    (void) key;
+    (void) opcode;
+    (void) attribute_handle;
+    (void) message_len;
+    (void) message;
+    (void) sign_counter;
+    cmac_done_callback = done_callback;
+}
+void le_device_db_remote_csrk_get(int index, sm_key_t csrk){
+    (void) index;
+    memset(csrk, 0, 16);
+}
+uint32_t le_device_db_remote_counter_get(int index){
+    (void) index;
+    return remote_counter;
+}
+void le_device_db_remote_counter_set(int index, uint32_t counter){
+    (void) index;
+    remote_counter = counter;
+}
+
+static int att_write_callback(hci_con_handle_t con_handle, uint16_t attribute_handle, uint16_t transaction_mode, uint16_t offset, uint8_t *buffer, uint16_t buffer_size){
+    (void) con_handle;
+    (void) transaction_mode;
+    (void) offset;
+    if (attribute_handle != VALUE_HANDLE) return 0;
+    if (buffer_size < 1) return 0;
+    written_values[written_num++] = buffer[0];
+    return 0;
+}
+
+static void write_command(uint8_t value){
+    uint8_t pdu[4];
+    pdu[0] = ATT_WRITE_COMMAND;
+    little_endian_store_16(pdu, 1, VALUE_HANDLE);
+    pdu[3] = value;
+    mock_controller_receive_att_pdu(CON_HANDLE, pdu, sizeof(pdu));
+}
+
+// signature = { sign counter, MAC }, MAC is all zero as provided by cmac_complete
+static void signed_write_command(uint8_t value, uint32_t counter){
+    uint8_t pdu[16];
+    memset(pdu, 0, sizeof(pdu));
+    pdu[0] = ATT_SIGNED_WRITE_COMMAND;
+    little_endian_store_16(pdu, 1, VALUE_HANDLE);
+    pdu[3] = value;
+    little_endian_store_32(pdu, 4, counter);
+    mock_controller_receive_att_pdu(CON_HANDLE, pdu, sizeof(pdu));
+}
+
+static void cmac_complete(void){
+    uint8_t hash[8];
+    memset(hash, 0, sizeof(hash));
+    void (*callback)(uint8_t hash[8]) = cmac_done_callback;
+    cmac_done_callback = NULL;
+    if (!callback) return;
+    (*callback)(hash);
+}
+
+static void identity_resolving_started(void){
+    uint8_t event[11];
+    memset(event, 0, sizeof(event));
+    event[0] = SM_EVENT_IDENTITY_RESOLVING_STARTED;
+    event[1] = sizeof(event) - 2;
+    little_endian_store_16(event, 2, CON_HANDLE);
+    mock_controller_emit_sm_event(event, sizeof(event));
+}
+
+static void identity_resolving_succeeded(void){
+    uint8_t event[20];
+    memset(event, 0, sizeof(event));
+    event[0] = SM_EVENT_IDENTITY_RESOLVING_SUCCEEDED;
+    event[1] = sizeof(event) - 2;
+    little_endian_store_16(event, 2, CON_HANDLE);
+    little_endian_store_16(event, 18, 0);
+    mock_controller_emit_sm_event(event, sizeof(event));
+}
+
+int main(void){
+    btstack_memory_init();
+    btstack_run_loop_init(btstack_run_loop_posix_get_instance());
+    mock_controller_init(NUM_ACL_BUFFERS);
+    l2cap_init();
+    att_server_init(profile_data, NULL, &att_write_callback);
+    if (mock_controller_power_on()){
+        printf("HCI init failed\n");
+        return 1;
+    }
+    mock_controller_create_le_connection(CON_HANDLE);
+
+    // no validation pending, handled directly
+    write_command(1);
+    CHECK_EQUAL(1, written_num);
+
+    // signed write waits for identity resolution, following commands are queued
+    identity_resolving_started();
+    signed_write_command(2, 0);
+    write_command(3);
+    write_command(4);
+    CHECK_EQUAL(1, written_num);
+    CHECK_EQUAL(0, cmac_done_callback != NULL);
+
+    // validation started after identity resolution, commands stay queued
+    identity_resolving_succeeded();
+    CHECK_EQUAL(1, cmac_done_callback != NULL);
+    CHECK_EQUAL(1, written_num);
+
+    // second signed write is queued behind write commands
+    signed_write_command(5, 1);
+    write_command(6);
+    CHECK_EQUAL(1, written_num);
+
+    // first signature valid: signed write and write commands up to next signed write
+    cmac_complete();
+    CHECK_EQUAL(4, written_num);
+    CHECK_EQUAL(1, remote_counter);
+    CHECK_EQUAL(1, cmac_done_callback != NULL);
+
+    // second signature valid: remaining commands
+    cmac_complete();
+    CHECK_EQUAL(6, written_num);
+    CHECK_EQUAL(2, remote_counter);
+    CHECK_EQUAL(0, cmac_done_callback != NULL);
+
+    const uint8_t expected_values[] = { 1, 2, 3, 4, 5, 6 };
+    int i;
+    for (i=0;i<6;i++){
+        CHECK_EQUAL(expected_values[i], written_values[i]);
+    }
+
+    // replayed sign counter is rejected
+    signed_write_command(7, 0);
+    CHECK_EQUAL(0, cmac_done_callback != NULL);
+    CHECK_EQUAL(6, written_num);
+
+    // overflow queue while signed write is validated, each entry is length + 4 byte Write Command
+    CHECK_EQUAL(0, att_server_get_dropped_pdus(CON_HANDLE));
+    signed_write_command(8, 2);
+    int num_queued = ATT_SERVER_COMMAND_QUEUE_SIZE / 6;
+    for (i=0;i<num_queued + 2;i++){
+        write_command(10 + i);
+    }
+    CHECK_EQUAL(2, att_server_get_dropped_pdus(CON_HANDLE));
+    cmac_complete();
+    CHECK_EQUAL(7 + num_queued, written_num);
+    CHECK_EQUAL(8, written_values[6]);
+    CHECK_EQUAL(10 + num_queued - 1, written_values[6 + num_queued]);
+
+    if (failures){
+        printf("%u checks failed\n", failures);
+        return 1;
+    }
+    printf("command queue: OK\n");
+    return 0;
+}
@@ -0,0 +1,153 @@
+/*
+ * Copyright (C) 2017 BlueKitchen GmbH
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ * 4. Any redistribution, use, or modification is done solely for
+ *    personal benefit and not for any commercial purpose or for
+ *    monetary gain.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BLUEKITCHEN GMBH AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL MATTHIAS
+ * RINGWALD OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Please inquire about commercial licensing options at 
+ * contact@bluekitchen-gmbh.com
+ *
+ */
+
+/*
+ *  att_server_fairness_benchmark.c
+ *
+ *  Measures aggregate notification rate of the ATT Server with several LE connections, one of them stalled.
+ *
+ *  Each connection streams notifications via att_server_register_can_send_now_callback. A simulated Controller
+ *  completes one ACL packet per tick in order, but never completes packets of the stalled connection.
+ *  HCI is brought up with the mock controller.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "btstack_config.h"
+#include "btstack_event.h"
+#include "btstack_memory.h"
+#include "btstack_run_loop.h"
+#include "btstack_run_loop_posix.h"
+#include "ble/att_server.h"
+#include "hci.h"
+#include "l2cap.h"
+#include "mock_controller.h"
+
+#define NUM_CONNECTIONS      8
+#define NUM_ACL_BUFFERS      8
+#define NUM_TICKS            10000
+#define NUM_PERIODS          5
+#define CON_HANDLE_BASE      0x0040
+#define CON_HANDLE_STALLED   CON_HANDLE_BASE
+#define ATTRIBUTE_HANDLE     0x0003
+#define MIN_AGGREGATE_NOTIFICATIONS_PER_TICK 0.9
+
+#ifndef ATT_SERVER_MAX_OUTGOING_PACKETS_PER_CONNECTION
+#define ATT_SERVER_MAX_OUTGOING_PACKETS_PER_CONNECTION 0
+#endif
+
+static btstack_context_callback_registration_t notification_callbacks[NUM_CONNECTIONS];
+static uint32_t notifications_completed[NUM_CONNECTIONS];
+
+static const uint8_t profile_data[] = { 0x00, 0x00 };
+
+// Controller completes one packet per tick, but none from the stalled connection
+static void controller_tick(void){
+    hci_con_handle_t con_handle = mock_controller_complete_packet(CON_HANDLE_STALLED);
+    if (con_handle == HCI_CON_HANDLE_INVALID) return;
+    notifications_completed[con_handle - CON_HANDLE_BASE]++;
+}
+
+static void send_notification(void * context){
+    hci_con_handle_t con_handle = (hci_con_handle_t) (uintptr_t) context;
+    uint8_t value[20];
+    memset(value, con_handle, sizeof(value));
+    att_server_notify(con_handle, ATTRIBUTE_HANDLE, value, sizeof(value));
+    att_server_register_can_send_now_callback(&notification_callbacks[con_handle - CON_HANDLE_BASE], con_handle);
+}
+
+int main(void){
+    btstack_memory_init();
+    btstack_run_loop_init(btstack_run_loop_posix_get_instance());
+    mock_controller_init(NUM_ACL_BUFFERS);
+    l2cap_init();
+    att_server_init(profile_data, NULL, NULL);
+    if (mock_controller_power_on()){
+        printf("HCI init failed\n");
+        return 1;
+    }
+
+    int i;
+    for (i=0;i<NUM_CONNECTIONS;i++){
+        mock_controller_create_le_connection(CON_HANDLE_BASE + i);
+    }
+    for (i=0;i<NUM_CONNECTIONS;i++){
+        notification_callbacks[i].callback = &send_notification;
+        notification_callbacks[i].context  = (void*) (uintptr_t) (CON_HANDLE_BASE + i);
+        att_server_register_can_send_now_callback(&notification_callbacks[i], CON_HANDLE_BASE + i);
+    }
+
+#if ATT_SERVER_MAX_OUTGOING_PACKETS_PER_CONNECTION > 0
+    printf("%u connections, %u ACL buffers, connection 0x%04x stalled, packet limit per connection: %u\n",
+        NUM_CONNECTIONS, NUM_ACL_BUFFERS, CON_HANDLE_STALLED, ATT_SERVER_MAX_OUTGOING_PACKETS_PER_CONNECTION);
+#else
+    printf("%u connections, %u ACL buffers, connection 0x%04x stalled, one buffer reserved per other connection\n",
+        NUM_CONNECTIONS, NUM_ACL_BUFFERS, CON_HANDLE_STALLED);
+#endif
+    uint32_t total_completed = 0;
+    int period;
+    for (period=0;period<NUM_PERIODS;period++){
+        memset(notifications_completed, 0, sizeof(notifications_completed));
+        int tick;
+        for (tick=0;tick<NUM_TICKS;tick++){
+            controller_tick();
+        }
+        uint32_t completed = 0;
+        uint32_t min_completed = 0xffffffff;
+        uint32_t max_completed = 0;
+        for (i=0;i<NUM_CONNECTIONS;i++){
+            if (CON_HANDLE_BASE + i == CON_HANDLE_STALLED) continue;
+            completed += notifications_completed[i];
+            if (notifications_completed[i] < min_completed) min_completed = notifications_completed[i];
+            if (notifications_completed[i] > max_completed) max_completed = notifications_completed[i];
+        }
+        total_completed += completed;
+        printf("ticks %6u - %6u: %5.3f notifications per tick, per connection min %u / max %u\n",
+            period * NUM_TICKS, (period + 1) * NUM_TICKS, (double) completed / NUM_TICKS, min_completed, max_completed);
+    }
+    double aggregate = (double) total_completed / (NUM_TICKS * NUM_PERIODS);
+    printf("aggregate: %5.3f notifications per tick\n", aggregate);
+    // stalled connection must not block the others
+    if (aggregate < MIN_AGGREGATE_NOTIFICATIONS_PER_TICK){
+        printf("aggregate below %5.3f\n", MIN_AGGREGATE_NOTIFICATIONS_PER_TICK);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,168 @@
+/*
+ * Copyright (C) 2017 BlueKitchen GmbH
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ * 4. Any redistribution, use, or modification is done solely for
+ *    personal benefit and not for any commercial purpose or for
+ *    monetary gain.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BLUEKITCHEN GMBH AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL MATTHIAS
+ * RINGWALD OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Please inquire about commercial licensing options at 
+ * contact@bluekitchen-gmbh.com
+ *
+ */
+
+/*
+ *  att_server_notification_queue_test.c
+ *
+ *  Checks queueing and coalescing of notifications in att_server_notify with ENABLE_ATT_SERVER_NOTIFICATION_QUEUE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "btstack_config.h"
+#include "btstack_memory.h"
+#include "btstack_run_loop.h"
+#include "btstack_run_loop_posix.h"
+#include "ble/att_server.h"
+#include "bluetooth.h"
+#include "hci.h"
+#include "l2cap.h"
+#include "mock_controller.h"
+
+#define NUM_ACL_BUFFERS 2
+#define CON_HANDLE      0x0040
+
+#define CHECK_EQUAL(expected, actual) check_equal(expected, actual, __LINE__)
+
+static const uint8_t profile_data[] = { 0x00, 0x00 };
+
+// notifications sent to Controller: attribute handle and first value byte
+static uint16_t sent_attribute_handles[16];
+static uint8_t  sent_values[16];
+static int      sent_num;
+static int      failures;
+
+static void check_equal(int expected, int actual, int line){
+    if (expected == actual) return;
+    printf("line %u: expected %d, got %d\n", line, expected, actual);
+    failures++;
+}
+
+static void acl_packet_handler(uint8_t * packet, uint16_t size){
+    (void) size;
+    // skip ACL and L2CAP header
+    if (packet[8] != ATT_HANDLE_VALUE_NOTIFICATION) return;
+    sent_attribute_handles[sent_num] = little_endian_read_16(packet, 9);
+    sent_values[sent_num] = packet[11];
+    sent_num++;
+}
+
+static int notify(uint16_t attribute_handle, uint8_t value){
+    uint8_t buffer[4];
+    memset(buffer, value, sizeof(buffer));
+    return att_server_notify(CON_HANDLE, attribute_handle, buffer, sizeof(buffer));
+}
+
+static void complete_all_packets(void){
+    while (mock_controller_complete_packet(HCI_CON_HANDLE_INVALID) != HCI_CON_HANDLE_INVALID);
+}
+
+int main(void){
+    btstack_memory_init();
+    btstack_run_loop_init(btstack_run_loop_posix_get_instance());
+    mock_controller_init(NUM_ACL_BUFFERS);
+    mock_controller_register_acl_packet_handler(&acl_packet_handler);
+    l2cap_init();
+    att_server_init(profile_data, NULL, NULL);
+    if (mock_controller_power_on()){
+        printf("HCI init failed\n");
+        return 1;
+    }
+    mock_controller_create_le_connection(CON_HANDLE);
+
+    // sent directly
+    CHECK_EQUAL(0, notify(0x0003, 1));
+    CHECK_EQUAL(0, notify(0x0005, 2));
+    CHECK_EQUAL(2, sent_num);
+
+    // Controller full, queue
+    CHECK_EQUAL(0, notify(0x0003, 3));
+    CHECK_EQUAL(0, notify(0x0005, 4));
+    CHECK_EQUAL(0, notify(0x0003, 5));
+    CHECK_EQUAL(0, notify(0x0007, 6));
+    CHECK_EQUAL(2, sent_num);
+
+    // value too long for queue is rejected, not truncated
+    uint8_t long_value[ATT_SERVER_NOTIFICATION_QUEUE_VALUE_SIZE + 1];
+    memset(long_value, 0x55, sizeof(long_value));
+    CHECK_EQUAL(ERROR_CODE_INVALID_HCI_COMMAND_PARAMETERS, att_server_notify(CON_HANDLE, 0x0003, long_value, sizeof(long_value)));
+
+#ifdef ENABLE_ATT_SERVER_NOTIFICATION_COALESCING
+    // 0x0003 updated in place
+    CHECK_EQUAL(0, notify(0x0009, 7));
+    CHECK_EQUAL(BTSTACK_ACL_BUFFERS_FULL, notify(0x000b, 8));
+#else
+    CHECK_EQUAL(BTSTACK_ACL_BUFFERS_FULL, notify(0x0009, 7));
+#endif
+
+    // drain as packets complete
+    mock_controller_complete_packet(HCI_CON_HANDLE_INVALID);
+    CHECK_EQUAL(3, sent_num);
+    complete_all_packets();
+    CHECK_EQUAL(6, sent_num);
+#ifdef ENABLE_ATT_SERVER_NOTIFICATION_COALESCING
+    const uint16_t expected_handles[] = { 0x0003, 0x0005, 0x0003, 0x0005, 0x0007, 0x0009 };
+    const uint8_t  expected_values[]  = { 1, 2, 5, 4, 6, 7 };
+#else
+    const uint16_t expected_handles[] = { 0x0003, 0x0005, 0x0003, 0x0005, 0x0003, 0x0007 };
+    const uint8_t  expected_values[]  = { 1, 2, 3, 4, 5, 6 };
+#endif
+    int i;
+    for (i=0;i<6;i++){
+        CHECK_EQUAL(expected_handles[i], sent_attribute_handles[i]);
+        CHECK_EQUAL(expected_values[i], sent_values[i]);
+    }
+
+    // queue empty, send directly again
+    CHECK_EQUAL(0, notify(0x0003, 9));
+    CHECK_EQUAL(7, sent_num);
+    CHECK_EQUAL(9, sent_values[6]);
+
+    if (failures){
+        printf("%u checks failed\n", failures);
+        return 1;
+    }
+#ifdef ENABLE_ATT_SERVER_NOTIFICATION_COALESCING
+    printf("notification queue with coalescing: OK\n");
+#else
+    printf("notification queue: OK\n");
+#endif
+    return 0;
+}
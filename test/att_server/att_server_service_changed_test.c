@@ -0,0 +1,194 @@
+/*
+ * Copyright (C) 2017 BlueKitchen GmbH
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ * 4. Any redistribution, use, or modification is done solely for
+ *    personal benefit and not for any commercial purpose or for
+ *    monetary gain.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BLUEKITCHEN GMBH AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL MATTHIAS
+ * RINGWALD OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Please inquire about commercial licensing options at 
+ * contact@bluekitchen-gmbh.com
+ *
+ */
+
+/*
+ *  att_server_service_changed_test.c
+ *
+ *  Checks that ATT Server indicates Service Changed to subscribed clients after the ATT DB was modified
+ *  with att_db_util, with a single indication in flight per connection.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "btstack_config.h"
+#include "btstack_memory.h"
+#include "btstack_run_loop.h"
+#include "btstack_run_loop_posix.h"
+#include "ble/att_db_util.h"
+#include "ble/att_server.h"
+#include "bluetooth.h"
+#include "bluetooth_gatt.h"
+#include "hci.h"
+#include "l2cap.h"
+#include "mock_controller.h"
+
+#define NUM_ACL_BUFFERS 4
+#define CON_HANDLE_A    0x0040
+#define CON_HANDLE_B    0x0041
+
+#define CHECK_EQUAL(expected, actual) check_equal(expected, actual, __LINE__)
+
+// Service Changed indications sent to Controller
+static hci_con_handle_t sent_con_handles[8];
+static uint16_t sent_start_handles[8];
+static uint16_t sent_end_handles[8];
+static int      sent_num;
+static int      failures;
+
+static uint16_t service_changed_value_handle;
+static uint16_t service_changed_configuration_handle;
+
+static void check_equal(int expected, int actual, int line){
+    if (expected == actual) return;
+    printf("line %u: expected %d, got %d\n", line, expected, actual);
+    failures++;
+}
+
+static void acl_packet_handler(uint8_t * packet, uint16_t size){
+    (void) size;
+    // skip ACL and L2CAP header
+    if (packet[8] != ATT_HANDLE_VALUE_INDICATION) return;
+    if (little_endian_read_16(packet, 9) != service_changed_value_handle) return;
+    sent_con_handles[sent_num] = little_endian_read_16(packet, 0) & 0x0fff;
+    sent_start_handles[sent_num] = little_endian_read_16(packet, 11);
+    sent_end_handles[sent_num] = little_endian_read_16(packet, 13);
+    sent_num++;
+}
+
+static int att_write_callback(hci_con_handle_t con_handle, uint16_t attribute_handle, uint16_t transaction_mode, uint16_t offset, uint8_t *buffer, uint16_t buffer_size){
+    (void) con_handle;
+    (void) attribute_handle;
+    (void) transaction_mode;
+    (void) offset;
+    (void) buffer;
+    (void) buffer_size;
+    return 0;
+}
+
+static void complete_all_packets(void){
+    while (mock_controller_complete_packet(HCI_CON_HANDLE_INVALID) != HCI_CON_HANDLE_INVALID);
+}
+
+static void write_service_changed_configuration(hci_con_handle_t con_handle, uint16_t configuration){
+    uint8_t pdu[5];
+    pdu[0] = ATT_WRITE_REQUEST;
+    little_endian_store_16(pdu, 1, service_changed_configuration_handle);
+    little_endian_store_16(pdu, 3, configuration);
+    mock_controller_receive_att_pdu(con_handle, pdu, sizeof(pdu));
+    complete_all_packets();
+}
+
+static void confirm_indication(hci_con_handle_t con_handle){
+    uint8_t pdu[1] = { ATT_HANDLE_VALUE_CONFIRMATION };
+    mock_controller_receive_att_pdu(con_handle, pdu, sizeof(pdu));
+    complete_all_packets();
+}
+
+int main(void){
+    uint8_t value[1] = { 0 };
+    att_db_util_init();
+    att_db_util_add_service_uuid16(ORG_BLUETOOTH_SERVICE_GENERIC_ATTRIBUTE);
+    service_changed_value_handle = att_db_util_add_characteristic_uuid16(ORG_BLUETOOTH_CHARACTERISTIC_GATT_SERVICE_CHANGED, ATT_PROPERTY_INDICATE, NULL, 0);
+    service_changed_configuration_handle = service_changed_value_handle + 1;
+    uint16_t battery_service_handle = att_db_util_add_service_uuid16(ORG_BLUETOOTH_SERVICE_BATTERY_SERVICE);
+    att_db_util_add_characteristic_uuid16(ORG_BLUETOOTH_CHARACTERISTIC_BATTERY_LEVEL, ATT_PROPERTY_READ, value, sizeof(value));
+    uint16_t device_information_service_handle = att_db_util_add_service_uuid16(ORG_BLUETOOTH_SERVICE_DEVICE_INFORMATION);
+    att_db_util_add_characteristic_uuid16(ORG_BLUETOOTH_CHARACTERISTIC_MANUFACTURER_NAME_STRING, ATT_PROPERTY_READ, value, sizeof(value));
+
+    btstack_memory_init();
+    btstack_run_loop_init(btstack_run_loop_posix_get_instance());
+    mock_controller_init(NUM_ACL_BUFFERS);
+    mock_controller_register_acl_packet_handler(&acl_packet_handler);
+    l2cap_init();
+    att_server_init(att_db_util_get_address(), NULL, &att_write_callback);
+    if (mock_controller_power_on()){
+        printf("HCI init failed\n");
+        return 1;
+    }
+    mock_controller_create_le_connection(CON_HANDLE_A);
+    mock_controller_create_le_connection(CON_HANDLE_B);
+
+    // only A enables indications, B enables notifications
+    write_service_changed_configuration(CON_HANDLE_A, GATT_CLIENT_CHARACTERISTICS_CONFIGURATION_INDICATION);
+    write_service_changed_configuration(CON_HANDLE_B, GATT_CLIENT_CHARACTERISTICS_CONFIGURATION_NOTIFICATION);
+    CHECK_EQUAL(0, sent_num);
+
+    // removed service indicated right away
+    uint16_t battery_end_handle = att_db_util_remove_service(battery_service_handle);
+    complete_all_packets();
+    CHECK_EQUAL(1, sent_num);
+    CHECK_EQUAL(CON_HANDLE_A, sent_con_handles[0]);
+    CHECK_EQUAL(battery_service_handle, sent_start_handles[0]);
+    CHECK_EQUAL(battery_end_handle, sent_end_handles[0]);
+
+    // further changes wait for confirmation and are merged
+    att_db_util_replace_service_begin(device_information_service_handle);
+    att_db_util_add_service_uuid16(ORG_BLUETOOTH_SERVICE_DEVICE_INFORMATION);
+    att_db_util_add_characteristic_uuid16(ORG_BLUETOOTH_CHARACTERISTIC_MANUFACTURER_NAME_STRING, ATT_PROPERTY_READ, value, sizeof(value));
+    att_db_util_add_characteristic_uuid16(ORG_BLUETOOTH_CHARACTERISTIC_MODEL_NUMBER_STRING, ATT_PROPERTY_READ, value, sizeof(value));
+    att_db_util_replace_service_end();
+    complete_all_packets();
+    CHECK_EQUAL(1, sent_num);
+    uint16_t first_changed_handle = att_db_util_compact_handles();
+    CHECK_EQUAL(battery_service_handle, first_changed_handle);
+    complete_all_packets();
+    CHECK_EQUAL(1, sent_num);
+
+    confirm_indication(CON_HANDLE_A);
+    CHECK_EQUAL(2, sent_num);
+    CHECK_EQUAL(CON_HANDLE_A, sent_con_handles[1]);
+    CHECK_EQUAL(battery_service_handle, sent_start_handles[1]);
+    CHECK_EQUAL(0xffff, sent_end_handles[1]);
+    confirm_indication(CON_HANDLE_A);
+    CHECK_EQUAL(2, sent_num);
+
+    // disabled again
+    write_service_changed_configuration(CON_HANDLE_A, 0);
+    att_db_util_remove_service(battery_service_handle);
+    complete_all_packets();
+    CHECK_EQUAL(2, sent_num);
+
+    if (failures){
+        printf("%u checks failed\n", failures);
+        return 1;
+    }
+    printf("service changed: OK\n");
+    return 0;
+}
@@ -0,0 +1,223 @@
+/*
+ * Copyright (C) 2017 BlueKitchen GmbH
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ * 4. Any redistribution, use, or modification is done solely for
+ *    personal benefit and not for any commercial purpose or for
+ *    monetary gain.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BLUEKITCHEN GMBH AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL MATTHIAS
+ * RINGWALD OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Please inquire about commercial licensing options at 
+ * contact@bluekitchen-gmbh.com
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mock_controller.h"
+
+#include "btstack_config.h"
+#include "btstack_event.h"
+#include "ble/sm.h"
+
+#define MAX_NUM_PACKETS 64
+
+static void (*transport_packet_handler)(uint8_t packet_type, uint8_t *packet, uint16_t size);
+static void (*acl_packet_handler)(uint8_t * packet, uint16_t size);
+static uint8_t  pending_event[80];
+static uint16_t pending_event_len;
+static uint16_t acl_buffers_num;
+static btstack_packet_callback_registration_t * sm_event_callback_registration;
+
+// ACL packets in Controller
+static hci_con_handle_t controller_packets[MAX_NUM_PACKETS];
+static int              controller_packets_num;
+
+// SM stubs, ATT Server only uses them for security properties
+void sm_add_event_handler(btstack_packet_callback_registration_t * callback_handler){
+    sm_event_callback_registration = callback_handler;
+}
+int sm_encryption_key_size(hci_con_handle_t con_handle){
+    (void) con_handle;
+    return 0;
+}
+int sm_authenticated(hci_con_handle_t con_handle){
+    (void) con_handle;
+    return 0;
+}
+authorization_state_t sm_authorization_state(hci_con_handle_t con_handle){
+    (void) con_handle;
+    return AUTHORIZATION_UNKNOWN;
+}
+void sm_request_pairing(hci_con_handle_t con_handle){
+    (void) con_handle;
+}
+
+static void transport_register_packet_handler(void (*handler)(uint8_t packet_type, uint8_t *packet, uint16_t size)){
+    transport_packet_handler = handler;
+}
+
+static int transport_send_packet(uint8_t packet_type, uint8_t *packet, int size){
+    if (packet_type == HCI_ACL_DATA_PACKET){
+        if (controller_packets_num == acl_buffers_num){
+            printf("Controller buffer overrun\n");
+            exit(1);
+        }
+        controller_packets[controller_packets_num++] = little_endian_read_16(packet, 0) & 0x0fff;
+        if (acl_packet_handler){
+            (*acl_packet_handler)(packet, size);
+        }
+        return 0;
+    }
+    if (packet_type != HCI_COMMAND_DATA_PACKET) return 0;
+    // prepare Command Complete event with success status
+    uint16_t opcode = little_endian_read_16(packet, 0);
+    memset(pending_event, 0, sizeof(pending_event));
+    pending_event[0] = HCI_EVENT_COMMAND_COMPLETE;
+    pending_event[2] = 1;
+    little_endian_store_16(pending_event, 3, opcode);
+    pending_event_len = 22;
+    if (opcode == hci_read_local_supported_commands.opcode){
+        memset(&pending_event[6], 0xff, 64);
+        pending_event_len = 70;
+    }
+    if (opcode == hci_read_buffer_size.opcode){
+        little_endian_store_16(pending_event, 6, HCI_ACL_PAYLOAD_SIZE);
+        pending_event[8] = 64;
+        little_endian_store_16(pending_event,  9, acl_buffers_num);
+        little_endian_store_16(pending_event, 11, 8);
+    }
+    pending_event[1] = pending_event_len - 2;
+    return 0;
+}
+
+static int transport_open(void){
+    return 0;
+}
+
+static int transport_close(void){
+    return 0;
+}
+
+static void transport_init(const void * transport_config){
+    (void) transport_config;
+}
+
+static const hci_transport_t transport = {
+    "mock",
+    &transport_init,
+    &transport_open,
+    &transport_close,
+    &transport_register_packet_handler,
+    NULL,
+    &transport_send_packet,
+    NULL,
+    NULL,
+    NULL,
+};
+
+static void deliver_pending_events(void){
+    while (pending_event_len){
+        uint8_t event[sizeof(pending_event)];
+        uint16_t len = pending_event_len;
+        memcpy(event, pending_event, len);
+        pending_event_len = 0;
+        transport_packet_handler(HCI_EVENT_PACKET, event, len);
+    }
+}
+
+void mock_controller_init(uint16_t num_acl_buffers){
+    acl_buffers_num = num_acl_buffers;
+    if (acl_buffers_num > MAX_NUM_PACKETS){
+        acl_buffers_num = MAX_NUM_PACKETS;
+    }
+    hci_init(&transport, NULL);
+}
+
+int mock_controller_power_on(void){
+    hci_power_control(HCI_POWER_ON);
+    deliver_pending_events();
+    return hci_get_state() == HCI_STATE_WORKING ? 0 : 1;
+}
+
+void mock_controller_create_le_connection(hci_con_handle_t con_handle){
+    uint8_t event[21];
+    memset(event, 0, sizeof(event));
+    event[0] = HCI_EVENT_LE_META;
+    event[1] = sizeof(event) - 2;
+    event[2] = HCI_SUBEVENT_LE_CONNECTION_COMPLETE;
+    little_endian_store_16(event, 4, con_handle);
+    event[6] = HCI_ROLE_SLAVE;
+    // use con handle as peer address
+    little_endian_store_16(event, 8, con_handle);
+    transport_packet_handler(HCI_EVENT_PACKET, event, sizeof(event));
+    deliver_pending_events();
+}
+
+void mock_controller_register_acl_packet_handler(void (*handler)(uint8_t * packet, uint16_t size)){
+    acl_packet_handler = handler;
+}
+
+void mock_controller_receive_att_pdu(hci_con_handle_t con_handle, const uint8_t * pdu, uint16_t len){
+    uint8_t packet[8 + HCI_ACL_PAYLOAD_SIZE];
+    if (len > HCI_ACL_PAYLOAD_SIZE - 4){
+        printf("ATT PDU too long\n");
+        exit(1);
+    }
+    // first automatically flushable packet
+    little_endian_store_16(packet, 0, con_handle | 0x2000);
+    little_endian_store_16(packet, 2, len + 4);
+    little_endian_store_16(packet, 4, len);
+    little_endian_store_16(packet, 6, L2CAP_CID_ATTRIBUTE_PROTOCOL);
+    memcpy(&packet[8], pdu, len);
+    transport_packet_handler(HCI_ACL_DATA_PACKET, packet, len + 8);
+}
+
+void mock_controller_emit_sm_event(uint8_t * event, uint16_t len){
+    if (!sm_event_callback_registration) return;
+    (*sm_event_callback_registration->callback)(HCI_EVENT_PACKET, 0, event, len);
+}
+
+int mock_controller_num_packets(void){
+    return controller_packets_num;
+}
+
+hci_con_handle_t mock_controller_complete_packet(hci_con_handle_t skipped_con_handle){
+    int i;
+    for (i=0;i<controller_packets_num;i++){
+        hci_con_handle_t con_handle = controller_packets[i];
+        if (con_handle == skipped_con_handle) continue;
+        memmove(&controller_packets[i], &controller_packets[i+1], (controller_packets_num - i - 1) * sizeof(hci_con_handle_t));
+        controller_packets_num--;
+        uint8_t event[] = { HCI_EVENT_NUMBER_OF_COMPLETED_PACKETS, 5, 1, 0, 0, 1, 0};
+        little_endian_store_16(event, 3, con_handle);
+        transport_packet_handler(HCI_EVENT_PACKET, event, sizeof(event));
+        return con_handle;
+    }
+    return HCI_CON_HANDLE_INVALID;
+}
@@ -0,0 +1,87 @@
+/*
+ * Copyright (C) 2017 BlueKitchen GmbH
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ * 4. Any redistribution, use, or modification is done solely for
+ *    personal benefit and not for any commercial purpose or for
+ *    monetary gain.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BLUEKITCHEN GMBH AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL MATTHIAS
+ * RINGWALD OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Please inquire about commercial licensing options at 
+ * contact@bluekitchen-gmbh.com
+ *
+ */
+
+/*
+ *  mock_controller.h
+ *
+ *  Fake HCI transport for ATT Server tests. Answers every HCI Command with a Command Complete event
+ *  and keeps outgoing ACL packets in the Controller until they get completed by the test.
+ */
+
+#ifndef MOCK_CONTROLLER_H
+#define MOCK_CONTROLLER_H
+
+#include <stdint.h>
+#include "hci.h"
+
+/*
+ * @brief init HCI with fake transport and given number of Controller ACL buffers
+ */
+void mock_controller_init(uint16_t num_acl_buffers);
+
+/*
+ * @brief power on HCI, call after l2cap_init and att_server_init
+ * @return 0 if HCI is working
+ */
+int mock_controller_power_on(void);
+
+/*
+ * @brief emit LE Connection Complete for given handle
+ */
+void mock_controller_create_le_connection(hci_con_handle_t con_handle);
+
+/*
+ * @brief register handler for ACL packets sent to Controller
+ */
+void mock_controller_register_acl_packet_handler(void (*handler)(uint8_t * packet, uint16_t size));
+
+/*
+ * @brief get number of ACL packets in Controller
+ */
+void mock_controller_receive_att_pdu(hci_con_handle_t con_handle, const uint8_t * pdu, uint16_t len);
+
+void mock_controller_emit_sm_event(uint8_t * event, uint16_t len);
+
+int mock_controller_num_packets(void);
+
+/*
+ * @brief complete oldest packet in Controller that was not sent on skipped connection
+ * @return handle of completed packet or HCI_CON_HANDLE_INVALID
+ */
+hci_con_handle_t mock_controller_complete_packet(hci_con_handle_t skipped_con_handle);
+
+#endif
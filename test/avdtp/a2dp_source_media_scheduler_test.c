@@ -0,0 +1,516 @@
+/*
+ * Copyright (C) 2017 BlueKitchen GmbH
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ * 4. Any redistribution, use, or modification is done solely for
+ *    personal benefit and not for any commercial purpose or for
+ *    monetary gain.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BLUEKITCHEN GMBH AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL MATTHIAS
+ * RINGWALD OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Please inquire about commercial licensing options at
+ * contact@bluekitchen-gmbh.com
+ *
+ */
+
+/*
+ *  a2dp_source_media_scheduler_test.c
+ *
+ *  Runs the A2DP Source media scheduler against a simulated run loop and media channel.
+ *  Checks pacing, RTP header, bounded queue, underrun handling and adaptive bitpool. AVDTP, L2CAP and SDP are stubbed.
+ */
+
+#include "a2dp_source.c"
+
+#define CHECK_EQUAL(expected, actual) check_equal(expected, actual, __LINE__)
+#define CHECK(condition)              check_equal(1, (condition) ? 1 : 0, __LINE__)
+
+#define A2DP_CID        7
+#define LOCAL_SEID      1
+#define MEDIA_CID       0x41
+#define SAMPLES_PER_SBC_FRAME 128
+
+static int failures;
+
+// simulated time and run loop with a single timer
+static uint32_t now_ms;
+static btstack_timer_source_t * active_timer;
+
+// media channel
+static uint8_t  media_packet[1024];
+static uint16_t remote_mtu = 895;
+static int      can_send_now_pending;
+static int      num_media_packets;
+static uint16_t last_sequence_number;
+static uint32_t last_timestamp;
+static int      last_num_frames;
+static int      acl_backlog;
+static uint16_t acl_data_packet_length = 1021;
+
+// application
+static int fill_calls;
+static int fill_limit = -1;
+static int num_underrun_events;
+static int num_bitpool_events;
+static int last_bitpool;
+static int last_backlog;
+static int min_bitpool;
+
+static void check_equal(int expected, int actual, int line){
+    if (expected == actual) return;
+    printf("line %u: expected %d, got %d\n", line, expected, actual);
+    failures++;
+}
+
+// stubs
+void btstack_run_loop_set_timer_handler(btstack_timer_source_t * ts, void (*process)(btstack_timer_source_t * _ts)){
+    ts->process = process;
+}
+void btstack_run_loop_set_timer(btstack_timer_source_t * ts, uint32_t timeout_in_ms){
+    ts->timeout = now_ms + timeout_in_ms;
+}
+void btstack_run_loop_add_timer(btstack_timer_source_t * ts){
+    active_timer = ts;
+}
+int btstack_run_loop_remove_timer(btstack_timer_source_t * ts){
+    if (active_timer != ts) return 0;
+    active_timer = NULL;
+    return 1;
+}
+uint32_t btstack_run_loop_get_time_ms(void){
+    return now_ms;
+}
+void hci_dump_log(int log_level, const char * format, ...){
+    (void) log_level;
+    (void) format;
+}
+int hci_number_outgoing_acl_packets_for_handle(hci_con_handle_t con_handle){
+    (void) con_handle;
+    return acl_backlog;
+}
+uint16_t hci_max_acl_data_packet_length(void){
+    return acl_data_packet_length;
+}
+int l2cap_reserve_packet_buffer(void){
+    return 1;
+}
+uint8_t * l2cap_get_outgoing_buffer(void){
+    return media_packet;
+}
+uint16_t l2cap_get_remote_mtu_for_local_cid(uint16_t local_cid){
+    (void) local_cid;
+    return remote_mtu;
+}
+uint8_t l2cap_register_service(btstack_packet_handler_t handler, uint16_t psm, uint16_t mtu, gap_security_level_t security_level){
+    (void) handler; (void) psm; (void) mtu; (void) security_level;
+    return 0;
+}
+int l2cap_send_prepared(uint16_t local_cid, uint16_t len){
+    (void) local_cid;
+    CHECK(len <= remote_mtu);
+    uint16_t sequence_number = big_endian_read_16(media_packet, 2);
+    uint32_t timestamp = big_endian_read_32(media_packet, 4);
+    int num_frames = media_packet[AVDTP_MEDIA_PAYLOAD_HEADER_SIZE] & 0x0f;
+    CHECK(num_frames > 0);
+    if (num_media_packets){
+        CHECK_EQUAL((uint16_t) (last_sequence_number + 1), sequence_number);
+        // RTP timestamp counts samples
+        CHECK_EQUAL(last_timestamp + last_num_frames * SAMPLES_PER_SBC_FRAME, timestamp);
+    }
+    // payload consists of complete SBC frames
+    int pos = AVDTP_MEDIA_PAYLOAD_HEADER_SIZE + A2DP_SBC_MEDIA_PAYLOAD_HEADER_SIZE;
+    int i;
+    for (i = 0; i < num_frames && pos < len; i++){
+        CHECK_EQUAL(0x9c, media_packet[pos]);
+        pos += a2dp_source_sbc_frame_length(media_packet[pos + 2]);
+    }
+    CHECK_EQUAL(len, pos);
+    last_sequence_number = sequence_number;
+    last_timestamp = timestamp;
+    last_num_frames = num_frames;
+    num_media_packets++;
+    return 0;
+}
+void avdtp_request_can_send_now_initiator(avdtp_connection_t * connection, uint16_t l2cap_cid){
+    (void) connection;
+    (void) l2cap_cid;
+    CHECK_EQUAL(0, can_send_now_pending);
+    can_send_now_pending = 1;
+}
+uint8_t avdtp_stream_endpoint_seid(avdtp_stream_endpoint_t * stream_endpoint){
+    (void) stream_endpoint;
+    return LOCAL_SEID;
+}
+avdtp_stream_endpoint_t * avdtp_stream_endpoint_for_seid(uint16_t seid, avdtp_context_t * context){
+    (void) seid;
+    (void) context;
+    return sc.local_stream_endpoint;
+}
+
+// not used by media scheduler
+void a2dp_streaming_emit_connection_established(btstack_packet_handler_t callback, uint16_t cid, bd_addr_t addr, uint8_t local_seid, uint8_t remote_seid, uint8_t status){
+    (void) callback; (void) cid; (void) addr; (void) local_seid; (void) remote_seid; (void) status;
+}
+uint8_t avdtp_choose_sbc_allocation_method(avdtp_stream_endpoint_t * stream_endpoint, uint8_t remote_allocation_method_bitmap){
+    (void) stream_endpoint; (void) remote_allocation_method_bitmap;
+    return 0;
+}
+uint8_t avdtp_choose_sbc_block_length(avdtp_stream_endpoint_t * stream_endpoint, uint8_t remote_block_length_bitmap){
+    (void) stream_endpoint; (void) remote_block_length_bitmap;
+    return 0;
+}
+uint8_t avdtp_choose_sbc_channel_mode(avdtp_stream_endpoint_t * stream_endpoint, uint8_t remote_channel_mode_bitmap){
+    (void) stream_endpoint; (void) remote_channel_mode_bitmap;
+    return 0;
+}
+uint8_t avdtp_choose_sbc_max_bitpool_value(avdtp_stream_endpoint_t * stream_endpoint, uint8_t remote_max_bitpool_value){
+    (void) stream_endpoint; (void) remote_max_bitpool_value;
+    return 0;
+}
+uint8_t avdtp_choose_sbc_min_bitpool_value(avdtp_stream_endpoint_t * stream_endpoint, uint8_t remote_min_bitpool_value){
+    (void) stream_endpoint; (void) remote_min_bitpool_value;
+    return 0;
+}
+uint8_t avdtp_choose_sbc_sampling_frequency(avdtp_stream_endpoint_t * stream_endpoint, uint8_t remote_sampling_frequency_bitmap){
+    (void) stream_endpoint; (void) remote_sampling_frequency_bitmap;
+    return 0;
+}
+uint8_t avdtp_choose_sbc_subbands(avdtp_stream_endpoint_t * stream_endpoint, uint8_t remote_subbands_bitmap){
+    (void) stream_endpoint; (void) remote_subbands_bitmap;
+    return 0;
+}
+uint8_t avdtp_disconnect(uint16_t avdtp_cid, avdtp_context_t * context){
+    (void) avdtp_cid; (void) context;
+    return 0;
+}
+uint8_t avdtp_source_connect(bd_addr_t remote, uint16_t * avdtp_cid){
+    (void) remote; (void) avdtp_cid;
+    return 0;
+}
+avdtp_stream_endpoint_t * avdtp_source_create_stream_endpoint(avdtp_sep_type_t sep_type, avdtp_media_type_t media_type){
+    (void) sep_type; (void) media_type;
+    return NULL;
+}
+void avdtp_source_discover_stream_endpoints(uint16_t avdtp_cid){
+    (void) avdtp_cid;
+}
+void avdtp_source_get_capabilities(uint16_t avdtp_cid, uint8_t remote_seid){
+    (void) avdtp_cid; (void) remote_seid;
+}
+void avdtp_source_get_configuration(uint16_t avdtp_cid, uint8_t remote_seid){
+    (void) avdtp_cid; (void) remote_seid;
+}
+void avdtp_source_init(avdtp_context_t * avdtp_context){
+    (void) avdtp_context;
+}
+uint8_t avdtp_source_open_stream(uint16_t avdtp_cid, uint8_t local_seid, uint8_t remote_seid){
+    (void) avdtp_cid; (void) local_seid; (void) remote_seid;
+    return 0;
+}
+void avdtp_source_register_media_codec_category(uint8_t seid, avdtp_media_type_t media_type, avdtp_media_codec_type_t media_codec_type, uint8_t * media_codec_info, uint16_t media_codec_info_len){
+    (void) seid; (void) media_type; (void) media_codec_type; (void) media_codec_info; (void) media_codec_info_len;
+}
+void avdtp_source_register_media_transport_category(uint8_t seid){
+    (void) seid;
+}
+void avdtp_source_register_packet_handler(btstack_packet_handler_t callback){
+    (void) callback;
+}
+avdtp_sep_t * avdtp_source_remote_sep(uint16_t avdtp_cid, uint8_t index){
+    (void) avdtp_cid; (void) index;
+    return NULL;
+}
+uint8_t avdtp_source_remote_seps_num(uint16_t avdtp_cid){
+    (void) avdtp_cid;
+    return 0;
+}
+void avdtp_source_set_configuration(uint16_t avdtp_cid, uint8_t local_seid, uint8_t remote_seid, uint16_t configured_services_bitmap, avdtp_capabilities_t configuration){
+    (void) avdtp_cid; (void) local_seid; (void) remote_seid; (void) configured_services_bitmap; (void) configuration;
+}
+uint8_t avdtp_start_stream(uint16_t avdtp_cid, uint8_t local_seid, avdtp_context_t * context){
+    (void) avdtp_cid; (void) local_seid; (void) context;
+    return 0;
+}
+uint8_t avdtp_suspend_stream(uint16_t avdtp_cid, uint8_t local_seid, avdtp_context_t * context){
+    (void) avdtp_cid; (void) local_seid; (void) context;
+    return 0;
+}
+uint8_t store_bit16(uint16_t bitmap, int position, uint8_t value){
+    (void) position; (void) value;
+    return bitmap;
+}
+void de_create_sequence(uint8_t * header){
+    (void) header;
+}
+uint8_t * de_push_sequence(uint8_t * sequence){
+    (void) sequence;
+    return NULL;
+}
+void de_pop_sequence(uint8_t * parent, uint8_t * child){
+    (void) parent; (void) child;
+}
+void de_add_number(uint8_t * sequence, de_type_t type, de_size_t size, uint32_t value){
+    (void) sequence; (void) type; (void) size; (void) value;
+}
+void de_add_data(uint8_t * sequence, de_type_t type, uint16_t size, uint8_t * data){
+    (void) sequence; (void) type; (void) size; (void) data;
+}
+
+// application
+static int fill_pcm(int16_t * pcm_buffer, int num_audio_frames, void * context){
+    (void) context;
+    fill_calls++;
+    if (fill_limit >= 0 && fill_calls > fill_limit) return 0;
+    int i;
+    for (i = 0; i < num_audio_frames * 2; i++){
+        pcm_buffer[i] = (int16_t) ((fill_calls * 997 + i * 131) & 0x3fff);
+    }
+    return 1;
+}
+
+static void a2dp_packet_handler(uint8_t packet_type, uint16_t channel, uint8_t * packet, uint16_t size){
+    (void) packet_type;
+    (void) channel;
+    switch (packet[2]){
+        case A2DP_SUBEVENT_MEDIA_SCHEDULER_UNDERRUN:
+            num_underrun_events++;
+            CHECK_EQUAL(12, size);
+            CHECK_EQUAL(A2DP_CID, a2dp_subevent_media_scheduler_underrun_get_a2dp_cid(packet));
+            CHECK_EQUAL(num_underrun_events, a2dp_subevent_media_scheduler_underrun_get_underruns(packet));
+            break;
+        case A2DP_SUBEVENT_MEDIA_SCHEDULER_BITPOOL_CHANGED:
+            num_bitpool_events++;
+            // event format 121111
+            CHECK_EQUAL(9, size);
+            CHECK_EQUAL(size - 2, packet[1]);
+            CHECK_EQUAL(A2DP_CID, a2dp_subevent_media_scheduler_bitpool_changed_get_a2dp_cid(packet));
+            CHECK_EQUAL(LOCAL_SEID, a2dp_subevent_media_scheduler_bitpool_changed_get_local_seid(packet));
+            CHECK_EQUAL(last_bitpool, a2dp_subevent_media_scheduler_bitpool_changed_get_previous_bitpool(packet));
+            last_bitpool = a2dp_subevent_media_scheduler_bitpool_changed_get_bitpool(packet);
+            last_backlog = a2dp_subevent_media_scheduler_bitpool_changed_get_backlog(packet);
+            if (last_bitpool < min_bitpool){
+                min_bitpool = last_bitpool;
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+// advance time by 1 ms steps, deliver can send now if media channel is not congested
+static void run_until(uint32_t time_ms, int media_channel_ready){
+    while (now_ms < time_ms){
+        now_ms++;
+        if (active_timer && (int32_t) (now_ms - active_timer->timeout) >= 0){
+            btstack_timer_source_t * ts = active_timer;
+            active_timer = NULL;
+            ts->process(ts);
+        }
+        if (can_send_now_pending && media_channel_ready){
+            can_send_now_pending = 0;
+            uint8_t event[8];
+            event[0] = HCI_EVENT_AVDTP_META;
+            event[1] = sizeof(event) - 2;
+            event[2] = AVDTP_SUBEVENT_STREAMING_CAN_SEND_MEDIA_PACKET_NOW;
+            little_endian_store_16(event, 3, A2DP_CID);
+            event[5] = LOCAL_SEID;
+            little_endian_store_16(event, 6, 0);
+            packet_handler(HCI_EVENT_PACKET, 0, event, sizeof(event));
+        }
+    }
+}
+
+static void setup_stream(uint8_t channel_mode, uint16_t mtu){
+    static avdtp_stream_endpoint_t stream_endpoint;
+    static avdtp_connection_t connection;
+    memset(&stream_endpoint, 0, sizeof(stream_endpoint));
+    stream_endpoint.l2cap_media_cid = MEDIA_CID;
+    stream_endpoint.connection = &connection;
+    a2dp_source_context.a2dp_callback = &a2dp_packet_handler;
+    a2dp_source_context.avdtp_cid = A2DP_CID;
+    sc.local_stream_endpoint = &stream_endpoint;
+    sc.sampling_frequency = 44100;
+    sc.block_length = 16;
+    sc.subbands = 8;
+    sc.allocation_method = 0;
+    sc.channel_mode = channel_mode;
+    sc.min_bitpool_value = 2;
+    sc.max_bitpool_value = 53;
+    btstack_sbc_encoder_init(&sc.sbc_encoder_state, SBC_MODE_STANDARD, sc.block_length, sc.subbands, sc.allocation_method,
+        sc.sampling_frequency, sc.max_bitpool_value, a2dp_source_sbc_encoder_channel_mode(channel_mode));
+    remote_mtu = mtu;
+    num_media_packets = 0;
+    fill_calls = 0;
+    fill_limit = -1;
+    num_underrun_events = 0;
+    num_bitpool_events = 0;
+    last_bitpool = sc.max_bitpool_value;
+    min_bitpool = sc.max_bitpool_value;
+    acl_backlog = 0;
+    acl_data_packet_length = 1021;
+    can_send_now_pending = 0;
+}
+
+static a2dp_source_media_scheduler_statistics_t get_statistics(void){
+    a2dp_source_media_scheduler_statistics_t statistics;
+    CHECK_EQUAL(ERROR_CODE_SUCCESS, a2dp_source_media_scheduler_get_statistics(A2DP_CID, LOCAL_SEID, &statistics));
+    return statistics;
+}
+
+// encoder produces frames of the size used for queue and packet budget
+static void test_sbc_channel_modes(void){
+    const uint8_t channel_modes[] = { AVDTP_SBC_MONO, AVDTP_SBC_DUAL_CHANNEL, AVDTP_SBC_STEREO, AVDTP_SBC_JOINT_STEREO };
+    int16_t pcm_buffer[SAMPLES_PER_SBC_FRAME * 2];
+    memset(pcm_buffer, 0, sizeof(pcm_buffer));
+    unsigned int i;
+    for (i = 0; i < sizeof(channel_modes); i++){
+        setup_stream(channel_modes[i], 895);
+        btstack_sbc_encoder_process_data(&sc.sbc_encoder_state, pcm_buffer);
+        CHECK_EQUAL(a2dp_source_sbc_frame_length(sc.max_bitpool_value), btstack_sbc_encoder_sbc_buffer_length(&sc.sbc_encoder_state));
+    }
+}
+
+static void test_pacing(void){
+    setup_stream(AVDTP_SBC_JOINT_STEREO, 895);
+    now_ms = 1000;
+    CHECK_EQUAL(ERROR_CODE_SUCCESS, a2dp_source_media_scheduler_start_pcm(A2DP_CID, LOCAL_SEID, &fill_pcm, NULL));
+    run_until(11000, 1);
+    a2dp_source_media_scheduler_statistics_t statistics = get_statistics();
+    // 10 seconds at 44100 Hz
+    int expected_frames = 10 * 44100 / SAMPLES_PER_SBC_FRAME;
+    int frames = statistics.frames_sent + statistics.queued_frames;
+    CHECK(frames >= expected_frames - 1 && frames <= expected_frames + 1);
+    CHECK_EQUAL(0, statistics.underruns);
+    CHECK_EQUAL(num_media_packets, statistics.packets_sent);
+    // only an incomplete packet is kept back
+    CHECK(statistics.max_queued_frames <= 2 * A2DP_SBC_MAX_FRAMES_PER_PACKET);
+    CHECK_EQUAL(ERROR_CODE_SUCCESS, a2dp_source_media_scheduler_stop(A2DP_CID, LOCAL_SEID));
+    CHECK(active_timer == NULL);
+}
+
+static void test_bounded_queue(void){
+    setup_stream(AVDTP_SBC_JOINT_STEREO, 895);
+    CHECK_EQUAL(ERROR_CODE_SUCCESS, a2dp_source_media_scheduler_start_pcm(A2DP_CID, LOCAL_SEID, &fill_pcm, NULL));
+    run_until(now_ms + 1000, 1);
+    uint32_t packets_before = get_statistics().packets_sent;
+    // media channel blocked for 2 seconds
+    run_until(now_ms + 2000, 0);
+    a2dp_source_media_scheduler_statistics_t statistics = get_statistics();
+    CHECK_EQUAL(packets_before, statistics.packets_sent);
+    CHECK(statistics.queued_frames <= A2DP_SOURCE_MEDIA_SCHEDULER_MAX_FRAMES);
+    CHECK(statistics.queued_bytes <= A2DP_SOURCE_MEDIA_SCHEDULER_QUEUE_SIZE);
+    // media clock does not try to catch up after congestion
+    int fill_calls_blocked = fill_calls;
+    run_until(now_ms + 1000, 1);
+    statistics = get_statistics();
+    int fill_calls_per_second = 44100 / SAMPLES_PER_SBC_FRAME;
+    CHECK(fill_calls - fill_calls_blocked <= fill_calls_per_second + 1);
+    CHECK(statistics.queued_frames < A2DP_SBC_MAX_FRAMES_PER_PACKET * 2);
+    a2dp_source_media_scheduler_stop(A2DP_CID, LOCAL_SEID);
+}
+
+static void test_underrun(void){
+    setup_stream(AVDTP_SBC_JOINT_STEREO, 895);
+    CHECK_EQUAL(ERROR_CODE_SUCCESS, a2dp_source_media_scheduler_start_pcm(A2DP_CID, LOCAL_SEID, &fill_pcm, NULL));
+    run_until(now_ms + 500, 1);
+    fill_limit = fill_calls + 10;
+    run_until(now_ms + 100, 1);
+    fill_limit = -1;
+    // RTP timestamps stay contiguous across underrun, checked in l2cap_send_prepared
+    run_until(now_ms + 500, 1);
+    a2dp_source_media_scheduler_statistics_t statistics = get_statistics();
+    CHECK(statistics.underruns > 0);
+    CHECK_EQUAL(statistics.underruns, num_underrun_events);
+    a2dp_source_media_scheduler_stop(A2DP_CID, LOCAL_SEID);
+}
+
+// encoder frame larger than media packet payload is dropped instead of overflowing the queue
+static void test_oversized_frame(void){
+    setup_stream(AVDTP_SBC_JOINT_STEREO, 895);
+    // misconfigured encoder: dual channel frames are almost twice as long as joint stereo frames
+    btstack_sbc_encoder_init(&sc.sbc_encoder_state, SBC_MODE_STANDARD, sc.block_length, sc.subbands, sc.allocation_method,
+        sc.sampling_frequency, sc.max_bitpool_value, a2dp_source_sbc_encoder_channel_mode(AVDTP_SBC_DUAL_CHANNEL));
+    remote_mtu = AVDTP_MEDIA_PAYLOAD_HEADER_SIZE + A2DP_SBC_MEDIA_PAYLOAD_HEADER_SIZE + a2dp_source_sbc_frame_length(sc.max_bitpool_value);
+    CHECK_EQUAL(ERROR_CODE_SUCCESS, a2dp_source_media_scheduler_start_pcm(A2DP_CID, LOCAL_SEID, &fill_pcm, NULL));
+    run_until(now_ms + 100, 1);
+    a2dp_source_media_scheduler_statistics_t statistics = get_statistics();
+    CHECK_EQUAL(0, statistics.queued_bytes);
+    CHECK_EQUAL(0, statistics.packets_sent);
+    CHECK(statistics.underruns > 0);
+    a2dp_source_media_scheduler_stop(A2DP_CID, LOCAL_SEID);
+}
+
+// bitpool is lowered while media packets are queued in the Controller and raised again afterwards
+static void test_adaptive_bitpool(void){
+    setup_stream(AVDTP_SBC_JOINT_STEREO, 895);
+    a2dp_source_media_scheduler_enable_adaptive_bitpool(1);
+    CHECK_EQUAL(ERROR_CODE_SUCCESS, a2dp_source_media_scheduler_start_pcm(A2DP_CID, LOCAL_SEID, &fill_pcm, NULL));
+    run_until(now_ms + 2000, 1);
+    CHECK_EQUAL(0, num_bitpool_events);
+
+    // congested: 4 media packets in Controller
+    acl_backlog = 4;
+    run_until(now_ms + 500, 1);
+    CHECK(num_bitpool_events > 0);
+    CHECK(last_bitpool < sc.max_bitpool_value);
+    CHECK(min_bitpool >= sc.min_bitpool_value);
+    CHECK(last_backlog >= A2DP_SOURCE_BITPOOL_BACKLOG_CONGESTED);
+
+    // clear
+    acl_backlog = 0;
+    run_until(now_ms + 60000, 1);
+    CHECK_EQUAL(sc.max_bitpool_value, last_bitpool);
+    a2dp_source_media_scheduler_stop(A2DP_CID, LOCAL_SEID);
+
+    // media packets fragmented into 3 ACL packets: 3 ACL packets in Controller are a single media packet
+    setup_stream(AVDTP_SBC_JOINT_STEREO, 895);
+    acl_data_packet_length = 339;
+    CHECK_EQUAL(ERROR_CODE_SUCCESS, a2dp_source_media_scheduler_start_pcm(A2DP_CID, LOCAL_SEID, &fill_pcm, NULL));
+    acl_backlog = 3;
+    run_until(now_ms + 1000, 1);
+    CHECK_EQUAL(0, num_bitpool_events);
+    // 9 ACL packets are 3 media packets
+    acl_backlog = 9;
+    run_until(now_ms + 1000, 1);
+    CHECK(num_bitpool_events > 0);
+    CHECK(last_backlog >= A2DP_SOURCE_BITPOOL_BACKLOG_CONGESTED);
+    a2dp_source_media_scheduler_stop(A2DP_CID, LOCAL_SEID);
+    a2dp_source_media_scheduler_enable_adaptive_bitpool(0);
+}
+
+int main(void){
+    test_sbc_channel_modes();
+    test_pacing();
+    test_bounded_queue();
+    test_underrun();
+    test_oversized_frame();
+    test_adaptive_bitpool();
+    if (failures){
+        printf("%u checks failed\n", failures);
+        return 1;
+    }
+    printf("A2DP Source media scheduler test passed\n");
+    return 0;
+}
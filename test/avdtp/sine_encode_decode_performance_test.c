@@ -102,42 +102,68 @@ static void fill_sine_frame(void *userData, int num_samples_to_write){
     }
 }
 
-int btstack_main(int argc, const char * argv[]);
-int btstack_main(int argc, const char * argv[]){
-    (void) argc;
-    (void) argv;
-    btstack_sbc_encoder_init(&sbc_encoder_state, SBC_MODE_STANDARD, 16, 8, 2, 44100, 53);
-                    
-    /* initialise sinusoidal wavetable */
-    int i;
-    for (i=0; i<TABLE_SIZE_441HZ; i++){ 
-        sin_data.source[i] = sin(((double)i/(double)TABLE_SIZE_441HZ) * M_PI * 2.)*32767;
-    }
-    sin_data.left_phase = sin_data.right_phase = 0;
-    
-    btstack_sbc_decoder_init(&sbc_decoder_state, mode, handle_pcm_data, NULL);
-    int num_frames = 10000;
+// encode and decode num_frames SBC frames with the currently selected windowing kernel
+static void measure_kernel(const char * kernel_name, int num_frames){
     uint32_t timestamp_start;
     uint32_t encoding_time = 0;
     uint32_t decoding_time = 0;
-    
+    int i;
+
+    // A2DP default: 16 blocks, 8 subbands, loudness, bitpool 53, joint stereo
+    btstack_sbc_encoder_init(&sbc_encoder_state, SBC_MODE_STANDARD, 16, 8, 0, 44100, 53, 3);
+    btstack_sbc_decoder_init(&sbc_decoder_state, mode, handle_pcm_data, NULL);
+    sin_data.left_phase = sin_data.right_phase = 0;
+
     timestamp_start = btstack_run_loop_get_time_ms();
     for (i=0; i<num_frames; i++){
         fill_sine_frame(&sin_data, 128);
-        btstack_sbc_encoder_process_data((int16_t *) pcm_frame);
+        btstack_sbc_encoder_process_data(&sbc_encoder_state, (int16_t *) pcm_frame);
     }
     encoding_time = btstack_run_loop_get_time_ms() - timestamp_start;
 
     timestamp_start = btstack_run_loop_get_time_ms();
     for (i=0; i<num_frames; i++){
         fill_sine_frame(&sin_data, 128);
-        btstack_sbc_encoder_process_data((int16_t *) pcm_frame);
-        btstack_sbc_decoder_process_data(&sbc_decoder_state, 0, btstack_sbc_encoder_sbc_buffer(), btstack_sbc_encoder_sbc_buffer_length());
+        btstack_sbc_encoder_process_data(&sbc_encoder_state, (int16_t *) pcm_frame);
+        btstack_sbc_decoder_process_data(&sbc_decoder_state, 0, btstack_sbc_encoder_sbc_buffer(&sbc_encoder_state), btstack_sbc_encoder_sbc_buffer_length(&sbc_encoder_state));
     }
     decoding_time =  btstack_run_loop_get_time_ms() - timestamp_start - encoding_time;
 
-    printf("%d frames encoded in %dms\n", num_frames, encoding_time);
-    printf("%d frames decoded in %dms\n", num_frames, decoding_time);
+    printf("%-4s: %d frames encoded in %ums", kernel_name, num_frames, encoding_time);
+    if (encoding_time){
+        printf(" - %u frames/s", (uint32_t) ((uint64_t) num_frames * 1000 / encoding_time));
+    }
+    printf("\n");
+    printf("%-4s: %d frames decoded in %ums", kernel_name, num_frames, decoding_time);
+    if (decoding_time){
+        printf(" - %u frames/s", (uint32_t) ((uint64_t) num_frames * 1000 / decoding_time));
+    }
+    printf("\n");
+}
+
+int btstack_main(int argc, const char * argv[]);
+int btstack_main(int argc, const char * argv[]){
+    (void) argc;
+    (void) argv;
+                    
+    /* initialise sinusoidal wavetable */
+    int i;
+    for (i=0; i<TABLE_SIZE_441HZ; i++){ 
+        sin_data.source[i] = sin(((double)i/(double)TABLE_SIZE_441HZ) * M_PI * 2.)*32767;
+    }
+    
+    int num_frames = 10000;
+
+    // plain C windowing
+    btstack_sbc_encoder_test_use_simd(0);
+    measure_kernel("C", num_frames);
+
+    // SIMD windowing, if available for this target
+    const char * simd_name = btstack_sbc_encoder_test_simd_name();
+    btstack_sbc_encoder_test_use_simd(1);
+    if (simd_name){
+        measure_kernel(simd_name, num_frames);
+    }
     
     exit(0);
 }
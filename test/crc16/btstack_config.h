@@ -0,0 +1,7 @@
+//
+// btstack_config.h for CRC16 benchmark
+//
+#ifndef __BTSTACK_CONFIG
+#define __BTSTACK_CONFIG
+
+#endif
@@ -0,0 +1,118 @@
+/*
+ * Copyright (C) 2017 BlueKitchen GmbH
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ * 4. Any redistribution, use, or modification is done solely for
+ *    personal benefit and not for any commercial purpose or for
+ *    monetary gain.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BLUEKITCHEN GMBH AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL MATTHIAS
+ * RINGWALD OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Please inquire about commercial licensing options at 
+ * contact@bluekitchen-gmbh.com
+ *
+ */
+
+/*
+ *  crc16_benchmark.c
+ *
+ *  Verifies btstack_crc16 against a bitwise reference implementation and reports throughput
+ *  for the implementation selected at compile time.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "btstack_crc16.h"
+
+#define BUFFER_SIZE     1024
+#define NUM_ITERATIONS  20000
+
+static uint16_t crc16_reference(uint16_t polynom, uint16_t crc, const uint8_t * data, uint16_t len){
+    while (len--){
+        crc ^= *data++;
+        int bit;
+        for (bit = 0; bit < 8; bit++){
+            crc = (crc & 1) ? ((crc >> 1) ^ polynom) : (crc >> 1);
+        }
+    }
+    return crc;
+}
+
+static int check(const char * name, uint16_t expected, uint16_t actual){
+    if (expected == actual) return 0;
+    printf("%s: expected 0x%04x, got 0x%04x\n", name, expected, actual);
+    return 1;
+}
+
+static double benchmark(uint16_t (*crc16_update)(uint16_t crc, const uint8_t * data, uint16_t len), const uint8_t * data){
+    volatile uint16_t crc = 0;
+    clock_t start = clock();
+    int i;
+    for (i = 0; i < NUM_ITERATIONS; i++){
+        crc = crc16_update(crc, data, BUFFER_SIZE);
+    }
+    clock_t end = clock();
+    double seconds = (double) (end - start) / CLOCKS_PER_SEC;
+    if (seconds <= 0) seconds = 1e-6;
+    return (double) NUM_ITERATIONS * BUFFER_SIZE / seconds / (1024 * 1024);
+}
+
+int main(int argc, const char * argv[]){
+    (void) argc;
+    (void) argv;
+    int errors = 0;
+
+    // check values for "123456789": CRC-16/MCRF4XX and CRC-16/ARC
+    const uint8_t check_string[] = "123456789";
+    errors += check("ccitt check", 0x6f91, btstack_crc16_ccitt_update(0xffff, check_string, 9));
+    errors += check("ibm check",   0xbb3d, btstack_crc16_ibm_update(0, check_string, 9));
+
+    // random data, all lengths and split points
+    uint8_t data[BUFFER_SIZE];
+    int i;
+    srand(1);
+    for (i = 0; i < BUFFER_SIZE; i++){
+        data[i] = rand();
+    }
+    uint16_t len;
+    for (len = 0; len < 64; len++){
+        uint16_t split = len / 3;
+        uint16_t crc = btstack_crc16_ccitt_update(btstack_crc16_ccitt_update(0xffff, data, split), &data[split], len - split);
+        errors += check("ccitt", crc16_reference(0x8408, 0xffff, data, len), crc);
+        crc = btstack_crc16_ibm_update(btstack_crc16_ibm_update(0, data, split), &data[split], len - split);
+        errors += check("ibm", crc16_reference(0xa001, 0, data, len), crc);
+    }
+    errors += check("ccitt", crc16_reference(0x8408, 0xffff, data, BUFFER_SIZE), btstack_crc16_ccitt_update(0xffff, data, BUFFER_SIZE));
+    errors += check("ibm", crc16_reference(0xa001, 0, data, BUFFER_SIZE), btstack_crc16_ibm_update(0, data, BUFFER_SIZE));
+
+    printf("%-14s: CRC-16-CCITT %7.1f MB/s, CRC-16-IBM %7.1f MB/s\n", btstack_crc16_implementation(),
+        benchmark(&btstack_crc16_ccitt_update, data), benchmark(&btstack_crc16_ibm_update, data));
+
+    return errors;
+}
@@ -25,6 +25,8 @@
 #define ENABLE_LE_CENTRAL
 #define ENABLE_SDP_EXTRA_QUERIES
 #define ENABLE_L2CAP_ENHANCED_RETRANSMISSION_MODE
+#define ENABLE_GATT_CLIENT_OPERATION_QUEUE
+#define ENABLE_GATT_CLIENT_CACHE
 
 // BTstack configuration. buffers, sizes, ...
 #define HCI_ACL_PAYLOAD_SIZE 52
@@ -32,6 +34,8 @@
 
 #define MAX_NR_LE_DEVICE_DB_ENTRIES 4
 
+#define GATT_CLIENT_WRITE_COMMAND_VALUE_SIZE 10
+
 #define NVM_NUM_LINK_KEYS 2
 
 #endif
@@ -21,11 +21,14 @@
 #include "hci_dump.h"
 #include "ble/gatt_client.h"
 #include "ble/att_db.h"
+#include "ble/le_device_db.h"
 #include "profile.h"
 #include "expected_results.h"
 
 static uint16_t gatt_client_handle = 0x40;
 static int gatt_query_complete = 0;
+static int gatt_query_complete_counter = 0;
+static uint8_t gatt_query_complete_status = 0;
 
 typedef enum {
 	IDLE,
@@ -73,6 +76,62 @@ static gatt_client_characteristic_descriptor_t descriptors[50];
 
 void mock_simulate_discover_primary_services_response(void);
 void mock_simulate_att_exchange_mtu_response(void);
+void mock_set_deferred_responses(int enabled);
+int  mock_deliver_deferred_response(void);
+int  mock_num_sent_pdus(void);
+void mock_set_le_device_index(int index);
+void mock_simulate_att_packet(uint8_t * packet, uint16_t size);
+int  mock_fire_timers(uint32_t timeout_in_ms);
+
+// minimal in-memory TLV for GATT client cache
+#define TLV_MAX_TAGS 4
+static uint32_t tlv_tags[TLV_MAX_TAGS];
+static uint8_t  tlv_values[TLV_MAX_TAGS][2048];
+static uint32_t tlv_sizes[TLV_MAX_TAGS];
+
+static int tlv_find(uint32_t tag){
+	int i;
+	for (i=0;i<TLV_MAX_TAGS;i++){
+		if (tlv_sizes[i] && tlv_tags[i] == tag) return i;
+	}
+	return -1;
+}
+
+static int tlv_get_tag(void * context, uint32_t tag, uint8_t * buffer, uint32_t buffer_size){
+	int i = tlv_find(tag);
+	if (i < 0) return 0;
+	uint32_t size = tlv_sizes[i] < buffer_size ? tlv_sizes[i] : buffer_size;
+	memcpy(buffer, tlv_values[i], size);
+	return tlv_sizes[i];
+}
+
+static int tlv_store_tag(void * context, uint32_t tag, const uint8_t * data, uint32_t data_size){
+	if (data_size > sizeof(tlv_values[0])) return 1;
+	int i = tlv_find(tag);
+	if (i < 0) i = tlv_find(0);
+	if (i < 0) {
+		for (i=0;i<TLV_MAX_TAGS;i++){
+			if (tlv_sizes[i] == 0) break;
+		}
+		if (i == TLV_MAX_TAGS) return 1;
+	}
+	tlv_tags[i] = tag;
+	tlv_sizes[i] = data_size;
+	memcpy(tlv_values[i], data, data_size);
+	return 0;
+}
+
+static void tlv_delete_tag(void * context, uint32_t tag){
+	int i = tlv_find(tag);
+	if (i < 0) return;
+	tlv_sizes[i] = 0;
+}
+
+static const btstack_tlv_t tlv_impl = {
+	&tlv_get_tag,
+	&tlv_store_tag,
+	&tlv_delete_tag,
+};
 
 void CHECK_EQUAL_ARRAY(const uint8_t * expected, uint8_t * actual, int size){
 	for (int i=0; i<size; i++){
@@ -150,7 +209,9 @@ static void handle_ble_client_event(uint8_t packet_type, uint16_t channel, uint8
 	switch (packet[0]){
 		case GATT_EVENT_QUERY_COMPLETE:
 			status = packet[4];
+            gatt_query_complete_status = status;
             gatt_query_complete = 1;
+            gatt_query_complete_counter++;
             if (status){
                 gatt_query_complete = 0;
                 printf("GATT_EVENT_QUERY_COMPLETE failed with status 0x%02X\n", status);
@@ -302,9 +363,38 @@ TEST_GROUP(GATTClient){
 
 	void reset_query_state(void){
 		gatt_query_complete = 0;
+		gatt_query_complete_counter = 0;
 		result_counter = 0;
 		result_index = 0;
 	}
+
+	void discover_characteristic_f100(void){
+		reset_query_state();
+		status = gatt_client_discover_primary_services_by_uuid16(handle_ble_client_event, gatt_client_handle, service_uuid16);
+		CHECK_EQUAL(status, 0);
+		reset_query_state();
+		status = gatt_client_discover_characteristics_for_service_by_uuid16(handle_ble_client_event, gatt_client_handle, &services[0], 0xF100);
+		CHECK_EQUAL(status, 0);
+		CHECK_EQUAL(result_counter, 1);
+		reset_query_state();
+	}
+
+	void setup_cache(void){
+		bd_addr_t addr = { 0x00, 0x1b, 0xdc, 0x01, 0x02, 0x03 };
+		sm_key_t irk;
+		memset(irk, 0, sizeof(irk));
+		memset(tlv_sizes, 0, sizeof(tlv_sizes));
+		le_device_db_init();
+		mock_set_le_device_index(le_device_db_add(BD_ADDR_TYPE_LE_PUBLIC, addr, irk));
+		gatt_client_cache_configure(&tlv_impl, NULL);
+		mock_set_deferred_responses(0);
+	}
+
+	void teardown(void){
+		mock_set_deferred_responses(0);
+		mock_set_le_device_index(-1);
+		gatt_client_cache_configure(NULL, NULL);
+	}
 };
 
 
@@ -699,6 +789,293 @@ TEST(GATTClient, TestWriteReliableLongCharacteristicValue){
 	CHECK_EQUAL(gatt_query_complete, 1);
 }
 
+TEST(GATTClient, TestQueuedReadsAndWriteCommand){
+	test = READ_CHARACTERISTIC_VALUE;
+	discover_characteristic_f100();
+
+	mock_set_deferred_responses(1);
+	uint8_t value[] = { 0x01, 0x02 };
+	status = gatt_client_read_value_of_characteristic(handle_ble_client_event, gatt_client_handle, &characteristics[0]);
+	CHECK_EQUAL(0, status);
+	status = gatt_client_read_value_of_characteristic(handle_ble_client_event, gatt_client_handle, &characteristics[0]);
+	CHECK_EQUAL(0, status);
+	status = gatt_client_write_value_of_characteristic_without_response(gatt_client_handle, characteristics[0].value_handle, sizeof(value), value);
+	CHECK_EQUAL(0, status);
+	status = gatt_client_read_value_of_characteristic(handle_ble_client_event, gatt_client_handle, &characteristics[0]);
+	CHECK_EQUAL(0, status);
+	// only first request sent
+	CHECK_EQUAL(1, mock_num_sent_pdus());
+	CHECK_EQUAL(0, gatt_query_complete_counter);
+
+	// second request and Write Command sent right after first response
+	CHECK_EQUAL(1, mock_deliver_deferred_response());
+	CHECK_EQUAL(1, gatt_query_complete_counter);
+	CHECK_EQUAL(3, mock_num_sent_pdus());
+
+	CHECK_EQUAL(1, mock_deliver_deferred_response());
+	CHECK_EQUAL(4, mock_num_sent_pdus());
+	CHECK_EQUAL(1, mock_deliver_deferred_response());
+	CHECK_EQUAL(0, mock_deliver_deferred_response());
+	CHECK_EQUAL(3, gatt_query_complete_counter);
+	CHECK_EQUAL(1, gatt_client_is_ready(gatt_client_handle));
+}
+
+TEST(GATTClient, TestQueueFull){
+	test = READ_CHARACTERISTIC_VALUE;
+	discover_characteristic_f100();
+
+	mock_set_deferred_responses(1);
+	int i;
+	for (i = 0; i <= GATT_CLIENT_OPERATION_QUEUE_SIZE; i++){
+		status = gatt_client_read_value_of_characteristic(handle_ble_client_event, gatt_client_handle, &characteristics[0]);
+		CHECK_EQUAL(0, status);
+	}
+	status = gatt_client_read_value_of_characteristic(handle_ble_client_event, gatt_client_handle, &characteristics[0]);
+	CHECK_EQUAL(GATT_CLIENT_BUSY, status);
+
+	while (mock_deliver_deferred_response());
+	CHECK_EQUAL(GATT_CLIENT_OPERATION_QUEUE_SIZE + 1, gatt_query_complete_counter);
+	CHECK_EQUAL(GATT_CLIENT_OPERATION_QUEUE_SIZE + 1, mock_num_sent_pdus());
+}
+
+TEST(GATTClient, TestQueuedOperationsFailOnTimeout){
+	test = READ_CHARACTERISTIC_VALUE;
+	discover_characteristic_f100();
+
+	mock_set_deferred_responses(1);
+	uint8_t value[GATT_CLIENT_WRITE_COMMAND_VALUE_SIZE + 1];
+	memset(value, 0, sizeof(value));
+	int i;
+	for (i = 0; i < 3; i++){
+		status = gatt_client_read_value_of_characteristic(handle_ble_client_event, gatt_client_handle, &characteristics[0]);
+		CHECK_EQUAL(0, status);
+	}
+	status = gatt_client_write_value_of_characteristic_without_response(gatt_client_handle, characteristics[0].value_handle, GATT_CLIENT_WRITE_COMMAND_VALUE_SIZE, value);
+	CHECK_EQUAL(0, status);
+	// too long to be queued
+	status = gatt_client_write_value_of_characteristic_without_response(gatt_client_handle, characteristics[0].value_handle, sizeof(value), value);
+	CHECK_EQUAL(GATT_CLIENT_VALUE_TOO_LONG, status);
+	CHECK_EQUAL(1, mock_num_sent_pdus());
+
+	// no response: current and queued requests fail, queued Write Command is dropped
+	CHECK_EQUAL(1, mock_fire_timers(30000));
+	CHECK_EQUAL(3, gatt_query_complete_counter);
+	CHECK_EQUAL(ATT_ERROR_TIMEOUT, gatt_query_complete_status);
+	CHECK_EQUAL(1, mock_num_sent_pdus());
+	CHECK_EQUAL(1, gatt_client_is_ready(gatt_client_handle));
+	CHECK_EQUAL(0, mock_fire_timers(30000));
+}
+
+TEST(GATTClient, TestReadMultipleVariableCharacteristicValues){
+	test = READ_CHARACTERISTIC_VALUE;
+	discover_characteristic_f100();
+
+	uint16_t value_handles[] = { characteristics[0].value_handle, characteristics[0].value_handle };
+	status = gatt_client_read_multiple_variable_characteristic_values(handle_ble_client_event, gatt_client_handle, 2, value_handles);
+	CHECK_EQUAL(0, status);
+	CHECK_EQUAL(1, gatt_query_complete);
+	// two read callbacks (length, value) on server side and one result event per handle
+	CHECK_EQUAL(6, result_counter);
+}
+
+static int      multiple_notification_counter;
+static uint16_t multiple_notification_handles[2];
+static uint16_t multiple_notification_lengths[2];
+static uint8_t  multiple_notification_values[2][4];
+
+static void handle_multiple_notification_event(uint8_t packet_type, uint16_t channel, uint8_t *packet, uint16_t size){
+	if (packet_type != HCI_EVENT_PACKET) return;
+	if (packet[0] != GATT_EVENT_NOTIFICATION) return;
+	if (multiple_notification_counter == 2) return;
+	uint16_t value_length = little_endian_read_16(packet, 6);
+	multiple_notification_handles[multiple_notification_counter] = little_endian_read_16(packet, 4);
+	multiple_notification_lengths[multiple_notification_counter] = value_length;
+	memcpy(multiple_notification_values[multiple_notification_counter], &packet[8], value_length < 4 ? value_length : 4);
+	multiple_notification_counter++;
+}
+
+TEST(GATTClient, TestMultipleHandleValueNotification){
+	gatt_client_characteristic_t characteristic_a;
+	gatt_client_characteristic_t characteristic_b;
+	memset(&characteristic_a, 0, sizeof(characteristic_a));
+	memset(&characteristic_b, 0, sizeof(characteristic_b));
+	characteristic_a.value_handle = 0x0020;
+	characteristic_b.value_handle = 0x0030;
+	gatt_client_notification_t listener_a;
+	gatt_client_notification_t listener_b;
+	gatt_client_listen_for_characteristic_value_updates(&listener_a, handle_multiple_notification_event, gatt_client_handle, &characteristic_a);
+	gatt_client_listen_for_characteristic_value_updates(&listener_b, handle_multiple_notification_event, gatt_client_handle, &characteristic_b);
+
+	multiple_notification_counter = 0;
+	uint8_t notification[] = { ATT_MULTIPLE_HANDLE_VALUE_NOTIFICATION, 0x20, 0x00, 0x03, 0x00, 0x01, 0x02, 0x03, 0x30, 0x00, 0x01, 0x00, 0x04 };
+	mock_simulate_att_packet(notification, sizeof(notification));
+	CHECK_EQUAL(2, multiple_notification_counter);
+	CHECK_EQUAL(0x0020, multiple_notification_handles[0]);
+	CHECK_EQUAL(3, multiple_notification_lengths[0]);
+	CHECK_EQUAL(3, multiple_notification_values[0][2]);
+	CHECK_EQUAL(0x0030, multiple_notification_handles[1]);
+	CHECK_EQUAL(1, multiple_notification_lengths[1]);
+	CHECK_EQUAL(4, multiple_notification_values[1][0]);
+
+	// malformed: second value exceeds PDU
+	multiple_notification_counter = 0;
+	little_endian_store_16(notification, 10, 2);
+	mock_simulate_att_packet(notification, sizeof(notification));
+	CHECK_EQUAL(1, multiple_notification_counter);
+
+	gatt_client_stop_listening_for_characteristic_value_updates(&listener_a);
+	gatt_client_stop_listening_for_characteristic_value_updates(&listener_b);
+}
+
+TEST(GATTClient, TestCacheDiscovery){
+	test = DISCOVER_PRIMARY_SERVICES;
+	setup_cache();
+
+	// not cached, services not complete
+	reset_query_state();
+	status = gatt_client_discover_primary_services_by_uuid16(handle_ble_client_event, gatt_client_handle, service_uuid16);
+	CHECK_EQUAL(0, status);
+	CHECK_EQUAL(1, gatt_query_complete);
+	int num_services_with_uuid16 = result_counter;
+	CHECK(mock_num_sent_pdus() > 0);
+
+	// remote, then from cache
+	int i;
+	int num_services = 0;
+	for (i = 0; i < 2; i++){
+		mock_set_deferred_responses(0);
+		reset_query_state();
+		status = gatt_client_discover_primary_services(handle_ble_client_event, gatt_client_handle);
+		CHECK_EQUAL(0, status);
+		if (i == 1){
+			// results from cache are reported after the call returned
+			CHECK_EQUAL(0, gatt_query_complete);
+			CHECK_EQUAL(0, result_counter);
+			CHECK_EQUAL(1, mock_fire_timers(0));
+		}
+		CHECK_EQUAL(1, gatt_query_complete);
+		if (i == 0){
+			num_services = result_counter;
+			CHECK(mock_num_sent_pdus() > 0);
+		} else {
+			CHECK_EQUAL(num_services, result_counter);
+			CHECK_EQUAL(0, mock_num_sent_pdus());
+			verify_primary_services();
+		}
+	}
+
+	reset_query_state();
+	status = gatt_client_discover_primary_services_by_uuid16(handle_ble_client_event, gatt_client_handle, service_uuid16);
+	CHECK_EQUAL(0, status);
+	CHECK_EQUAL(0, gatt_query_complete);
+	CHECK_EQUAL(1, mock_fire_timers(0));
+	CHECK_EQUAL(1, gatt_query_complete);
+	CHECK_EQUAL(num_services_with_uuid16, result_counter);
+	CHECK_EQUAL(0, mock_num_sent_pdus());
+
+	// characteristics and descriptors of first service
+	gatt_client_service_t service = services[0];
+	int num_characteristics = 0;
+	for (i = 0; i < 2; i++){
+		mock_set_deferred_responses(0);
+		reset_query_state();
+		status = gatt_client_discover_characteristics_for_service(handle_ble_client_event, gatt_client_handle, &service);
+		CHECK_EQUAL(0, status);
+		if (i == 1){
+			CHECK_EQUAL(0, gatt_query_complete);
+			CHECK_EQUAL(1, mock_fire_timers(0));
+		}
+		CHECK_EQUAL(1, gatt_query_complete);
+		if (i == 0){
+			num_characteristics = result_counter;
+			CHECK(mock_num_sent_pdus() > 0);
+		} else {
+			CHECK_EQUAL(num_characteristics, result_counter);
+			CHECK_EQUAL(0, mock_num_sent_pdus());
+		}
+	}
+	gatt_client_characteristic_t characteristic = characteristics[0];
+	int num_descriptors = 0;
+	for (i = 0; i < 2; i++){
+		mock_set_deferred_responses(0);
+		reset_query_state();
+		status = gatt_client_discover_characteristic_descriptors(handle_ble_client_event, gatt_client_handle, &characteristic);
+		CHECK_EQUAL(0, status);
+		if (i == 1){
+			CHECK_EQUAL(0, gatt_query_complete);
+			CHECK_EQUAL(1, mock_fire_timers(0));
+		}
+		CHECK_EQUAL(1, gatt_query_complete);
+		if (i == 0){
+			num_descriptors = result_counter;
+			CHECK(mock_num_sent_pdus() > 0);
+		} else {
+			CHECK_EQUAL(num_descriptors, result_counter);
+			CHECK_EQUAL(0, mock_num_sent_pdus());
+		}
+	}
+
+	// reload from TLV
+	gatt_client_cache_configure(&tlv_impl, NULL);
+	mock_set_deferred_responses(0);
+	reset_query_state();
+	status = gatt_client_discover_characteristics_for_service(handle_ble_client_event, gatt_client_handle, &service);
+	CHECK_EQUAL(0, status);
+	CHECK_EQUAL(1, mock_fire_timers(0));
+	CHECK_EQUAL(num_characteristics, result_counter);
+	CHECK_EQUAL(0, mock_num_sent_pdus());
+
+	// cache deleted before results are reported, query remote instead
+	mock_set_deferred_responses(0);
+	reset_query_state();
+	status = gatt_client_discover_characteristics_for_service(handle_ble_client_event, gatt_client_handle, &service);
+	CHECK_EQUAL(0, status);
+	gatt_client_cache_delete(sm_le_device_index(gatt_client_handle));
+	CHECK_EQUAL(1, mock_fire_timers(0));
+	CHECK_EQUAL(1, gatt_query_complete);
+	CHECK(mock_num_sent_pdus() > 0);
+}
+
+TEST(GATTClient, TestCacheServiceChanged){
+	test = DISCOVER_PRIMARY_SERVICES;
+	setup_cache();
+
+	reset_query_state();
+	status = gatt_client_discover_primary_services(handle_ble_client_event, gatt_client_handle);
+	CHECK_EQUAL(0, status);
+	int i;
+	gatt_client_service_t gatt_service;
+	memset(&gatt_service, 0, sizeof(gatt_service));
+	for (i = 0; i < result_index; i++){
+		if (services[i].uuid16 == 0x1801) gatt_service = services[i];
+	}
+	CHECK(gatt_service.start_group_handle != 0);
+
+	reset_query_state();
+	status = gatt_client_discover_characteristics_for_service(handle_ble_client_event, gatt_client_handle, &gatt_service);
+	CHECK_EQUAL(0, status);
+	CHECK_EQUAL(1, result_counter);
+	uint16_t service_changed_value_handle = characteristics[0].value_handle;
+
+	// cached
+	mock_set_deferred_responses(0);
+	reset_query_state();
+	status = gatt_client_discover_primary_services(handle_ble_client_event, gatt_client_handle);
+	CHECK_EQUAL(1, mock_fire_timers(0));
+	CHECK_EQUAL(0, mock_num_sent_pdus());
+
+	// Service Changed indication
+	uint8_t indication[] = { ATT_HANDLE_VALUE_INDICATION, 0, 0, 0x01, 0x00, 0xff, 0xff };
+	little_endian_store_16(indication, 1, service_changed_value_handle);
+	mock_simulate_att_packet(indication, sizeof(indication));
+
+	mock_set_deferred_responses(0);
+	reset_query_state();
+	status = gatt_client_discover_primary_services(handle_ble_client_event, gatt_client_handle);
+	CHECK_EQUAL(0, status);
+	CHECK_EQUAL(1, gatt_query_complete);
+	CHECK(mock_num_sent_pdus() > 0);
+}
 
 int main (int argc, const char * argv[]){
 	att_set_db(profile_data);
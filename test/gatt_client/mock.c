@@ -102,17 +102,74 @@ int l2cap_can_send_fixed_channel_packet_now(uint16_t handle, uint16_t channel_id
 	return 1;
 }
 
-void l2cap_request_can_send_fix_channel_now_event(uint16_t handle, uint16_t channel_id){
+// deferred mode: keep response and can send now event until mock_deliver_deferred_response is called
+static int      deferred_responses;
+static int      can_send_now_requested;
+
+static void emit_can_send_now(void){
 	uint8_t event[] = { L2CAP_EVENT_CAN_SEND_NOW, 2, 1, 0};
 	att_packet_handler(HCI_EVENT_PACKET, 0, (uint8_t*)event, sizeof(event));
 }
 
+void l2cap_request_can_send_fix_channel_now_event(uint16_t handle, uint16_t channel_id){
+	if (deferred_responses){
+		can_send_now_requested = 1;
+		return;
+	}
+	emit_can_send_now();
+}
+
+static uint8_t  deferred_response[max_mtu];
+static uint16_t deferred_response_len;
+static int      sent_pdus;
+
+void mock_set_deferred_responses(int enabled){
+	deferred_responses = enabled;
+	deferred_response_len = 0;
+	can_send_now_requested = 0;
+	sent_pdus = 0;
+}
+
+void mock_simulate_att_packet(uint8_t * packet, uint16_t size){
+	uint8_t response_buffer[HCI_INCOMING_PRE_BUFFER_SIZE + 8 + max_mtu];
+	memcpy(&response_buffer[HCI_INCOMING_PRE_BUFFER_SIZE + 8], packet, size);
+	att_packet_handler(ATT_DATA_PACKET, gatt_client_handle, &response_buffer[HCI_INCOMING_PRE_BUFFER_SIZE + 8], size);
+}
+
+int mock_num_sent_pdus(void){
+	return sent_pdus;
+}
+
+int mock_deliver_deferred_response(void){
+	if (!deferred_response_len) return 0;
+	// pre buffer + HCI + L2CAP header in front of ATT PDU, used by GATT Client to build events in place
+	uint8_t response_buffer[HCI_INCOMING_PRE_BUFFER_SIZE + 8 + max_mtu];
+	uint8_t * response = &response_buffer[HCI_INCOMING_PRE_BUFFER_SIZE + 8];
+	uint16_t response_len = deferred_response_len;
+	memcpy(response, deferred_response, response_len);
+	deferred_response_len = 0;
+	att_packet_handler(ATT_DATA_PACKET, gatt_client_handle, &response[0], response_len);
+	while (can_send_now_requested){
+		can_send_now_requested = 0;
+		emit_can_send_now();
+	}
+	return 1;
+}
+
 int l2cap_send_prepared_connectionless(uint16_t handle, uint16_t cid, uint16_t len){
 	att_connection_t att_connection;
 	att_init_connection(&att_connection);
-	uint8_t response[max_mtu];
+	// pre buffer + HCI + L2CAP header in front of ATT PDU, used by GATT Client to build events in place
+	uint8_t response_buffer[HCI_INCOMING_PRE_BUFFER_SIZE + 8 + max_mtu];
+	uint8_t * response = &response_buffer[HCI_INCOMING_PRE_BUFFER_SIZE + 8];
+	sent_pdus++;
 	uint16_t response_len = att_handle_request(&att_connection, l2cap_get_outgoing_buffer(), len, &response[0]);
 	if (response_len){
+		if (deferred_responses){
+			memcpy(deferred_response, response, response_len);
+			deferred_response_len = response_len;
+			return 0;
+		}
 		att_packet_handler(ATT_DATA_PACKET, gatt_client_handle, &response[0], response_len);
 	}
 	return 0;
@@ -124,23 +181,52 @@ int  sm_cmac_ready(void){
 void sm_cmac_signed_write_start(const sm_key_t key, uint8_t opcode, uint16_t attribute_handle, uint16_t message_len, const uint8_t * message, uint32_t sign_counter, void (*done_callback)(uint8_t * hash)){
 	//sm_notify_client(SM_EVENT_IDENTITY_RESOLVING_SUCCEEDED, sm_central_device_addr_type, sm_central_device_address, 0, sm_central_device_matched);      
 }
+static int le_device_index = -1;
+
+void mock_set_le_device_index(int index){
+	le_device_index = index;
+}
+
 int sm_le_device_index(uint16_t handle ){
-	return -1;
+	return le_device_index;
 }
 
+static btstack_linked_list_t timers;
+
 void btstack_run_loop_set_timer(btstack_timer_source_t *a, uint32_t timeout_in_ms){
+	a->timeout = timeout_in_ms;
 }
 
 // Set callback that will be executed when timer expires.
 void btstack_run_loop_set_timer_handler(btstack_timer_source_t *ts, void (*process)(btstack_timer_source_t *_ts)){
+	ts->process = process;
 }
 
 // Add/Remove timer source.
 void btstack_run_loop_add_timer(btstack_timer_source_t *timer){
+	btstack_linked_list_remove(&timers, (btstack_linked_item_t *) timer);
+	btstack_linked_list_add_tail(&timers, (btstack_linked_item_t *) timer);
 }
 
 int  btstack_run_loop_remove_timer(btstack_timer_source_t *timer){
-	return 1;
+	return btstack_linked_list_remove(&timers, (btstack_linked_item_t *) timer);
+}
+
+// fire timers with a timeout up to timeout_in_ms, returns number of fired timers
+int mock_fire_timers(uint32_t timeout_in_ms){
+	int num_fired = 0;
+	btstack_linked_list_iterator_t it;
+	btstack_linked_list_iterator_init(&it, &timers);
+	while (btstack_linked_list_iterator_has_next(&it)){
+		btstack_timer_source_t * timer = (btstack_timer_source_t *) btstack_linked_list_iterator_next(&it);
+		if (timer->timeout > timeout_in_ms) continue;
+		btstack_linked_list_iterator_remove(&it);
+		timer->process(timer);
+		num_fired++;
+		// handler might have changed the list
+		btstack_linked_list_iterator_init(&it, &timers);
+	}
+	return num_fired;
 }
 
 // todo:
@@ -0,0 +1,162 @@
+#include "CppUTest/TestHarness.h"
+#include "CppUTest/CommandLineTestRunner.h"
+#include <stdlib.h>
+#include <string.h>
+
+#include "btstack_hash_map.h"
+
+#define NUM_ENTRIES 7
+
+static btstack_hash_map_entry_t entries[NUM_ENTRIES];
+static int values[100];
+
+TEST_GROUP(HashMap){
+    btstack_hash_map_t hash_map;
+
+    void setup(void){
+        btstack_hash_map_init(&hash_map, entries, NUM_ENTRIES);
+    }
+};
+
+TEST(HashMap, Empty){
+    CHECK_EQUAL(0, hash_map.count);
+    CHECK(btstack_hash_map_get(&hash_map, 0) == NULL);
+    CHECK(btstack_hash_map_get(&hash_map, 0x40) == NULL);
+    CHECK_TRUE(btstack_hash_map_complete(&hash_map));
+}
+
+TEST(HashMap, PutGet){
+    CHECK_EQUAL(1, btstack_hash_map_put(&hash_map, 0x40, &values[0]));
+    CHECK_EQUAL(1, btstack_hash_map_put(&hash_map, 0x41, &values[1]));
+    CHECK(btstack_hash_map_get(&hash_map, 0x40) == &values[0]);
+    CHECK(btstack_hash_map_get(&hash_map, 0x41) == &values[1]);
+    CHECK(btstack_hash_map_get(&hash_map, 0x42) == NULL);
+    CHECK_EQUAL(2, hash_map.count);
+}
+
+TEST(HashMap, Replace){
+    btstack_hash_map_put(&hash_map, 5, &values[0]);
+    btstack_hash_map_put(&hash_map, 5, &values[1]);
+    CHECK(btstack_hash_map_get(&hash_map, 5) == &values[1]);
+    CHECK_EQUAL(1, hash_map.count);
+}
+
+TEST(HashMap, Collisions){
+    // all keys share home slot 0
+    int i;
+    for (i = 0; i < 4; i++){
+        btstack_hash_map_put(&hash_map, i * NUM_ENTRIES, &values[i]);
+    }
+    for (i = 0; i < 4; i++){
+        CHECK(btstack_hash_map_get(&hash_map, i * NUM_ENTRIES) == &values[i]);
+    }
+    // remove head of probe sequence, others have to be shifted back
+    btstack_hash_map_remove(&hash_map, 0);
+    CHECK(btstack_hash_map_get(&hash_map, 0) == NULL);
+    for (i = 1; i < 4; i++){
+        CHECK(btstack_hash_map_get(&hash_map, i * NUM_ENTRIES) == &values[i]);
+    }
+    CHECK_EQUAL(3, hash_map.count);
+}
+
+TEST(HashMap, RemoveWrapAround){
+    // keys with home slot 6 wrap to slot 0 and 1, key 1 has home slot 1
+    btstack_hash_map_put(&hash_map, 6, &values[0]);
+    btstack_hash_map_put(&hash_map, 13, &values[1]);
+    btstack_hash_map_put(&hash_map, 20, &values[2]);
+    btstack_hash_map_put(&hash_map, 1, &values[3]);
+    btstack_hash_map_remove(&hash_map, 13);
+    CHECK(btstack_hash_map_get(&hash_map, 6)  == &values[0]);
+    CHECK(btstack_hash_map_get(&hash_map, 13) == NULL);
+    CHECK(btstack_hash_map_get(&hash_map, 20) == &values[2]);
+    CHECK(btstack_hash_map_get(&hash_map, 1)  == &values[3]);
+    btstack_hash_map_remove(&hash_map, 6);
+    CHECK(btstack_hash_map_get(&hash_map, 20) == &values[2]);
+    CHECK(btstack_hash_map_get(&hash_map, 1)  == &values[3]);
+}
+
+TEST(HashMap, Overflow){
+    int i;
+    for (i = 0; i < NUM_ENTRIES - 1; i++){
+        CHECK_EQUAL(1, btstack_hash_map_put(&hash_map, i, &values[i]));
+    }
+    CHECK_TRUE(btstack_hash_map_complete(&hash_map));
+    CHECK_EQUAL(0, btstack_hash_map_put(&hash_map, 50, &values[50]));
+    CHECK_FALSE(btstack_hash_map_complete(&hash_map));
+    CHECK(btstack_hash_map_get(&hash_map, 50) == NULL);
+    // removing a key that was never added does not make the map complete
+    btstack_hash_map_remove(&hash_map, 60);
+    CHECK_FALSE(btstack_hash_map_complete(&hash_map));
+    // removing the dropped item makes the map complete again
+    btstack_hash_map_remove(&hash_map, 50);
+    CHECK_TRUE(btstack_hash_map_complete(&hash_map));
+    // removing it twice has no effect
+    CHECK_EQUAL(0, btstack_hash_map_put(&hash_map, 51, &values[51]));
+    btstack_hash_map_remove(&hash_map, 50);
+    CHECK_FALSE(btstack_hash_map_complete(&hash_map));
+    btstack_hash_map_remove(&hash_map, 51);
+    CHECK_TRUE(btstack_hash_map_complete(&hash_map));
+}
+
+TEST(HashMap, OverflowStoredAfterRemove){
+    int i;
+    for (i = 0; i < NUM_ENTRIES - 1; i++){
+        btstack_hash_map_put(&hash_map, i, &values[i]);
+    }
+    CHECK_EQUAL(0, btstack_hash_map_put(&hash_map, 50, &values[50]));
+    btstack_hash_map_remove(&hash_map, 0);
+    CHECK_FALSE(btstack_hash_map_complete(&hash_map));
+    // dropped key fits after another item was removed
+    CHECK_EQUAL(1, btstack_hash_map_put(&hash_map, 50, &values[50]));
+    CHECK(btstack_hash_map_get(&hash_map, 50) == &values[50]);
+    CHECK_TRUE(btstack_hash_map_complete(&hash_map));
+}
+
+TEST(HashMap, OverflowKeysLost){
+    int i;
+    for (i = 0; i < NUM_ENTRIES - 1; i++){
+        btstack_hash_map_put(&hash_map, i, &values[i]);
+    }
+    for (i = 0; i <= BTSTACK_HASH_MAP_OVERFLOW_SIZE; i++){
+        CHECK_EQUAL(0, btstack_hash_map_put(&hash_map, 50 + i, &values[50 + i]));
+    }
+    for (i = 0; i <= BTSTACK_HASH_MAP_OVERFLOW_SIZE; i++){
+        btstack_hash_map_remove(&hash_map, 50 + i);
+    }
+    // untracked key might still be missing from the map
+    CHECK_FALSE(btstack_hash_map_complete(&hash_map));
+    btstack_hash_map_clear(&hash_map);
+    CHECK_TRUE(btstack_hash_map_complete(&hash_map));
+}
+
+TEST(HashMap, RandomOperations){
+    static int present[100];
+    int i;
+    memset(present, 0, sizeof(present));
+    srand(1);
+    for (i = 0; i < 10000; i++){
+        int key = rand() % 20;
+        if (rand() & 1){
+            if (present[key] || hash_map.count < NUM_ENTRIES - 1){
+                CHECK_EQUAL(1, btstack_hash_map_put(&hash_map, key, &values[key]));
+                present[key] = 1;
+            }
+        } else {
+            btstack_hash_map_remove(&hash_map, key);
+            present[key] = 0;
+        }
+        int j;
+        int count = 0;
+        for (j = 0; j < 20; j++){
+            void * expected = present[j] ? &values[j] : NULL;
+            CHECK(btstack_hash_map_get(&hash_map, j) == expected);
+            count += present[j];
+        }
+        CHECK_EQUAL(count, hash_map.count);
+    }
+    CHECK_TRUE(btstack_hash_map_complete(&hash_map));
+}
+
+int main (int argc, const char * argv[]){
+    return CommandLineTestRunner::RunAllTests(argc, argv);
+}
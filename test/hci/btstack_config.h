@@ -0,0 +1,25 @@
+//
+// btstack_config.h for HCI benchmarks
+//
+
+#ifndef __BTSTACK_CONFIG
+#define __BTSTACK_CONFIG
+
+// Port related features
+#define HAVE_MALLOC
+#define HAVE_POSIX_TIME
+
+// BTstack features that can be enabled
+#define ENABLE_BLE
+#define ENABLE_CLASSIC
+#define ENABLE_LOG_ERROR
+#define ENABLE_LE_PERIPHERAL
+#define ENABLE_LE_CENTRAL
+#define ENABLE_H4_STREAMING_RX
+
+// BTstack configuration. buffers, sizes, ...
+#define HCI_ACL_PAYLOAD_SIZE 251
+#define HCI_CONNECTION_INDEX_SIZE 131
+#define HCI_H5_SLIDING_WINDOW_SIZE 7
+
+#endif
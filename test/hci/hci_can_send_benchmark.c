@@ -0,0 +1,174 @@
+/*
+ * Copyright (C) 2017 BlueKitchen GmbH
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ * 4. Any redistribution, use, or modification is done solely for
+ *    personal benefit and not for any commercial purpose or for
+ *    monetary gain.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BLUEKITCHEN GMBH AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL MATTHIAS
+ * RINGWALD OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Please inquire about commercial licensing options at 
+ * contact@bluekitchen-gmbh.com
+ *
+ */
+
+/*
+ *  hci_can_send_benchmark.c
+ *
+ *  Measures the cost of hci_can_send_acl_packet_now() against the number of LE connections.
+ *  HCI is brought up with a fake HCI transport that answers every HCI Command with a Command Complete event.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "btstack_config.h"
+#include "btstack_event.h"
+#include "btstack_memory.h"
+#include "btstack_run_loop.h"
+#include "btstack_run_loop_posix.h"
+#include "hci.h"
+
+#define MAX_CONNECTIONS 64
+#define NUM_ITERATIONS  1000000
+#define CON_HANDLE_BASE 0x0040
+
+static void (*transport_packet_handler)(uint8_t packet_type, uint8_t *packet, uint16_t size);
+static uint8_t  pending_event[80];
+static uint16_t pending_event_len;
+
+static void transport_register_packet_handler(void (*handler)(uint8_t packet_type, uint8_t *packet, uint16_t size)){
+    transport_packet_handler = handler;
+}
+
+static int transport_send_packet(uint8_t packet_type, uint8_t *packet, int size){
+    (void) size;
+    if (packet_type != HCI_COMMAND_DATA_PACKET) return 0;
+    // prepare Command Complete event with success status
+    uint16_t opcode = little_endian_read_16(packet, 0);
+    memset(pending_event, 0, sizeof(pending_event));
+    pending_event[0] = HCI_EVENT_COMMAND_COMPLETE;
+    pending_event[2] = 1;
+    little_endian_store_16(pending_event, 3, opcode);
+    pending_event_len = 22;
+    if (opcode == hci_read_local_supported_commands.opcode){
+        memset(&pending_event[6], 0xff, 64);
+        pending_event_len = 70;
+    }
+    if (opcode == hci_read_buffer_size.opcode){
+        little_endian_store_16(pending_event, 6, HCI_ACL_PAYLOAD_SIZE);
+        pending_event[8] = 64;
+        little_endian_store_16(pending_event,  9, 8);
+        little_endian_store_16(pending_event, 11, 8);
+    }
+    pending_event[1] = pending_event_len - 2;
+    return 0;
+}
+
+static int transport_open(void){
+    return 0;
+}
+
+static int transport_close(void){
+    return 0;
+}
+
+static void transport_init(const void * transport_config){
+    (void) transport_config;
+}
+
+static const hci_transport_t transport = {
+    "benchmark",
+    &transport_init,
+    &transport_open,
+    &transport_close,
+    &transport_register_packet_handler,
+    NULL,
+    &transport_send_packet,
+    NULL,
+    NULL,
+    NULL,
+};
+
+static void deliver_pending_events(void){
+    while (pending_event_len){
+        uint8_t event[sizeof(pending_event)];
+        uint16_t len = pending_event_len;
+        memcpy(event, pending_event, len);
+        pending_event_len = 0;
+        transport_packet_handler(HCI_EVENT_PACKET, event, len);
+    }
+}
+
+static void create_le_connection(hci_con_handle_t con_handle){
+    uint8_t event[21];
+    memset(event, 0, sizeof(event));
+    event[0] = HCI_EVENT_LE_META;
+    event[1] = sizeof(event) - 2;
+    event[2] = HCI_SUBEVENT_LE_CONNECTION_COMPLETE;
+    little_endian_store_16(event, 4, con_handle);
+    event[6] = HCI_ROLE_SLAVE;
+    // use con handle as peer address
+    little_endian_store_16(event, 8, con_handle);
+    transport_packet_handler(HCI_EVENT_PACKET, event, sizeof(event));
+    deliver_pending_events();
+}
+
+int main(void){
+    btstack_memory_init();
+    btstack_run_loop_init(btstack_run_loop_posix_get_instance());
+    hci_init(&transport, NULL);
+    hci_power_control(HCI_POWER_ON);
+    deliver_pending_events();
+    if (hci_get_state() != HCI_STATE_WORKING){
+        printf("HCI init failed\n");
+        return 1;
+    }
+
+    int num_connections = 0;
+    int next_count = 1;
+    while (num_connections < MAX_CONNECTIONS){
+        create_le_connection(CON_HANDLE_BASE + num_connections);
+        num_connections++;
+        if (num_connections != next_count) continue;
+        next_count *= 2;
+
+        struct timespec start_ts, end_ts;
+        int i;
+        int can_send = 0;
+        clock_gettime(CLOCK_MONOTONIC, &start_ts);
+        for (i = 0; i < NUM_ITERATIONS; i++){
+            can_send += hci_can_send_acl_packet_now(CON_HANDLE_BASE + (i % num_connections));
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end_ts);
+        double duration_ns = (end_ts.tv_sec - start_ts.tv_sec) * 1e9 + (end_ts.tv_nsec - start_ts.tv_nsec);
+        printf("%2u connections: %6.1f ns per hci_can_send_acl_packet_now (%u)\n", num_connections, duration_ns / NUM_ITERATIONS, can_send == NUM_ITERATIONS);
+    }
+    return 0;
+}
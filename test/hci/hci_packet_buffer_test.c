@@ -0,0 +1,330 @@
+/*
+ * Copyright (C) 2017 BlueKitchen GmbH
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ * 4. Any redistribution, use, or modification is done solely for
+ *    personal benefit and not for any commercial purpose or for
+ *    monetary gain.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BLUEKITCHEN GMBH AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL MATTHIAS
+ * RINGWALD OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Please inquire about commercial licensing options at
+ * contact@bluekitchen-gmbh.com
+ *
+ */
+
+/*
+ *  hci_packet_buffer_test.c
+ *
+ *  Checks the pool of outgoing packet buffers and the ACL packet queue with HCI_OUTGOING_PACKET_BUFFER_NUM > 1.
+ *  HCI is brought up with a fake asynchronous HCI transport that accepts a single packet until the test completes it.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "btstack_config.h"
+#include "btstack_event.h"
+#include "btstack_memory.h"
+#include "btstack_run_loop.h"
+#include "btstack_run_loop_posix.h"
+#include "hci.h"
+
+#define CON_HANDLE_1            0x0040
+#define CON_HANDLE_2            0x0041
+#define ACL_DATA_PACKET_LENGTH  27
+#define NUM_ACL_PACKETS         8
+
+#define CHECK_EQUAL(expected, actual) check_equal(expected, actual, __LINE__)
+#define CHECK(condition)              check_equal(1, (condition) ? 1 : 0, __LINE__)
+
+static int failures;
+
+static void (*transport_packet_handler)(uint8_t packet_type, uint8_t *packet, uint16_t size);
+static uint8_t  pending_event[80];
+static uint16_t pending_event_len;
+
+// packet handed to transport, transport reads from it until completed
+static int       transport_busy;
+static uint8_t * transport_packet;
+static uint8_t   transport_packet_copy[HCI_ACL_PAYLOAD_SIZE + 4];
+static int       transport_packet_size;
+
+// ACL packets received by controller
+static hci_con_handle_t received_handles[32];
+static uint8_t          received_values[32];
+static int              received_num;
+static int              num_acl_fragments;
+
+static void check_equal(int expected, int actual, int line){
+    if (expected == actual) return;
+    printf("line %u: expected %d, got %d\n", line, expected, actual);
+    failures++;
+}
+
+static void transport_register_packet_handler(void (*handler)(uint8_t packet_type, uint8_t *packet, uint16_t size)){
+    transport_packet_handler = handler;
+}
+
+static int transport_can_send_packet_now(uint8_t packet_type){
+    (void) packet_type;
+    return !transport_busy;
+}
+
+static void answer_command(uint8_t * packet){
+    // prepare Command Complete event with success status
+    uint16_t opcode = little_endian_read_16(packet, 0);
+    memset(pending_event, 0, sizeof(pending_event));
+    pending_event[0] = HCI_EVENT_COMMAND_COMPLETE;
+    pending_event[2] = 1;
+    little_endian_store_16(pending_event, 3, opcode);
+    pending_event_len = 22;
+    if (opcode == hci_read_local_supported_commands.opcode){
+        memset(&pending_event[6], 0xff, 64);
+        pending_event_len = 70;
+    }
+    if (opcode == hci_read_buffer_size.opcode){
+        little_endian_store_16(pending_event, 6, ACL_DATA_PACKET_LENGTH);
+        pending_event[8] = 64;
+        little_endian_store_16(pending_event,  9, NUM_ACL_PACKETS);
+        little_endian_store_16(pending_event, 11, 8);
+    }
+    pending_event[1] = pending_event_len - 2;
+}
+
+static void receive_acl_fragment(uint8_t * packet, int size){
+    num_acl_fragments++;
+    CHECK_EQUAL(size - 4, little_endian_read_16(packet, 2));
+    CHECK(size - 4 <= ACL_DATA_PACKET_LENGTH);
+    uint16_t handle_and_flags = little_endian_read_16(packet, 0);
+    if ((handle_and_flags & 0x3000) == 0x1000) return;
+    // first fragment: store first payload byte
+    received_handles[received_num] = handle_and_flags & 0x0fff;
+    received_values[received_num]  = packet[4];
+    received_num++;
+}
+
+static int transport_send_packet(uint8_t packet_type, uint8_t *packet, int size){
+    CHECK_EQUAL(0, transport_busy);
+    transport_busy = 1;
+    transport_packet = packet;
+    transport_packet_size = size;
+    memcpy(transport_packet_copy, packet, size);
+    if (packet_type == HCI_COMMAND_DATA_PACKET){
+        answer_command(packet);
+    }
+    if (packet_type == HCI_ACL_DATA_PACKET){
+        receive_acl_fragment(packet, size);
+    }
+    return 0;
+}
+
+static int transport_open(void){
+    return 0;
+}
+
+static int transport_close(void){
+    return 0;
+}
+
+static void transport_init(const void * transport_config){
+    (void) transport_config;
+}
+
+static const hci_transport_t transport = {
+    "packet buffer test",
+    &transport_init,
+    &transport_open,
+    &transport_close,
+    &transport_register_packet_handler,
+    &transport_can_send_packet_now,
+    &transport_send_packet,
+    NULL,
+    NULL,
+    NULL,
+};
+
+// transport done with current packet: check it has not been modified meanwhile and report packet sent
+static void complete_transport(void){
+    if (!transport_busy) return;
+    CHECK_EQUAL(0, memcmp(transport_packet, transport_packet_copy, transport_packet_size));
+    transport_busy = 0;
+    uint8_t event[] = { HCI_EVENT_TRANSPORT_PACKET_SENT, 0};
+    transport_packet_handler(HCI_EVENT_PACKET, event, sizeof(event));
+}
+
+static void deliver_pending_events(void){
+    while (transport_busy || pending_event_len){
+        complete_transport();
+        if (!pending_event_len) continue;
+        uint8_t event[sizeof(pending_event)];
+        uint16_t len = pending_event_len;
+        memcpy(event, pending_event, len);
+        pending_event_len = 0;
+        transport_packet_handler(HCI_EVENT_PACKET, event, len);
+    }
+}
+
+static void create_le_connection(hci_con_handle_t con_handle){
+    uint8_t event[21];
+    memset(event, 0, sizeof(event));
+    event[0] = HCI_EVENT_LE_META;
+    event[1] = sizeof(event) - 2;
+    event[2] = HCI_SUBEVENT_LE_CONNECTION_COMPLETE;
+    little_endian_store_16(event, 4, con_handle);
+    event[6] = HCI_ROLE_SLAVE;
+    // use con handle as peer address
+    little_endian_store_16(event, 8, con_handle);
+    transport_packet_handler(HCI_EVENT_PACKET, event, sizeof(event));
+    deliver_pending_events();
+}
+
+static void disconnect(hci_con_handle_t con_handle){
+    uint8_t event[6];
+    event[0] = HCI_EVENT_DISCONNECTION_COMPLETE;
+    event[1] = sizeof(event) - 2;
+    event[2] = 0;
+    little_endian_store_16(event, 3, con_handle);
+    event[5] = 0x13;
+    transport_packet_handler(HCI_EVENT_PACKET, event, sizeof(event));
+}
+
+static void complete_acl_packets(hci_con_handle_t con_handle, int num_packets){
+    uint8_t event[7];
+    event[0] = HCI_EVENT_NUMBER_OF_COMPLETED_PACKETS;
+    event[1] = sizeof(event) - 2;
+    event[2] = 1;
+    little_endian_store_16(event, 3, con_handle);
+    little_endian_store_16(event, 5, num_packets);
+    transport_packet_handler(HCI_EVENT_PACKET, event, sizeof(event));
+}
+
+// reserve buffer and send ACL packet with payload_len bytes of value
+static int send_acl_packet(hci_con_handle_t con_handle, uint8_t value, int payload_len){
+    if (!hci_can_send_acl_packet_now(con_handle)) return BTSTACK_ACL_BUFFERS_FULL;
+    hci_reserve_packet_buffer();
+    uint8_t * packet = hci_get_outgoing_packet_buffer();
+    little_endian_store_16(packet, 0, con_handle | (0x02 << 12));
+    little_endian_store_16(packet, 2, payload_len);
+    memset(&packet[4], value, payload_len);
+    return hci_send_acl_packet_buffer(4 + payload_len);
+}
+
+// with async transport, further packets are queued and sent after HCI_EVENT_TRANSPORT_PACKET_SENT
+static void test_packet_queue(void){
+    received_num = 0;
+    CHECK_EQUAL(0, send_acl_packet(CON_HANDLE_1, 1, 10));
+    CHECK_EQUAL(1, received_num);
+    // transport busy, packets are queued until all buffers are used
+    int i;
+    for (i = 1; i < HCI_OUTGOING_PACKET_BUFFER_NUM; i++){
+        CHECK_EQUAL(0, send_acl_packet(CON_HANDLE_1, 1 + i, 10));
+    }
+    CHECK_EQUAL(1, received_num);
+    CHECK_EQUAL(0, hci_can_send_acl_packet_now(CON_HANDLE_1));
+    // each completed transport frees a buffer and sends the next queued packet
+    for (i = 1; i < HCI_OUTGOING_PACKET_BUFFER_NUM; i++){
+        complete_transport();
+        CHECK_EQUAL(i + 1, received_num);
+        CHECK_EQUAL(1, hci_can_send_acl_packet_now(CON_HANDLE_1));
+    }
+    complete_transport();
+    for (i = 0; i < HCI_OUTGOING_PACKET_BUFFER_NUM; i++){
+        CHECK_EQUAL(CON_HANDLE_1, received_handles[i]);
+        CHECK_EQUAL(1 + i, received_values[i]);
+    }
+    complete_acl_packets(CON_HANDLE_1, HCI_OUTGOING_PACKET_BUFFER_NUM);
+    CHECK_EQUAL(0, hci_number_outgoing_acl_packets_for_handle(CON_HANDLE_1));
+}
+
+// packet larger than controller buffer is sent in fragments, each after HCI_EVENT_TRANSPORT_PACKET_SENT
+static void test_fragmentation(void){
+    received_num = 0;
+    num_acl_fragments = 0;
+    CHECK_EQUAL(0, send_acl_packet(CON_HANDLE_1, 0x11, 3 * ACL_DATA_PACKET_LENGTH));
+    CHECK_EQUAL(1, num_acl_fragments);
+    CHECK_EQUAL(0, send_acl_packet(CON_HANDLE_1, 0x12, 10));
+    complete_transport();
+    complete_transport();
+    CHECK_EQUAL(3, num_acl_fragments);
+    CHECK_EQUAL(1, received_num);
+    complete_transport();
+    CHECK_EQUAL(4, num_acl_fragments);
+    CHECK_EQUAL(2, received_num);
+    CHECK_EQUAL(0x12, received_values[1]);
+    complete_transport();
+    CHECK_EQUAL(4, hci_number_outgoing_acl_packets_for_handle(CON_HANDLE_1));
+    complete_acl_packets(CON_HANDLE_1, 4);
+}
+
+// buffer with fragment in transport must not be reused when its connection is closed
+static void test_disconnect_during_fragment(void){
+    received_num = 0;
+    CHECK_EQUAL(0, send_acl_packet(CON_HANDLE_1, 0x21, 3 * ACL_DATA_PACKET_LENGTH));
+    CHECK_EQUAL(1, received_num);
+    disconnect(CON_HANDLE_1);
+    // remaining buffers can be used while first fragment is still in transport
+    int i;
+    for (i = 1; i < HCI_OUTGOING_PACKET_BUFFER_NUM; i++){
+        CHECK_EQUAL(0, send_acl_packet(CON_HANDLE_2, 0x30 + i, 10));
+    }
+    CHECK_EQUAL(0, hci_can_send_acl_packet_now(CON_HANDLE_2));
+    // fragment unchanged, checked in complete_transport
+    complete_transport();
+    CHECK_EQUAL(2, received_num);
+    CHECK_EQUAL(CON_HANDLE_2, received_handles[1]);
+    for (i = 1; i < HCI_OUTGOING_PACKET_BUFFER_NUM; i++){
+        complete_transport();
+    }
+    CHECK_EQUAL(HCI_OUTGOING_PACKET_BUFFER_NUM, received_num);
+    CHECK_EQUAL(1, hci_can_send_acl_packet_now(CON_HANDLE_2));
+}
+
+int main(void){
+    btstack_memory_init();
+    btstack_run_loop_init(btstack_run_loop_posix_get_instance());
+    hci_init(&transport, NULL);
+    hci_power_control(HCI_POWER_ON);
+    deliver_pending_events();
+    if (hci_get_state() != HCI_STATE_WORKING){
+        printf("HCI init failed\n");
+        return 1;
+    }
+    create_le_connection(CON_HANDLE_1);
+    create_le_connection(CON_HANDLE_2);
+
+    test_packet_queue();
+    test_fragmentation();
+    test_disconnect_during_fragment();
+
+    if (failures){
+        printf("%u checks failed\n", failures);
+        return 1;
+    }
+    printf("HCI packet buffer test passed\n");
+    return 0;
+}
@@ -0,0 +1,249 @@
+/*
+ * Copyright (C) 2017 BlueKitchen GmbH
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ * 4. Any redistribution, use, or modification is done solely for
+ *    personal benefit and not for any commercial purpose or for
+ *    monetary gain.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BLUEKITCHEN GMBH AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL MATTHIAS
+ * RINGWALD OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Please inquire about commercial licensing options at 
+ * contact@bluekitchen-gmbh.com
+ *
+ */
+
+/*
+ *  hci_transport_h4_benchmark.c
+ *
+ *  Feeds a stream of random HCI Events, ACL and SCO packets through the H4 transport using a fake UART driver
+ *  and compares the number of UART reads and the time spent with block reads and with streaming receive.
+ *  All packets are checked for correct framing.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "btstack_config.h"
+#include "btstack_uart_block.h"
+#include "btstack_util.h"
+#include "hci.h"
+#include "hci_transport.h"
+
+#define NUM_PACKETS     100000
+#define MAX_CHUNK_SIZE  4096
+
+static uint8_t * stream;
+static uint32_t  stream_len;
+static uint32_t  stream_pos;
+static uint32_t  packet_offsets[NUM_PACKETS+1];
+static int       packets_received;
+static int       packets_invalid;
+static uint32_t  uart_reads;
+
+// fake UART driver
+static void (*block_received)(void);
+static void (*data_received)(uint16_t size);
+static uint8_t * read_buffer;
+static uint16_t  read_len;
+static int       read_stream;
+static int       read_pending;
+
+static int  uart_init(const btstack_uart_config_t * config){ (void) config; return 0; }
+static int  uart_open(void){ return 0; }
+static int  uart_close(void){ return 0; }
+static void uart_set_block_received(void (*handler)(void)){ block_received = handler; }
+static void uart_set_block_sent(void (*handler)(void)){ (void) handler; }
+static void uart_set_data_received(void (*handler)(uint16_t size)){ data_received = handler; }
+static int  uart_set_baudrate(uint32_t baudrate){ (void) baudrate; return 0; }
+static void uart_send_block(const uint8_t * data, uint16_t size){ (void) data; (void) size; }
+
+static void uart_receive_block(uint8_t * buffer, uint16_t len){
+    read_buffer  = buffer;
+    read_len     = len;
+    read_stream  = 0;
+    read_pending = 1;
+}
+
+static void uart_receive_data(uint8_t * buffer, uint16_t len){
+    read_buffer  = buffer;
+    read_len     = len;
+    read_stream  = 1;
+    read_pending = 1;
+}
+
+static btstack_uart_block_t uart_driver = {
+    &uart_init,
+    &uart_open,
+    &uart_close,
+    &uart_set_block_received,
+    &uart_set_block_sent,
+    &uart_set_baudrate,
+    NULL,
+    NULL,
+    &uart_receive_block,
+    &uart_send_block,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+};
+
+// deliver pending read, each call corresponds to one read() syscall
+static int uart_process_read(void){
+    if (!read_pending) return 0;
+    uint32_t available = stream_len - stream_pos;
+    if (available == 0) return 0;
+    // with streaming receive, data arrives in chunks of random size
+    uint32_t len = read_len;
+    if (read_stream){
+        uint32_t chunk = 1 + (rand() % MAX_CHUNK_SIZE);
+        if (chunk < len) len = chunk;
+        if (available < len) len = available;
+    } else {
+        if (available < len) return 0;
+    }
+    memcpy(read_buffer, &stream[stream_pos], len);
+    stream_pos += len;
+    read_pending = 0;
+    uart_reads++;
+    if (read_stream){
+        (*data_received)(len);
+    } else {
+        (*block_received)();
+    }
+    return 1;
+}
+
+static void packet_handler(uint8_t packet_type, uint8_t * packet, uint16_t size){
+    uint32_t offset = packet_offsets[packets_received];
+    uint32_t expected_size = packet_offsets[packets_received+1] - offset - 1;
+    if (packet_type != stream[offset] || size != expected_size || memcmp(packet, &stream[offset+1], size) != 0){
+        packets_invalid++;
+    }
+    packets_received++;
+    // upper layers may use pre-buffer in front of packet
+    memset(packet - HCI_INCOMING_PRE_BUFFER_SIZE, 0x55, HCI_INCOMING_PRE_BUFFER_SIZE);
+}
+
+static void create_stream(void){
+    stream = malloc(NUM_PACKETS * (1 + HCI_PACKET_BUFFER_SIZE));
+    stream_len = 0;
+    int i;
+    for (i=0;i<NUM_PACKETS;i++){
+        packet_offsets[i] = stream_len;
+        uint8_t * packet = &stream[stream_len];
+        uint16_t payload_len;
+        uint16_t header_len;
+        switch (rand() % 3){
+            case 0:
+                packet[0] = HCI_EVENT_PACKET;
+                payload_len = rand() % 256;
+                packet[1] = HCI_EVENT_NUMBER_OF_COMPLETED_PACKETS;
+                packet[2] = payload_len;
+                header_len = HCI_EVENT_HEADER_SIZE;
+                break;
+            case 1:
+                packet[0] = HCI_ACL_DATA_PACKET;
+                payload_len = rand() % (HCI_ACL_PAYLOAD_SIZE + 1);
+                little_endian_store_16(packet, 1, 0x2040);
+                little_endian_store_16(packet, 3, payload_len);
+                header_len = HCI_ACL_HEADER_SIZE;
+                break;
+            default:
+                packet[0] = HCI_SCO_DATA_PACKET;
+                payload_len = 60;
+                little_endian_store_16(packet, 1, 0x0001);
+                packet[3] = payload_len;
+                header_len = HCI_SCO_HEADER_SIZE;
+                break;
+        }
+        int j;
+        for (j=0;j<payload_len;j++){
+            packet[1 + header_len + j] = rand();
+        }
+        stream_len += 1 + header_len + payload_len;
+    }
+    packet_offsets[NUM_PACKETS] = stream_len;
+}
+
+static int run(const char * name, int streaming){
+    stream_pos = 0;
+    packets_received = 0;
+    packets_invalid = 0;
+    uart_reads = 0;
+    read_pending = 0;
+
+    if (streaming){
+        uart_driver.set_data_received = &uart_set_data_received;
+        uart_driver.receive_data      = &uart_receive_data;
+    } else {
+        uart_driver.set_data_received = NULL;
+        uart_driver.receive_data      = NULL;
+    }
+
+    static const hci_transport_config_uart_t config = {
+        HCI_TRANSPORT_CONFIG_UART,
+        115200,
+        0,
+        0,
+        NULL,
+    };
+    const hci_transport_t * transport = hci_transport_h4_instance(&uart_driver);
+    transport->init(&config);
+    transport->register_packet_handler(&packet_handler);
+    transport->open();
+
+    clock_t start = clock();
+    while (uart_process_read());
+    clock_t end = clock();
+    transport->close();
+
+    double ms = (end - start) * 1000.0 / CLOCKS_PER_SEC;
+    printf("%-10s: %u packets, %u bytes, %u reads (%.2f reads/packet), %.1f ms\n", name, packets_received,
+        stream_len, uart_reads, (double) uart_reads / packets_received, ms);
+
+    if (packets_received != NUM_PACKETS || packets_invalid){
+        printf("%-10s: FAILED, %u of %u packets received, %u invalid\n", name, packets_received, NUM_PACKETS, packets_invalid);
+        return 1;
+    }
+    return 0;
+}
+
+int main(int argc, const char * argv[]){
+    (void) argc;
+    (void) argv;
+    srand(1);
+    create_stream();
+    int errors = 0;
+    errors += run("block", 0);
+    errors += run("streaming", 1);
+    free(stream);
+    return errors;
+}
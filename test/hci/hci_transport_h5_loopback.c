@@ -0,0 +1,376 @@
+/*
+ * Copyright (C) 2017 BlueKitchen GmbH
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ * 4. Any redistribution, use, or modification is done solely for
+ *    personal benefit and not for any commercial purpose or for
+ *    monetary gain.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BLUEKITCHEN GMBH AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL MATTHIAS
+ * RINGWALD OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Please inquire about commercial licensing options at 
+ * contact@bluekitchen-gmbh.com
+ *
+ */
+
+/*
+ *  hci_transport_h5_loopback.c
+ *
+ *  Runs the H5 transport with the POSIX UART driver on a pty and a simulated H5 peer on the other end.
+ *  The peer acknowledges received packets with a small delay, similar to a Bluetooth Controller.
+ *  Measures throughput of reliable ACL packets for a negotiated sliding window of 1 and of HCI_H5_SLIDING_WINDOW_SIZE,
+ *  and checks that a burst of HCI Events sent by the peer is received in order.
+ *  One ACL packet is dropped by the peer to verify retransmission of unacknowledged packets.
+ */
+
+#define _XOPEN_SOURCE 600
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <termios.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+#include "btstack_config.h"
+#include "btstack_run_loop.h"
+#include "btstack_run_loop_posix.h"
+#include "btstack_uart_block.h"
+#include "btstack_util.h"
+#include "hci.h"
+#include "hci_transport.h"
+
+#define NUM_ACL_PACKETS     1000
+#define NUM_PEER_EVENTS     50
+#define ACL_PAYLOAD_LEN     (HCI_ACL_PAYLOAD_SIZE)
+#define PEER_ACK_DELAY_US   1000
+#define PEER_DROPPED_PACKET 100
+#define TEST_TIMEOUT_MS     30000
+
+#define VENDOR_EVENT_BURST  0x01
+#define VENDOR_EVENT_DONE   0x02
+
+// --- simulated H5 peer, runs in child process with blocking I/O
+
+static int      peer_fd;
+static uint8_t  peer_frame[8 + HCI_PACKET_BUFFER_SIZE];
+static uint16_t peer_frame_len;
+static int      peer_frame_escape;
+static uint8_t  peer_seq_nr;
+static uint8_t  peer_ack_nr;
+static int      peer_ack_pending;
+static int      peer_acl_received;
+static int      peer_acl_dropped;
+
+static void peer_write(const uint8_t * data, int len){
+    while (len){
+        int res = write(peer_fd, data, len);
+        if (res < 0) _exit(10);
+        data += res;
+        len  -= res;
+    }
+}
+
+static void peer_send_frame(int reliable, uint8_t packet_type, const uint8_t * payload, uint16_t len){
+    uint8_t header[4];
+    header[0] = (reliable ? peer_seq_nr : 0) | (peer_ack_nr << 3) | (reliable << 7);
+    header[1] = packet_type | ((len & 0x0f) << 4);
+    header[2] = len >> 4;
+    header[3] = 0xff - (header[0] + header[1] + header[2]);
+    if (reliable){
+        peer_seq_nr = (peer_seq_nr + 1) & 0x07;
+    }
+    uint8_t buffer[2 * (4 + HCI_PACKET_BUFFER_SIZE) + 2];
+    int pos = 0;
+    buffer[pos++] = 0xc0;
+    int i;
+    for (i = 0; i < 4 + len; i++){
+        uint8_t byte = i < 4 ? header[i] : payload[i-4];
+        switch (byte){
+            case 0xc0:
+                buffer[pos++] = 0xdb;
+                buffer[pos++] = 0xdc;
+                break;
+            case 0xdb:
+                buffer[pos++] = 0xdb;
+                buffer[pos++] = 0xdd;
+                break;
+            default:
+                buffer[pos++] = byte;
+                break;
+        }
+    }
+    buffer[pos++] = 0xc0;
+    peer_write(buffer, pos);
+}
+
+static void peer_send_vendor_event(uint8_t type, uint8_t index){
+    uint8_t event[] = { 0xff, 2, type, index };
+    peer_send_frame(1, HCI_EVENT_PACKET, event, sizeof(event));
+}
+
+static void peer_process_frame(uint8_t window_size){
+    if (peer_frame_len < 4) return;
+    uint8_t  seq_nr      = peer_frame[0] & 0x07;
+    uint8_t  reliable    = peer_frame[0] >> 7;
+    uint8_t  packet_type = peer_frame[1] & 0x0f;
+    uint16_t payload_len = (peer_frame[1] >> 4) | (peer_frame[2] << 4);
+    uint8_t * payload    = &peer_frame[4];
+    int      dic_len     = (peer_frame[0] & 0x40) ? 2 : 0;
+    if (peer_frame_len != 4 + payload_len + dic_len) _exit(11);
+
+    if (packet_type == 0x0f){
+        static const uint8_t sync[]            = { 0x01, 0x7e };
+        static const uint8_t sync_response[]   = { 0x02, 0x7d };
+        static const uint8_t config_prefix[]   = { 0x03, 0xfc };
+        static int config_received;
+        if (payload_len >= 2 && memcmp(payload, sync, 2) == 0){
+            peer_send_frame(0, 0x0f, sync_response, sizeof(sync_response));
+        } else if (payload_len >= 2 && memcmp(payload, config_prefix, 2) == 0){
+            uint8_t config_response[] = { 0x04, 0x7b, window_size };
+            peer_send_frame(0, 0x0f, config_response, sizeof(config_response));
+            if (config_received) return;
+            config_received = 1;
+            // send burst of reliable events, host processes them after link became active
+            int i;
+            for (i = 0; i < NUM_PEER_EVENTS; i++){
+                peer_send_vendor_event(VENDOR_EVENT_BURST, i);
+            }
+        }
+        return;
+    }
+
+    if (!reliable) return;
+    // drop one ACL packet to trigger retransmission
+    if (packet_type == HCI_ACL_DATA_PACKET && peer_acl_received == PEER_DROPPED_PACKET && !peer_acl_dropped){
+        peer_acl_dropped = 1;
+        return;
+    }
+    if (seq_nr != peer_ack_nr){
+        // out of sequence, host will resend
+        peer_ack_pending = 1;
+        return;
+    }
+    peer_ack_nr = (peer_ack_nr + 1) & 0x07;
+    peer_ack_pending = 1;
+    if (packet_type != HCI_ACL_DATA_PACKET) return;
+
+    // verify ACL packet content
+    if (payload_len != 4 + ACL_PAYLOAD_LEN) _exit(12);
+    int i;
+    for (i = 0; i < ACL_PAYLOAD_LEN; i++){
+        if (payload[4+i] != (uint8_t) (peer_acl_received + i)) _exit(13);
+    }
+    peer_acl_received++;
+    if (peer_acl_received == NUM_ACL_PACKETS){
+        peer_send_vendor_event(VENDOR_EVENT_DONE, 0);
+        peer_ack_pending = 0;
+    }
+}
+
+static void peer_run(int fd, uint8_t window_size){
+    peer_fd = fd;
+    uint8_t buffer[1024];
+    while (1){
+        int len = read(peer_fd, buffer, sizeof(buffer));
+        if (len <= 0) _exit(0);
+        int i;
+        for (i = 0; i < len; i++){
+            uint8_t byte = buffer[i];
+            if (byte == 0xc0){
+                peer_process_frame(window_size);
+                peer_frame_len = 0;
+                peer_frame_escape = 0;
+                continue;
+            }
+            if (byte == 0xdb){
+                peer_frame_escape = 1;
+                continue;
+            }
+            if (peer_frame_escape){
+                byte = (byte == 0xdc) ? 0xc0 : 0xdb;
+                peer_frame_escape = 0;
+            }
+            if (peer_frame_len < sizeof(peer_frame)){
+                peer_frame[peer_frame_len++] = byte;
+            }
+        }
+        if (peer_ack_pending){
+            // controller needs some time before acknowledging
+            usleep(PEER_ACK_DELAY_US);
+            peer_ack_pending = 0;
+            peer_send_frame(0, 0x00, NULL, 0);
+        }
+    }
+}
+
+// --- BTstack side
+
+static const hci_transport_t * transport;
+static hci_transport_config_uart_t config = {
+    HCI_TRANSPORT_CONFIG_UART,
+    115200,
+    0,
+    0,
+    NULL,
+};
+static uint8_t  acl_packet_with_pre_buffer[HCI_OUTGOING_PRE_BUFFER_SIZE + 4 + ACL_PAYLOAD_LEN];
+static uint8_t * acl_packet = &acl_packet_with_pre_buffer[HCI_OUTGOING_PRE_BUFFER_SIZE];
+
+static const uint8_t window_sizes[] = { 1, HCI_H5_SLIDING_WINDOW_SIZE };
+static int      run_index;
+static pid_t    peer_pid;
+static int      pty_slave_fd;
+static int      acl_packets_sent;
+static int      events_received;
+static uint32_t time_start_ms;
+static int      errors;
+static btstack_timer_source_t next_run_timer;
+static btstack_timer_source_t timeout_timer;
+
+static void start_run(btstack_timer_source_t * ts);
+
+static void send_next_acl_packet(void){
+    if (acl_packets_sent == NUM_ACL_PACKETS) return;
+    if (!transport->can_send_packet_now(HCI_ACL_DATA_PACKET)) return;
+    little_endian_store_16(acl_packet, 0, 0x0001);
+    little_endian_store_16(acl_packet, 2, ACL_PAYLOAD_LEN);
+    int i;
+    for (i = 0; i < ACL_PAYLOAD_LEN; i++){
+        acl_packet[4+i] = acl_packets_sent + i;
+    }
+    acl_packets_sent++;
+    transport->send_packet(HCI_ACL_DATA_PACKET, acl_packet, 4 + ACL_PAYLOAD_LEN);
+}
+
+static void finish_run(void){
+    transport->close();
+    close(pty_slave_fd);
+    int status;
+    waitpid(peer_pid, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status)){
+        printf("window %u: peer failed with status %d\n", window_sizes[run_index], WEXITSTATUS(status));
+        errors++;
+    }
+    run_index++;
+    btstack_run_loop_set_timer_handler(&next_run_timer, &start_run);
+    btstack_run_loop_set_timer(&next_run_timer, 0);
+    btstack_run_loop_add_timer(&next_run_timer);
+}
+
+static void packet_handler(uint8_t packet_type, uint8_t * packet, uint16_t size){
+    (void) size;
+    if (packet_type != HCI_EVENT_PACKET) return;
+    switch (packet[0]){
+        case HCI_EVENT_TRANSPORT_PACKET_SENT:
+            if (time_start_ms == 0){
+                time_start_ms = btstack_run_loop_get_time_ms();
+            }
+            send_next_acl_packet();
+            break;
+        case 0xff:
+            if (packet[2] == VENDOR_EVENT_BURST){
+                if (packet[3] != events_received){
+                    printf("window %u: expected event %u, got %u\n", window_sizes[run_index], events_received, packet[3]);
+                    errors++;
+                }
+                events_received++;
+                break;
+            }
+            if (packet[2] == VENDOR_EVENT_DONE){
+                uint32_t duration_ms = btstack_run_loop_get_time_ms() - time_start_ms;
+                if (duration_ms == 0) duration_ms = 1;
+                printf("window %u: %u ACL packets in %u ms, %u packets/s, %u kB/s, %u peer events\n", window_sizes[run_index],
+                    NUM_ACL_PACKETS, duration_ms, NUM_ACL_PACKETS * 1000 / duration_ms,
+                    NUM_ACL_PACKETS * ACL_PAYLOAD_LEN / duration_ms, events_received);
+                if (events_received != NUM_PEER_EVENTS){
+                    errors++;
+                }
+                finish_run();
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+static void start_run(btstack_timer_source_t * ts){
+    (void) ts;
+    if (run_index == sizeof(window_sizes)){
+        exit(errors);
+    }
+
+    int master_fd = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master_fd < 0 || grantpt(master_fd) || unlockpt(master_fd)){
+        printf("cannot open pty\n");
+        exit(1);
+    }
+    config.device_name = ptsname(master_fd);
+
+    // configure raw mode before peer starts sending
+    pty_slave_fd = open(config.device_name, O_RDWR | O_NOCTTY);
+    struct termios toptions;
+    tcgetattr(pty_slave_fd, &toptions);
+    cfmakeraw(&toptions);
+    tcsetattr(pty_slave_fd, TCSANOW, &toptions);
+
+    peer_pid = fork();
+    if (peer_pid == 0){
+        close(pty_slave_fd);
+        peer_run(master_fd, window_sizes[run_index]);
+    }
+    close(master_fd);
+
+    acl_packets_sent = 0;
+    events_received = 0;
+    time_start_ms = 0;
+    transport = hci_transport_h5_instance(btstack_uart_block_posix_instance());
+    transport->init(&config);
+    transport->register_packet_handler(&packet_handler);
+    transport->open();
+}
+
+static void timeout_handler(btstack_timer_source_t * ts){
+    (void) ts;
+    printf("window %u: timeout, %u ACL packets sent, %u peer events received\n", window_sizes[run_index], acl_packets_sent, events_received);
+    kill(peer_pid, SIGKILL);
+    exit(1);
+}
+
+int main(int argc, const char * argv[]){
+    (void) argc;
+    (void) argv;
+    btstack_run_loop_init(btstack_run_loop_posix_get_instance());
+    btstack_run_loop_set_timer_handler(&timeout_timer, &timeout_handler);
+    btstack_run_loop_set_timer(&timeout_timer, TEST_TIMEOUT_MS);
+    btstack_run_loop_add_timer(&timeout_timer);
+    start_run(NULL);
+    btstack_run_loop_execute();
+    return 0;
+}
@@ -217,6 +217,32 @@ TEST(CVSD_PLC, TestSineWave){
     process_wav_file_with_plc("results/sine_test_with_bad_frames.wav", "results/sine_test_with_bad_frames_after_plc.wav");
 }
 
+// lose every 10th frame of a sine wave, concealed signal must stay close to the original
+TEST(CVSD_PLC, ConcealmentQuality){
+    int16_t audio_frame_out[audio_samples_per_frame];
+    int64_t signal_energy = 0;
+    int64_t error_energy  = 0;
+    int frame, i;
+
+    phase = 0;
+    btstack_cvsd_plc_init(&plc_state);
+    for (frame = 0; frame < 1000; frame++){
+        create_sine_wave_int16_data(audio_samples_per_frame, audio_frame_in);
+        if (frame > 20 && (frame % 10) == 0){
+            btstack_cvsd_plc_bad_frame(&plc_state, audio_frame_out);
+        } else {
+            btstack_cvsd_plc_good_frame(&plc_state, audio_frame_in, audio_frame_out);
+        }
+        for (i = 0; i < audio_samples_per_frame; i++){
+            int32_t error = audio_frame_out[i] - audio_frame_in[i];
+            signal_energy += (int32_t) audio_frame_in[i] * audio_frame_in[i];
+            error_energy  += error * error;
+        }
+    }
+    // SNR > 40 dB
+    CHECK(error_energy * 10000 < signal_energy);
+}
+
 int main (int argc, const char * argv[]){
     return CommandLineTestRunner::RunAllTests(argc, argv);
 }
\ No newline at end of file
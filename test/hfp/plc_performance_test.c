@@ -0,0 +1,157 @@
+/*
+ * Copyright (C) 2017 BlueKitchen GmbH
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ * 4. Any redistribution, use, or modification is done solely for
+ *    personal benefit and not for any commercial purpose or for
+ *    monetary gain.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BLUEKITCHEN GMBH AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL MATTHIAS
+ * RINGWALD OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Please inquire about commercial licensing options at 
+ * contact@bluekitchen-gmbh.com
+ *
+ */
+ 
+// *****************************************************************************
+//
+// PLC performance test: time needed to conceal lost CVSD and mSBC frames
+//
+// *****************************************************************************
+
+#include "btstack_config.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "btstack_run_loop.h"
+#include "btstack_run_loop_posix.h"
+#include "btstack_cvsd_plc.h"
+#include "btstack_sbc_plc.h"
+
+#define NUM_LOST_FRAMES 20000
+
+static uint32_t noise_state = 1;
+
+// speech-like test signal: random walk
+static void fill_frame(int16_t * frame, int num_samples){
+    static int32_t value;
+    int i;
+    for (i = 0; i < num_samples; i++){
+        noise_state = noise_state * 1103515245u + 12345u;
+        value += (int32_t) ((noise_state >> 16) & 0x7ff) - 0x400;
+        if (value >  20000) value =  20000;
+        if (value < -20000) value = -20000;
+        frame[i] = (int16_t) value;
+    }
+}
+
+static void report(const char * name, uint32_t time_ms){
+    printf("%-5s: %u lost frames concealed in %u ms", name, NUM_LOST_FRAMES, time_ms);
+    if ((int32_t) time_ms > 0){
+        printf(" - %u frames/s, %u ns/frame", (uint32_t) ((uint64_t) NUM_LOST_FRAMES * 1000 / time_ms),
+            (uint32_t) ((uint64_t) time_ms * 1000000 / NUM_LOST_FRAMES));
+    }
+    printf("\n");
+}
+
+// every second frame is lost, so each lost frame runs the pattern search.
+// the time for the good frames is measured separately and subtracted
+static void measure_cvsd(void){
+    static btstack_cvsd_plc_state_t plc_state;
+    int16_t frame_in[CVSD_FS];
+    int16_t frame_out[CVSD_FS];
+    uint32_t time_ms;
+    uint32_t timestamp_start;
+    int i;
+
+    btstack_cvsd_plc_init(&plc_state);
+    for (i = 0; i < CVSD_LHIST / CVSD_FS + 1; i++){
+        fill_frame(frame_in, CVSD_FS);
+        btstack_cvsd_plc_good_frame(&plc_state, frame_in, frame_out);
+    }
+    // reference: good frames only
+    timestamp_start = btstack_run_loop_get_time_ms();
+    for (i = 0; i < NUM_LOST_FRAMES; i++){
+        fill_frame(frame_in, CVSD_FS);
+        btstack_cvsd_plc_good_frame(&plc_state, frame_in, frame_out);
+        btstack_cvsd_plc_good_frame(&plc_state, frame_in, frame_out);
+    }
+    time_ms = btstack_run_loop_get_time_ms() - timestamp_start;
+
+    timestamp_start = btstack_run_loop_get_time_ms();
+    for (i = 0; i < NUM_LOST_FRAMES; i++){
+        fill_frame(frame_in, CVSD_FS);
+        btstack_cvsd_plc_good_frame(&plc_state, frame_in, frame_out);
+        btstack_cvsd_plc_bad_frame(&plc_state, frame_out);
+    }
+    time_ms = btstack_run_loop_get_time_ms() - timestamp_start - time_ms;
+    report("CVSD", time_ms);
+}
+
+static void measure_msbc(void){
+    static btstack_sbc_plc_state_t plc_state;
+    int16_t frame_in[SBC_FS];
+    int16_t frame_out[SBC_FS];
+    int16_t zir[SBC_FS];
+    uint32_t time_ms;
+    uint32_t timestamp_start;
+    int i;
+
+    memset(zir, 0, sizeof(zir));
+    btstack_sbc_plc_init(&plc_state);
+    for (i = 0; i < SBC_LHIST / SBC_FS + 1; i++){
+        fill_frame(frame_in, SBC_FS);
+        btstack_sbc_plc_good_frame(&plc_state, frame_in, frame_out);
+    }
+    // reference: good frames only
+    timestamp_start = btstack_run_loop_get_time_ms();
+    for (i = 0; i < NUM_LOST_FRAMES; i++){
+        fill_frame(frame_in, SBC_FS);
+        btstack_sbc_plc_good_frame(&plc_state, frame_in, frame_out);
+        btstack_sbc_plc_good_frame(&plc_state, frame_in, frame_out);
+    }
+    time_ms = btstack_run_loop_get_time_ms() - timestamp_start;
+
+    timestamp_start = btstack_run_loop_get_time_ms();
+    for (i = 0; i < NUM_LOST_FRAMES; i++){
+        fill_frame(frame_in, SBC_FS);
+        btstack_sbc_plc_good_frame(&plc_state, frame_in, frame_out);
+        btstack_sbc_plc_bad_frame(&plc_state, zir, frame_out);
+    }
+    time_ms = btstack_run_loop_get_time_ms() - timestamp_start - time_ms;
+    report("mSBC", time_ms);
+}
+
+int main (int argc, const char * argv[]){
+    (void) argc;
+    (void) argv;
+    btstack_run_loop_init(btstack_run_loop_posix_get_instance());
+    measure_cvsd();
+    measure_msbc();
+    return 0;
+}
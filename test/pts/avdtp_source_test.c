@@ -206,7 +206,7 @@ static int avdtp_source_stream_send_media_payload(uint8_t local_seid, uint8_t *
 }
 
 static void a2dp_demo_send_media_packet(void){
-    int num_bytes_in_frame = btstack_sbc_encoder_sbc_buffer_length();
+    int num_bytes_in_frame = btstack_sbc_encoder_sbc_buffer_length(&sc.sbc_encoder_state);
     int bytes_in_storage = media_tracker.sbc_storage_count;
     uint8_t num_frames = bytes_in_storage / num_bytes_in_frame;
     
@@ -231,18 +231,18 @@ static void produce_sine_audio(int16_t * pcm_buffer, int num_samples_to_write){
 static int fill_sbc_audio_buffer(a2dp_media_sending_context_t * context){
     // perform sbc encodin
     int total_num_bytes_read = 0;
-    int num_audio_samples_per_sbc_buffer = btstack_sbc_encoder_num_audio_frames();
-    // printf("num_audio_samples_per_sbc_buffer %d, btstack_sbc_encoder_sbc_buffer_length() %d\n", num_audio_samples_per_sbc_buffer, btstack_sbc_encoder_sbc_buffer_length());
+    int num_audio_samples_per_sbc_buffer = btstack_sbc_encoder_num_audio_frames(&sc.sbc_encoder_state);
+    // printf("num_audio_samples_per_sbc_buffer %d, btstack_sbc_encoder_sbc_buffer_length(&sc.sbc_encoder_state) %d\n", num_audio_samples_per_sbc_buffer, btstack_sbc_encoder_sbc_buffer_length(&sc.sbc_encoder_state));
     while (context->samples_ready >= num_audio_samples_per_sbc_buffer
-        && (context->max_media_payload_size - context->sbc_storage_count) >= btstack_sbc_encoder_sbc_buffer_length()){
+        && (context->max_media_payload_size - context->sbc_storage_count) >= btstack_sbc_encoder_sbc_buffer_length(&sc.sbc_encoder_state)){
 
         uint8_t pcm_frame[256*BYTES_PER_AUDIO_SAMPLE];
 
         produce_sine_audio((int16_t *) pcm_frame, num_audio_samples_per_sbc_buffer);
-        btstack_sbc_encoder_process_data((int16_t *) pcm_frame);
+        btstack_sbc_encoder_process_data(&sc.sbc_encoder_state, (int16_t *) pcm_frame);
         
-        uint16_t sbc_frame_size = btstack_sbc_encoder_sbc_buffer_length(); 
-        uint8_t * sbc_frame = btstack_sbc_encoder_sbc_buffer();
+        uint16_t sbc_frame_size = btstack_sbc_encoder_sbc_buffer_length(&sc.sbc_encoder_state); 
+        uint8_t * sbc_frame = btstack_sbc_encoder_sbc_buffer(&sc.sbc_encoder_state);
         
         total_num_bytes_read += num_audio_samples_per_sbc_buffer;
         memcpy(&context->sbc_storage[context->sbc_storage_count], sbc_frame, sbc_frame_size);
@@ -277,7 +277,7 @@ static void avdtp_audio_timeout_handler(btstack_timer_source_t * timer){
 
     fill_sbc_audio_buffer(context);
 
-    if ((context->sbc_storage_count + btstack_sbc_encoder_sbc_buffer_length()) > context->max_media_payload_size){
+    if ((context->sbc_storage_count + btstack_sbc_encoder_sbc_buffer_length(&sc.sbc_encoder_state)) > context->max_media_payload_size){
         // schedule sending
         context->sbc_ready_to_send = 1;
 
@@ -0,0 +1,152 @@
+/*
+ * Copyright (C) 2017 BlueKitchen GmbH
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ * 4. Any redistribution, use, or modification is done solely for
+ *    personal benefit and not for any commercial purpose or for
+ *    monetary gain.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BLUEKITCHEN GMBH AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL MATTHIAS
+ * RINGWALD OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Please inquire about commercial licensing options at 
+ * contact@bluekitchen-gmbh.com
+ *
+ */
+
+/*
+ *  run_loop_benchmark.c
+ *
+ *  Compares dispatch cost of the select based POSIX run loop with the epoll based run loop
+ *  for 10, 100 and 1000 data sources. Each data source wraps an eventfd, the handler
+ *  consumes its event and triggers another data source, so exactly one source is ready per iteration.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/select.h>
+#include <sys/wait.h>
+
+#include "btstack_run_loop.h"
+#include "btstack_run_loop_posix.h"
+#include "btstack_run_loop_epoll.h"
+
+#define MAX_DATA_SOURCES 1000
+#define NUM_DISPATCHES   20000
+
+static btstack_data_source_t data_sources[MAX_DATA_SOURCES];
+static int      num_data_sources;
+static int      num_dispatches;
+static uint32_t next_index;
+static struct timespec start_ts;
+static const char * run_loop_name;
+
+static void trigger(int index){
+    uint64_t value = 1;
+    if (write(data_sources[index].fd, &value, sizeof(value)) != sizeof(value)){
+        perror("write");
+        exit(1);
+    }
+}
+
+static void data_source_handler(btstack_data_source_t * ds, btstack_data_source_callback_type_t callback_type){
+    (void) callback_type;
+    uint64_t value;
+    if (read(ds->fd, &value, sizeof(value)) != sizeof(value)){
+        perror("read");
+        exit(1);
+    }
+    num_dispatches++;
+    if (num_dispatches == NUM_DISPATCHES){
+        struct timespec end_ts;
+        clock_gettime(CLOCK_MONOTONIC, &end_ts);
+        double duration_us = (end_ts.tv_sec - start_ts.tv_sec) * 1e6 + (end_ts.tv_nsec - start_ts.tv_nsec) / 1e3;
+        printf("%-6s %4u data sources: %8.3f us per dispatch\n", run_loop_name, num_data_sources, duration_us / NUM_DISPATCHES);
+        exit(0);
+    }
+    // simple LCG to pick next data source
+    next_index = next_index * 1103515245u + 12345u;
+    trigger((next_index >> 8) % num_data_sources);
+}
+
+static void run_benchmark(const char * name, const btstack_run_loop_t * run_loop, int count){
+    run_loop_name = name;
+    num_data_sources = count;
+    btstack_run_loop_init(run_loop);
+    int i;
+    for (i = 0; i < num_data_sources; i++){
+        int fd = eventfd(0, EFD_NONBLOCK);
+        if (fd < 0){
+            perror("eventfd");
+            exit(1);
+        }
+        if (run_loop == btstack_run_loop_posix_get_instance() && fd >= FD_SETSIZE){
+            printf("%-6s %4u data sources: not supported, fd %u >= FD_SETSIZE\n", run_loop_name, num_data_sources, fd);
+            exit(0);
+        }
+        btstack_run_loop_set_data_source_fd(&data_sources[i], fd);
+        btstack_run_loop_set_data_source_handler(&data_sources[i], &data_source_handler);
+        btstack_run_loop_enable_data_source_callbacks(&data_sources[i], DATA_SOURCE_CALLBACK_READ);
+        btstack_run_loop_add_data_source(&data_sources[i]);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &start_ts);
+    trigger(0);
+    btstack_run_loop_execute();
+}
+
+int main(void){
+    // allow for more file descriptors than the default soft limit
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0){
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+
+    const int counts[] = { 10, 100, MAX_DATA_SOURCES };
+    unsigned int i;
+    for (i = 0; i < sizeof(counts) / sizeof(int); i++){
+        int variant;
+        for (variant = 0; variant < 2; variant++){
+            // run loops don't return, so run each benchmark in a child process
+            fflush(stdout);
+            pid_t pid = fork();
+            if (pid == 0){
+                if (variant == 0){
+                    run_benchmark("select", btstack_run_loop_posix_get_instance(), counts[i]);
+                } else {
+                    run_benchmark("epoll", btstack_run_loop_epoll_get_instance(), counts[i]);
+                }
+            }
+            int status;
+            waitpid(pid, &status, 0);
+        }
+    }
+    return 0;
+}
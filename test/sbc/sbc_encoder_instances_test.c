@@ -0,0 +1,227 @@
+/*
+ * Copyright (C) 2017 BlueKitchen GmbH
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ * 4. Any redistribution, use, or modification is done solely for
+ *    personal benefit and not for any commercial purpose or for
+ *    monetary gain.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BLUEKITCHEN GMBH AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL MATTHIAS
+ * RINGWALD OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Please inquire about commercial licensing options at 
+ * contact@bluekitchen-gmbh.com
+ *
+ */
+ 
+// *****************************************************************************
+//
+// SBC encoder/decoder instances test: independent streams encoded and decoded
+// interleaved and from separate threads must match single instance output
+//
+// *****************************************************************************
+
+#include "btstack_config.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "btstack_sbc.h"
+
+#define NUM_STREAMS        3
+#define NUM_FRAMES       200
+#define MAX_SBC_FRAME_SIZE 512
+#define MAX_PCM_FRAME    (16*8*2)
+
+typedef struct {
+    btstack_sbc_mode_t mode;
+    int blocks;
+    int subbands;
+    int allocation_method;
+    int sample_rate;
+    int bitpool;
+    int channel_mode;
+    int num_channels;
+} stream_config_t;
+
+typedef struct {
+    const stream_config_t * config;
+    btstack_sbc_encoder_state_t encoder_state;
+    btstack_sbc_decoder_state_t decoder_state;
+    uint32_t  phase;
+    int       frame_nr;
+    uint8_t   sbc[NUM_FRAMES][MAX_SBC_FRAME_SIZE];
+    uint16_t  sbc_len[NUM_FRAMES];
+    uint32_t  pcm_hash;
+    int       pcm_samples;
+} stream_t;
+
+static const stream_config_t configs[NUM_STREAMS] = {
+    // A2DP: 44.1 kHz, joint stereo, 16 blocks, 8 subbands, loudness, bitpool 53
+    { SBC_MODE_STANDARD, 16, 8, 0, 44100, 53, 3, 2 },
+    // A2DP: 32 kHz, mono, 8 blocks, 4 subbands, SNR, bitpool 31
+    { SBC_MODE_STANDARD,  8, 4, 1, 32000, 31, 0, 1 },
+    // HFP: mSBC
+    { SBC_MODE_mSBC,     15, 8, 0, 16000, 26, 0, 1 },
+};
+
+static stream_t reference[NUM_STREAMS];
+static stream_t streams[NUM_STREAMS];
+
+// simple deterministic test signal, different per stream
+static void fill_pcm(stream_t * stream, int16_t * pcm, int num_samples){
+    int i;
+    for (i = 0; i < num_samples * stream->config->num_channels; i++){
+        stream->phase = stream->phase * 1103515245u + 12345u;
+        pcm[i] = (int16_t) ((stream->phase >> 16) & 0x3fff) - 0x2000;
+    }
+}
+
+static void handle_pcm_data(int16_t * data, int num_samples, int num_channels, int sample_rate, void * context){
+    (void) sample_rate;
+    stream_t * stream = (stream_t *) context;
+    int i;
+    for (i = 0; i < num_samples * num_channels; i++){
+        stream->pcm_hash = (stream->pcm_hash * 31u) + (uint16_t) data[i];
+    }
+    stream->pcm_samples += num_samples;
+}
+
+static void stream_init(stream_t * stream, const stream_config_t * config){
+    memset(stream, 0, sizeof(stream_t));
+    stream->config = config;
+    stream->phase  = (uint32_t) config->sample_rate;
+    btstack_sbc_encoder_init(&stream->encoder_state, config->mode, config->blocks, config->subbands,
+        config->allocation_method, config->sample_rate, config->bitpool, config->channel_mode);
+    btstack_sbc_decoder_init(&stream->decoder_state, config->mode, &handle_pcm_data, stream);
+}
+
+static void stream_process_frame(stream_t * stream){
+    int16_t pcm[MAX_PCM_FRAME];
+    int num_samples = btstack_sbc_encoder_num_audio_frames(&stream->encoder_state);
+    fill_pcm(stream, pcm, num_samples);
+    btstack_sbc_encoder_process_data(&stream->encoder_state, pcm);
+
+    uint16_t len = btstack_sbc_encoder_sbc_buffer_length(&stream->encoder_state);
+    uint8_t * sbc = btstack_sbc_encoder_sbc_buffer(&stream->encoder_state);
+    memcpy(stream->sbc[stream->frame_nr], sbc, len);
+    stream->sbc_len[stream->frame_nr] = len;
+    stream->frame_nr++;
+
+    if (stream->config->mode == SBC_MODE_mSBC){
+        // decoder expects H2 header and padding as received over SCO
+        static const uint8_t h2_byte_1[] = { 0x08, 0x38, 0xc8, 0xf8 };
+        uint8_t frame[60];
+        frame[0] = 0x01;
+        frame[1] = h2_byte_1[(stream->frame_nr - 1) & 3];
+        memcpy(&frame[2], sbc, 57);
+        frame[59] = 0;
+        btstack_sbc_decoder_process_data(&stream->decoder_state, 0, frame, sizeof(frame));
+    } else {
+        btstack_sbc_decoder_process_data(&stream->decoder_state, 0, sbc, len);
+    }
+}
+
+static void * stream_thread(void * context){
+    stream_t * stream = (stream_t *) context;
+    int i;
+    for (i = 0; i < NUM_FRAMES; i++){
+        stream_process_frame(stream);
+    }
+    return NULL;
+}
+
+static int compare_with_reference(const char * name){
+    int errors = 0;
+    int i, j;
+    for (i = 0; i < NUM_STREAMS; i++){
+        for (j = 0; j < NUM_FRAMES; j++){
+            if (streams[i].sbc_len[j] != reference[i].sbc_len[j] ||
+                memcmp(streams[i].sbc[j], reference[i].sbc[j], reference[i].sbc_len[j]) != 0){
+                printf("%s: stream %d, frame %d: SBC frame differs from reference\n", name, i, j);
+                errors++;
+                break;
+            }
+        }
+        if (streams[i].pcm_samples != reference[i].pcm_samples || streams[i].pcm_hash != reference[i].pcm_hash){
+            printf("%s: stream %d: decoded PCM differs from reference (%d vs. %d samples)\n", name, i,
+                streams[i].pcm_samples, reference[i].pcm_samples);
+            errors++;
+        }
+    }
+    return errors;
+}
+
+int main (int argc, const char * argv[]){
+    (void) argc;
+    (void) argv;
+    int errors = 0;
+    int i, j;
+
+    // reference: one stream after the other
+    for (i = 0; i < NUM_STREAMS; i++){
+        stream_init(&reference[i], &configs[i]);
+        for (j = 0; j < NUM_FRAMES; j++){
+            stream_process_frame(&reference[i]);
+        }
+        if (reference[i].pcm_samples == 0){
+            printf("reference: stream %d: no PCM decoded\n", i);
+            errors++;
+        }
+    }
+
+    // interleaved: all streams advance frame by frame
+    for (i = 0; i < NUM_STREAMS; i++){
+        stream_init(&streams[i], &configs[i]);
+    }
+    for (j = 0; j < NUM_FRAMES; j++){
+        for (i = 0; i < NUM_STREAMS; i++){
+            stream_process_frame(&streams[i]);
+        }
+    }
+    errors += compare_with_reference("interleaved");
+
+    // threads: each stream on its own thread
+    pthread_t threads[NUM_STREAMS];
+    for (i = 0; i < NUM_STREAMS; i++){
+        stream_init(&streams[i], &configs[i]);
+    }
+    for (i = 0; i < NUM_STREAMS; i++){
+        pthread_create(&threads[i], NULL, &stream_thread, &streams[i]);
+    }
+    for (i = 0; i < NUM_STREAMS; i++){
+        pthread_join(threads[i], NULL);
+    }
+    errors += compare_with_reference("threads");
+
+    if (errors){
+        printf("SBC instances: %d errors\n", errors);
+        return 1;
+    }
+    printf("SBC instances: OK\n");
+    return 0;
+}
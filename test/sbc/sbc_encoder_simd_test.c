@@ -0,0 +1,137 @@
+/*
+ * Copyright (C) 2017 BlueKitchen GmbH
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ * 4. Any redistribution, use, or modification is done solely for
+ *    personal benefit and not for any commercial purpose or for
+ *    monetary gain.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BLUEKITCHEN GMBH AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL MATTHIAS
+ * RINGWALD OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Please inquire about commercial licensing options at 
+ * contact@bluekitchen-gmbh.com
+ *
+ */
+ 
+// *****************************************************************************
+//
+// SBC encoder SIMD test: SIMD windowing of the analysis filter must be
+// bit-exact with the C implementation for all configurations
+//
+// *****************************************************************************
+
+#include "btstack_config.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "btstack_sbc.h"
+
+#define NUM_FRAMES       100
+#define MAX_PCM_FRAME    (16*8*2)
+
+// channel modes: 0 = mono, 1 = dual channel, 2 = stereo, 3 = joint stereo
+#define CHANNEL_MODE_MONO         0
+#define CHANNEL_MODE_JOINT_STEREO 3
+#define ALLOCATION_LOUDNESS       0
+
+static uint32_t phase;
+
+// full scale random signal with occasional extreme values
+static void fill_pcm(int16_t * pcm, int num_values){
+    int i;
+    for (i = 0; i < num_values; i++){
+        phase = phase * 1103515245u + 12345u;
+        switch ((phase >> 8) & 0x1f){
+            case 0:
+                pcm[i] = 32767;
+                break;
+            case 1:
+                pcm[i] = -32768;
+                break;
+            default:
+                pcm[i] = (int16_t) (phase >> 16);
+                break;
+        }
+    }
+}
+
+static int compare_config(btstack_sbc_mode_t mode, int blocks, int subbands, int allocation_method, int bitpool, int channel_mode){
+    static btstack_sbc_encoder_state_t encoder_state_c;
+    static btstack_sbc_encoder_state_t encoder_state_simd;
+    int16_t pcm[MAX_PCM_FRAME];
+    int num_channels = (channel_mode == CHANNEL_MODE_MONO) ? 1 : 2;
+    int frame;
+
+    btstack_sbc_encoder_test_use_simd(0);
+    btstack_sbc_encoder_init(&encoder_state_c, mode, blocks, subbands, allocation_method, 44100, bitpool, channel_mode);
+    btstack_sbc_encoder_test_use_simd(1);
+    btstack_sbc_encoder_init(&encoder_state_simd, mode, blocks, subbands, allocation_method, 44100, bitpool, channel_mode);
+
+    int num_values = btstack_sbc_encoder_num_audio_frames(&encoder_state_c) * num_channels;
+    for (frame = 0; frame < NUM_FRAMES; frame++){
+        fill_pcm(pcm, num_values);
+        btstack_sbc_encoder_process_data(&encoder_state_c, pcm);
+        btstack_sbc_encoder_process_data(&encoder_state_simd, pcm);
+        uint16_t len = btstack_sbc_encoder_sbc_buffer_length(&encoder_state_c);
+        if (len != btstack_sbc_encoder_sbc_buffer_length(&encoder_state_simd) ||
+            memcmp(btstack_sbc_encoder_sbc_buffer(&encoder_state_c), btstack_sbc_encoder_sbc_buffer(&encoder_state_simd), len) != 0){
+            printf("mode %u, %u blocks, %u subbands, channel mode %u: frame %u differs\n", mode, blocks, subbands, channel_mode, frame);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int main (int argc, const char * argv[]){
+    (void) argc;
+    (void) argv;
+    const char * simd_name = btstack_sbc_encoder_test_simd_name();
+    int errors = 0;
+    int blocks, subbands, channel_mode;
+
+    if (simd_name == NULL){
+        printf("SBC SIMD: no SIMD windowing available, skipped\n");
+        return 0;
+    }
+
+    for (subbands = 4; subbands <= 8; subbands += 4){
+        for (blocks = 4; blocks <= 16; blocks += 4){
+            for (channel_mode = CHANNEL_MODE_MONO; channel_mode <= CHANNEL_MODE_JOINT_STEREO; channel_mode++){
+                errors += compare_config(SBC_MODE_STANDARD, blocks, subbands, ALLOCATION_LOUDNESS, 53, channel_mode);
+            }
+        }
+    }
+    errors += compare_config(SBC_MODE_mSBC, 15, 8, ALLOCATION_LOUDNESS, 26, CHANNEL_MODE_MONO);
+
+    if (errors){
+        printf("SBC SIMD (%s): %d errors\n", simd_name, errors);
+        return 1;
+    }
+    printf("SBC SIMD (%s): OK\n", simd_name);
+    return 0;
+}
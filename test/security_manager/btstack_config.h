@@ -34,4 +34,6 @@
 
 #define NVM_NUM_LINK_KEYS 2
 
+#define SM_SETUP_CONTEXT_NUM 4
+
 #endif
@@ -30,6 +30,10 @@ uint8_t * mock_packet_buffer(void){
 	return packet_buffer;
 }
 
+uint16_t mock_packet_buffer_len(void){
+	return packet_buffer_len;
+}
+
 void mock_clear_packet_buffer(void){
 	packet_buffer_len = 0;
 	memset(packet_buffer, 0, sizeof(packet_buffer));
@@ -0,0 +1,215 @@
+// *****************************************************************************
+//
+// Address resolution tests: resolving cache and statistics
+//
+// *****************************************************************************
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "CppUTest/TestHarness.h"
+#include "CppUTest/CommandLineTestRunner.h"
+
+#include "btstack_run_loop_posix.h"
+
+#include "hci_cmd.h"
+#include "btstack_util.h"
+
+#include "btstack_memory.h"
+#include "hci.h"
+#include "hci_dump.h"
+#include "l2cap.h"
+#include "ble/le_device_db.h"
+#include "ble/sm.h"
+
+void mock_init(void);
+void mock_simulate_hci_state_working(void);
+void mock_simulate_hci_event(uint8_t * packet, uint16_t size);
+void aes128_report_result(void);
+void aes128_calc_cyphertext(uint8_t key[16], uint8_t plaintext[16], uint8_t cyphertext[16]);
+uint8_t * mock_packet_buffer(void);
+uint16_t mock_packet_buffer_len(void);
+void mock_clear_packet_buffer(void);
+
+static uint8_t rand_event[] = { 0x0e, 0x0c, 0x01, 0x18, 0x20, 0x00, 0x2f, 0x04, 0x82, 0x84, 0x72, 0x46, 0x9c, 0x93 };
+
+static btstack_packet_callback_registration_t sm_event_callback_registration;
+
+static int le_encrypt_count;
+static int resolving_succeeded;
+static int resolving_failed;
+static int resolved_index;
+
+static void app_packet_handler(uint8_t packet_type, uint16_t channel, uint8_t *packet, uint16_t size){
+    UNUSED(channel);
+    UNUSED(size);
+    if (packet_type != HCI_EVENT_PACKET) return;
+    switch (packet[0]){
+        case SM_EVENT_IDENTITY_RESOLVING_SUCCEEDED:
+            resolving_succeeded++;
+            resolved_index = packet[18];
+            break;
+        case SM_EVENT_IDENTITY_RESOLVING_FAILED:
+            resolving_failed++;
+            break;
+        default:
+            break;
+    }
+}
+
+// act as controller until SM is idle
+static void process_packets(void){
+    while (mock_packet_buffer_len()){
+        uint16_t opcode = little_endian_read_16(mock_packet_buffer(), 0);
+        mock_clear_packet_buffer();
+        if (opcode == hci_le_encrypt.opcode){
+            le_encrypt_count++;
+            aes128_report_result();
+        } else if (opcode == hci_le_rand.opcode){
+            mock_simulate_hci_event(rand_event, sizeof(rand_event));
+        }
+    }
+}
+
+static void irk_for_device(int device, sm_key_t irk){
+    memset(irk, 0xa0 + device, 16);
+}
+
+// resolvable private address = prand || ah(irk, prand)
+static void rpa_for_device(int device, uint8_t prand_lsb, bd_addr_t address){
+    sm_key_t irk;
+    irk_for_device(device, irk);
+    sm_key_t r_prime;
+    memset(r_prime, 0, 16);
+    r_prime[13] = 0x40;
+    r_prime[14] = 0x12;
+    r_prime[15] = prand_lsb;
+    sm_key_t hash;
+    aes128_calc_cyphertext(irk, r_prime, hash);
+    memcpy(&address[0], &r_prime[13], 3);
+    memcpy(&address[3], &hash[13], 3);
+}
+
+static void add_device(int device){
+    sm_key_t irk;
+    irk_for_device(device, irk);
+    bd_addr_t identity_address = { 0x00, 0x1b, 0xdc, 0x00, 0x00, 0x00 };
+    identity_address[5] = device;
+    le_device_db_add(BD_ADDR_TYPE_LE_PUBLIC, identity_address, irk);
+}
+
+static void lookup(bd_addr_t address){
+    le_encrypt_count = 0;
+    resolving_succeeded = 0;
+    resolving_failed = 0;
+    resolved_index = -1;
+    sm_address_resolution_lookup(BD_ADDR_TYPE_LE_RANDOM, address);
+    process_packets();
+}
+
+TEST_GROUP(AddressResolution){
+    sm_address_resolution_statistics_t statistics;
+
+    void setup(void){
+        static int first = 1;
+        if (first){
+            first = 0;
+            btstack_memory_init();
+            btstack_run_loop_init(btstack_run_loop_posix_get_instance());
+            hci_dump_enable_log_level(LOG_LEVEL_INFO, 0);
+        }
+        sm_init();
+        sm_event_callback_registration.callback = &app_packet_handler;
+        sm_add_event_handler(&sm_event_callback_registration);
+        mock_init();
+        mock_clear_packet_buffer();
+        mock_simulate_hci_state_working();
+        process_packets();
+
+        le_device_db_init();
+        add_device(0);
+        add_device(1);
+        add_device(2);
+    }
+};
+
+TEST(AddressResolution, ResolvedAddressFromCache){
+    bd_addr_t address;
+    rpa_for_device(1, 0x34, address);
+
+    lookup(address);
+    CHECK_EQUAL(1, resolving_succeeded);
+    CHECK_EQUAL(1, resolved_index);
+    CHECK_EQUAL(2, le_encrypt_count);
+
+    lookup(address);
+    CHECK_EQUAL(1, resolving_succeeded);
+    CHECK_EQUAL(1, resolved_index);
+    CHECK_EQUAL(0, le_encrypt_count);
+
+    sm_address_resolution_get_statistics(&statistics);
+    CHECK_EQUAL(2, statistics.lookups);
+    CHECK_EQUAL(1, statistics.cache_hits);
+    CHECK_EQUAL(2, statistics.ah_calculations);
+}
+
+TEST(AddressResolution, UnresolvedAddressFromCache){
+    bd_addr_t address;
+    rpa_for_device(3, 0x56, address);
+
+    lookup(address);
+    CHECK_EQUAL(1, resolving_failed);
+    CHECK_EQUAL(3, le_encrypt_count);
+
+    lookup(address);
+    CHECK_EQUAL(1, resolving_failed);
+    CHECK_EQUAL(0, le_encrypt_count);
+
+    // new device invalidates cached failure
+    add_device(3);
+    lookup(address);
+    CHECK_EQUAL(1, resolving_succeeded);
+    CHECK_EQUAL(3, resolved_index);
+    CHECK_EQUAL(4, le_encrypt_count);
+
+    sm_address_resolution_get_statistics(&statistics);
+    CHECK_EQUAL(3, statistics.lookups);
+    CHECK_EQUAL(1, statistics.cache_hits);
+}
+
+TEST(AddressResolution, RemovedDeviceNotResolvedFromCache){
+    bd_addr_t address;
+    rpa_for_device(2, 0x78, address);
+
+    lookup(address);
+    CHECK_EQUAL(1, resolving_succeeded);
+    CHECK_EQUAL(2, resolved_index);
+
+    // replace device with different IRK
+    le_device_db_remove(2);
+    add_device(3);
+    lookup(address);
+    CHECK_EQUAL(1, resolving_failed);
+    CHECK_EQUAL(3, le_encrypt_count);
+}
+
+TEST(AddressResolution, RemovedDeviceWithoutReplacementNotResolvedFromCache){
+    bd_addr_t address;
+    rpa_for_device(2, 0x9a, address);
+
+    lookup(address);
+    CHECK_EQUAL(1, resolving_succeeded);
+    CHECK_EQUAL(2, resolved_index);
+
+    // removed entry keeps its IRK in the memory LE Device DB
+    le_device_db_remove(2);
+    lookup(address);
+    CHECK_EQUAL(0, resolving_succeeded);
+    CHECK_EQUAL(1, resolving_failed);
+}
+
+int main (int argc, const char * argv[]){
+    return CommandLineTestRunner::RunAllTests(argc, argv);
+}
@@ -0,0 +1,512 @@
+// *****************************************************************************
+//
+// Concurrent LE Legacy Pairing stress test
+//
+// Pairs NUM_CONNECTIONS simulated centrals with the Security Manager at once.
+// The controller and the peers are simulated by this file: the controller
+// accepts a single outstanding HCI command, each peer computes its own
+// confirm value and the expected STK and validates the Security Manager's values.
+//
+// *****************************************************************************
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "CppUTest/TestHarness.h"
+#include "CppUTest/CommandLineTestRunner.h"
+
+#include "btstack_run_loop_posix.h"
+
+#include "hci_cmd.h"
+#include "btstack_util.h"
+
+#include "btstack_memory.h"
+#include "hci.h"
+#include "hci_dump.h"
+#include "l2cap.h"
+#include "ble/le_device_db.h"
+#include "ble/sm.h"
+#include "rijndael.h"
+
+#define NUM_CONNECTIONS_MAX 16
+#define CON_HANDLE_BASE     0x0040
+
+// Pairing Request: NoInputNoOutput, no OOB, bonding, key size 16, no initiator keys, all responder keys
+static const uint8_t pairing_request[] = { SM_CODE_PAIRING_REQUEST, 0x03, 0x00, 0x01, 0x10, 0x00, 0x07 };
+
+// local address as provided by gap_le_get_own_address
+static const bd_addr_t local_address = { 0x00, 0x1b, 0xdc, 0x07, 0x32, 0xef };
+
+typedef enum {
+    PEER_W4_PAIRING_RESPONSE,
+    PEER_W4_PAIRING_CONFIRM,
+    PEER_W4_PAIRING_RANDOM,
+    PEER_W4_ENCRYPTION,
+    PEER_W4_KEYS,
+    PEER_DONE,
+    PEER_FAILED,
+} peer_state_t;
+
+typedef struct {
+    hci_connection_t   hci_connection;
+    hci_con_handle_t   con_handle;
+    bd_addr_t          address;
+    peer_state_t       state;
+    // SMP PDU sent by Security Manager, one at a time
+    uint8_t            pdu[32];
+    uint16_t           pdu_len;
+    int                can_send_now_requested;
+    // pairing values in big endian, as used by sm.c
+    uint8_t            pres[7];
+    sm_key_t           m_random;
+    sm_key_t           s_confirm;
+    sm_key_t           stk;
+} peer_t;
+
+static btstack_packet_handler_t le_data_handler;
+static btstack_packet_handler_t event_packet_handler;
+static btstack_packet_callback_registration_t sm_event_callback_registration;
+
+static peer_t                peers[NUM_CONNECTIONS_MAX];
+static int                   num_peers;
+static btstack_linked_list_t connections;
+
+// single HCI command buffer = controller provides one command credit
+static uint8_t  hci_command[64];
+static uint16_t hci_command_len;
+static int      hci_command_overruns;
+
+static uint32_t random_seed;
+static int      num_active_pairings;
+static int      max_active_pairings;
+static hci_con_handle_t idle_con_handle;
+
+static void aes128(const sm_key_t key, const sm_key_t plaintext, sm_key_t cyphertext){
+    uint32_t rk[RKLENGTH(KEYBITS)];
+    int nrounds = rijndaelSetupEncrypt(rk, &key[0], KEYBITS);
+    rijndaelEncrypt(rk, nrounds, plaintext, cyphertext);
+}
+
+// c1 as specified in Vol 3, Part H, 2.2.3 - see sm_c1_t1 and sm_c1_t3 in sm.c
+static void peer_c1(peer_t * peer, const sm_key_t r, sm_key_t c1){
+    sm_key_t tk;
+    memset(tk, 0, 16);
+    sm_key_t p1;
+    reverse_56(peer->pres, &p1[0]);
+    reverse_56(pairing_request, &p1[7]);
+    p1[14] = 0;     // rat: public
+    p1[15] = 0;     // iat: public
+    sm_key_t t1;
+    int i;
+    for (i = 0; i < 16; i++){
+        t1[i] = r[i] ^ p1[i];
+    }
+    sm_key_t t2;
+    aes128(tk, t1, t2);
+    sm_key_t p2;
+    memset(p2, 0, 16);
+    memcpy(&p2[4],  peer->address, 6);
+    memcpy(&p2[10], local_address, 6);
+    sm_key_t t3;
+    for (i = 0; i < 16; i++){
+        t3[i] = t2[i] ^ p2[i];
+    }
+    aes128(tk, t3, c1);
+}
+
+static void simulate_hci_event(uint8_t * packet, uint16_t size){
+    if (event_packet_handler){
+        event_packet_handler(HCI_EVENT_PACKET, 0, packet, size);
+    }
+    if (le_data_handler){
+        le_data_handler(HCI_EVENT_PACKET, 0, packet, size);
+    }
+}
+
+static void simulate_command_complete(uint16_t opcode, const uint8_t * return_parameters, int len){
+    uint8_t event[32];
+    event[0] = HCI_EVENT_COMMAND_COMPLETE;
+    event[1] = 4 + len;
+    event[2] = 1;
+    little_endian_store_16(event, 3, opcode);
+    event[5] = 0;
+    memcpy(&event[6], return_parameters, len);
+    simulate_hci_event(event, 6 + len);
+}
+
+static void peer_send_pdu(peer_t * peer, uint8_t * pdu, uint16_t len){
+    le_data_handler(SM_DATA_PACKET, peer->con_handle, pdu, len);
+}
+
+static void peer_send_key(peer_t * peer, uint8_t code, const sm_key_t key){
+    uint8_t pdu[17];
+    pdu[0] = code;
+    reverse_128(key, &pdu[1]);
+    peer_send_pdu(peer, pdu, sizeof(pdu));
+}
+
+static void peer_set_state(peer_t * peer, peer_state_t state){
+    if (peer->state == PEER_W4_PAIRING_RESPONSE){
+        num_active_pairings++;
+        if (num_active_pairings > max_active_pairings){
+            max_active_pairings = num_active_pairings;
+        }
+    }
+    if (state == PEER_DONE || state == PEER_FAILED){
+        num_active_pairings--;
+    }
+    peer->state = state;
+}
+
+static void peer_handle_pdu(peer_t * peer){
+    uint8_t * pdu = peer->pdu;
+    if (pdu[0] == SM_CODE_PAIRING_FAILED){
+        peer_set_state(peer, PEER_FAILED);
+        return;
+    }
+    switch (peer->state){
+        case PEER_W4_PAIRING_RESPONSE:
+            if (pdu[0] != SM_CODE_PAIRING_RESPONSE) break;
+            memcpy(peer->pres, pdu, 7);
+            sm_key_t m_confirm;
+            peer_c1(peer, peer->m_random, m_confirm);
+            peer_set_state(peer, PEER_W4_PAIRING_CONFIRM);
+            peer_send_key(peer, SM_CODE_PAIRING_CONFIRM, m_confirm);
+            return;
+        case PEER_W4_PAIRING_CONFIRM:
+            if (pdu[0] != SM_CODE_PAIRING_CONFIRM) break;
+            reverse_128(&pdu[1], peer->s_confirm);
+            peer_set_state(peer, PEER_W4_PAIRING_RANDOM);
+            peer_send_key(peer, SM_CODE_PAIRING_RANDOM, peer->m_random);
+            return;
+        case PEER_W4_PAIRING_RANDOM: {
+            if (pdu[0] != SM_CODE_PAIRING_RANDOM) break;
+            sm_key_t s_random;
+            reverse_128(&pdu[1], s_random);
+            sm_key_t s_confirm;
+            peer_c1(peer, s_random, s_confirm);
+            if (memcmp(s_confirm, peer->s_confirm, 16) != 0) break;
+            // STK = s1(TK, Srand, Mrand)
+            sm_key_t tk;
+            memset(tk, 0, 16);
+            sm_key_t r_prime;
+            memcpy(&r_prime[0], &s_random[8], 8);
+            memcpy(&r_prime[8], &peer->m_random[8], 8);
+            aes128(tk, r_prime, peer->stk);
+            peer_set_state(peer, PEER_W4_ENCRYPTION);
+            // start encryption with STK: Controller requests LTK with EDIV and Rand = 0
+            uint8_t ltk_request[15];
+            memset(ltk_request, 0, sizeof(ltk_request));
+            ltk_request[0] = HCI_EVENT_LE_META;
+            ltk_request[1] = sizeof(ltk_request) - 2;
+            ltk_request[2] = HCI_SUBEVENT_LE_LONG_TERM_KEY_REQUEST;
+            little_endian_store_16(ltk_request, 3, peer->con_handle);
+            simulate_hci_event(ltk_request, sizeof(ltk_request));
+            return;
+        }
+        case PEER_W4_KEYS:
+            // Signing Information is the last key distributed by responder
+            if (pdu[0] == SM_CODE_SIGNING_INFORMATION){
+                peer_set_state(peer, PEER_DONE);
+            }
+            return;
+        default:
+            break;
+    }
+    printf("peer 0x%04x: unexpected PDU 0x%02x in state %u\n", peer->con_handle, pdu[0], peer->state);
+    peer_set_state(peer, PEER_FAILED);
+}
+
+static peer_t * peer_for_handle(hci_con_handle_t con_handle){
+    int index = con_handle - CON_HANDLE_BASE;
+    if (index < 0 || index >= num_peers) return NULL;
+    return &peers[index];
+}
+
+// handle command from copy as the Security Manager may send the next one while processing the result
+static void controller_handle_command(const uint8_t * hci_command){
+    uint16_t opcode = little_endian_read_16(hci_command, 0);
+    if (opcode == hci_le_encrypt.opcode){
+        sm_key_t key;
+        sm_key_t plaintext;
+        sm_key_t cyphertext;
+        reverse_128(&hci_command[3],  key);
+        reverse_128(&hci_command[19], plaintext);
+        aes128(key, plaintext, cyphertext);
+        uint8_t result[16];
+        reverse_128(cyphertext, result);
+        simulate_command_complete(opcode, result, 16);
+        return;
+    }
+    if (opcode == hci_le_rand.opcode){
+        uint8_t random[8];
+        int i;
+        for (i = 0; i < 8; i++){
+            random_seed = random_seed * 1103515245 + 12345;
+            random[i] = random_seed >> 16;
+        }
+        simulate_command_complete(opcode, random, 8);
+        return;
+    }
+    if (opcode == hci_le_long_term_key_request_reply.opcode){
+        hci_con_handle_t con_handle = little_endian_read_16(hci_command, 3);
+        uint8_t return_parameters[2];
+        little_endian_store_16(return_parameters, 0, con_handle);
+        simulate_command_complete(opcode, return_parameters, 2);
+        peer_t * peer = peer_for_handle(con_handle);
+        if (!peer || peer->state != PEER_W4_ENCRYPTION) return;
+        sm_key_t ltk;
+        reverse_128(&hci_command[5], ltk);
+        if (memcmp(ltk, peer->stk, 16) != 0){
+            printf("peer 0x%04x: LTK reply does not match STK\n", con_handle);
+            peer_set_state(peer, PEER_FAILED);
+            return;
+        }
+        peer_set_state(peer, PEER_W4_KEYS);
+        uint8_t encryption_change[] = { HCI_EVENT_ENCRYPTION_CHANGE, 4, 0, 0, 0, 1 };
+        little_endian_store_16(encryption_change, 3, con_handle);
+        simulate_hci_event(encryption_change, sizeof(encryption_change));
+        return;
+    }
+    // other commands don't need a response for this test
+}
+
+// process one HCI command and one SMP PDU per peer in each round until idle
+static int controller_run(void){
+    int rounds = 0;
+    int busy = 1;
+    while (busy){
+        busy = 0;
+        rounds++;
+        if (hci_command_len){
+            uint8_t command[sizeof(hci_command)];
+            memcpy(command, hci_command, hci_command_len);
+            hci_command_len = 0;
+            controller_handle_command(command);
+            busy = 1;
+        }
+        int i;
+        for (i = 0; i < num_peers; i++){
+            peer_t * peer = &peers[i];
+            if (peer->pdu_len == 0) continue;
+            peer_handle_pdu(peer);
+            peer->pdu_len = 0;
+            busy = 1;
+            uint8_t num_completed_packets[] = { HCI_EVENT_NUMBER_OF_COMPLETED_PACKETS, 5, 1, 0, 0, 1, 0 };
+            little_endian_store_16(num_completed_packets, 3, peer->con_handle);
+            simulate_hci_event(num_completed_packets, sizeof(num_completed_packets));
+            if (peer->can_send_now_requested){
+                peer->can_send_now_requested = 0;
+                uint8_t event[] = { L2CAP_EVENT_CAN_SEND_NOW, 2, 0, 0};
+                little_endian_store_16(event, 2, L2CAP_CID_SECURITY_MANAGER_PROTOCOL);
+                le_data_handler(HCI_EVENT_PACKET, 0, event, sizeof(event));
+            }
+        }
+    }
+    return rounds;
+}
+
+static void app_packet_handler(uint8_t packet_type, uint16_t channel, uint8_t *packet, uint16_t size){
+    UNUSED(channel);
+    UNUSED(size);
+    if (packet_type != HCI_EVENT_PACKET) return;
+    if (packet[0] == SM_EVENT_JUST_WORKS_REQUEST){
+        if (idle_con_handle != HCI_CON_HANDLE_INVALID){
+            // user actions for a connection without setup context must not affect other pairings
+            sm_passkey_input(idle_con_handle, 123456);
+            sm_keypress_notification(idle_con_handle, SM_KEYPRESS_PASSKEY_DIGIT_ENTERED);
+            sm_bonding_decline(idle_con_handle);
+        }
+        sm_just_works_confirm(little_endian_read_16(packet, 2));
+    }
+}
+
+static void connect_peers(int num_connections){
+    num_peers = num_connections;
+    connections = NULL;
+    int i;
+    for (i = 0; i < num_peers; i++){
+        peer_t * peer = &peers[i];
+        memset(peer, 0, sizeof(peer_t));
+        peer->con_handle = CON_HANDLE_BASE + i;
+        bd_addr_t address = { 0xc0, 0x00, 0x00, 0x00, 0x00, 0x00 };
+        address[5] = i;
+        memcpy(peer->address, address, 6);
+        memset(peer->m_random, 0x10 + i, 16);
+        btstack_linked_list_add_tail(&connections, (btstack_linked_item_t *) &peer->hci_connection);
+
+        // LE Connection Complete, role slave, public peer address
+        uint8_t connection_complete[] = { HCI_EVENT_LE_META, 0x13, HCI_SUBEVENT_LE_CONNECTION_COMPLETE, 0x00, 0x00, 0x00, 0x01, 0x00,
+            0, 0, 0, 0, 0, 0, 0x18, 0x00, 0x00, 0x00, 0x48, 0x00, 0x05};
+        little_endian_store_16(connection_complete, 4, peer->con_handle);
+        reverse_bd_addr(peer->address, &connection_complete[8]);
+        simulate_hci_event(connection_complete, sizeof(connection_complete));
+    }
+    controller_run();
+}
+
+// HCI and L2CAP functions used by the Security Manager
+
+void gap_local_bd_addr(bd_addr_t address_buffer){
+    memcpy(address_buffer, local_address, 6);
+}
+
+void gap_le_get_own_address(uint8_t * addr_type, bd_addr_t addr){
+    *addr_type = 0;
+    memcpy(addr, local_address, 6);
+}
+
+hci_connection_t * hci_connection_for_handle(hci_con_handle_t con_handle){
+    peer_t * peer = peer_for_handle(con_handle);
+    if (!peer) return NULL;
+    return &peer->hci_connection;
+}
+
+hci_connection_t * hci_connection_for_bd_addr_and_type(bd_addr_t addr, bd_addr_type_t addr_type){
+    UNUSED(addr_type);
+    int i;
+    for (i = 0; i < num_peers; i++){
+        if (memcmp(peers[i].address, addr, 6) == 0) return &peers[i].hci_connection;
+    }
+    return NULL;
+}
+
+void hci_connections_get_iterator(btstack_linked_list_iterator_t *it){
+    btstack_linked_list_iterator_init(it, &connections);
+}
+
+HCI_STATE hci_get_state(void){
+    return HCI_STATE_WORKING;
+}
+
+int hci_can_send_command_packet_now(void){
+    return hci_command_len == 0;
+}
+
+int hci_send_cmd(const hci_cmd_t *cmd, ...){
+    if (hci_command_len){
+        hci_command_overruns++;
+    }
+    va_list argptr;
+    va_start(argptr, cmd);
+    hci_command_len = hci_cmd_create_from_template(hci_command, cmd, argptr);
+    va_end(argptr);
+    return 0;
+}
+
+void hci_add_event_handler(btstack_packet_callback_registration_t * callback_handler){
+    event_packet_handler = callback_handler->callback;
+}
+
+void hci_disconnect_security_block(hci_con_handle_t con_handle){
+    UNUSED(con_handle);
+}
+
+void hci_le_advertisements_set_params(uint16_t adv_int_min, uint16_t adv_int_max, uint8_t adv_type,
+    uint8_t direct_address_typ, bd_addr_t direct_address, uint8_t channel_map, uint8_t filter_policy) {
+}
+
+void hci_le_set_own_address_type(uint8_t own_address){
+}
+
+void l2cap_register_fixed_channel(btstack_packet_handler_t packet_handler, uint16_t channel_id) {
+    UNUSED(channel_id);
+    le_data_handler = packet_handler;
+}
+
+int l2cap_can_send_fixed_channel_packet_now(uint16_t handle, uint16_t channel_id){
+    UNUSED(channel_id);
+    peer_t * peer = peer_for_handle(handle);
+    return peer && peer->pdu_len == 0;
+}
+
+void l2cap_request_can_send_fix_channel_now_event(hci_con_handle_t con_handle, uint16_t channel_id){
+    UNUSED(channel_id);
+    peer_t * peer = peer_for_handle(con_handle);
+    if (!peer) return;
+    peer->can_send_now_requested = 1;
+}
+
+int l2cap_send_connectionless(uint16_t handle, uint16_t cid, uint8_t * buffer, uint16_t len){
+    UNUSED(cid);
+    peer_t * peer = peer_for_handle(handle);
+    if (!peer || peer->pdu_len || len > sizeof(peer->pdu)) return 1;
+    memcpy(peer->pdu, buffer, len);
+    peer->pdu_len = len;
+    return 0;
+}
+
+void l2cap_run(void){
+}
+
+TEST_GROUP(ConcurrentPairing){
+    void setup(void){
+        static int first = 1;
+        if (first){
+            first = 0;
+            btstack_memory_init();
+            btstack_run_loop_init(btstack_run_loop_posix_get_instance());
+            hci_dump_enable_log_level(LOG_LEVEL_INFO, 0);
+        }
+        hci_command_len = 0;
+        hci_command_overruns = 0;
+        random_seed = 0;
+        num_active_pairings = 0;
+        max_active_pairings = 0;
+        idle_con_handle = HCI_CON_HANDLE_INVALID;
+        le_device_db_init();
+        sm_init();
+        sm_set_io_capabilities(IO_CAPABILITY_NO_INPUT_NO_OUTPUT);
+        sm_set_authentication_requirements(SM_AUTHREQ_BONDING);
+        sm_event_callback_registration.callback = &app_packet_handler;
+        sm_add_event_handler(&sm_event_callback_registration);
+
+        // derive IRK and DHK
+        uint8_t state_working[] = { BTSTACK_EVENT_STATE, 1, HCI_STATE_WORKING };
+        simulate_hci_event(state_working, sizeof(state_working));
+        controller_run();
+    }
+
+    void pair_all(int num_connections){
+        connect_peers(num_connections);
+        int i;
+        for (i = 0; i < num_peers; i++){
+            peer_send_pdu(&peers[i], (uint8_t *) pairing_request, sizeof(pairing_request));
+        }
+        controller_run();
+
+        for (i = 0; i < num_peers; i++){
+            CHECK_EQUAL(PEER_DONE, peers[i].state);
+        }
+        CHECK_EQUAL(0, hci_command_overruns);
+    }
+};
+
+TEST(ConcurrentPairing, SingleConnection){
+    pair_all(1);
+    CHECK_EQUAL(1, max_active_pairings);
+}
+
+TEST(ConcurrentPairing, AllSetupContexts){
+    pair_all(SM_SETUP_CONTEXT_NUM);
+    CHECK_EQUAL(SM_SETUP_CONTEXT_NUM, max_active_pairings);
+}
+
+TEST(ConcurrentPairing, MoreConnectionsThanSetupContexts){
+    pair_all(NUM_CONNECTIONS_MAX);
+    CHECK_EQUAL(SM_SETUP_CONTEXT_NUM, max_active_pairings);
+}
+
+TEST(ConcurrentPairing, UserActionsForConnectionWithoutSetupContext){
+    connect_peers(2);
+    idle_con_handle = peers[1].con_handle;
+    peer_send_pdu(&peers[0], (uint8_t *) pairing_request, sizeof(pairing_request));
+    controller_run();
+    CHECK_EQUAL(PEER_DONE, peers[0].state);
+}
+
+int main (int argc, const char * argv[]){
+    return CommandLineTestRunner::RunAllTests(argc, argv);
+}
@@ -0,0 +1,228 @@
+// *****************************************************************************
+//
+// LE Legacy Pairing latency benchmark
+//
+// Runs Just Works pairing as responder against the mocked HCI/L2CAP layer and
+// measures the host time. Each HCI LE Encrypt command is counted, its round trip
+// time over H4 UART is estimated from command and event size.
+//
+// sm_pairing_benchmark                   - AES128 via HCI LE Encrypt
+// sm_pairing_benchmark_software_aes128   - ENABLE_SOFTWARE_AES128
+//
+// *****************************************************************************
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "btstack_aes128.h"
+#include "btstack_linked_list.h"
+#include "btstack_memory.h"
+#include "btstack_run_loop.h"
+#include "btstack_util.h"
+#include "hci.h"
+#include "hci_cmd.h"
+#include "hci_dump.h"
+#include "ble/le_device_db.h"
+#include "ble/sm.h"
+
+#define NUM_PAIRINGS 2000
+
+// H4 LE Encrypt: command 1 + 3 + 32 bytes, command complete event 1 + 2 + 4 + 16 bytes
+#define LE_ENCRYPT_ROUND_TRIP_BYTES 59
+
+void mock_init(void);
+void mock_simulate_hci_state_working(void);
+void mock_simulate_hci_event(uint8_t * packet, uint16_t size);
+void aes128_report_result(void);
+void mock_simulate_sm_data_packet(uint8_t * packet, uint16_t size);
+void mock_simulate_connected(void);
+uint8_t * mock_packet_buffer(void);
+uint16_t mock_packet_buffer_len(void);
+void mock_clear_packet_buffer(void);
+
+// same pairing as in security_manager.c MainTest
+static uint8_t pairing_request[] = { 0x01, 0x04, 0x00, 0x01, 0x10, 0x07, 0x07 };
+static uint8_t pairing_confirm[] = { 0x03, 0x84, 0x5a, 0x87, 0x9a, 0x0f, 0xa9, 0x42, 0xba, 0x48, 0xc5, 0x79, 0xa0, 0x70, 0x70, 0xa9, 0xc8 };
+static uint8_t pairing_random[]  = { 0x04, 0xfd, 0xd4, 0x06, 0x45, 0x0f, 0x1e, 0xdc, 0x84, 0xd5, 0x43, 0xac, 0xf7, 0x5e, 0xc0, 0x36, 0x29 };
+static uint8_t le_ltk_request[]  = { 0x3e, 0x0d, 0x05, 0x40, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 };
+static uint8_t encryption_change[] = { 0x08, 0x04, 0x00, 0x40, 0x00, 0x01 };
+static uint8_t num_completed_packets[] = { 0x13, 0x05, 0x01, 0x40, 0x00, 0x01, 0x00 };
+static uint8_t disconnection_complete[] = { 0x05, 0x04, 0x00, 0x40, 0x00, 0x13 };
+static uint8_t rand_events[][14] = {
+    { 0x0e, 0x0c, 0x01, 0x18, 0x20, 0x00, 0x2f, 0x04, 0x82, 0x84, 0x72, 0x46, 0x9c, 0x93 },
+    { 0x0e, 0x0c, 0x01, 0x18, 0x20, 0x00, 0x48, 0x3f, 0x27, 0x0e, 0xeb, 0xd5, 0x05, 0x7a },
+    { 0x0e, 0x0c, 0x01, 0x18, 0x20, 0x00, 0xc0, 0x10, 0x70, 0x5f, 0x3c, 0x2d, 0xe3, 0xb3 },
+    { 0x0e, 0x0c, 0x01, 0x18, 0x20, 0x00, 0xf1, 0xe2, 0xbf, 0x7d, 0x84, 0x19, 0x32, 0x8b },
+};
+
+static int      rand_index;
+static int      le_encrypt_count;
+static int      acl_count;
+static int      pairing_failed;
+static uint32_t acl_checksum;
+
+// minimal run loop: timers without delay are executed by process_packets(), time does not advance
+static btstack_linked_list_t timers;
+static void benchmark_run_loop_set_timer(btstack_timer_source_t * ts, uint32_t timeout_in_ms){
+    ts->timeout = timeout_in_ms;
+}
+static void benchmark_run_loop_add_timer(btstack_timer_source_t * ts){
+    btstack_linked_list_remove(&timers, (btstack_linked_item_t *) ts);
+    btstack_linked_list_add_tail(&timers, (btstack_linked_item_t *) ts);
+}
+static int benchmark_run_loop_remove_timer(btstack_timer_source_t * ts){
+    return btstack_linked_list_remove(&timers, (btstack_linked_item_t *) ts);
+}
+static uint32_t benchmark_run_loop_get_time_ms(void){
+    return 0;
+}
+static void benchmark_run_loop_init(void){
+    timers = NULL;
+}
+static const btstack_run_loop_t benchmark_run_loop = {
+    &benchmark_run_loop_init,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    &benchmark_run_loop_set_timer,
+    &benchmark_run_loop_add_timer,
+    &benchmark_run_loop_remove_timer,
+    NULL,
+    NULL,
+    &benchmark_run_loop_get_time_ms,
+};
+
+static void app_packet_handler(uint8_t packet_type, uint16_t channel, uint8_t *packet, uint16_t size){
+    UNUSED(channel);
+    UNUSED(size);
+    if (packet_type != HCI_EVENT_PACKET) return;
+    if (packet[0] == SM_EVENT_JUST_WORKS_REQUEST){
+        sm_just_works_confirm(little_endian_read_16(packet, 2));
+    }
+}
+
+// act as controller and remote until SM is idle
+static void process_packets(void){
+    while (1){
+        btstack_timer_source_t * ts = NULL;
+        btstack_linked_item_t * it;
+        for (it = (btstack_linked_item_t *) timers; it ; it = it->next){
+            if (((btstack_timer_source_t *) it)->timeout == 0){
+                ts = (btstack_timer_source_t *) it;
+                break;
+            }
+        }
+        if (ts){
+            btstack_linked_list_remove(&timers, (btstack_linked_item_t *) ts);
+            ts->process(ts);
+            continue;
+        }
+        if (mock_packet_buffer_len() == 0) return;
+        uint8_t * packet = mock_packet_buffer();
+        uint16_t opcode = little_endian_read_16(packet, 0);
+        if (opcode == hci_le_encrypt.opcode){
+            le_encrypt_count++;
+            mock_clear_packet_buffer();
+            aes128_report_result();
+        } else if (opcode == hci_le_rand.opcode){
+            mock_clear_packet_buffer();
+            mock_simulate_hci_event(rand_events[rand_index++ & 3], sizeof(rand_events[0]));
+        } else if (opcode == hci_le_long_term_key_request_reply.opcode){
+            mock_clear_packet_buffer();
+            mock_simulate_hci_event(encryption_change, sizeof(encryption_change));
+        } else {
+            // SMP PDU on handle 0x0040
+            uint16_t len = mock_packet_buffer_len();
+            if (packet[8] == SM_CODE_PAIRING_FAILED){
+                pairing_failed = 1;
+            }
+            int i;
+            for (i = 0; i < len; i++){
+                acl_checksum = (acl_checksum * 31) + packet[i];
+            }
+            acl_count++;
+            mock_clear_packet_buffer();
+            mock_simulate_hci_event(num_completed_packets, sizeof(num_completed_packets));
+        }
+    }
+}
+
+static double timespec_diff_us(struct timespec * start, struct timespec * end){
+    return (end->tv_sec - start->tv_sec) * 1e6 + (end->tv_nsec - start->tv_nsec) / 1e3;
+}
+
+int main(void){
+    // skip log output
+    hci_dump_enable_log_level(LOG_LEVEL_INFO, 0);
+
+    btstack_memory_init();
+    btstack_run_loop_init(&benchmark_run_loop);
+
+    static btstack_packet_callback_registration_t sm_event_callback_registration;
+    double pairing_time_us = 0;
+    int i;
+    for (i = 0; i < NUM_PAIRINGS; i++){
+        rand_index = 0;
+        le_encrypt_count = 0;
+        acl_count = 0;
+        acl_checksum = 0;
+
+        sm_init();
+        sm_set_io_capabilities(IO_CAPABILITY_NO_INPUT_NO_OUTPUT);
+        sm_set_authentication_requirements(SM_AUTHREQ_BONDING);
+        sm_event_callback_registration.callback = &app_packet_handler;
+        sm_add_event_handler(&sm_event_callback_registration);
+
+        // key generation and address resolution on connect are not part of the pairing
+        mock_init();
+        mock_simulate_hci_state_working();
+        process_packets();
+        mock_simulate_connected();
+        process_packets();
+        le_encrypt_count = 0;
+        rand_index = 0;
+
+        struct timespec start_ts, end_ts;
+        clock_gettime(CLOCK_MONOTONIC, &start_ts);
+        mock_simulate_sm_data_packet(pairing_request, sizeof(pairing_request));
+        process_packets();
+        mock_simulate_sm_data_packet(pairing_confirm, sizeof(pairing_confirm));
+        process_packets();
+        mock_simulate_sm_data_packet(pairing_random, sizeof(pairing_random));
+        process_packets();
+        mock_simulate_hci_event(le_ltk_request, sizeof(le_ltk_request));
+        process_packets();
+        clock_gettime(CLOCK_MONOTONIC, &end_ts);
+        pairing_time_us += timespec_diff_us(&start_ts, &end_ts);
+
+        if (pairing_failed){
+            printf("Pairing failed\n");
+            return 1;
+        }
+
+        // forget connection and bonding for next run
+        mock_simulate_hci_event(disconnection_complete, sizeof(disconnection_complete));
+        process_packets();
+        le_device_db_init();
+    }
+
+#ifdef ENABLE_SOFTWARE_AES128
+    printf("AES128: software%s\n", btstack_aes128_hardware_accelerated() ? " (AES-NI)" : "");
+#else
+    printf("AES128: HCI LE Encrypt\n");
+#endif
+    printf("SMP PDUs sent: %u, checksum %08x\n", acl_count, acl_checksum);
+    printf("HCI LE Encrypt round trips per pairing: %u\n", le_encrypt_count);
+    double host_us = pairing_time_us / NUM_PAIRINGS;
+    printf("Host processing per pairing: %.1f us\n", host_us);
+    const uint32_t baudrates[] = { 115200, 921600, 3000000 };
+    for (i = 0; i < 3; i++){
+        double round_trip_us = LE_ENCRYPT_ROUND_TRIP_BYTES * 10 * 1e6 / baudrates[i];
+        printf("Estimated crypto latency per pairing at %7u baud: %8.1f us\n", baudrates[i], host_us + le_encrypt_count * round_trip_us);
+    }
+    return 0;
+}